@@ -0,0 +1,49 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <random>
+
+#include "breakpoint.h"
+
+namespace shuidb {
+
+namespace {
+
+// Stop-time lookup of the breakpoint under a SIGTRAP, half hits and half
+// misses
+void FindBreakPoint(benchmark::State& state) {
+  BreakPointTable table;
+  std::mt19937_64 rng(1);
+  std::vector<std::intptr_t> probes;
+  for (int64_t i = 0; i < state.range(0); i++) {
+    auto addr = 0x400000 + static_cast<std::intptr_t>(rng() % (1 << 26));
+    table.Add(addr);
+    probes.push_back(i % 2 == 0 ? addr : addr + 1);
+  }
+  std::shuffle(probes.begin(), probes.end(), rng);
+  std::size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(table.Find(probes[i]));
+    i = i + 1 == probes.size() ? 0 : i + 1;
+  }
+}
+}  // namespace
+
+BENCHMARK(FindBreakPoint)->Arg(100)->Arg(50000);
+}  // namespace shuidb
@@ -0,0 +1,207 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <csignal>
+#include <memory>
+
+#include "breakpoint.h"
+#include "debugger.h"
+#include "memory_operator.h"
+#include "thread_stopper.h"
+#include "utils/logger.hpp"
+#include "utils/ps_utils.hpp"
+
+// Round trips against real inferiors from examples/, run from the build
+// directory
+
+namespace shuidb {
+
+namespace {
+
+// What the debugger prints would be mixed into the results
+void SilenceOutput() {
+  static const bool silenced = [] {
+    utils::Logger::Get().Redirect(utils::Sink::kStdout,
+                                  open("/dev/null", O_WRONLY | O_CLOEXEC));
+    return true;
+  }();
+  benchmark::DoNotOptimize(silenced);
+}
+
+// `prog` stopped at the first hit of `function`, or at its first signal
+// when empty
+std::unique_ptr<Debugger> Start(benchmark::State& state,
+                                const std::string& prog,
+                                const std::string& function = "") {
+  SilenceOutput();
+  auto debugger = std::make_unique<Debugger>(prog);
+  debugger->RunProc();
+  if (!function.empty() &&
+      debugger->SetBreakPoint(function) != StatusType::kSuccess) {
+    state.SkipWithError("no breakpoint location");
+    return nullptr;
+  }
+  if (debugger->RunUntilStop(false, 0).exit_status.has_value()) {
+    state.SkipWithError("inferior exited");
+    return nullptr;
+  }
+  return debugger;
+}
+
+// Resume from a breakpoint, step over it and hit it again
+void BreakPointRoundTrip(benchmark::State& state) {
+  auto debugger = Start(state, "examples/tight_loop", "Tick");
+  if (debugger == nullptr) {
+    return;
+  }
+  for (auto _ : state) {
+    if (!debugger->RunUntilStop(false, 0).breakpoint) {
+      state.SkipWithError("breakpoint missed");
+      break;
+    }
+  }
+}
+
+void ReadRegisters(benchmark::State& state) {
+  auto debugger = Start(state, "examples/tight_loop", "Tick");
+  if (debugger == nullptr) {
+    return;
+  }
+  user_regs_struct regs;
+  user_fpregs_struct fpregs;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(debugger->ReadRegisterSets(&regs, &fpregs));
+  }
+}
+
+void WriteRegisters(benchmark::State& state) {
+  auto debugger = Start(state, "examples/tight_loop", "Tick");
+  if (debugger == nullptr) {
+    return;
+  }
+  user_regs_struct regs;
+  user_fpregs_struct fpregs;
+  debugger->ReadRegisterSets(&regs, &fpregs);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(debugger->WriteRegisterSets(regs, fpregs));
+  }
+}
+
+// Uncached reads of the large block of the inferior, by read size
+void ReadMemory(benchmark::State& state) {
+  auto debugger = Start(state, "examples/large_heap");
+  if (debugger == nullptr) {
+    return;
+  }
+  auto regions = utils::GetMemoryRegions(debugger->GetPid());
+  auto largest = std::max_element(
+      regions.begin(), regions.end(), [](const auto& a, const auto& b) {
+        return a.end - a.start < b.end - b.start;
+      });
+  std::size_t size = state.range(0);
+  std::vector<uint8_t> buf(size);
+  std::uintptr_t offset = 0;
+  for (auto _ : state) {
+    if (MemoryOperator::ReadMemory(debugger->GetPid(), largest->start + offset,
+                                   buf.data(), size) != size) {
+      state.SkipWithError("short read");
+      break;
+    }
+    offset = offset + 2 * size > largest->end - largest->start ? 0
+                                                               : offset + size;
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+}
+
+// Planting and lifting the given number of breakpoints spread over the text
+// of libc, in one batch each
+void InstallBreakPoints(benchmark::State& state) {
+  auto debugger = Start(state, "examples/tight_loop", "Tick");
+  if (debugger == nullptr) {
+    return;
+  }
+  auto regions = utils::GetMemoryRegions(debugger->GetPid());
+  auto libc = std::find_if(regions.begin(), regions.end(), [](const auto& r) {
+    return r.IsExecutable() && r.path.find("libc.so") != std::string::npos;
+  });
+  if (libc == regions.end()) {
+    state.SkipWithError("no libc text");
+    return;
+  }
+  BreakPointTable table;
+  table.Reset(debugger->GetPid());
+  std::vector<uint32_t> indices;
+  auto step = std::max<std::uintptr_t>(
+      1, (libc->end - libc->start) / state.range(0));
+  for (int64_t i = 0; i < state.range(0); i++) {
+    indices.push_back(table.Add(libc->start + i * step));
+  }
+  for (auto _ : state) {
+    table.SetEnabled(indices, true);
+    table.SetEnabled(indices, false);
+  }
+  state.SetItemsProcessed(state.iterations() * indices.size());
+}
+
+// From the launch to the stop at the entry point, with the dynamic loader
+// run and the symbols of the program read
+void LaunchToEntry(benchmark::State& state) {
+  SilenceOutput();
+  for (auto _ : state) {
+    auto debugger = std::make_unique<Debugger>("examples/hello_world");
+    debugger->RunProc();
+    state.PauseTiming();
+    debugger.reset();
+    state.ResumeTiming();
+  }
+}
+
+// Stopping and resuming every thread of a process we do not trace, as before
+// touching memory shared with them
+void StopTheWorld(benchmark::State& state) {
+  auto debugger = Start(state, "examples/many_threads");
+  if (debugger == nullptr) {
+    return;
+  }
+  // Traced threads are stopped already, let them all go
+  auto pid = debugger->GetPid();
+  debugger->Detach();
+  std::size_t threads = 0;
+  for (auto _ : state) {
+    ThreadStopper stopper(pid, {});
+    threads = stopper.GetThreads().size();
+  }
+  state.counters["threads"] = threads;
+  kill(pid, SIGKILL);
+  waitpid(pid, nullptr, __WALL);
+}
+
+}  // namespace
+
+BENCHMARK(BreakPointRoundTrip)->Unit(benchmark::kMicrosecond);
+BENCHMARK(ReadRegisters);
+BENCHMARK(WriteRegisters);
+BENCHMARK(ReadMemory)->Arg(8)->Arg(4 << 10)->Arg(64 << 10)->Arg(1 << 20);
+BENCHMARK(InstallBreakPoints)->Arg(10000)->Unit(benchmark::kMicrosecond);
+BENCHMARK(LaunchToEntry)->Unit(benchmark::kMillisecond);
+BENCHMARK(StopTheWorld)->Unit(benchmark::kMicrosecond);
+}  // namespace shuidb
@@ -0,0 +1,77 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+
+#include "elf_file.h"
+#include "utils/ps_utils.hpp"
+#include "x86_decoder.h"
+
+namespace shuidb {
+
+namespace {
+
+// The text section of the libc this benchmark is linked against
+std::shared_ptr<ElfFile> OpenLibc() {
+  for (const auto& region : utils::GetMemoryRegions(getpid())) {
+    if (region.path.find("/libc.so") != std::string::npos ||
+        region.path.find("/libc-") != std::string::npos) {
+      return ElfFile::Open(region.path);
+    }
+  }
+  return nullptr;
+}
+
+// Linear sweep, skipping a byte on anything undecodable (data in text)
+template <bool kFormat>
+void DecodeText(benchmark::State& state) {
+  auto libc = OpenLibc();
+  auto text = libc ? libc->GetSection(".text") : std::nullopt;
+  if (!text.has_value()) {
+    state.SkipWithError("libc .text not found");
+    return;
+  }
+
+  std::size_t instructions = 0;
+  for (auto _ : state) {
+    Instruction insn;
+    std::size_t offset = 0;
+    while (offset < text->size()) {
+      if (X86Decoder::Decode(text->data() + offset, text->size() - offset,
+                             offset, insn)) {
+        if constexpr (kFormat) {
+          benchmark::DoNotOptimize(X86Decoder::Format(insn));
+        }
+        offset += insn.length;
+        instructions++;
+      } else {
+        offset++;
+      }
+    }
+    benchmark::DoNotOptimize(insn);
+  }
+  state.SetBytesProcessed(state.iterations() * text->size());
+  state.counters["insns"] =
+      benchmark::Counter(instructions, benchmark::Counter::kIsRate);
+}
+
+}  // namespace
+
+BENCHMARK(DecodeText<false>)->Name("Decode/libc_text")->Unit(benchmark::kMillisecond);
+BENCHMARK(DecodeText<true>)->Name("DecodeFormat/libc_text")->Unit(benchmark::kMillisecond);
+
+}  // namespace shuidb
@@ -0,0 +1,79 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <random>
+
+#include "memory_search.h"
+
+namespace shuidb {
+
+namespace {
+
+// Random bytes with a pattern which does not occur
+const std::vector<uint8_t>& GetHaystack() {
+  static const auto data = [] {
+    std::vector<uint8_t> data(64 << 20);
+    std::mt19937_64 rng(1);
+    for (std::size_t i = 0; i < data.size(); i += 8) {
+      auto value = rng();
+      std::memcpy(&data[i], &value, sizeof(value));
+    }
+    return data;
+  }();
+  return data;
+}
+
+void FindPatternKernel(benchmark::State& state) {
+  const auto& data = GetHaystack();
+  std::vector<uint8_t> pattern{0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88};
+  auto kernel = static_cast<SearchKernel>(state.range(0));
+  std::vector<std::size_t> matches;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        MemorySearch::FindPattern(data, pattern, matches, SIZE_MAX, kernel));
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+// Chunked reads through process_vm_readv of our own memory, on all cores
+void SearchProcess(benchmark::State& state) {
+  const auto& data = GetHaystack();
+  auto begin = reinterpret_cast<std::uintptr_t>(data.data());
+  auto regions = utils::GetMemoryRegions(getpid());
+  std::vector<uint8_t> pattern{0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88};
+  utils::ThreadPool pool;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(MemorySearch::Search(
+        getpid(), regions, begin, begin + data.size(), pattern, 100, pool));
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+}  // namespace
+
+BENCHMARK(FindPatternKernel)
+    ->ArgName("kernel")
+    ->Arg(static_cast<int>(SearchKernel::kScalar))
+    ->Arg(static_cast<int>(SearchKernel::kSse2))
+    ->Arg(static_cast<int>(SearchKernel::kAvx2))
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(SearchProcess)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+}  // namespace shuidb
@@ -0,0 +1,42 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+#include <chrono>
+#include <csignal>
+#include <mutex>
+#include <thread>
+
+// Two threads taking two mutexes in opposite order, then the main thread traps
+// into the debugger once both of them are stuck
+std::mutex first;
+std::mutex second;
+
+int main() {
+  using namespace std::chrono_literals;
+  std::thread a([] {
+    std::lock_guard<std::mutex> lock_first(first);
+    std::this_thread::sleep_for(50ms);
+    std::lock_guard<std::mutex> lock_second(second);
+  });
+  std::thread b([] {
+    std::lock_guard<std::mutex> lock_second(second);
+    std::this_thread::sleep_for(50ms);
+    std::lock_guard<std::mutex> lock_first(first);
+  });
+  std::this_thread::sleep_for(200ms);
+  raise(SIGTRAP);
+  a.join();
+  b.join();
+}
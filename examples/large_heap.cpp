@@ -0,0 +1,59 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Allocates a 256 MiB block, or argv[1] MiB, plus small chunks of mixed
+// sizes with every third one freed, then traps into the debugger. The small
+// chunks are split over two threads, so there is more than one arena
+
+namespace {
+
+constexpr int kChunks = 100000;
+
+std::vector<void*> Allocate(int seed) {
+  std::vector<void*> chunks;
+  for (int i = 0; i < kChunks; i++) {
+    auto size = 16 + (i * 37 + seed) % 1024;
+    chunks.push_back(std::malloc(size));
+    std::memset(chunks.back(), i & 0xff, size);
+  }
+  for (int i = 0; i < kChunks; i += 3) {
+    std::free(chunks[i]);
+    chunks[i] = nullptr;
+  }
+  return chunks;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::size_t size = (argc > 1 ? std::atol(argv[1]) : 256) << 20;
+  auto* block = static_cast<unsigned char*>(std::malloc(size));
+  for (std::size_t i = 0; i < size; i += 4096) {
+    block[i] = static_cast<unsigned char>(i >> 12);
+  }
+  auto chunks = Allocate(0);
+  std::vector<void*> other;
+  std::thread thread([&other] { other = Allocate(1); });
+  thread.join();
+  raise(SIGTRAP);
+  std::free(block);
+}
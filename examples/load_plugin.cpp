@@ -0,0 +1,37 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <dlfcn.h>
+
+#include <cstdio>
+#include <string>
+
+// dlopen()s libplugin.so from its own directory and calls plugin_entry().
+// Exits with 0 when the call returned what it should
+
+int main(int argc, char** argv) {
+  std::string path = argv[0];
+  path = path.substr(0, path.rfind('/') + 1) + "libplugin.so";
+  void* plugin = dlopen(path.c_str(), RTLD_NOW);
+  if (plugin == nullptr) {
+    std::fprintf(stderr, "%s\n", dlerror());
+    return 1;
+  }
+  auto entry = reinterpret_cast<int (*)(int)>(dlsym(plugin, "plugin_entry"));
+  int result = entry != nullptr ? entry(41) : 0;
+  dlclose(plugin);
+  return result == 42 ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <csignal>
+#include <cstdlib>
+#include <latch>
+#include <thread>
+#include <vector>
+
+// Starts 256 threads, or argv[1], all blocked, then the main thread traps
+// into the debugger once every one of them exists
+
+int main(int argc, char** argv) {
+  using namespace std::chrono_literals;
+  int count = argc > 1 ? std::atoi(argv[1]) : 256;
+  std::latch started(count);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < count; i++) {
+    threads.emplace_back([&started] {
+      started.count_down();
+      for (;;) {
+        std::this_thread::sleep_for(1h);
+      }
+    });
+  }
+  started.wait();
+  raise(SIGTRAP);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
@@ -0,0 +1,38 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <cstdio>
+#include <thread>
+
+// A worker thread runs work(), the main thread checks its result. Exits with
+// 0 when both ran to the end
+
+__attribute__((noinline)) int work(int n) {
+  int sum = 0;
+  for (int i = 0; i < n; i++) {
+    sum += i;
+  }
+  std::printf("worker: %d\n", sum);
+  return sum;
+}
+
+int main() {
+  int result = 0;
+  std::thread worker([&result] { result = work(10); });
+  worker.join();
+  std::printf("main: %d\n", result);
+  return result == 45 ? 0 : 1;
+}
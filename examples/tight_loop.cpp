@@ -0,0 +1,33 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <cstdlib>
+
+// Calls `Tick` in a loop, as a breakpoint target hit as fast as the debugger
+// can resume. Loops forever unless given a count
+
+volatile unsigned long counter;
+
+extern "C" __attribute__((noinline)) void Tick(unsigned long i) {
+  counter = counter + i;
+}
+
+int main(int argc, char** argv) {
+  unsigned long count = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 0;
+  for (unsigned long i = 0; count == 0 || i < count; i++) {
+    Tick(i);
+  }
+}
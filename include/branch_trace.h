@@ -0,0 +1,112 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "x86_decoder.h"
+
+namespace shuidb {
+
+// An executable file mapping of the traced process, enough to find the code
+// of a traced pc on disk
+struct TraceModule {
+  std::uintptr_t start;
+  std::uintptr_t end;
+  uint64_t offset;
+  std::string path;
+};
+
+// Trace file layout: a TraceHeader, the pc of every stop as a zigzag LEB128
+// delta from the previous one, then the module table
+struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t flags;
+  uint64_t start_pc;
+  uint64_t count;
+  uint64_t modules_offset;
+  uint64_t modules_count;
+};
+
+enum TraceFlags : uint32_t {
+  // Stops happened on taken branches only (x86 BTF), otherwise after every
+  // instruction
+  kTraceBlockStep = 1 << 0,
+};
+
+// Appends stop pcs to a memory-mapped trace file, growing it as needed
+class TraceWriter {
+ public:
+  TraceWriter() = default;
+  ~TraceWriter();
+  TraceWriter(const TraceWriter&) = delete;
+  TraceWriter& operator=(const TraceWriter&) = delete;
+
+  bool Open(const std::string& path, std::uintptr_t start_pc);
+  bool Append(std::uintptr_t pc);
+  // Writes the module table and the header, and trims the file
+  bool Close(const std::vector<TraceModule>& modules, uint32_t flags);
+
+  std::size_t GetCount() const;
+  std::size_t GetSize() const;
+
+ private:
+  bool Reserve(std::size_t len);
+
+  int fd_{-1};
+  uint8_t* data_{nullptr};
+  std::size_t capacity_{0};
+  std::size_t size_{0};
+  std::size_t count_{0};
+  std::uintptr_t last_pc_{0};
+};
+
+class TraceReader {
+ public:
+  static std::shared_ptr<TraceReader> Open(const std::string& path);
+  ~TraceReader();
+  TraceReader(const TraceReader&) = delete;
+  TraceReader& operator=(const TraceReader&) = delete;
+
+  const TraceHeader& GetHeader() const;
+  const std::vector<TraceModule>& GetModules() const;
+  std::vector<std::uintptr_t> GetStops() const;
+
+  // Rebuilds the executed instruction path from the stops and the on-disk
+  // code of the modules, calling `fn` for each instruction until it returns
+  // false. Blocks whose code is not file-backed (e.g. vdso) are skipped.
+  // Returns the number of instructions visited
+  std::size_t Replay(const std::function<bool(const Instruction&)>& fn) const;
+
+ private:
+  TraceReader(const uint8_t* data, std::size_t size)
+      : data_(data), size_(size){};
+  bool Parse();
+
+  const uint8_t* data_;
+  std::size_t size_;
+  TraceHeader header_;
+  std::vector<TraceModule> modules_;
+};
+
+}  // namespace shuidb
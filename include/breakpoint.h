@@ -19,27 +19,140 @@
 #include <stdint.h>
 #include <unistd.h>
 
-#include <atomic>
-#include <mutex>
+#include <cstdint>
+#include <vector>
 
 namespace shuidb {
 
-class BreakPoint {
+// User breakpoints of one process in a flat open-addressing table. Each
+// breakpoint has a dense index into structure-of-arrays fields, which stays
+// valid until the breakpoint is removed
+class BreakPointTable {
  public:
-  BreakPoint() = default;
-  BreakPoint(pid_t pid, std::intptr_t addr)
-      : pid_(pid), addr_(addr), enabled_(false) {}
-  void Enable();
-  void Disable();
-  bool IsEnabled() const;
-  std::intptr_t GetAddress() const;
+  static constexpr uint32_t kNotFound = UINT32_MAX;
+
+  // Forgets every breakpoint, without touching memory
+  void Reset(pid_t pid);
+  // Index of the breakpoint at `addr`, added disabled when new
+  uint32_t Add(std::intptr_t addr);
+  uint32_t Find(std::intptr_t addr) const;
+  // Disables the breakpoint first, the last index moves into its place
+  void Remove(uint32_t index);
+
+  bool Enable(uint32_t index);
+  bool Disable(uint32_t index);
+  // Enables or disables many breakpoints at once, with one read and one
+  // write per page
+  bool SetEnabled(const std::vector<uint32_t>& indices, bool enabled);
+
+  std::intptr_t GetAddress(uint32_t index) const { return addrs_[index]; }
+  bool IsEnabled(uint32_t index) const { return enabled_[index] != 0; }
+  // The byte the int3 replaced, valid while enabled
+  uint8_t GetOriginalData(uint32_t index) const {
+    return original_data_[index];
+  }
+  uint64_t GetHitCount(uint32_t index) const { return hit_counts_[index]; }
+  void RecordHit(uint32_t index) { hit_counts_[index]++; }
+  uint32_t GetConditionId(uint32_t index) const {
+    return condition_ids_[index];
+  }
+  void SetConditionId(uint32_t index, uint32_t id) {
+    condition_ids_[index] = id;
+  }
+
+  // Moves the table to `pid`, a fork of its process taken earlier, and
+  // patches its code to match: int3s at enabled breakpoints only
+  bool Reinstall(pid_t pid);
+
+  const std::vector<std::intptr_t>& GetAddresses() const;
+  std::size_t Size() const;
+
+ private:
+  std::size_t Slot(std::intptr_t addr) const;
+  void Rehash(std::size_t capacity);
+
+  pid_t pid_{0};
+  // Dense index + 1 per slot, 0 when empty. Linear probing, kept at most
+  // half full
+  std::vector<uint32_t> slots_;
+  int shift_{64};
+  std::vector<std::intptr_t> addrs_;
+  std::vector<uint8_t> original_data_;
+  std::vector<uint8_t> enabled_;
+  std::vector<uint64_t> hit_counts_;
+  std::vector<uint32_t> condition_ids_;
+  std::vector<uint8_t> buffer_;
+};
+
+// Temporary breakpoints set and cleared as a group, e.g. by source stepping.
+// Each touched page costs one read and one write, and the storage is kept
+// for the next group
+class BreakPointSet {
+ public:
+  // Clears the set, which must not be installed
+  void Reset(pid_t pid);
+  void Add(std::intptr_t addr);
+  bool Install();
+  bool Remove();
+  bool Contains(std::intptr_t addr) const;
+  bool IsInstalled() const;
+  std::size_t Size() const;
+
+ private:
+  pid_t pid_{0};
+  bool installed_{false};
+  // Sorted and unique once installed
+  std::vector<std::intptr_t> addrs_;
+  std::vector<uint8_t> original_data_;
+  std::vector<uint8_t> buffer_;
+};
+
+// One-shot breakpoints, e.g. for coverage. A hit lifts its int3 for good, so
+// the cost fades as the code warms up. Sites are kept sorted with one hit bit
+// each, there is no allocation per site
+class OneShotBreakPointSet {
+ public:
+  static constexpr std::size_t kNotFound = SIZE_MAX;
+
+  // Clears the set and its hits
+  void Reset(pid_t pid);
+  void Add(std::intptr_t addr);
+  bool Install();
+  // Restores the original byte of the pending site at `addr` and marks it
+  // hit, false when there is no pending site at `addr`. The code is patched
+  // through `tid`, the stopped thread which hit it, 0 for the process
+  bool Hit(std::intptr_t addr, pid_t tid = 0);
+  // Lifts the sites which were not hit, the hit bits stay
+  bool Remove();
+  // Moves the set to `pid`, a fork of its process taken earlier, and patches
+  // its code to match: int3s at pending sites only
+  bool Reinstall(pid_t pid);
+
+  std::size_t Find(std::intptr_t addr) const;
+  bool IsInstalled() const;
+  // Installed and not hit yet
+  bool IsPending(std::size_t index) const;
+  bool IsHit(std::size_t index) const {
+    return (hit_bits_[index / 64] >> (index % 64)) & 1;
+  }
+  uint8_t GetOriginalData(std::size_t index) const {
+    return original_data_[index];
+  }
+  // Sorted and unique once installed
+  const std::vector<std::intptr_t>& GetAddresses() const;
+  // Bit `i % 64` of word `i / 64` is set when site `i` was hit
+  const std::vector<uint64_t>& GetHitBits() const;
+  std::size_t GetHitCount() const;
+  std::size_t Size() const;
 
  private:
-  pid_t pid_;
-  std::intptr_t addr_;
-  bool enabled_;
-  uint8_t original_data_;
-  std::mutex mutex_;
+  pid_t pid_{0};
+  bool installed_{false};
+  std::vector<std::intptr_t> addrs_;
+  std::vector<uint8_t> original_data_;
+  std::vector<uint64_t> hit_bits_;
+  std::size_t hit_count_{0};
+  std::vector<uint8_t> buffer_;
 };
 
 }  // namespace shuidb
\ No newline at end of file
@@ -0,0 +1,61 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utils/ps_utils.hpp"
+#include "utils/thread_pool.hpp"
+
+namespace shuidb {
+
+struct CoreDumpStats {
+  std::size_t threads;
+  // PT_LOAD segments, and the bytes of memory they cover
+  std::size_t segments;
+  std::size_t memory_bytes;
+  // Bytes copied into the file, zero pages are left as holes
+  std::size_t written_bytes;
+  std::size_t file_size;
+};
+
+// Writes ELF core files of stopped processes, the kind the kernel writes.
+// Readable regions are copied unless they are file-backed and unmodified,
+// in which case only the first page of a file (the ELF header) is kept
+class CoreDump {
+ public:
+  // Regions are copied in chunks of this size, one per pool task
+  static constexpr std::size_t kChunkSize = 4 << 20;
+
+  // Dumps `pid`, whose `threads` (the first one the main thread) are all in
+  // ptrace-stop. `patches` replace bytes of memory in the dump, e.g. the
+  // ones under our int3s. `signal` is the signal the main thread stopped by
+  static std::optional<CoreDumpStats> Write(
+      const std::string& path, pid_t pid, const std::vector<pid_t>& threads,
+      const std::vector<utils::MemoryRegion>& regions,
+      const std::vector<std::pair<std::uintptr_t, uint8_t>>& patches,
+      int signal, utils::ThreadPool& pool);
+};
+
+}  // namespace shuidb
@@ -0,0 +1,87 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <elf.h>
+
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "target.h"
+
+namespace shuidb {
+
+// A read-only mmap of an ELF core file. Memory reads are served straight
+// from the mapping, only the notes are parsed on open. Parts of file-backed
+// mappings left out of the core are read from the mapped files.
+class CoreTarget : public Target {
+ public:
+  static std::unique_ptr<CoreTarget> Open(const std::string& path);
+  ~CoreTarget() override;
+  CoreTarget(const CoreTarget&) = delete;
+  CoreTarget& operator=(const CoreTarget&) = delete;
+
+  pid_t GetPid() const override;
+  std::size_t ReadMemory(std::uintptr_t addr, void* buf,
+                         std::size_t len) const override;
+  std::optional<user_regs_struct> GetRegisters(pid_t tid) const override;
+  std::vector<pid_t> GetThreads() const override;
+  std::vector<utils::MemoryRegion> GetRegions() const override;
+
+  // Bytes of the core from `addr` to the end of its segment, empty when
+  // `addr` is not in the file. Valid as long as the CoreTarget lives
+  std::span<const uint8_t> GetMemory(std::uintptr_t addr) const;
+  // Signal which killed the process, 0 when unknown
+  int GetSignal() const;
+
+ private:
+  struct Segment {
+    std::uintptr_t vaddr;
+    std::size_t memsz;
+    // Bytes of the segment in the core, from `data`
+    std::size_t filesz;
+    const uint8_t* data;
+    // Index into `regions_`
+    std::size_t region;
+  };
+
+  struct Thread {
+    pid_t tid;
+    user_regs_struct regs;
+  };
+
+  CoreTarget(const uint8_t* data, std::size_t size)
+      : data_(data), size_(size) {}
+  bool Parse();
+  void ParseNotes(std::span<const uint8_t> notes);
+  const Segment* FindSegment(std::uintptr_t addr) const;
+
+  const uint8_t* data_;
+  std::size_t size_;
+  // Sorted by address
+  std::vector<Segment> segments_;
+  std::vector<utils::MemoryRegion> regions_;
+  // In note order, the main thread first
+  std::vector<Thread> threads_;
+  int signal_{0};
+  // From NT_FILE, start, end and file offset of each file-backed mapping
+  std::vector<utils::MemoryRegion> files_;
+};
+
+}  // namespace shuidb
@@ -0,0 +1,55 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "breakpoint.h"
+#include "elf_file.h"
+#include "symbolizer.h"
+
+namespace shuidb {
+
+enum class CoverageMode : uint32_t { kFunctions, kBlocks };
+
+// Link-time addresses to plant coverage breakpoints at: the entries of the
+// functions of `elf`, or the leaders of their basic blocks. Ascending, every
+// address starts an instruction
+std::vector<uint64_t> FindCoverageSites(const ElfFile& elf, CoverageMode mode);
+
+// Bitmap file layout: a CoverageHeader, then the hit bits of the sites in
+// address order as little-endian 64-bit words
+struct CoverageHeader {
+  char magic[8];
+  uint32_t version;
+  // CoverageMode of the sites
+  uint32_t mode;
+  uint64_t count;
+  uint64_t hit_count;
+};
+
+bool WriteCoverageBitmap(const std::string& path,
+                         const OneShotBreakPointSet& sites, CoverageMode mode);
+// lcov tracefile of the sites with line information. A line counts once
+// when any of its sites was hit, sites at a symbol are its function entry
+bool WriteCoverageLcov(const std::string& path,
+                       const OneShotBreakPointSet& sites,
+                       Symbolizer& symbolizer);
+
+}  // namespace shuidb
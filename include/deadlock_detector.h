@@ -0,0 +1,58 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "utils/thread_pool.hpp"
+
+namespace shuidb {
+
+// A thread sleeping in futex(2)
+struct FutexWaiter {
+  pid_t tid;
+  std::uintptr_t futex_addr;
+  int op;
+  // Holder of the lock, when the futex word belongs to a pthread_mutex_t (or
+  // is a PI futex) owned by another thread of the process
+  std::optional<pid_t> owner;
+};
+
+struct WaitForGraph {
+  std::size_t num_threads;
+  std::vector<FutexWaiter> waiters;
+  // Each cycle lists its threads in wait-for order
+  std::vector<std::vector<pid_t>> cycles;
+  // Acyclic chains of at least kMinChainLength threads, longest first. The
+  // last thread of a chain is the one holding everybody up
+  std::vector<std::vector<pid_t>> chains;
+};
+
+constexpr std::size_t kMinChainLength = 3;
+
+class DeadlockDetector {
+ public:
+  // `tids` must all be in ptrace-stop, and the calling thread the tracer
+  static WaitForGraph Analyze(pid_t pid, const std::vector<pid_t>& tids,
+                              utils::ThreadPool& pool);
+};
+
+}  // namespace shuidb
@@ -0,0 +1,82 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#pragma once
+
+#include <unistd.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <set>
+
+namespace shuidb {
+
+enum class WatchKind { kExecute, kWrite, kAccess };
+
+// The four x86 debug address registers, for hardware breakpoints and
+// watchpoints. Set through ptrace in every thread of the process, which keeps
+// them across stops and resumes
+class DebugRegisters {
+ public:
+  static constexpr std::size_t kSlots = 4;
+
+  struct Hit {
+    std::uintptr_t addr;
+    WatchKind kind;
+  };
+
+  // Forgets every slot and thread but `pid`, without touching them
+  void Reset(pid_t pid);
+  // Writes the slots to a new thread, stopped: clones do not inherit them
+  bool AddThread(pid_t tid);
+  void RemoveThread(pid_t tid);
+  // Takes a free slot. `len` is 1, 2, 4 or 8 with `addr` aligned to it, and
+  // 1 for kExecute
+  bool Insert(std::uintptr_t addr, std::size_t len, WatchKind kind);
+  bool Remove(std::uintptr_t addr, std::size_t len, WatchKind kind);
+  // The slot which caused the last SIGTRAP of thread `tid`, if any. Clears
+  // the status so the next stop starts afresh
+  std::optional<Hit> TakeHit(pid_t tid);
+  // Moves the slots to `pid`, a fork of the process taken earlier: forks do
+  // not inherit them
+  bool Reinstall(pid_t pid);
+  // Frees every slot and disables them in every thread
+  bool Clear();
+  bool IsEmpty() const;
+
+ private:
+  struct Slot {
+    std::uintptr_t addr;
+    std::size_t len;
+    WatchKind kind;
+    bool used;
+  };
+
+  // DR7 for the used slots
+  uint64_t Control() const;
+  // Writes DR7 from the used slots, to every thread
+  bool WriteControl();
+  // Writes the address of every used slot and DR7 to `tid`
+  bool WriteThread(pid_t tid);
+
+  std::set<pid_t> threads_;
+  std::array<Slot, kSlots> slots_{};
+};
+
+}  // namespace shuidb
@@ -17,15 +17,30 @@
 #pragma once
 
 #include <sys/ptrace.h>
+#include <sys/user.h>
 
+#include <array>
+#include <chrono>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "breakpoint.h"
+#include "core_target.h"
+#include "coverage.h"
+#include "debug_registers.h"
+#include "event_trace.h"
+#include "memory_cache.h"
+#include "memory_snapshot.h"
+#include "process_launcher.h"
+#include "read_planner.h"
 #include "register_def.h"
+#include "symbolizer.h"
 #include "type_def.h"
 
 namespace shuidb {
@@ -33,29 +48,335 @@ namespace shuidb {
 class Debugger {
  public:
   Debugger(std::string prog) : prog_(prog), pid_(0){};
-  Debugger(std::string prog, pid_t pid) : prog_(prog), pid_(pid){};
+  Debugger(std::string prog, pid_t pid) : prog_(prog), pid_(pid), tid_(pid){};
   ~Debugger();
+  // Starts the program and runs it to its entry point, past the dynamic
+  // loader
   void RunProc();
+  // Arguments, environment, working directory and redirections of the
+  // following runs
+  void SetLaunchOptions(const LaunchOptions& options);
+  LaunchOptions GetLaunchOptions() const;
   void ContinueExecution();
   void SetBreakPointAtAddress(std::intptr_t addr);
+  // `location` is a symbol with an optional +offset, or a hex address.
+  // Breakpoints are kept for later runs, re-resolved as modules load
+  StatusType SetBreakPoint(const std::string& location);
+  StatusType ShowBreakPoints();
   std::vector<std::intptr_t> GetBreakPoints() const;
   std::optional<std::unordered_map<Register, uint64_t>> GetRegisters() const;
   void DumpRegisters() const;
   StatusType ReadRegister(const std::string& reg_name) const;
   StatusType WriteRegister(const std::string& reg_name, const uint64_t& val);
+  StatusType Backtrace();
+  StatusType SnapshotStacks();
+  StatusType DetectDeadlocks();
+  // `location` is a hex address or a symbol name, the current pc when empty
+  StatusType Disassemble(const std::string& location, std::size_t count);
+  StatusType StepInstruction();
+  // Steps over calls
+  StatusType NextInstruction();
+  // Runs until the current function returns
+  StatusType Finish();
+  // Source line stepping, `Step` enters called functions with line info
+  StatusType Step();
+  StatusType Next();
+  // Block-steps until the process exits, hits a breakpoint or `max_stops`
+  // stops were recorded, writing the stop pcs to `path`
+  StatusType RecordTrace(const std::string& path, std::size_t max_stops);
+  // Prints the instruction path of a recorded trace, needs no process
+  StatusType DumpTrace(const std::string& path, std::size_t count);
+  // Plants one-shot breakpoints at every function entry, or basic block with
+  // `blocks`, of the modules whose file name contains one of `modules`. Only
+  // the executable when `modules` is empty
+  StatusType StartCoverage(bool blocks,
+                           const std::vector<std::string>& modules);
+  // Lifts the breakpoints which were not hit
+  StatusType StopCoverage();
+  // Hit sites per module
+  StatusType ShowCoverage();
+  // Writes the hit bitmap to `<prefix>.cov` and an lcov tracefile to
+  // `<prefix>.info`, also after the process exited
+  StatusType SaveCoverage(const std::string& prefix);
+  // Records every stop to the binary trace file `path` until stopped, also
+  // across runs. Only the last `max_segments` segments of records are kept
+  // when not 0, see EventTraceWriter
+  StatusType StartEventTrace(const std::string& path,
+                             std::size_t max_segments);
+  StatusType StopEventTrace();
+  // Hit rate of the memory cache, and calls, latency and bytes of the
+  // syscalls made on the process, see utils::SyscallStats
+  StatusType ShowStats();
+  // Shown at every stop: a register (`$rsp`), the 64-bit word at an address
+  // (`*$rsp+8`) or `/<n> <address>` for n bytes. An address is a register,
+  // symbol or hex number with an optional offset
+  StatusType AddDisplay(const std::string& expr);
+  StatusType RemoveDisplay(std::size_t number);
+  StatusType ShowDisplays();
+  // Searches readable memory for `pattern`. `range` is `<start>-<end>` in
+  // hex, or part of a mapping name (e.g. `[heap]`), everything when empty
+  StatusType FindMemory(const std::vector<uint8_t>& pattern,
+                        const std::string& range);
+  // Arenas, size classes and the `max_largest` largest allocations of glibc
+  // malloc, with every thread stopped, see HeapWalker
+  StatusType ShowHeap(std::size_t max_largest);
+  // Copies the writable memory under `name`. Pages not written since the
+  // previous snapshot are shared with it
+  StatusType SaveSnapshot(const std::string& name);
+  // Byte ranges which changed from snapshot `a` to `b`
+  StatusType DiffSnapshots(const std::string& a, const std::string& b);
+  // Puts registers, memory and mappings back as they were at snapshot
+  // `name`, writing only the pages changed since
+  StatusType RestoreSnapshot(const std::string& name);
+  // Replays each file of `inputs` (a file or a directory) `rounds` times:
+  // restores snapshot `name`, writes the input at `buffer`, its length to
+  // `size_reg` if given, and continues to the next stop. A breakpoint ends
+  // a run, a signal counts as a crash
+  StatusType Fuzz(const std::string& name, const std::string& buffer,
+                  const std::string& inputs, std::size_t rounds,
+                  const std::string& size_reg);
+  // Forks the stopped process into a frozen copy-on-write checkpoint
+  StatusType AddCheckpoint();
+  StatusType RemoveCheckpoint(std::size_t number);
+  StatusType ShowCheckpoints();
+  // Switches to a fresh fork of checkpoint `number`, which stays as it is.
+  // The current process is killed, breakpoints carry over
+  StatusType Restart(std::size_t number);
+  // Goes back to the previous breakpoint hit: restarts the latest checkpoint
+  // before it and continues until the hit count matches again. Needs the
+  // process to run the same way each time
+  StatusType ReverseContinue();
+  // Writes an ELF core of the stopped process and all its threads, without
+  // our int3s in it
+  StatusType GenerateCore(const std::string& path);
+  // Calls `function` in the stopped process with integer or pointer `args`
+  // (numbers or address expressions) and returns what it returned. All
+  // registers are put back afterwards, also when the call is stopped by a
+  // breakpoint or signal
+  std::optional<uint64_t> CallFunction(const std::string& function,
+                                       const std::vector<std::string>& args);
+  // Debugs the process of a core file post-mortem: backtraces, registers and
+  // memory come from the core until a process is run
+  StatusType LoadCore(const std::string& path);
+  // Hexdump of `count` bytes at an address, as taken by `display`
+  StatusType ExamineMemory(const std::string& expr, std::size_t count);
+  // Every thread with the function it is in, the main thread first
+  StatusType ShowThreads();
   pid_t GetPid() const;
+  // Traced threads, all of them stopped while the process is
+  std::vector<pid_t> GetThreads() const;
+  // Thread of the last stop unless another was selected, the one registers,
+  // steps and the pending signal apply to
+  pid_t GetCurrentThread() const;
+  // Makes traced thread `tid` the current one, the process being stopped
+  bool SelectThread(pid_t tid);
   bool IsRunning() const;
   void Quit();
 
+  // Unprinted access for frontends which drive the debugger themselves, e.g.
+  // the gdb server. They need the process stopped
+
+  // How the process stopped after RunUntilStop
+  struct StopInfo {
+    // Wait status once the process is gone
+    std::optional<int> exit_status;
+    // Signal of the stop, SIGTRAP for breakpoints and steps
+    int signal;
+    // Stopped at a breakpoint of the table, the pc is rewound to it
+    bool breakpoint;
+    // Hardware breakpoint or watchpoint which triggered
+    std::optional<DebugRegisters::Hit> hit;
+  };
+  // Memory with our int3s replaced by the original bytes, short at the first
+  // unreadable page
+  std::size_t ReadMemory(std::uintptr_t addr, void* buf, std::size_t len);
+  // Breakpoints under the written range take the new bytes as theirs
+  std::size_t WriteMemory(std::uintptr_t addr, const void* buf,
+                          std::size_t len);
+  bool ReadRegisterSets(user_regs_struct* regs, user_fpregs_struct* fpregs);
+  bool WriteRegisterSets(const user_regs_struct& regs,
+                         const user_fpregs_struct& fpregs);
+  // Breakpoints of the current run only, not kept as locations
+  bool InsertBreakPoint(std::uintptr_t addr);
+  bool RemoveBreakPoint(std::uintptr_t addr);
+  bool InsertWatchPoint(std::uintptr_t addr, std::size_t len, WatchKind kind);
+  bool RemoveWatchPoint(std::uintptr_t addr, std::size_t len, WatchKind kind);
+  // Continues, or steps one instruction, delivering `signal` (0 for none),
+  // until the next stop
+  StopInfo RunUntilStop(bool step, int signal);
+  // Lets the process run on its own, with our breakpoints lifted
+  void Detach();
+
  private:
+  enum class StopReason { kExited, kStep, kBreakpoint, kSignal };
+
+  struct Display {
+    std::size_t number;
+    std::string text;
+    // Register, symbol or hex number
+    std::string base;
+    int64_t offset;
+    // Bytes shown at the address, 0 for the value of the address itself
+    std::size_t len;
+    // Shown as one 64-bit word rather than bytes
+    bool word;
+  };
+
+  struct Checkpoint {
+    std::size_t number;
+    pid_t pid;
+    uint64_t pc;
+    // Breakpoint hits before the checkpoint, and whether it was taken right
+    // at the last of them
+    uint64_t hits;
+    bool at_hit;
+  };
+
+  // Where a user breakpoint goes, resolved again on every run
+  struct BreakPointLocation {
+    // Empty for an address
+    std::string symbol;
+    // Empty for an absolute address
+    std::string module;
+    // From the symbol, or the link-time address in `module`
+    uint64_t offset;
+    bool operator==(const BreakPointLocation&) const = default;
+  };
+
+  struct Snapshot {
+    std::shared_ptr<MemorySnapshot> memory;
+    user_regs_struct regs;
+    user_fpregs_struct fpregs;
+    // Program break, 0 when unknown
+    uint64_t brk;
+  };
+
   std::string prog_;
+  LaunchOptions launch_options_;
   bool running_{false};
   std::mutex mutex_;
   pid_t pid_{0};
-  std::unordered_map<std::intptr_t, std::shared_ptr<BreakPoint>> breakpoints_;
+  // Thread that stopped last, the one registers and steps apply to
+  pid_t tid_{0};
+  // Every traced thread of the process, all of them stopped between commands
+  std::set<pid_t> threads_;
+  // Threads resumed and not waited for since
+  std::set<pid_t> running_threads_;
+  // New threads whose first SIGSTOP is still to be waited for
+  std::set<pid_t> initial_stops_;
+  // Signals of threads other than the current one, delivered on resume
+  std::unordered_map<pid_t, int> thread_signals_;
+  // The last resume let every thread run, not only the current one
+  bool all_threads_running_{false};
+  BreakPointTable breakpoints_;
+  std::vector<BreakPointLocation> breakpoint_locations_;
+  Symbolizer symbolizer_;
+  // Valid while stopped, every resume invalidates it
+  MemoryCache memory_cache_{symbolizer_};
+  // Signal which stopped the process, delivered when it resumes
+  int pending_signal_{0};
+  // Breakpoint in the dynamic loader, which it calls whenever a module is
+  // loaded or unloaded. Set while some locations are pending, 0 otherwise
+  std::uintptr_t module_hook_{0};
+  // Line boundaries of a source step, installed only while resumed
+  BreakPointSet temp_breakpoints_;
+  OneShotBreakPointSet coverage_sites_;
+  CoverageMode coverage_mode_{CoverageMode::kFunctions};
+  std::vector<Display> displays_;
+  std::size_t next_display_{1};
+  // Memory of all displays, read at once
+  ReadPlanner read_planner_;
+  std::map<std::string, Snapshot> snapshots_;
+  // Snapshot last taken or restored, the soft-dirty bits are relative to it
+  std::shared_ptr<MemorySnapshot> last_snapshot_;
+  std::vector<Checkpoint> checkpoints_;
+  std::size_t next_checkpoint_{1};
+  // User breakpoint hits since the process started, the position in its
+  // execution that reverse-continue goes by
+  uint64_t breakpoint_hits_{0};
+  // Stopped by the last of those hits, nothing ran since
+  bool stopped_at_hit_{false};
+  std::shared_ptr<CoreTarget> core_;
+  DebugRegisters debug_registers_;
+  // Wait status of the last process when it exited
+  int exit_status_{0};
+  // Page with the int3 that called functions return to, 0 until the first
+  // call in the process
+  std::uintptr_t call_stub_{0};
+  // XSAVE area saved around calls, kept for the next one
+  std::vector<uint8_t> call_xstate_;
+  // Stops are recorded while set
+  std::unique_ptr<EventTraceWriter> event_trace_;
+  std::string event_trace_path_;
+  std::chrono::steady_clock::time_point event_trace_start_;
 
+  // The running process, else the core file if one is loaded, else nullptr
+  std::shared_ptr<const Target> GetTarget() const;
+  // Loads the symbolizer with the mappings of the target
+  void LoadSymbols();
+  BreakPointLocation LocateAddress(std::uintptr_t addr) const;
+  std::optional<std::uintptr_t> ResolveLocation(
+      const BreakPointLocation& location) const;
+  std::string FormatLocation(const BreakPointLocation& location) const;
+  // An address below the load address is taken as relative to it
+  StatusType AddBreakPoint(std::intptr_t addr);
+  StatusType AddBreakPoint(const BreakPointLocation& location);
+  // Resolves every location in the process, and enables the new ones at
+  // once. Watches module loads while some stay pending. The count is printed
+  // when `report` is set or something new was installed
+  void InstallBreakPoints(bool report);
   void SetRun(pid_t pid);
   void SetStop();
+  // Makes a fresh fork of `checkpoint` the debugged process
+  bool SwitchTo(const Checkpoint& checkpoint);
+  void KillCheckpoints();
+  // Resumes with `request` (PTRACE_CONT, PTRACE_SINGLESTEP or
+  // PTRACE_SINGLEBLOCK), executing the instruction under a breakpoint at the
+  // pc first, and waits for the next stop. A continue resumes the other
+  // threads too, unless `all_threads` is false; steps only the current one
+  StopReason Resume(__ptrace_request request, bool all_threads = true);
+  // Coverage breakpoints are lifted on the way, resuming with `request`. The
+  // thread of a reported stop becomes the current one, and all others are
+  // stopped before returning
+  StopReason WaitStop(__ptrace_request request);
+  // Brings every running thread to a stop, through SIGSTOP
+  void StopAll();
+  // A new thread, reported by PTRACE_EVENT_CLONE or by its first stop
+  void AddThread(pid_t tid);
+  void RemoveThread(pid_t tid);
+  // Kills the process and reaps every thread of it
+  void KillProcess();
+  // A signal which arrived while code was injected into thread `tid`,
+  // delivered on its next resume. Raised again if one is already due
+  void KeepSignal(pid_t tid, int signal);
+  // Runs syscall `nr` in the main thread, see SyscallInjector::Call
+  std::optional<long> InjectSyscall(long nr,
+                                    const std::array<uint64_t, 6>& args = {});
+  void ReportStop(StopReason reason);
+  // Appends a stop to the event trace, if one is recorded. Of thread `tid`,
+  // the current one when 0
+  void TraceStop(EventType type,
+                 std::chrono::steady_clock::time_point resumed, uint64_t pc,
+                 int value, pid_t tid = 0);
+  // Restores the mappings first: the program break through brk, then
+  // munmap of new mappings and mmap of removed anonymous ones
+  bool RestoreState(const Snapshot& snapshot);
+  // `$<reg>`, a symbol or a hex number, with an optional +/- offset
+  std::optional<uint64_t> EvaluateAddress(const std::string& expr);
+  // Evaluates the displays, once the process stopped after a command
+  void PrintDisplays();
+  // Continues until `addr` is reached with the stack pointer at or above
+  // `min_sp`, through a temporary breakpoint. Returns kStep once there
+  StopReason RunTo(std::uintptr_t addr, uint64_t min_sp);
+  // Memory at `addr` with our int3s replaced by the original bytes
+  std::vector<uint8_t> ReadCode(std::uintptr_t addr, std::size_t len);
+  std::size_t ReadCode(std::uintptr_t addr, void* buf, std::size_t len);
+  StatusType PrintInstructions(std::uintptr_t addr, std::size_t count);
+  StatusType StepLine(bool into);
+  // e.g. `main at hello_world.cpp:22`, followed by the source line
+  void PrintSourceLine(std::uintptr_t pc);
+  void PrintFrames(const std::vector<std::uintptr_t>& frames,
+                   const std::vector<std::string>& names) const;
 };
 
 }  // namespace shuidb
\ No newline at end of file
@@ -0,0 +1,75 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <elf.h>
+#include <stdint.h>
+
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace shuidb {
+
+struct ElfSymbol {
+  // Points into the mapped string table, valid as long as the ElfFile lives
+  std::string_view name;
+  uint64_t addr;
+  uint64_t size;
+  bool is_function;
+};
+
+// A read-only mmap of an ELF64 file, symbols are indexed on open
+class ElfFile {
+ public:
+  static std::shared_ptr<ElfFile> Open(const std::string& path);
+  ~ElfFile();
+  ElfFile(const ElfFile&) = delete;
+  ElfFile& operator=(const ElfFile&) = delete;
+
+  const std::string& GetPath() const;
+  std::span<const uint8_t> GetData() const;
+  const Elf64_Ehdr& GetHeader() const;
+  std::span<const Elf64_Phdr> GetProgramHeaders() const;
+  std::optional<std::span<const uint8_t>> GetSection(
+      std::string_view name) const;
+  std::optional<uint64_t> GetSectionAddress(std::string_view name) const;
+
+  const std::vector<ElfSymbol>& GetSymbols() const;
+  const ElfSymbol* FindSymbol(uint64_t vaddr) const;
+  const ElfSymbol* LookupSymbol(std::string_view name) const;
+
+  std::optional<uint64_t> FileOffsetToVaddr(uint64_t offset) const;
+  std::optional<uint64_t> VaddrToFileOffset(uint64_t vaddr) const;
+
+ private:
+  ElfFile(std::string path, const uint8_t* data, std::size_t size)
+      : path_(std::move(path)), data_(data), size_(size){};
+  bool Parse();
+  void LoadSymbols(const Elf64_Shdr& symtab);
+
+  std::string path_;
+  const uint8_t* data_;
+  std::size_t size_;
+  std::span<const Elf64_Shdr> sections_;
+  std::vector<ElfSymbol> symbols_;
+};
+
+}  // namespace shuidb
@@ -0,0 +1,175 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace shuidb {
+
+enum class EventType : uint32_t {
+  // A SIGTRAP stop which is not a breakpoint, e.g. after a single step
+  kStep,
+  kBreakpoint,
+  // A coverage site, the process goes on without stopping
+  kCoverage,
+  kSignal,
+  kExit,
+  // A new thread, reported by the thread which created it
+  kClone,
+  // A thread other than the main one is gone, the process goes on
+  kThreadExit,
+};
+
+// One stop of the traced process
+struct EventRecord {
+  // Since the trace started, at the stop
+  uint64_t time_ns;
+  // From the resume request to the stop
+  uint64_t latency_ns;
+  uint64_t pc;
+  int32_t tid;
+  EventType type;
+  // Breakpoint number, signal, wait status of an exit, si_code of a step or
+  // the new thread of a clone
+  int32_t value;
+  uint32_t reserved;
+};
+static_assert(sizeof(EventRecord) == 40);
+
+// Event trace file layout: an EventTraceHeader padded to a page, then
+// segments of an EventSegmentHeader padded to 64 bytes and EventRecords
+struct EventTraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t segment_size;
+  // Segments reused as a ring, 0 when the file only grows
+  uint64_t max_segments;
+};
+
+struct EventSegmentHeader {
+  // From 1 in writing order, 0 for a segment never written
+  uint64_t sequence;
+  uint64_t count;
+};
+
+// Appends records through a shared mapping of the current segment, mapping
+// the next one when it is full. An append is a copy into the mapping, and
+// what was appended survives a crash of the debugger
+class EventTraceWriter {
+ public:
+  static constexpr std::size_t kHeaderSize = 4096;
+  static constexpr std::size_t kSegmentSize = 1 << 20;
+  static constexpr std::size_t kSegmentHeaderSize = 64;
+  static constexpr std::size_t kSegmentRecords =
+      (kSegmentSize - kSegmentHeaderSize) / sizeof(EventRecord);
+
+  // Keeps the last `max_segments` segments only when not 0
+  static std::unique_ptr<EventTraceWriter> Create(const std::string& path,
+                                                  std::size_t max_segments);
+  ~EventTraceWriter();
+  EventTraceWriter(const EventTraceWriter&) = delete;
+  EventTraceWriter& operator=(const EventTraceWriter&) = delete;
+
+  void Append(const EventRecord& record) {
+    if (segment_ == nullptr || segment_->count == kSegmentRecords) {
+      if (!NextSegment()) {
+        return;
+      }
+    }
+    records_[segment_->count++] = record;
+  }
+  // Records appended so far, also those overwritten in the ring
+  uint64_t GetCount() const {
+    return segment_ == nullptr
+               ? 0
+               : (sequence_ - 1) * kSegmentRecords + segment_->count;
+  }
+
+ private:
+  EventTraceWriter(int fd, std::size_t max_segments)
+      : fd_(fd), max_segments_(max_segments){};
+  bool NextSegment();
+
+  int fd_;
+  std::size_t max_segments_;
+  uint64_t sequence_{0};
+  // Segments in the file
+  std::size_t segments_{0};
+  EventSegmentHeader* segment_{nullptr};
+  EventRecord* records_{nullptr};
+};
+
+struct EventTraceSummary {
+  std::size_t records{0};
+  uint64_t duration_ns{0};
+  std::map<EventType, std::size_t> types;
+  // Breakpoint hits by pc
+  std::map<uint64_t, std::size_t> hits;
+  // Threads created or gone during the trace, by tid. A time is missing
+  // when it is outside the trace
+  struct ThreadSpan {
+    std::optional<uint64_t> created_ns;
+    std::optional<uint64_t> exited_ns;
+  };
+  std::map<int32_t, ThreadSpan> threads;
+  // Bucket i counts values in [2^i, 2^(i+1)) ns, 0 in the first one
+  std::array<std::size_t, 64> inter_arrival{};
+  std::array<std::size_t, 64> latency{};
+  // Highest latency first
+  std::vector<EventRecord> slowest;
+};
+
+class EventTraceReader {
+ public:
+  static std::shared_ptr<EventTraceReader> Open(const std::string& path);
+  ~EventTraceReader();
+  EventTraceReader(const EventTraceReader&) = delete;
+  EventTraceReader& operator=(const EventTraceReader&) = delete;
+
+  const EventTraceHeader& GetHeader() const;
+  // In writing order, the oldest ring segments are gone
+  const std::vector<EventRecord>& GetRecords() const;
+
+  // Counts and histograms, with the `slowest` stops by latency
+  EventTraceSummary Summarize(std::size_t slowest) const;
+  // Chrome trace event JSON, one complete event per stop spanning the run
+  // before it
+  void WriteChromeTrace(std::ostream& os) const;
+
+ private:
+  EventTraceReader(const uint8_t* data, std::size_t size)
+      : data_(data), size_(size){};
+  bool Parse();
+
+  const uint8_t* data_;
+  std::size_t size_;
+  EventTraceHeader header_;
+  std::vector<EventRecord> records_;
+};
+
+const char* GetEventTypeName(EventType type);
+
+}  // namespace shuidb
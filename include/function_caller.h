@@ -0,0 +1,52 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/user.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace shuidb {
+
+// Calls functions inside a stopped tracee, following the SysV x86-64 ABI
+// for integer and pointer arguments. Calls return into a stub page holding
+// an int3, mapped once per process, so no code is patched per call.
+class FunctionCaller {
+ public:
+  // Below the stack pointer, leaf functions may keep data there
+  static constexpr std::size_t kRedZone = 128;
+
+  // Maps the stub page, returns its address. A signal arriving meanwhile is
+  // kept in `signal`, see SyscallInjector::Call
+  static std::optional<std::uintptr_t> InjectStub(pid_t pid,
+                                                  int* signal = nullptr);
+  // Points the registers of `pid`, stopped with `regs`, at `func` with
+  // `args` in rdi, rsi, rdx, rcx, r8, r9 and then on the stack, returning
+  // to `stub`. The caller resumes, and puts the registers back afterwards
+  static bool SetUpCall(pid_t pid, const user_regs_struct& regs,
+                        std::uintptr_t stub, std::uintptr_t func,
+                        const std::vector<uint64_t>& args);
+  // Whether a SIGTRAP stop with `regs` is the return of a call
+  static bool IsReturn(const user_regs_struct& regs, std::uintptr_t stub) {
+    return regs.rip == stub + 1;
+  }
+};
+
+}  // namespace shuidb
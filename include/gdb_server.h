@@ -0,0 +1,93 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#pragma once
+
+#include <sys/user.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "debugger.h"
+#include "type_def.h"
+
+namespace shuidb {
+
+// Serves a debugger to gdb, IDEs or scripts over the GDB remote serial
+// protocol, in all-stop mode and on the debugged process only. Registers are
+// read once per stop and kept until the next resume, memory goes through the
+// page cache of the debugger, so large `m` packets cost a few bulk reads
+class GdbServer {
+ public:
+  // Big enough for whole pages in one `m` or `X` packet
+  static constexpr std::size_t kPacketSize = 0x20000;
+
+  explicit GdbServer(Debugger& debugger) : debugger_(debugger){};
+
+  // Serves one connection, reading from `in_fd` and writing to `out_fd`,
+  // until it detaches, kills the process or closes
+  StatusType Serve(int in_fd, int out_fd);
+  // Serves the first connection to a unix socket created at `path`
+  StatusType ServeUnixSocket(const std::string& path);
+
+ private:
+  // Both register sets, with the x87 tag word in its full form
+  struct RegisterCache {
+    user_regs_struct regs;
+    user_fpregs_struct fpregs;
+    uint32_t ftag;
+  };
+
+  // Reads more input, false once the connection is closed
+  bool Fill();
+  // Payload of the next packet, nullopt once the connection is closed
+  std::optional<std::string> ReadPacket();
+  bool WritePacket(const std::string& payload);
+  // Reply to `packet`, nullopt when none is due
+  std::optional<std::string> Handle(const std::string& packet);
+  std::string HandleQuery(const std::string& packet);
+  std::string HandleVCont(const std::string& packet);
+  std::string HandleBreakPoint(const std::string& packet, bool insert);
+  std::string ReadRegisters();
+  std::string WriteRegisters(const std::string& hex);
+  std::string ReadRegister(std::size_t number);
+  std::string WriteRegister(std::size_t number, const std::string& hex);
+  std::string ReadMemory(std::uintptr_t addr, std::size_t len);
+  std::string WriteMemory(std::uintptr_t addr, const std::string& data);
+  // Runs until the next stop, handing Ctrl-C (0x03) from the frontend to the
+  // process as SIGINT meanwhile
+  std::string Resume(bool step, int signal);
+  std::string StopReply() const;
+  // Registers of the current stop, read on first use
+  RegisterCache* GetRegisterCache();
+  bool StoreRegisters(const RegisterCache& cache);
+
+  Debugger& debugger_;
+  int in_fd_{-1};
+  int out_fd_{-1};
+  // Received but not yet parsed
+  std::string input_;
+  bool ack_{true};
+  // The session ended by a kill or detach
+  bool done_{false};
+  Debugger::StopInfo last_stop_{};
+  std::optional<RegisterCache> registers_;
+};
+
+}  // namespace shuidb
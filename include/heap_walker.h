@@ -0,0 +1,101 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "utils/ps_utils.hpp"
+#include "utils/thread_pool.hpp"
+
+namespace shuidb {
+
+// A chunk of glibc malloc, `size` includes its header
+struct HeapChunk {
+  std::uintptr_t addr;
+  std::size_t size;
+  // In a mapping of its own rather than in an arena
+  bool mmapped;
+};
+
+struct HeapArena {
+  std::uintptr_t addr;
+  // The brk heap of main_arena, the mmapped heaps of a thread arena
+  std::size_t heaps;
+  std::size_t used_count;
+  std::size_t used_bytes;
+  // Chunks in bins, fastbins and tcaches, the top chunk is not counted
+  std::size_t free_count;
+  std::size_t free_bytes;
+  std::size_t fastbin_count;
+  std::size_t tcache_count;
+  std::size_t largest_free;
+  std::size_t top_size;
+  // The walk of a heap stopped at a chunk header which makes no sense
+  bool corrupt;
+};
+
+// Chunks of [min_size, max_size]: one size up to kExactSizeLimit, powers of
+// two above
+struct HeapSizeClass {
+  std::size_t min_size;
+  std::size_t max_size;
+  std::size_t used_count;
+  std::size_t used_bytes;
+  std::size_t free_count;
+  std::size_t free_bytes;
+};
+
+struct HeapReport {
+  // main_arena first
+  std::vector<HeapArena> arenas;
+  // Non-empty classes by size
+  std::vector<HeapSizeClass> classes;
+  // In-use chunks, largest first
+  std::vector<HeapChunk> largest;
+  std::size_t mmapped_count;
+  std::size_t mmapped_bytes;
+  std::size_t bytes_read;
+};
+
+// Walks the heaps of glibc malloc (2.30 and later, x86-64) in a process
+// whose threads are all stopped. Each heap is read in windows of
+// kWindowSize and walked from chunk header to chunk header, one heap per
+// task; windows skip the inside of large chunks. Tcache and fastbin chunks
+// look in use to the walk, their lists are followed afterwards with one
+// batched read per list position
+class HeapWalker {
+ public:
+  static constexpr std::size_t kWindowSize = 8 << 20;
+  static constexpr std::size_t kExactSizeLimit = 1024;
+
+  // main_arena is not exported, without the symbol it is found in the
+  // writable data of libc by its top chunk, which ends the brk heap
+  static std::optional<std::uintptr_t> FindMainArena(
+      pid_t pid, const std::vector<utils::MemoryRegion>& regions);
+  // Keeps the `max_largest` largest in-use chunks, mmapped ones included
+  static std::optional<HeapReport> Walk(
+      pid_t pid, const std::vector<utils::MemoryRegion>& regions,
+      std::uintptr_t main_arena, std::size_t max_largest,
+      utils::ThreadPool& pool);
+};
+
+}  // namespace shuidb
@@ -0,0 +1,62 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "elf_file.h"
+
+namespace shuidb {
+
+struct LineRow {
+  // Link-time address
+  uint64_t address;
+  // Index into the table's file names
+  uint32_t file;
+  uint32_t line;
+  bool is_stmt;
+  // First address past a sequence, not a location of its own
+  bool end_sequence;
+};
+
+// Rows of the DWARF .debug_line programs (versions 2 to 5) of one module,
+// sorted by address
+class LineTable {
+ public:
+  static std::optional<LineTable> Parse(const ElfFile& elf);
+
+  // The row covering `addr`, nullptr outside of any sequence
+  const LineRow* FindRow(uint64_t addr) const;
+  // Statement addresses in [begin, end), ascending and unique
+  std::vector<uint64_t> GetLineStarts(uint64_t begin, uint64_t end) const;
+  const std::string& GetFileName(uint32_t file) const;
+  std::size_t Size() const;
+
+ private:
+  bool ParseUnit(std::span<const uint8_t> unit, bool dwarf64,
+                 std::span<const uint8_t> str,
+                 std::span<const uint8_t> line_str);
+
+  std::vector<LineRow> rows_;
+  std::vector<std::string> files_;
+};
+
+}  // namespace shuidb
@@ -0,0 +1,89 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "symbolizer.h"
+
+namespace shuidb {
+
+struct MemoryCacheStats {
+  // Pages found in the cache
+  uint64_t hits;
+  // Pages read from the process
+  uint64_t misses;
+  // Pages served from the module files
+  uint64_t file_reads;
+};
+
+// Read-through page cache of a stopped process, to be invalidated whenever
+// it runs. Pages of unmodified read-only file mappings (text, rodata) come
+// straight from the ELF files mapped by the symbolizer, without touching the
+// process. The memory map is the one last loaded by the symbolizer
+class MemoryCache {
+ public:
+  static constexpr std::size_t kPageSize = 4096;
+
+  explicit MemoryCache(const Symbolizer& symbolizer)
+      : symbolizer_(symbolizer){};
+
+  // Drops everything known about the previous process
+  void Reset(pid_t pid);
+  // Drops the cached pages, the process is about to run
+  void Invalidate();
+  // Returns the number of bytes read, short at the first unreadable page
+  std::size_t Read(std::uintptr_t addr, void* buf, std::size_t len);
+  // Writes to the process and to the cached pages. Written pages of file
+  // mappings are read from the process from then on
+  std::size_t Write(std::uintptr_t addr, const void* buf, std::size_t len);
+
+  const MemoryCacheStats& GetStats() const;
+
+ private:
+  struct Page {
+    // Into storage_
+    std::size_t offset;
+    // Readable bytes from the start of the page
+    std::size_t size;
+  };
+
+  // Whether the page at `page` can be served from the module file
+  bool IsFileBacked(std::uintptr_t page);
+  const Page& LoadPage(std::uintptr_t page);
+
+  const Symbolizer& symbolizer_;
+  pid_t pid_{0};
+  std::unordered_map<std::uintptr_t, Page> pages_;
+  // Page contents, kept across invalidations to avoid reallocating
+  std::vector<uint8_t> storage_;
+  // Pages of file mappings which differ from the file
+  std::unordered_set<std::uintptr_t> written_pages_;
+  // Read-only data mappings by start address, true when none of their pages
+  // was copied on write (e.g. relocated RELRO data is)
+  std::map<std::uintptr_t, bool> pristine_;
+  MemoryCacheStats stats_{};
+};
+
+}  // namespace shuidb
@@ -16,8 +16,12 @@
 
 #pragma once
 
-#include <unistd.h>
 #include <stdint.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <vector>
 
 namespace shuidb {
 
@@ -25,6 +29,23 @@ class MemoryOperator {
  public:
   static void WriteMemory(pid_t pid, uint64_t addr, uint64_t data);
   static uint64_t ReadMemory(pid_t pid, uint64_t addr);
+  // Bulk read through process_vm_readv, falls back to word-sized ptrace reads
+  // when the range is not readable that way. Returns the number of bytes read
+  static std::size_t ReadMemory(pid_t pid, uint64_t addr, void* buf,
+                                std::size_t len);
+  // Scatter-gather read, `local[i]` receives `remote[i]`. Issues one
+  // process_vm_readv per IOV_MAX ranges, ranges which cannot be read that way
+  // are retried one by one. Returns the number of bytes read
+  static std::size_t ReadMemoryV(pid_t pid, const std::vector<iovec>& local,
+                                 const std::vector<iovec>& remote);
+  // Writes `local[i]` to `remote[i]` through /proc/<pid>/mem, which also
+  // patches read-only code. The file stays open for the next writes and is
+  // reopened once a write through it fails. Falls back to word-sized ptrace
+  // writes. Returns the number of bytes written
+  static std::size_t WriteMemoryV(pid_t pid, const std::vector<iovec>& local,
+                                  const std::vector<iovec>& remote);
+  // Closes the /proc/<pid>/mem kept open by WriteMemoryV, once `pid` is gone
+  static void CloseMemory(pid_t pid);
 };
 
 }  // namespace shuidb
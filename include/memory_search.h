@@ -0,0 +1,76 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "utils/ps_utils.hpp"
+#include "utils/thread_pool.hpp"
+
+namespace shuidb {
+
+enum class SearchKernel { kScalar, kSse2, kAvx2 };
+
+struct SearchResult {
+  // Ascending, at most the `max_matches` lowest ones
+  std::vector<std::uintptr_t> matches;
+  // Every match, including the ones not kept
+  std::size_t count;
+  std::size_t bytes_scanned;
+};
+
+class MemorySearch {
+ public:
+  // Regions are read and scanned in chunks of this size, one per task
+  static constexpr std::size_t kChunkSize = 4 << 20;
+
+  // `text` as bytes: `b` hex bytes (`de ad be ef` or `deadbeef`), `w` a
+  // 64-bit little-endian integer, `s` a string
+  static std::optional<std::vector<uint8_t>> ParsePattern(
+      char kind, const std::string& text);
+
+  // Offsets of every occurrence of `pattern` in `data`, overlapping ones
+  // included. At most `max_matches` are appended, all are counted
+  static std::size_t FindPattern(std::span<const uint8_t> data,
+                                 std::span<const uint8_t> pattern,
+                                 std::vector<std::size_t>& matches,
+                                 std::size_t max_matches = SIZE_MAX);
+  static std::size_t FindPattern(std::span<const uint8_t> data,
+                                 std::span<const uint8_t> pattern,
+                                 std::vector<std::size_t>& matches,
+                                 std::size_t max_matches,
+                                 SearchKernel kernel);
+  // The fastest kernel this CPU supports
+  static SearchKernel GetBestKernel();
+
+  // Scans the readable parts of `regions` within [begin, end) of a process
+  // through process_vm_readv, the chunks spread over `pool`
+  static SearchResult Search(pid_t pid,
+                             const std::vector<utils::MemoryRegion>& regions,
+                             std::uintptr_t begin, std::uintptr_t end,
+                             std::span<const uint8_t> pattern,
+                             std::size_t max_matches, utils::ThreadPool& pool);
+};
+
+}  // namespace shuidb
@@ -0,0 +1,93 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "utils/ps_utils.hpp"
+
+namespace shuidb {
+
+struct SnapshotPage {
+  std::uintptr_t addr;
+  uint32_t crc;
+  // kPageSize bytes, owned by a snapshot store
+  const uint8_t* data;
+};
+
+// [begin, end) of bytes which differ between two snapshots
+struct ChangedRange {
+  std::uintptr_t begin;
+  std::uintptr_t end;
+};
+
+// Copy of the writable memory of a stopped process. Pages are stored once:
+// a snapshot shares the pages that did not change with the snapshot it was
+// taken on top of, so only written pages are copied
+class MemorySnapshot {
+ public:
+  static constexpr std::size_t kPageSize = 4096;
+
+  // With `base`, only pages which are soft-dirty since the last
+  // ClearSoftDirty are read, the rest come from `base`. Without soft-dirty
+  // support every present page is read, and identical ones are still shared
+  static std::shared_ptr<MemorySnapshot> Take(
+      pid_t pid, const std::vector<utils::MemoryRegion>& regions,
+      const MemorySnapshot* base);
+  // Pages written from now on are soft-dirty
+  static bool ClearSoftDirty(pid_t pid);
+  // Whether the kernel tracks soft-dirty pages (CONFIG_MEM_SOFT_DIRTY)
+  static bool IsSoftDirtySupported();
+  // Writes back the pages of the snapshotted regions which differ from
+  // `target`: those soft-dirty since `dirty_base` was taken or restored, plus
+  // those `dirty_base` has different. Without soft-dirty support every
+  // present page is compared. The mappings must already match `target`, a
+  // page it lacks is zeroed. Returns the number of pages written
+  static std::optional<std::size_t> Restore(
+      pid_t pid, const std::vector<utils::MemoryRegion>& regions,
+      const MemorySnapshot& target, const MemorySnapshot* dirty_base);
+  // Changed bytes from `a` to `b`, ascending, with changes less than a word
+  // apart merged. Pages missing from one side compare as zeros
+  static std::vector<ChangedRange> Diff(const MemorySnapshot& a,
+                                        const MemorySnapshot& b);
+  // CRC32C, with SSE4.2 when available
+  static uint32_t Crc32c(const uint8_t* data, std::size_t len);
+
+  // Sorted by address
+  const std::vector<SnapshotPage>& GetPages() const;
+  // Pages read from the process when taken
+  std::size_t GetReadPages() const;
+  // Pages stored by this snapshot rather than shared
+  std::size_t GetStoredPages() const;
+  // All mappings when taken, snapshotted or not
+  const std::vector<utils::MemoryRegion>& GetRegions() const;
+
+ private:
+  std::vector<utils::MemoryRegion> regions_;
+  std::vector<SnapshotPage> pages_;
+  std::vector<std::shared_ptr<const std::vector<uint8_t>>> stores_;
+  std::size_t read_pages_{0};
+  std::size_t stored_pages_{0};
+};
+
+}  // namespace shuidb
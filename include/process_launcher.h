@@ -0,0 +1,51 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace shuidb {
+
+struct LaunchOptions {
+  // Arguments after argv[0]
+  std::vector<std::string> args;
+  // `NAME=value` entries, our own environment when unset
+  std::optional<std::vector<std::string>> env;
+  // Working directory, ours when empty
+  std::string cwd;
+  // Files for stdin, stdout and stderr, ours when empty. Output files are
+  // truncated
+  std::string stdin_path;
+  std::string stdout_path;
+  std::string stderr_path;
+};
+
+class ProcessLauncher {
+ public:
+  // Starts `prog` traced, with ASLR disabled, and waits for the stop right
+  // after its exec. The child runs on our memory until the exec, like
+  // vfork, so nothing is copied however large the debugger is. Returns
+  // nullopt with errno set when the child could not be started
+  static std::optional<pid_t> Launch(const std::string& prog,
+                                     const LaunchOptions& options);
+};
+
+}  // namespace shuidb
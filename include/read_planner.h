@@ -0,0 +1,62 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace shuidb {
+
+// Collects the memory ranges wanted at a stop and reads them all at once.
+// Overlapping and adjacent ranges are merged, and the merged list is read
+// with one process_vm_readv into an arena kept from stop to stop
+class ReadPlanner {
+ public:
+  using Handle = std::size_t;
+
+  // Forgets the requests, the arena keeps its storage
+  void Clear();
+  Handle Request(std::uintptr_t addr, std::size_t len);
+  // Reads every requested range, returns the number of bytes read
+  std::size_t Execute(pid_t pid);
+  // Bytes of a request, cut short at the first unreadable one. Valid until
+  // the next Clear or Execute
+  std::span<const uint8_t> Get(Handle handle) const;
+  // Ranges actually read by the last Execute
+  std::size_t GetRangeCount() const;
+
+ private:
+  struct Range {
+    std::uintptr_t addr;
+    std::size_t len;
+    // Into arena_, for merged ranges
+    std::size_t offset;
+    // Readable bytes from `addr`, for merged ranges
+    std::size_t size;
+  };
+
+  std::vector<Range> requests_;
+  // Sorted by address, disjoint and not adjacent
+  std::vector<Range> ranges_;
+  std::vector<uint8_t> arena_;
+};
+
+}  // namespace shuidb
@@ -30,6 +30,8 @@ class RegisterOperator {
  public:
   static std::optional<std::unordered_map<Register, uint64_t>> GetRegisters(
       pid_t pid);
+  static std::unordered_map<Register, uint64_t> GetRegisters(
+      const user_regs_struct& regs);
   static std::optional<uint64_t> GetRegisterValue(pid_t pid, Register reg);
   static uint64_t GetRegisterValue(const user_regs_struct& regs,
                                    const Register reg);
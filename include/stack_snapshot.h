@@ -0,0 +1,80 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/user.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "symbolizer.h"
+#include "target.h"
+#include "utils/ps_utils.hpp"
+#include "utils/thread_pool.hpp"
+
+namespace shuidb {
+
+constexpr std::size_t kDefaultMaxStackBytes = 64 * 1024;
+constexpr std::size_t kMaxFrames = 64;
+
+// Registers and raw stack bytes of one thread, copied while it was stopped
+struct ThreadStack {
+  pid_t tid;
+  user_regs_struct regs;
+  // Address of stack_bytes[0], i.e. the stack pointer at capture time
+  std::uintptr_t stack_base;
+  std::vector<uint8_t> stack_bytes;
+  // Return addresses, innermost first, filled in by `UnwindStack`
+  std::vector<std::uintptr_t> frames;
+};
+
+struct StackGroup {
+  std::vector<pid_t> tids;
+  std::vector<std::uintptr_t> frames;
+};
+
+// Captures only need the threads to be stopped for the register and memory
+// copies, unwinding and symbolization run afterwards on the copied data.
+class StackSnapshot {
+ public:
+  // Registers are read on the calling thread (it must be the tracer), stack
+  // memory is copied on the pool
+  static StackSnapshot Capture(pid_t pid, const std::vector<pid_t>& tids,
+                               utils::ThreadPool& pool,
+                               std::size_t max_stack_bytes =
+                                   kDefaultMaxStackBytes);
+  static std::optional<ThreadStack> CaptureThread(
+      pid_t pid, pid_t tid, const std::vector<utils::MemoryRegion>& regions,
+      std::size_t max_stack_bytes = kDefaultMaxStackBytes);
+  // Same, for a process or a core file
+  static std::optional<ThreadStack> CaptureThread(
+      const Target& target, pid_t tid,
+      const std::vector<utils::MemoryRegion>& regions,
+      std::size_t max_stack_bytes = kDefaultMaxStackBytes);
+  static void UnwindStack(ThreadStack& stack, const Symbolizer& symbolizer);
+
+  void Unwind(const Symbolizer& symbolizer, utils::ThreadPool& pool);
+  // Threads with identical frames, most populated group first
+  std::vector<StackGroup> GroupStacks() const;
+  const std::vector<ThreadStack>& GetThreads() const;
+
+ private:
+  std::vector<ThreadStack> threads_;
+};
+
+}  // namespace shuidb
@@ -0,0 +1,94 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "elf_file.h"
+#include "line_table.h"
+#include "utils/ps_utils.hpp"
+
+namespace shuidb {
+
+struct SymbolInfo {
+  std::string_view name;
+  // Runtime address of the symbol
+  std::uintptr_t address;
+  uint64_t size;
+  std::string module;
+};
+
+// Maps runtime addresses of a process to ELF symbols of the loaded modules.
+// Parsed ELF files are cached by path and survive `Load` of another pid.
+class Symbolizer {
+ public:
+  Symbolizer() = default;
+  explicit Symbolizer(pid_t pid) { Load(pid); }
+
+  void Load(pid_t pid);
+  // Mappings of a process which may be gone, e.g. taken from a core file
+  void Load(std::vector<utils::MemoryRegion> regions);
+  const std::vector<utils::MemoryRegion>& GetRegions() const;
+  // Forgets the cached files which changed on disk since they were parsed,
+  // e.g. a rebuilt program. The rest stays parsed for the next process
+  void DropChangedFiles();
+
+  std::optional<SymbolInfo> FindSymbol(std::uintptr_t addr) const;
+  // e.g. `main+0x1a (hello_world)`, or `0x7ffff7fe3290` if unknown
+  std::string Symbolize(std::uintptr_t addr) const;
+  // Mangled or plain names first, then C++ functions by demangled name, e.g.
+  // `work` or `work(int)` for `_Z4worki`
+  std::optional<std::uintptr_t> LookupAddress(std::string_view name) const;
+
+  std::shared_ptr<const ElfFile> GetElfFile(const std::string& path) const;
+  // Bytes of a file-backed mapping as found on disk, or nullptr when
+  // [addr, addr + len) is not fully backed by a cached ELF file
+  const uint8_t* GetFileBytes(std::uintptr_t addr, std::size_t len) const;
+  // Runtime address minus link-time address for a loaded module
+  std::optional<std::intptr_t> GetLoadBias(const std::string& path) const;
+  // Parsed on first use, nullptr when the module has no .debug_line
+  const LineTable* GetLineTable(const std::string& path);
+
+ private:
+  // Identity of a file on disk, a rebuild changes it
+  struct FileStamp {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    int64_t mtime_ns;
+    bool operator==(const FileStamp&) const = default;
+  };
+  static FileStamp GetFileStamp(const std::string& path);
+
+  std::vector<utils::MemoryRegion> regions_;
+  std::unordered_map<std::string, std::shared_ptr<ElfFile>> files_;
+  std::unordered_map<std::string, FileStamp> stamps_;
+  std::unordered_map<std::string, std::intptr_t> load_bias_;
+  std::unordered_map<std::string, std::optional<LineTable>> line_tables_;
+  // Loaded modules in address order, the executable comes first
+  std::vector<std::string> modules_;
+};
+
+}  // namespace shuidb
@@ -0,0 +1,46 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <array>
+#include <cstdint>
+#include <optional>
+
+namespace shuidb {
+
+// Runs system calls inside a stopped tracee: a syscall instruction is
+// planted at its pc and single-stepped, then code and registers are put back
+class SyscallInjector {
+ public:
+  // The raw result of `nr`, a negative errno on failure. Nothing when the
+  // process could not be stepped or exited. A signal arriving meanwhile is
+  // stored in `signal` if it is given and still 0, for the caller to deliver
+  // on the next resume. Any other is raised again once the call is done
+  static std::optional<long> Call(pid_t pid, long nr,
+                                  const std::array<uint64_t, 6>& args = {},
+                                  int* signal = nullptr);
+  // Forks the tracee. The child is traced, killed with us, and stopped in
+  // the state the parent had before the call, sharing its pages copy-on-write.
+  // `options` are the ptrace options of the tracee, set again afterwards.
+  // Signals are kept as by Call
+  static std::optional<pid_t> Fork(pid_t pid, long options = 0,
+                                   int* signal = nullptr);
+};
+
+}  // namespace shuidb
@@ -0,0 +1,71 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/user.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "utils/ps_utils.hpp"
+
+namespace shuidb {
+
+// What is being debugged: memory, registers and threads of a live process or
+// of a core file
+class Target {
+ public:
+  virtual ~Target() = default;
+
+  // Pid of the process, which is also the tid of its main thread
+  virtual pid_t GetPid() const = 0;
+  // Thread whose registers and stack are shown by default
+  virtual pid_t GetCurrentThread() const { return GetPid(); }
+  // Returns the number of bytes read, short when the range is not all mapped
+  virtual std::size_t ReadMemory(std::uintptr_t addr, void* buf,
+                                 std::size_t len) const = 0;
+  virtual std::optional<user_regs_struct> GetRegisters(pid_t tid) const = 0;
+  // The main thread comes first
+  virtual std::vector<pid_t> GetThreads() const = 0;
+  // Sorted by address
+  virtual std::vector<utils::MemoryRegion> GetRegions() const = 0;
+};
+
+// A live process, registers can only be read from threads in ptrace-stop
+class ProcessTarget : public Target {
+ public:
+  // `tid` is the thread that stopped last, 0 for the main thread
+  explicit ProcessTarget(pid_t pid, pid_t tid = 0)
+      : pid_(pid), tid_(tid != 0 ? tid : pid) {}
+
+  pid_t GetPid() const override;
+  pid_t GetCurrentThread() const override;
+  std::size_t ReadMemory(std::uintptr_t addr, void* buf,
+                         std::size_t len) const override;
+  std::optional<user_regs_struct> GetRegisters(pid_t tid) const override;
+  std::vector<pid_t> GetThreads() const override;
+  std::vector<utils::MemoryRegion> GetRegions() const override;
+
+ private:
+  pid_t pid_;
+  pid_t tid_;
+};
+
+}  // namespace shuidb
@@ -0,0 +1,48 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <unordered_map>
+#include <vector>
+
+namespace shuidb {
+
+// Keeps every thread of a process in ptrace-stop for the lifetime of the
+// object. Threads which are not traced yet get seized and interrupted, and are
+// detached (thus resumed) again on `Resume` or destruction. Threads in
+// `traced` are already stopped under our control and are left alone.
+class ThreadStopper {
+ public:
+  ThreadStopper(pid_t pid, const std::vector<pid_t>& traced = {});
+  ~ThreadStopper();
+  ThreadStopper(const ThreadStopper&) = delete;
+  ThreadStopper& operator=(const ThreadStopper&) = delete;
+
+  // All stopped threads, including the ones in `traced`
+  const std::vector<pid_t>& GetThreads() const;
+  void Resume();
+
+ private:
+  std::vector<pid_t> threads_;
+  std::vector<pid_t> seized_;
+  // Signals which stopped a thread before our interrupt did
+  std::unordered_map<pid_t, int> signals_;
+};
+
+}  // namespace shuidb
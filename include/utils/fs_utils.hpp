@@ -18,7 +18,12 @@
 
 #include <sys/stat.h>
 
+#include <fstream>
+#include <optional>
 #include <string>
+#include <vector>
+
+#include "utils/string_utils.hpp"
 
 namespace shuidb {
 namespace utils {
@@ -28,5 +33,23 @@ inline bool file_exists(const std::string& path) {
   return (stat(path.c_str(), &buffer) == 0);
 }
 
+// Commands of a script, one per line, without blank lines and # comments
+inline std::optional<std::vector<std::string>> read_script(
+    const std::string& path) {
+  std::ifstream ifs(path);
+  if (!ifs) {
+    return std::nullopt;
+  }
+  std::vector<std::string> commands;
+  std::string line;
+  while (std::getline(ifs, line)) {
+    line = trim(line);
+    if (!line.empty() && line[0] != '#') {
+      commands.push_back(line);
+    }
+  }
+  return commands;
+}
+
 }  // namespace utils
 }  // namespace shuidb
@@ -0,0 +1,340 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace shuidb {
+namespace utils {
+
+enum class Sink { kStdout, kStderr };
+
+// Buffered, asynchronous stdout and stderr. Every thread appends to a ring
+// of its own without locking, a background thread drains the rings and
+// writes them in batches, so a slow terminal never holds up the tracer.
+// Output of a thread keeps its order, lines of different threads may
+// interleave
+class Logger {
+ public:
+  // Never destroyed, as output may come from other static destructors.
+  // The writer is stopped at exit, later output is written directly
+  static Logger& Get() {
+    static Logger* logger = new Logger();
+    return *logger;
+  }
+
+  Logger(const Logger&) = delete;
+  Logger& operator=(const Logger&) = delete;
+
+  // Queues `text`, only waits when the ring of this thread is full
+  void Write(Sink sink, std::string_view text) {
+    // Stop waits for pushes in progress, later ones go direct
+    writers_.fetch_add(1);
+    if (direct_.load()) {
+      writers_.fetch_sub(1);
+      WaitStopped();
+      WriteAll(fds_[Index(sink)], text);
+      return;
+    }
+    auto& ring = GetRing();
+    while (!text.empty()) {
+      auto piece = text.substr(0, Ring::kMaxRecord);
+      while (!ring.TryPush(sink, piece)) {
+        Wake();
+        std::this_thread::sleep_for(kFullWait);
+      }
+      text.remove_prefix(piece.size());
+    }
+    Wake();
+    writers_.fetch_sub(1);
+  }
+
+  // Returns once everything queued so far is written, e.g. before a prompt
+  void Flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (stopping_) {
+      // The writer drains the rings one last time
+      lock.unlock();
+      WaitStopped();
+      return;
+    }
+    auto ticket = ++flush_requested_;
+    wake_cv_.notify_one();
+    flushed_cv_.wait(lock, [&] { return flushed_ >= ticket; });
+  }
+
+  // Whether color codes go to `sink`, decided once from isatty
+  bool IsColored(Sink sink) const {
+    return colored_[Index(sink)].load(std::memory_order_relaxed);
+  }
+
+  // Writes `sink` to `fd` from now on
+  void Redirect(Sink sink, int fd) {
+    Flush();
+    fds_[Index(sink)] = fd;
+    colored_[Index(sink)] = isatty(fd) == 1;
+  }
+
+ private:
+  static constexpr auto kIdleWait = std::chrono::milliseconds(10);
+  static constexpr auto kFullWait = std::chrono::microseconds(50);
+
+  // Written by its thread, drained by the writer. Records are a header and
+  // the text, wrapping around the end of the buffer
+  class Ring {
+   public:
+    static constexpr std::size_t kSize = 1 << 16;
+    // Longer text takes several records
+    static constexpr std::size_t kMaxRecord = kSize / 4;
+
+    bool TryPush(Sink sink, std::string_view text) {
+      auto tail = tail_.load(std::memory_order_relaxed);
+      auto head = head_.load(std::memory_order_acquire);
+      if (kSize - (tail - head) < sizeof(Header) + text.size()) {
+        return false;
+      }
+      Header header{static_cast<uint32_t>(text.size()), sink};
+      CopyIn(tail, &header, sizeof(header));
+      CopyIn(tail + sizeof(header), text.data(), text.size());
+      tail_.store(tail + sizeof(header) + text.size(),
+                  std::memory_order_release);
+      return true;
+    }
+
+    // Hands every record to `fn(sink, text)`, in two calls where the text
+    // wraps
+    template <typename Fn>
+    void Drain(Fn&& fn) {
+      auto head = head_.load(std::memory_order_relaxed);
+      auto tail = tail_.load(std::memory_order_acquire);
+      while (head != tail) {
+        Header header;
+        CopyOut(head, &header, sizeof(header));
+        head += sizeof(header);
+        auto offset = head % kSize;
+        auto first = std::min<std::size_t>(header.size, kSize - offset);
+        fn(header.sink, std::string_view(data_.get() + offset, first));
+        if (first < header.size) {
+          fn(header.sink, std::string_view(data_.get(), header.size - first));
+        }
+        head += header.size;
+      }
+      head_.store(head, std::memory_order_release);
+    }
+
+    bool IsEmpty() const {
+      return head_.load(std::memory_order_acquire) ==
+             tail_.load(std::memory_order_acquire);
+    }
+
+    // Its thread is gone, the ring goes to the next new thread once drained
+    std::atomic<bool> retired{false};
+
+   private:
+    struct Header {
+      uint32_t size;
+      Sink sink;
+    };
+
+    void CopyIn(uint64_t pos, const void* src, std::size_t len) {
+      auto offset = pos % kSize;
+      auto first = std::min(len, kSize - offset);
+      std::memcpy(data_.get() + offset, src, first);
+      std::memcpy(data_.get(), static_cast<const char*>(src) + first,
+                  len - first);
+    }
+    void CopyOut(uint64_t pos, void* dst, std::size_t len) const {
+      auto offset = pos % kSize;
+      auto first = std::min(len, kSize - offset);
+      std::memcpy(dst, data_.get() + offset, first);
+      std::memcpy(static_cast<char*>(dst) + first, data_.get(), len - first);
+    }
+
+    std::unique_ptr<char[]> data_ = std::make_unique<char[]>(kSize);
+    // Positions only grow, the offset is taken modulo kSize
+    alignas(64) std::atomic<uint64_t> head_{0};
+    alignas(64) std::atomic<uint64_t> tail_{0};
+  };
+
+  struct RingHandle {
+    Ring* ring = nullptr;
+    ~RingHandle() {
+      if (ring != nullptr) {
+        ring->retired.store(true, std::memory_order_release);
+      }
+    }
+  };
+
+  Logger() {
+    for (auto sink : {Sink::kStdout, Sink::kStderr}) {
+      colored_[Index(sink)] = isatty(fds_[Index(sink)]) == 1;
+    }
+    writer_ = std::thread([this] { Run(); });
+    std::atexit([] { Get().Stop(); });
+  }
+
+  static int Index(Sink sink) { return static_cast<int>(sink); }
+
+  static void WriteAll(int fd, std::string_view text) {
+    while (!text.empty()) {
+      auto n = write(fd, text.data(), text.size());
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return;
+      }
+      text.remove_prefix(n);
+    }
+  }
+
+  Ring& GetRing() {
+    thread_local RingHandle handle;
+    if (handle.ring == nullptr) {
+      std::lock_guard<std::mutex> lock(rings_mutex_);
+      for (auto& ring : rings_) {
+        if (ring->retired.load(std::memory_order_acquire) && ring->IsEmpty()) {
+          ring->retired = false;
+          handle.ring = ring.get();
+          break;
+        }
+      }
+      if (handle.ring == nullptr) {
+        handle.ring = rings_.emplace_back(std::make_unique<Ring>()).get();
+      }
+    }
+    return *handle.ring;
+  }
+
+  // Lines queued before the stop are written before anything direct
+  void WaitStopped() const {
+    while (!stopped_.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+
+  void Wake() {
+    if (!pending_.exchange(true)) {
+      wake_cv_.notify_one();
+    }
+  }
+
+  void Run() {
+    std::vector<Ring*> rings;
+    std::string batch;
+    int batch_fd = -1;
+    auto write_batch = [&] {
+      WriteAll(batch_fd, batch);
+      batch.clear();
+    };
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      auto ticket = flush_requested_;
+      bool stopping = stopping_;
+      lock.unlock();
+
+      pending_ = false;
+      {
+        std::lock_guard<std::mutex> rings_lock(rings_mutex_);
+        rings.clear();
+        for (auto& ring : rings_) {
+          rings.push_back(ring.get());
+        }
+      }
+      // Records of one thread stay in order, also across the two sinks
+      for (auto* ring : rings) {
+        ring->Drain([&](Sink sink, std::string_view text) {
+          int fd = fds_[Index(sink)];
+          if (fd != batch_fd || batch.size() >= Ring::kSize) {
+            write_batch();
+            batch_fd = fd;
+          }
+          batch.append(text);
+        });
+      }
+      write_batch();
+
+      lock.lock();
+      flushed_ = ticket;
+      flushed_cv_.notify_all();
+      if (stopping) {
+        return;
+      }
+      // A missed wake-up only delays the output by kIdleWait
+      wake_cv_.wait_for(lock, kIdleWait, [&] {
+        return pending_ || stopping_ || flush_requested_ != ticket;
+      });
+    }
+  }
+
+  // Pushes still in progress land in the rings before the writer drains
+  // them for the last time, so no line is lost
+  void Stop() {
+    direct_.store(true);
+    while (writers_.load() != 0) {
+      std::this_thread::yield();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_cv_.notify_one();
+    writer_.join();
+    stopped_.store(true, std::memory_order_release);
+  }
+
+  std::atomic<int> fds_[2] = {STDOUT_FILENO, STDERR_FILENO};
+  std::atomic<bool> colored_[2];
+
+  std::mutex rings_mutex_;
+  std::vector<std::unique_ptr<Ring>> rings_;
+
+  std::thread writer_;
+  std::atomic<bool> pending_{false};
+  // Writes in progress on the rings
+  std::atomic<int> writers_{0};
+  // Set when stopping, writes no longer go through the rings
+  std::atomic<bool> direct_{false};
+  // The writer is gone
+  std::atomic<bool> stopped_{false};
+  // Guard the fields below
+  std::mutex mutex_;
+  std::condition_variable wake_cv_;
+  std::condition_variable flushed_cv_;
+  uint64_t flush_requested_ = 0;
+  uint64_t flushed_ = 0;
+  bool stopping_ = false;
+};
+
+}  // namespace utils
+}  // namespace shuidb
@@ -16,15 +16,39 @@
 
 #pragma once
 
-#include <iostream>
+#include <chrono>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
-#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "utils/logger.hpp"
+#include "utils/string_utils.hpp"
+
+// PR levels above this are compiled out: 0 errors, 1 warnings, 2 info and
+// 3 debug, e.g. -DSHUIDB_LOG_LEVEL=3 keeps PR(DEBUG)
+#ifndef SHUIDB_LOG_LEVEL
+#define SHUIDB_LOG_LEVEL 2
+#endif
 
 #define PR(x) PR_##x
-#define PR_ERROR shuidb::utils::Print(std::cerr, shuidb::utils::Color::RED)
-#define PR_WARNING shuidb::utils::Print(std::cerr, shuidb::utils::Color::YELLOW)
-#define PR_INFO shuidb::utils::Print(std::cout, shuidb::utils::Color::CYAN)
-#define PR_RAW shuidb::utils::Print(std::cout, shuidb::utils::Color::RESET)
+#define PR_ERROR SHUIDB_PR(0, kStderr, RED)
+#define PR_WARNING SHUIDB_PR(1, kStderr, YELLOW)
+#define PR_INFO SHUIDB_PR(2, kStdout, CYAN)
+#define PR_DEBUG SHUIDB_PR(3, kStderr, BRIGHT_BLACK)
+// Command output rather than a log, always kept
+#define PR_RAW SHUIDB_PR(0, kStdout, RESET)
+// One expression rather than an if statement, so that an `else` after a
+// PR(...) << ...; belongs to the caller's if
+#define SHUIDB_PR(level, sink, color)                           \
+  ((level) > SHUIDB_LOG_LEVEL)                                  \
+      ? (void)0                                                 \
+      : shuidb::utils::Voidify() &                              \
+            shuidb::utils::Print(shuidb::utils::Sink::sink,     \
+                                 shuidb::utils::Color::color)
 
 namespace shuidb {
 namespace utils {
@@ -49,30 +73,141 @@ enum class Color {
   RESET
 };
 
+// Indexed by Color
+inline constexpr const char* kColorCodes[] = {
+    "\033[30m", "\033[31m", "\033[32m", "\033[33m", "\033[34m", "\033[35m",
+    "\033[36m", "\033[37m", "\033[90m", "\033[91m", "\033[92m", "\033[93m",
+    "\033[94m", "\033[95m", "\033[96m", "\033[97m", "\033[0m"};
+
+enum class OutputMode {
+  // Lines go to the Logger, colored where the sink is a terminal
+  kText,
+  // Plain lines kept until the running command is done, see Output::Take
+  kJson,
+};
+
+// Where PR output goes, set up once at startup
+class Output {
+ public:
+  struct Line {
+    Color color;
+    std::string text;
+  };
+
+  static Output& Get() {
+    static Output output;
+    return output;
+  }
+
+  OutputMode GetMode() const { return mode_; }
+  void SetMode(OutputMode mode) { mode_ = mode; }
+  void Add(Color color, std::string text) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lines_.push_back({color, std::move(text)});
+  }
+  // Lines added in JSON mode since the last call
+  std::vector<Line> Take() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::exchange(lines_, {});
+  }
+
+ private:
+  OutputMode mode_{OutputMode::kText};
+  std::mutex mutex_;
+  std::vector<Line> lines_;
+};
+
+// Streams reused by the lines of a thread, one per nesting level as the
+// operands of a line may print lines of their own
+struct LineStreams {
+  std::vector<std::unique_ptr<std::ostringstream>> streams;
+  std::size_t depth = 0;
+
+  static LineStreams& Get() {
+    thread_local LineStreams line_streams;
+    return line_streams;
+  }
+};
+
+// One line of output, handed to the Logger as a whole when destroyed
 struct Print {
  public:
-  Print(std::ostream& os, Color c) : os_(os), color_(c){};
+  Print(Sink sink, Color c)
+      : sink_(sink), color_(c), mode_(Output::Get().GetMode()) {
+    auto& line_streams = LineStreams::Get();
+    auto& streams = line_streams.streams;
+    if (line_streams.depth == streams.size()) {
+      streams.push_back(std::make_unique<std::ostringstream>());
+    }
+    line_ = streams[line_streams.depth++].get();
+    line_->str({});
+    line_->clear();
+    line_->flags(std::ios::dec | std::ios::skipws);
+    line_->fill(' ');
+    line_->precision(6);
+    colored_ = mode_ == OutputMode::kText && color_ != Color::RESET &&
+               Logger::Get().IsColored(sink_);
+    if (colored_) {
+      *line_ << kColorCodes[static_cast<int>(color_)];
+    }
+  };
   template <typename T>
   Print& operator<<(const T& x) {
-    os_ << color_codes[color_] << x << color_codes[Color::RESET];
+    *line_ << x;
     return *this;
   }
 
-  ~Print() { os_ << std::endl; }
+  ~Print() {
+    if (mode_ == OutputMode::kJson) {
+      Output::Get().Add(color_, line_->str());
+    } else {
+      if (colored_) {
+        *line_ << kColorCodes[static_cast<int>(Color::RESET)];
+      }
+      *line_ << '\n';
+      Logger::Get().Write(sink_, line_->view());
+    }
+    LineStreams::Get().depth--;
+  }
 
  private:
-  std::ostream& os_;
+  Sink sink_;
   Color color_;
-  std::unordered_map<Color, std::string> color_codes = {
-      {Color::BLACK, "\033[30m"},        {Color::RED, "\033[31m"},
-      {Color::GREEN, "\033[32m"},        {Color::YELLOW, "\033[33m"},
-      {Color::BLUE, "\033[34m"},         {Color::MAGENTA, "\033[35m"},
-      {Color::CYAN, "\033[36m"},         {Color::WHITE, "\033[37m"},
-      {Color::BRIGHT_BLACK, "\033[90m"}, {Color::BRIGHT_RED, "\033[91m"},
-      {Color::BRIGHT_GREEN, "\033[92m"}, {Color::BRIGHT_YELLOW, "\033[93m"},
-      {Color::BRIGHT_BLUE, "\033[94m"},  {Color::BRIGHT_MAGENTA, "\033[95m"},
-      {Color::BRIGHT_CYAN, "\033[96m"},  {Color::BRIGHT_WHITE, "\033[97m"},
-      {Color::RESET, "\033[0m"}};
+  OutputMode mode_;
+  bool colored_;
+  std::ostringstream* line_;
+};
+
+// {"command": ..., "ok": ..., "elapsed_us": ..., "output": [...],
+//  "warnings": [...], "errors": [...]} from the lines printed by a command,
+// split by color and ok when there is no error. One line, newline included
+inline std::string json_record(const std::string& command,
+                               const std::vector<Output::Line>& lines,
+                               std::chrono::steady_clock::duration elapsed) {
+  std::string output;
+  std::string warnings;
+  std::string errors;
+  for (const auto& line : lines) {
+    auto& field = line.color == Color::RED      ? errors
+                  : line.color == Color::YELLOW ? warnings
+                                                : output;
+    field += (field.empty() ? "" : ",") + json_quote(line.text);
+  }
+  auto us =
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+  std::ostringstream record;
+  record << "{\"command\":" << json_quote(command)
+         << ",\"ok\":" << (errors.empty() ? "true" : "false")
+         << ",\"elapsed_us\":" << us << ",\"output\":[" << output
+         << "],\"warnings\":[" << warnings << "],\"errors\":[" << errors
+         << "]}\n";
+  return record.str();
+}
+
+// Takes the whole `Print(...) << ...` chain, as & binds looser than <<, and
+// gives it the void type of the other branch of SHUIDB_PR
+struct Voidify {
+  void operator&(const Print&) {}
 };
 
 }  // namespace utils
@@ -16,13 +16,39 @@
 
 #pragma once
 
+#include <dirent.h>
+#include <limits.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <fstream>
 #include <iomanip>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
 namespace shuidb {
 namespace utils {
 
+// One line of /proc/<pid>/maps
+struct MemoryRegion {
+  std::uintptr_t start;
+  std::uintptr_t end;
+  std::string perms;
+  uint64_t offset;
+  std::string path;
+
+  bool IsReadable() const { return perms.size() > 0 && perms[0] == 'r'; }
+  bool IsWritable() const { return perms.size() > 1 && perms[1] == 'w'; }
+  bool IsExecutable() const { return perms.size() > 2 && perms[2] == 'x'; }
+  bool IsFileBacked() const { return !path.empty() && path[0] == '/'; }
+  bool Contains(std::uintptr_t addr) const {
+    return addr >= start && addr < end;
+  }
+  std::size_t Size() const { return end - start; }
+};
+
 inline std::intptr_t GetProcessLoadAddress(pid_t pid) {
   std::ifstream ifs("/proc/" + std::to_string(pid) + "/maps");
   std::string line;
@@ -31,5 +57,87 @@ inline std::intptr_t GetProcessLoadAddress(pid_t pid) {
   return addr;
 }
 
+inline std::vector<MemoryRegion> GetMemoryRegions(pid_t pid) {
+  std::vector<MemoryRegion> regions;
+  std::ifstream ifs("/proc/" + std::to_string(pid) + "/maps");
+  std::string line;
+  while (std::getline(ifs, line)) {
+    // e.g. `00400000-00452000 r-xp 00000000 08:02 173521 /usr/bin/dbus`
+    std::istringstream iss(line);
+    std::string range, dev, inode;
+    MemoryRegion region;
+    iss >> range >> region.perms >> std::hex >> region.offset >> dev >> inode;
+    std::getline(iss >> std::ws, region.path);
+    auto dash = range.find('-');
+    region.start = std::stoul(range.substr(0, dash), 0, 16);
+    region.end = std::stoul(range.substr(dash + 1), 0, 16);
+    regions.push_back(std::move(region));
+  }
+  return regions;
+}
+
+// Returns the region containing `addr` in a list sorted by address, as
+// produced by `GetMemoryRegions`
+inline const MemoryRegion* FindMemoryRegion(
+    const std::vector<MemoryRegion>& regions, std::uintptr_t addr) {
+  auto it = std::upper_bound(
+      regions.begin(), regions.end(), addr,
+      [](std::uintptr_t a, const MemoryRegion& r) { return a < r.end; });
+  if (it == regions.end() || !it->Contains(addr)) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+inline std::vector<pid_t> GetThreadIds(pid_t pid) {
+  std::vector<pid_t> tids;
+  auto task_path = "/proc/" + std::to_string(pid) + "/task";
+  DIR* dir = opendir(task_path.c_str());
+  if (dir == nullptr) {
+    return tids;
+  }
+  while (auto* entry = readdir(dir)) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+    tids.push_back(std::stoi(entry->d_name));
+  }
+  closedir(dir);
+  std::sort(tids.begin(), tids.end());
+  return tids;
+}
+
+// Name of a thread as set by prctl(PR_SET_NAME), empty when it is gone
+inline std::string GetThreadName(pid_t pid, pid_t tid) {
+  std::ifstream ifs("/proc/" + std::to_string(pid) + "/task/" +
+                    std::to_string(tid) + "/comm");
+  std::string name;
+  std::getline(ifs, name);
+  return name;
+}
+
+inline std::string GetProcessExe(pid_t pid) {
+  char buf[PATH_MAX];
+  auto exe_path = "/proc/" + std::to_string(pid) + "/exe";
+  auto len = readlink(exe_path.c_str(), buf, sizeof(buf) - 1);
+  if (len < 0) {
+    return "";
+  }
+  return std::string(buf, len);
+}
+
+// Value of an auxiliary vector entry, e.g. AT_ENTRY
+inline std::optional<uint64_t> GetAuxValue(pid_t pid, uint64_t type) {
+  std::ifstream ifs("/proc/" + std::to_string(pid) + "/auxv",
+                    std::ios::binary);
+  uint64_t entry[2];
+  while (ifs.read(reinterpret_cast<char*>(entry), sizeof(entry))) {
+    if (entry[0] == type) {
+      return entry[1];
+    }
+  }
+  return std::nullopt;
+}
+
 }  // namespace utils
-}  // namespace shuidb
\ No newline at end of file
+}  // namespace shuidb
@@ -16,6 +16,10 @@
 
 #pragma once
 
+#include <cstdint>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -57,5 +61,72 @@ inline std::string trim(const std::string &s) {
   return (wsback <= wsfront ? std::string() : std::string(wsfront, wsback));
 }
 
+// Quoted JSON string
+inline std::string json_quote(const std::string &s) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+  std::string quoted = "\"";
+  for (unsigned char c : s) {
+    switch (c) {
+      case '"':
+        quoted += "\\\"";
+        break;
+      case '\\':
+        quoted += "\\\\";
+        break;
+      case '\n':
+        quoted += "\\n";
+        break;
+      case '\t':
+        quoted += "\\t";
+        break;
+      default:
+        if (c < 0x20) {
+          quoted += "\\u00";
+          quoted += kDigits[c >> 4];
+          quoted += kDigits[c & 0xf];
+        } else {
+          quoted += c;
+        }
+    }
+  }
+  return quoted + "\"";
+}
+
+// e.g. 512ns, 1.50us, 20.00ms
+inline std::string format_duration(double ns) {
+  std::ostringstream oss;
+  if (ns < 1000) {
+    oss << static_cast<uint64_t>(ns) << "ns";
+    return oss.str();
+  }
+  constexpr const char *kUnits[] = {"us", "ms", "s"};
+  double value = ns / 1000;
+  std::size_t unit = 0;
+  while (value >= 1000 && unit + 1 < std::size(kUnits)) {
+    value /= 1000;
+    unit++;
+  }
+  oss << std::fixed << std::setprecision(2) << value << kUnits[unit];
+  return oss.str();
+}
+
+// e.g. 512B, 1.50KB, 20.00MB
+inline std::string format_bytes(uint64_t bytes) {
+  std::ostringstream oss;
+  if (bytes < 1024) {
+    oss << bytes << "B";
+    return oss.str();
+  }
+  constexpr const char *kUnits[] = {"KB", "MB", "GB", "TB"};
+  double value = bytes / 1024.0;
+  std::size_t unit = 0;
+  while (value >= 1024 && unit + 1 < std::size(kUnits)) {
+    value /= 1024;
+    unit++;
+  }
+  oss << std::fixed << std::setprecision(2) << value << kUnits[unit];
+  return oss.str();
+}
+
 }  // namespace utils
 }  // namespace shuidb
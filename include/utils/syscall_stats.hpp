@@ -0,0 +1,273 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace shuidb {
+namespace utils {
+
+enum class SyscallOp {
+  // PTRACE_PEEKDATA, PEEKTEXT and PEEKUSER
+  kPeek,
+  kPoke,
+  // Registers and siginfo
+  kGetRegs,
+  kSetRegs,
+  // PTRACE_CONT and the stepping requests
+  kResume,
+  kPtraceOther,
+  kWaitPid,
+  kVmRead,
+  kVmWrite,
+  // pwrite to /proc/<pid>/mem
+  kMemWrite,
+  // Not a syscall: from a stop to the end of its handling by the debugger
+  kStopHandling,
+  kCount,
+};
+
+// Indexed by SyscallOp
+inline constexpr const char* kSyscallOpNames[] = {
+    "peek",    "poke",    "get regs", "set regs",  "resume",       "ptrace",
+    "waitpid", "vm read", "vm write", "mem write", "stop handling"};
+
+// Calls, TSC cycles and bytes of the syscalls made on tracees, for the whole
+// process. Recording a call is a few relaxed atomic adds, the cycles are
+// only turned into time for a report
+class SyscallStats {
+ public:
+  static constexpr std::size_t kOps =
+      static_cast<std::size_t>(SyscallOp::kCount);
+  static constexpr std::size_t kBuckets = 40;
+
+  struct OpStats {
+    uint64_t calls = 0;
+    uint64_t cycles = 0;
+    uint64_t bytes = 0;
+    // Bucket i counts calls of [2^i, 2^(i+1)) cycles, the last one also
+    // the longer ones
+    std::array<uint64_t, kBuckets> histogram{};
+  };
+
+  struct Snapshot {
+    std::array<OpStats, kOps> ops;
+    // Syscalls of the commands done, not the running one
+    uint64_t commands = 0;
+    uint64_t command_syscalls = 0;
+    uint64_t max_command_syscalls = 0;
+    // Since the stats started
+    uint64_t cycles = 0;
+    double cycles_per_ns = 0;
+  };
+
+  static SyscallStats& Get() {
+    static SyscallStats stats;
+    return stats;
+  }
+
+  void Record(SyscallOp op, uint64_t cycles, uint64_t bytes = 0) {
+    auto& counter = counters_[static_cast<std::size_t>(op)];
+    counter.calls.fetch_add(1, std::memory_order_relaxed);
+    counter.cycles.fetch_add(cycles, std::memory_order_relaxed);
+    if (bytes != 0) {
+      counter.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    auto bucket = std::min<std::size_t>(
+        cycles == 0 ? 0 : std::bit_width(cycles) - 1, kBuckets - 1);
+    counter.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Called before every command, to count the syscalls per command
+  void StartCommand() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto syscalls = GetSyscalls();
+    if (commands_ > 0) {
+      auto last = syscalls - command_start_;
+      command_syscalls_ += last;
+      max_command_syscalls_ = std::max(max_command_syscalls_, last);
+    }
+    commands_++;
+    command_start_ = syscalls;
+  }
+
+  Snapshot Take() const {
+    Snapshot snapshot;
+    for (std::size_t i = 0; i < kOps; i++) {
+      const auto& counter = counters_[i];
+      auto& op = snapshot.ops[i];
+      op.calls = counter.calls.load(std::memory_order_relaxed);
+      op.cycles = counter.cycles.load(std::memory_order_relaxed);
+      op.bytes = counter.bytes.load(std::memory_order_relaxed);
+      for (std::size_t b = 0; b < kBuckets; b++) {
+        op.histogram[b] = counter.histogram[b].load(std::memory_order_relaxed);
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      snapshot.commands = commands_ > 0 ? commands_ - 1 : 0;
+      snapshot.command_syscalls = command_syscalls_;
+      snapshot.max_command_syscalls = max_command_syscalls_;
+    }
+    snapshot.cycles = __rdtsc() - start_cycles_;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start_time_)
+                  .count();
+    snapshot.cycles_per_ns = ns > 0 ? double(snapshot.cycles) / ns : 1;
+    return snapshot;
+  }
+
+  // Every call but the stop handling
+  uint64_t GetSyscalls() const {
+    uint64_t total = 0;
+    for (std::size_t i = 0; i < kOps; i++) {
+      if (i != static_cast<std::size_t>(SyscallOp::kStopHandling)) {
+        total += counters_[i].calls.load(std::memory_order_relaxed);
+      }
+    }
+    return total;
+  }
+
+ private:
+  struct Counter {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> cycles{0};
+    std::atomic<uint64_t> bytes{0};
+    std::array<std::atomic<uint64_t>, kBuckets> histogram{};
+  };
+
+  SyscallStats()
+      : start_cycles_(__rdtsc()),
+        start_time_(std::chrono::steady_clock::now()) {}
+
+  std::array<Counter, kOps> counters_;
+  // The TSC is calibrated against the clock over the whole session
+  uint64_t start_cycles_;
+  std::chrono::steady_clock::time_point start_time_;
+  mutable std::mutex mutex_;
+  uint64_t commands_{0};
+  uint64_t command_start_{0};
+  uint64_t command_syscalls_{0};
+  uint64_t max_command_syscalls_{0};
+};
+
+// Records the cycles spent in its scope as `op`
+class ScopedSyscallTimer {
+ public:
+  explicit ScopedSyscallTimer(SyscallOp op) : op_(op), start_(__rdtsc()) {}
+  ~ScopedSyscallTimer() {
+    SyscallStats::Get().Record(op_, __rdtsc() - start_);
+  }
+
+ private:
+  SyscallOp op_;
+  uint64_t start_;
+};
+
+inline SyscallOp GetPtraceOp(__ptrace_request request) {
+  switch (request) {
+    case PTRACE_PEEKDATA:
+    case PTRACE_PEEKTEXT:
+    case PTRACE_PEEKUSER:
+      return SyscallOp::kPeek;
+    case PTRACE_POKEDATA:
+    case PTRACE_POKETEXT:
+    case PTRACE_POKEUSER:
+      return SyscallOp::kPoke;
+    case PTRACE_GETREGS:
+    case PTRACE_GETFPREGS:
+    case PTRACE_GETREGSET:
+    case PTRACE_GETSIGINFO:
+      return SyscallOp::kGetRegs;
+    case PTRACE_SETREGS:
+    case PTRACE_SETFPREGS:
+    case PTRACE_SETREGSET:
+      return SyscallOp::kSetRegs;
+    case PTRACE_CONT:
+    case PTRACE_SINGLESTEP:
+    case PTRACE_SINGLEBLOCK:
+    case PTRACE_SYSCALL:
+      return SyscallOp::kResume;
+    default:
+      return SyscallOp::kPtraceOther;
+  }
+}
+
+// The calls below are the plain syscalls, counted in SyscallStats
+
+template <typename Addr, typename Data>
+long Ptrace(__ptrace_request request, pid_t pid, Addr addr, Data data) {
+  auto start = __rdtsc();
+  auto ret = ptrace(request, pid, addr, data);
+  auto op = GetPtraceOp(request);
+  bool word = op == SyscallOp::kPeek || op == SyscallOp::kPoke;
+  SyscallStats::Get().Record(op, __rdtsc() - start, word ? sizeof(long) : 0);
+  return ret;
+}
+
+inline pid_t WaitPid(pid_t pid, int* wait_status, int options) {
+  auto start = __rdtsc();
+  auto ret = waitpid(pid, wait_status, options);
+  SyscallStats::Get().Record(SyscallOp::kWaitPid, __rdtsc() - start);
+  return ret;
+}
+
+inline ssize_t ProcessVmReadv(pid_t pid, const iovec* local,
+                              unsigned long local_count, const iovec* remote,
+                              unsigned long remote_count) {
+  auto start = __rdtsc();
+  auto ret = process_vm_readv(pid, local, local_count, remote, remote_count, 0);
+  SyscallStats::Get().Record(SyscallOp::kVmRead, __rdtsc() - start,
+                             ret > 0 ? ret : 0);
+  return ret;
+}
+
+inline ssize_t ProcessVmWritev(pid_t pid, const iovec* local,
+                               unsigned long local_count, const iovec* remote,
+                               unsigned long remote_count) {
+  auto start = __rdtsc();
+  auto ret =
+      process_vm_writev(pid, local, local_count, remote, remote_count, 0);
+  SyscallStats::Get().Record(SyscallOp::kVmWrite, __rdtsc() - start,
+                             ret > 0 ? ret : 0);
+  return ret;
+}
+
+// To an open /proc/<pid>/mem
+inline ssize_t PwriteMemory(int fd, const void* buf, std::size_t len,
+                            uint64_t addr) {
+  auto start = __rdtsc();
+  auto ret = pwrite(fd, buf, len, addr);
+  SyscallStats::Get().Record(SyscallOp::kMemWrite, __rdtsc() - start,
+                             ret > 0 ? ret : 0);
+  return ret;
+}
+
+}  // namespace utils
+}  // namespace shuidb
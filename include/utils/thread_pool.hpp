@@ -0,0 +1,127 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace shuidb {
+namespace utils {
+
+// A fixed-size pool of worker threads.
+// NOTE: ptrace requests are only accepted from the tracing thread, so tasks
+// running on the pool must stick to process_vm_readv / offline data
+class ThreadPool {
+ public:
+  explicit ThreadPool(std::size_t num_threads = DefaultThreadCount()) {
+    num_threads = std::max<std::size_t>(num_threads, 1);
+    for (std::size_t i = 0; i < num_threads; i++) {
+      workers_.emplace_back([this] { WorkerLoop(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  static std::size_t DefaultThreadCount() {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  std::size_t Size() const { return workers_.size(); }
+
+  void Submit(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push(std::move(task));
+    }
+    cv_.notify_one();
+  }
+
+  // Runs `fn(i)` for every i in [0, count) on the pool and the calling thread,
+  // returns once all of them are done
+  template <typename Fn>
+  void ParallelFor(std::size_t count, Fn&& fn) {
+    if (count == 0) {
+      return;
+    }
+    std::atomic<std::size_t> next{0};
+    auto body = [&] {
+      std::size_t i;
+      while ((i = next.fetch_add(1)) < count) {
+        fn(i);
+      }
+    };
+    auto helpers = std::min(count - 1, workers_.size());
+    std::mutex finish_mutex;
+    std::condition_variable finish_cv;
+    std::size_t finished = 0;
+    for (std::size_t i = 0; i < helpers; i++) {
+      Submit([&] {
+        body();
+        std::lock_guard<std::mutex> lock(finish_mutex);
+        finished++;
+        finish_cv.notify_one();
+      });
+    }
+    body();
+    std::unique_lock<std::mutex> lock(finish_mutex);
+    finish_cv.wait(lock, [&] { return finished == helpers; });
+  }
+
+ private:
+  std::vector<std::thread> workers_;
+  std::queue<std::function<void()>> tasks_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_{false};
+
+  void WorkerLoop() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+        if (stopping_ && tasks_.empty()) {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop();
+      }
+      task();
+    }
+  }
+};
+
+}  // namespace utils
+}  // namespace shuidb
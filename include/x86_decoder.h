@@ -0,0 +1,110 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace shuidb {
+
+constexpr std::size_t kMaxInstructionLength = 15;
+
+enum class FlowType : uint8_t {
+  kSequential,
+  kJump,
+  kConditionalJump,
+  kIndirectJump,
+  kCall,
+  kIndirectCall,
+  kReturn,
+  kSyscall,
+  kInterrupt,
+  kHalt,
+};
+
+enum class OpcodeMap : uint8_t { kOneByte, k0F, k0F38, k0F3A, kX87 };
+
+struct Instruction {
+  std::uintptr_t address;
+  uint8_t length;
+  OpcodeMap map;
+  uint8_t opcode;
+
+  // Prefixes
+  uint8_t rex;
+  bool operand_size;  // 0x66, unless it selected an SSE variant
+  bool address_size;  // 0x67
+  bool lock;
+  bool rep;    // 0xf3, unless it selected an SSE variant
+  bool repne;  // 0xf2, unless it selected an SSE variant
+  // 0x66/0xf3/0xf2 when it selected an SSE variant (or came from VEX.pp)
+  uint8_t mandatory_prefix;
+  uint8_t segment;
+  // 0: legacy, 2/3: VEX, 4: EVEX
+  uint8_t vex_size;
+  // VEX/EVEX fields
+  uint8_t vex_vvvv;
+  uint8_t vex_l;
+  // EVEX R' (bit 0) and V' (bit 1), reaching registers 16-31
+  uint8_t evex_high;
+
+  bool has_modrm;
+  uint8_t modrm;
+  bool has_sib;
+  uint8_t sib;
+  uint8_t disp_offset;
+  uint8_t disp_size;
+  int32_t disp;
+  uint8_t imm_offset;
+  uint8_t imm_size;
+  int64_t imm;
+  // Second immediate of `enter`
+  uint8_t imm2;
+
+  FlowType flow;
+  // Memory operand addressed as [rip + disp32]
+  bool rip_relative;
+  // Destination of direct jumps and calls, or the effective address of a
+  // rip-relative memory operand
+  std::uintptr_t target;
+
+  // Decoder-internal description used by `Format`
+  const char* mnemonic;
+  std::array<uint8_t, 3> operands;
+
+  std::uintptr_t NextAddress() const { return address + length; }
+  bool IsBranch() const { return flow != FlowType::kSequential; }
+  bool HasDirectTarget() const {
+    return flow == FlowType::kJump || flow == FlowType::kConditionalJump ||
+           flow == FlowType::kCall;
+  }
+};
+
+// Table-driven x86-64 decoder. Decoding only fills in the instruction layout
+// and never allocates, formatting to text is a separate step
+class X86Decoder {
+ public:
+  // Returns false on invalid or truncated encodings
+  static bool Decode(const uint8_t* code, std::size_t len,
+                     std::uintptr_t address, Instruction& insn);
+  // Intel syntax, e.g. `mov qword ptr [rbp-0x8], rdi`
+  static std::string Format(const Instruction& insn);
+};
+
+}  // namespace shuidb
@@ -17,16 +17,27 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <cerrno>
+#include <chrono>
 #include <csignal>
-#include <iostream>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <optional>
 #include <ranges>
 
 #include "debugger.h"
+#include "gdb_server.h"
 #include "linenoise.h"
+#include "memory_search.h"
 #include "type_def.h"
 #include "utils/fs_utils.hpp"
+#include "utils/logger.hpp"
 #include "utils/output_utils.hpp"
+#include "utils/ps_utils.hpp"
 #include "utils/string_utils.hpp"
+#include "utils/syscall_stats.hpp"
 
 using namespace shuidb;
 
@@ -116,19 +127,232 @@ void handle_command(Debugger& dbg, const std::string& line) {
   auto args = utils::split(line, ' ');
   auto command = args[0];
 
-  if (utils::starts_with(command, "c")) {
+  if (command == "set-env" || command == "unset-env") {
+    // set-env NAME=value, unset-env NAME
+    if (args.size() < 2) {
+      PR(ERROR) << "Variable not specified";
+      return;
+    }
+    auto options = dbg.GetLaunchOptions();
+    if (!options.env.has_value()) {
+      options.env.emplace();
+      for (auto** var = environ; *var != nullptr; var++) {
+        options.env->push_back(*var);
+      }
+    }
+    auto name = args[1].substr(0, args[1].find('='));
+    std::erase_if(options.env.value(), [&](const std::string& var) {
+      return var.substr(0, var.find('=')) == name;
+    });
+    if (command == "set-env") {
+      options.env->push_back(args[1].find('=') == std::string::npos
+                                 ? args[1] + "="
+                                 : args[1]);
+    }
+    dbg.SetLaunchOptions(options);
+  } else if (command == "cd") {
+    auto options = dbg.GetLaunchOptions();
+    options.cwd = args.size() > 1 ? args[1] : "";
+    dbg.SetLaunchOptions(options);
+  } else if (command == "checkpoint") {
+    // checkpoint [list | delete <n>]
+    if (args.size() == 1) {
+      dbg.AddCheckpoint();
+    } else if (args[1] == "list") {
+      dbg.ShowCheckpoints();
+    } else if (args[1] == "delete" && args.size() > 2) {
+      dbg.RemoveCheckpoint(std::stoul(args[2]));
+    } else {
+      PR(ERROR) << "Usage: checkpoint [list | delete <n>]";
+    }
+  } else if (command == "restart") {
+    if (args.size() < 2) {
+      PR(ERROR) << "Checkpoint number not specified";
+      return;
+    }
+    dbg.Restart(std::stoul(args[1]));
+  } else if (command == "reverse-continue" || command == "rc") {
+    dbg.ReverseContinue();
+  } else if (command == "coverage") {
+    // coverage [start [blocks] [module...] | stop | save <prefix>]
+    auto sub = args.size() > 1 ? args[1] : "";
+    if (sub.empty()) {
+      dbg.ShowCoverage();
+    } else if (sub == "start") {
+      bool blocks = args.size() > 2 && args[2] == "blocks";
+      std::vector<std::string> modules(args.begin() + (blocks ? 3 : 2),
+                                       args.end());
+      dbg.StartCoverage(blocks, modules);
+    } else if (sub == "stop") {
+      dbg.StopCoverage();
+    } else if (sub == "save" && args.size() > 2) {
+      dbg.SaveCoverage(args[2]);
+    } else {
+      PR(ERROR) << "Usage: coverage [start [blocks] [module...] | stop | "
+                   "save <prefix>]";
+    }
+  } else if (command == "event-trace") {
+    // event-trace <file> [max segments] | stop
+    if (args.size() < 2) {
+      PR(ERROR) << "Usage: event-trace <file> [max segments] | stop";
+    } else if (args[1] == "stop") {
+      dbg.StopEventTrace();
+    } else {
+      dbg.StartEventTrace(args[1], args.size() > 2 ? std::stoul(args[2]) : 0);
+    }
+  } else if (command == "call" || utils::starts_with(command, "call(")) {
+    // call <function>[(<arg>, ...)]
+    auto rest = utils::trim(line.substr(4));
+    auto open = rest.find('(');
+    std::vector<std::string> call_args;
+    if (open != std::string::npos) {
+      auto close = rest.rfind(')');
+      auto inner = utils::trim(rest.substr(
+          open + 1, close == std::string::npos || close < open
+                        ? std::string::npos
+                        : close - open - 1));
+      if (!inner.empty()) {
+        for (const auto& arg : utils::split(inner, ',')) {
+          call_args.push_back(utils::trim(arg));
+        }
+      }
+    }
+    auto function = utils::trim(rest.substr(0, open));
+    if (function.empty()) {
+      PR(ERROR) << "Usage: call <function>(<args...>)";
+      return;
+    }
+    dbg.CallFunction(function, call_args);
+  } else if (utils::starts_with(command, "c")) {
     dbg.ContinueExecution();
   } else if (utils::starts_with(command, "q") ||
              utils::starts_with(command, "exit")) {
     dbg.Quit();
+  } else if (command == "bt" || command == "backtrace") {
+    dbg.Backtrace();
+  } else if (command == "snapshot-stacks") {
+    dbg.SnapshotStacks();
+  } else if (command == "deadlock") {
+    dbg.DetectDeadlocks();
+  } else if (command == "disas" || command == "disassemble") {
+    // disas [addr|symbol] [count]
+    std::size_t count = 10;
+    if (args.size() > 2) {
+      count = std::stoul(args[2]);
+    }
+    dbg.Disassemble(args.size() > 1 ? args[1] : "", count);
+  } else if (utils::starts_with(command, "display")) {
+    // display[/<n>] [expr], the expression is the rest of the line
+    auto expr = utils::trim(line.substr(line.find("display") + 7));
+    if (expr.empty()) {
+      dbg.ShowDisplays();
+    } else {
+      dbg.AddDisplay(expr);
+    }
+  } else if (command == "x" || utils::starts_with(command, "x/")) {
+    // x[/<n>] <expr>, 64 bytes by default
+    std::size_t count = command.size() > 2 ? std::stoul(command.substr(2)) : 64;
+    auto expr = utils::trim(line.substr(line.find(command) + command.size()));
+    if (expr.empty()) {
+      PR(ERROR) << "Address not specified";
+      return;
+    }
+    dbg.ExamineMemory(expr, count);
+  } else if (command == "undisplay") {
+    if (args.size() < 2) {
+      PR(ERROR) << "Display number not specified";
+      return;
+    }
+    dbg.RemoveDisplay(std::stoul(args[1]));
+  } else if (command == "find") {
+    // find [/b|/w|/s] <pattern> [range], a pattern with spaces is quoted
+    auto rest = utils::trim(line.substr(line.find("find") + 4));
+    char kind = 's';
+    if (rest.size() >= 2 && rest[0] == '/') {
+      kind = rest[1];
+      rest = utils::trim(rest.substr(2));
+    }
+    std::string text;
+    auto end = rest.find(' ');
+    if (utils::starts_with(rest, "\"")) {
+      end = rest.find('"', 1);
+      text = rest.substr(1, end == std::string::npos ? end : end - 1);
+      end = end == std::string::npos ? end : end + 1;
+    } else {
+      text = rest.substr(0, end);
+    }
+    auto range = end < rest.size() ? utils::trim(rest.substr(end)) : "";
+    auto pattern = MemorySearch::ParsePattern(kind, text);
+    if (!pattern.has_value()) {
+      PR(ERROR) << "Usage: find [/b|/w|/s] <pattern> [start-end|mapping]";
+      return;
+    }
+    dbg.FindMemory(pattern.value(), range);
+  } else if (command == "gcore") {
+    dbg.GenerateCore(args.size() > 1 ? args[1]
+                                     : "core." + std::to_string(dbg.GetPid()));
+  } else if (command == "heap") {
+    // heap [n], the n largest allocations, 10 by default
+    dbg.ShowHeap(args.size() > 1 ? std::stoul(args[1]) : 10);
+  } else if (command == "stats") {
+    dbg.ShowStats();
+  } else if (command == "snapshot") {
+    if (args.size() == 3 && args[1] == "save") {
+      dbg.SaveSnapshot(args[2]);
+    } else if (args.size() == 4 && args[1] == "diff") {
+      dbg.DiffSnapshots(args[2], args[3]);
+    } else if (args.size() == 3 && args[1] == "restore") {
+      dbg.RestoreSnapshot(args[2]);
+    } else {
+      PR(ERROR) << "Usage: snapshot save <name> | diff <a> <b> | "
+                   "restore <name>";
+    }
+  } else if (command == "fuzz") {
+    // fuzz <snapshot> <buffer> <inputs> [rounds] [$size]
+    std::size_t rounds = 1;
+    std::string size_reg;
+    for (std::size_t i = 4; i < args.size(); i++) {
+      if (utils::starts_with(args[i], "$")) {
+        size_reg = args[i];
+      } else {
+        rounds = std::stoul(args[i]);
+      }
+    }
+    if (args.size() < 4) {
+      PR(ERROR) << "Usage: fuzz <snapshot> <buffer> <inputs> [rounds] "
+                   "[$size]";
+      return;
+    }
+    dbg.Fuzz(args[1], args[2], args[3], rounds, size_reg);
+  } else if (command == "si" || command == "stepi") {
+    dbg.StepInstruction();
+  } else if (command == "ni" || command == "nexti") {
+    dbg.NextInstruction();
+  } else if (command == "s" || command == "step") {
+    dbg.Step();
+  } else if (command == "n" || command == "next") {
+    dbg.Next();
+  } else if (command == "finish") {
+    dbg.Finish();
+  } else if (command == "record-trace" || command == "trace-dump") {
+    // record-trace <file> [max_stops], trace-dump <file> [count]
+    if (args.size() < 2) {
+      PR(ERROR) << "Trace file not specified";
+      return;
+    }
+    if (command == "record-trace") {
+      dbg.RecordTrace(args[1],
+                      args.size() > 2 ? std::stoul(args[2]) : 1000000);
+    } else {
+      dbg.DumpTrace(args[1], args.size() > 2 ? std::stoul(args[2]) : 100);
+    }
   } else if (utils::starts_with(command, "b")) {
+    // b <hex address | symbol[+offset]>
     if (args.size() < 2) {
       PR(ERROR) << "Address not specified";
       return;
     }
-    std::string addr_str = args[1];
-    auto addr = std::stol(addr_str, 0, 16);
-    dbg.SetBreakPointAtAddress(addr);
+    dbg.SetBreakPoint(args[1]);
   } else if (utils::starts_with(command, "reg")) {
     // `views::drop(1)` is used to drop the first element for the range view
     handle_reg_command(dbg, args | std::views::drop(1));
@@ -137,6 +361,10 @@ void handle_command(Debugger& dbg, const std::string& line) {
       auto info_name = utils::trim(args[1]);
       if (info_name == "reg") {
         handle_reg_command(dbg, args | std::views::drop(2));
+      } else if (info_name == "b" || info_name == "break") {
+        dbg.ShowBreakPoints();
+      } else if (info_name == "threads") {
+        dbg.ShowThreads();
       } else {
         PR(ERROR) << "Unknown info name";
       }
@@ -145,20 +373,121 @@ void handle_command(Debugger& dbg, const std::string& line) {
     }
   } else if (utils::starts_with(command, "r") ||
              utils::starts_with(command, "run")) {
-    // TODO: Currently, it will break at the entry point of the program
+    // r [args...] [<in] [>out] [2>err], kept for the following runs
+    if (args.size() > 1) {
+      auto options = dbg.GetLaunchOptions();
+      options.args.clear();
+      options.stdin_path.clear();
+      options.stdout_path.clear();
+      options.stderr_path.clear();
+      for (std::size_t i = 1; i < args.size(); i++) {
+        std::string* redirect = nullptr;
+        std::string arg = args[i];
+        for (auto [prefix, path] :
+             {std::pair{"2>", &options.stderr_path},
+              std::pair{">", &options.stdout_path},
+              std::pair{"<", &options.stdin_path}}) {
+          if (utils::starts_with(arg, prefix)) {
+            redirect = path;
+            arg = arg.substr(std::string(prefix).size());
+            break;
+          }
+        }
+        if (redirect == nullptr) {
+          options.args.push_back(arg);
+        } else if (!arg.empty()) {
+          *redirect = arg;
+        } else if (i + 1 < args.size()) {
+          *redirect = args[++i];
+        }
+      }
+      dbg.SetLaunchOptions(options);
+    }
     dbg.RunProc();
   } else if (utils::starts_with(command, "h")) {
     PR(INFO) << "Commands:";
     PR(INFO) << "c: continue";
     PR(INFO) << "q: quit";
-    PR(INFO) << "r: run";
-    PR(INFO) << "b <addr>: set breakpoint at address <addr>";
+    PR(INFO) << "r [args...] [<in] [>out] [2>err]: run to the entry point, "
+                "arguments and redirections are kept for later runs";
+    PR(INFO) << "set-env <name>=<value> / unset-env <name>: environment of "
+                "later runs";
+    PR(INFO) << "cd [dir]: working directory of later runs";
+    PR(INFO) << "b <addr | symbol[+offset]>: set a breakpoint, kept for "
+                "later runs";
+    PR(INFO) << "info b: list breakpoints";
     PR(INFO) << "reg / info reg: dump registers";
+    PR(INFO) << "bt: backtrace of the current thread";
+    PR(INFO) << "info threads: threads and where they are";
+    PR(INFO) << "x[/<n>] <expr>: hexdump <n> bytes at an address, 64 by "
+                "default";
+    PR(INFO) << "snapshot-stacks: backtraces of all threads, grouped";
+    PR(INFO) << "deadlock: find lock cycles between threads";
+    PR(INFO) << "disas [addr|symbol] [count]: disassemble, at pc by default";
+    PR(INFO) << "si / ni: step one instruction, ni steps over calls";
+    PR(INFO) << "s / n: step one source line, n steps over calls";
+    PR(INFO) << "finish: run until the current function returns";
+    PR(INFO) << "record-trace <file> [max_stops]: record a branch trace";
+    PR(INFO) << "trace-dump <file> [count]: replay a recorded trace";
+    PR(INFO) << "coverage start [blocks] [module...]: one-shot breakpoints "
+                "at functions or blocks";
+    PR(INFO) << "coverage [stop | save <prefix>]: show, stop or save coverage";
+    PR(INFO) << "event-trace <file> [max segments] | stop: record every "
+                "stop to a binary file, see shuidb-trace";
+    PR(INFO) << "stats: memory cache hit rate, syscall counts and latency";
+    PR(INFO) << "heap [n]: glibc malloc arenas, size classes, fragmentation "
+                "and the n largest allocations";
+    PR(INFO) << "find [/b|/w|/s] <pattern> [start-end|mapping]: search memory "
+                "for hex bytes, a 64-bit word or a string";
+    PR(INFO) << "display [/<n> | *]<expr>: show a register, word or <n> "
+                "bytes at every stop";
+    PR(INFO) << "undisplay <number>: stop showing a display";
+    PR(INFO) << "snapshot save <name>: copy the writable memory";
+    PR(INFO) << "snapshot diff <a> <b>: ranges changed between snapshots";
+    PR(INFO) << "snapshot restore <name>: rewind registers and memory";
+    PR(INFO) << "fuzz <snapshot> <buffer> <inputs> [rounds] [$size]: run "
+                "each input file from the snapshot to the next stop";
+    PR(INFO) << "call <function>(<args...>): call a function with integer "
+                "or pointer arguments";
+    PR(INFO) << "gcore [file]: write an ELF core, core.<pid> by default";
+    PR(INFO) << "checkpoint [list | delete <n>]: fork a frozen copy of the "
+                "process";
+    PR(INFO) << "restart <n>: switch to a fresh copy of checkpoint n";
+    PR(INFO) << "reverse-continue / rc: go back to the previous breakpoint "
+                "hit";
   } else {
     PR(ERROR) << "Unknown command";
   }
 }
 
+// The record of the lines printed by a command since the last one
+void write_record(const std::string& command,
+                  std::chrono::steady_clock::duration elapsed) {
+  auto record =
+      utils::json_record(command, utils::Output::Get().Take(), elapsed);
+  utils::Logger::Get().Write(utils::Sink::kStdout, record);
+}
+
+void run_command(Debugger& dbg, const std::string& line) {
+  utils::SyscallStats::Get().StartCommand();
+  auto start = std::chrono::steady_clock::now();
+  try {
+    handle_command(dbg, line);
+  } catch (const std::exception& e) {
+    PR(ERROR) << "Command failed: " << e.what();
+  }
+  switch (utils::Output::Get().GetMode()) {
+    case utils::OutputMode::kText:
+      // Before the prompt, and before the program prints anything of its own
+      utils::Logger::Get().Flush();
+      break;
+    case utils::OutputMode::kJson:
+      write_record(line, std::chrono::steady_clock::now() - start);
+      utils::Logger::Get().Flush();
+      break;
+  }
+}
+
 int main(int argc, char** argv) {
   signal(SIGINT, handle_signal_quit);
   signal(SIGTERM, handle_signal_quit);
@@ -168,18 +497,129 @@ int main(int argc, char** argv) {
     return -1;
   }
 
-  PR(INFO) << "Starting shuidb";
+  // One-shot modes, e.g. `shuidb --snapshot-stacks <pid>` dumps grouped stacks
+  // of a running process and leaves it running
+  std::string mode = argv[1];
+  if (mode == "--snapshot-stacks" || mode == "--deadlock") {
+    char* end = nullptr;
+    errno = 0;
+    long pid = argc < 3 ? 0 : std::strtol(argv[2], &end, 10);
+    if (argc < 3 || *end != '\0' || errno != 0 || pid <= 0 ||
+        pid > std::numeric_limits<pid_t>::max()) {
+      PR(ERROR) << "Usage: shuidb " << mode << " <pid>";
+      return -1;
+    }
+    Debugger dbg(utils::GetProcessExe(pid), pid);
+    auto status = mode == "--deadlock" ? dbg.DetectDeadlocks()
+                                       : dbg.SnapshotStacks();
+    return status == StatusType::kSuccess ? 0 : -1;
+  }
 
-  auto prog = argv[1];
+  // `shuidb --gdbserver <socket | stdio> <prog> [args...]` serves the program
+  // over the GDB remote protocol instead of the prompt
+  if (mode == "--gdbserver") {
+    if (argc < 4 || !utils::file_exists(argv[3])) {
+      PR(ERROR) << "Usage: shuidb --gdbserver <unix socket | stdio> "
+                   "<program> [args...]";
+      return -1;
+    }
+    std::string channel = argv[2];
+    bool stdio = channel == "stdio";
+    LaunchOptions options;
+    options.args.assign(argv + 4, argv + argc);
+    if (stdio) {
+      // The protocol owns stdin and stdout
+      utils::Logger::Get().Redirect(utils::Sink::kStdout, STDERR_FILENO);
+      options.stdin_path = "/dev/null";
+      options.stdout_path = "/dev/stderr";
+    }
+    signal(SIGPIPE, SIG_IGN);
+    Debugger dbg(argv[3]);
+    dbg.SetLaunchOptions(options);
+    dbg.RunProc();
+    GdbServer server(dbg);
+    auto status = stdio ? server.Serve(STDIN_FILENO, STDOUT_FILENO)
+                        : server.ServeUnixSocket(channel);
+    return status == StatusType::kSuccess ? 0 : -1;
+  }
+
+  // Options before the program:
+  //   --core <core>: inspect a core until a process is run
+  //   -ex <command>: run a command first, repeatable
+  //   --batch <script>: run the commands of a script, then exit
+  //   --json: print one JSON record per command
+  std::string core;
+  std::vector<std::string> commands;
+  bool batch = false;
+  bool json = false;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-'; i++) {
+    std::string option = argv[i];
+    if (option == "--json") {
+      json = true;
+    } else if (i + 1 == argc) {
+      PR(ERROR) << "Missing argument to " << option;
+      return -1;
+    } else if (option == "--core") {
+      core = argv[++i];
+    } else if (option == "-ex") {
+      commands.push_back(argv[++i]);
+    } else if (option == "--batch") {
+      batch = true;
+      auto script = utils::read_script(argv[++i]);
+      if (!script.has_value()) {
+        PR(ERROR) << "Cannot read " << argv[i];
+        return -1;
+      }
+      commands.insert(commands.end(), script->begin(), script->end());
+    } else {
+      PR(ERROR) << "Unknown option " << option;
+      return -1;
+    }
+  }
+  if (i == argc) {
+    PR(ERROR) << "Usage: shuidb [--core <core file>] [--batch <script>] "
+                 "[-ex <command>]... [--json] <program>";
+    return -1;
+  }
+  auto prog = argv[i];
   if (!utils::file_exists(prog)) {
     PR(ERROR) << "File " << prog << " does not exist";
     return -1;
   }
 
+  if (json) {
+    utils::Output::Get().SetMode(utils::OutputMode::kJson);
+  } else if (!batch) {
+    PR(INFO) << "Starting shuidb";
+  }
+
   Debugger dbg(prog);
+  if (json) {
+    // Records own stdout, the program writes to stderr unless redirected
+    auto options = dbg.GetLaunchOptions();
+    options.stdout_path = "/dev/stderr";
+    dbg.SetLaunchOptions(options);
+  }
+  if (!core.empty()) {
+    auto status = dbg.LoadCore(core);
+    if (json) {
+      write_record("--core " + core, {});
+    }
+    if (status != StatusType::kSuccess) {
+      return -1;
+    }
+  }
+  for (const auto& command : commands) {
+    run_command(dbg, command);
+  }
+  if (batch) {
+    return 0;
+  }
+  utils::Logger::Get().Flush();
   char* line = nullptr;
   while ((line = linenoise("shuidb> ")) != nullptr) {
-    handle_command(dbg, line);
+    run_command(dbg, line);
     linenoiseHistoryAdd(line);
     linenoiseFree(line);
   }
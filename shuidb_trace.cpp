@@ -0,0 +1,151 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "event_trace.h"
+#include "utils/output_utils.hpp"
+#include "utils/string_utils.hpp"
+
+using namespace shuidb;
+
+namespace {
+
+void print_histogram(const std::string& title,
+                     const std::array<std::size_t, 64>& buckets) {
+  constexpr std::size_t kBarWidth = 40;
+  auto max = *std::max_element(buckets.begin(), buckets.end());
+  if (max == 0) {
+    return;
+  }
+  PR(INFO) << title << ":";
+  for (std::size_t i = 0; i < buckets.size(); i++) {
+    if (buckets[i] == 0) {
+      continue;
+    }
+    std::string range = "[" +
+                        utils::format_duration(i == 0 ? 0 : 1UL << i) +
+                        ", " + utils::format_duration(2UL << i) + ")";
+    PR(RAW) << "  " << std::left << std::setw(22) << range << std::right
+            << std::setw(10) << buckets[i] << " "
+            << std::string((buckets[i] * kBarWidth + max - 1) / max, '#');
+  }
+}
+
+void print_summary(const EventTraceReader& reader, std::size_t slowest) {
+  auto summary = reader.Summarize(slowest);
+  PR(INFO) << summary.records << " stops over "
+           << utils::format_duration(summary.duration_ns);
+  std::string types;
+  for (const auto& [type, count] : summary.types) {
+    types += (types.empty() ? "" : ", ") +
+             std::string(GetEventTypeName(type)) + " " +
+             std::to_string(count);
+  }
+  PR(RAW) << "  " << types;
+
+  if (!summary.hits.empty()) {
+    std::vector<std::pair<uint64_t, std::size_t>> hits(summary.hits.begin(),
+                                                       summary.hits.end());
+    std::stable_sort(hits.begin(), hits.end(), [](auto& a, auto& b) {
+      return a.second > b.second;
+    });
+    PR(INFO) << "Breakpoint hits:";
+    for (const auto& [pc, count] : hits) {
+      PR(RAW) << "  0x" << std::hex << pc << std::dec << " " << count;
+    }
+  }
+  if (!summary.threads.empty()) {
+    PR(INFO) << "Threads:";
+    for (const auto& [tid, span] : summary.threads) {
+      std::string line = "  " + std::to_string(tid);
+      if (span.created_ns.has_value()) {
+        line += " created at " + utils::format_duration(*span.created_ns);
+      }
+      if (span.exited_ns.has_value()) {
+        line += std::string(span.created_ns.has_value() ? "," : "") +
+                " exited at " + utils::format_duration(*span.exited_ns);
+      }
+      if (span.created_ns.has_value() && span.exited_ns.has_value()) {
+        line += ", lived " + utils::format_duration(*span.exited_ns -
+                                                    *span.created_ns);
+      }
+      PR(RAW) << line;
+    }
+  }
+  print_histogram("Time between stops", summary.inter_arrival);
+  print_histogram("Time to stop after a resume", summary.latency);
+  if (!summary.slowest.empty()) {
+    PR(INFO) << "Slowest stops:";
+    for (const auto& record : summary.slowest) {
+      PR(RAW) << "  " << std::left << std::setw(10)
+              << utils::format_duration(record.latency_ns) << std::right << " "
+              << GetEventTypeName(record.type) << " at 0x" << std::hex
+              << record.pc << std::dec << ", thread " << record.tid << ", "
+              << utils::format_duration(record.time_ns) << " into the trace";
+    }
+  }
+}
+
+}  // namespace
+
+// shuidb-trace <trace> [--slowest <n>] [--chrome <json>]: summarizes a trace
+// written by `event-trace`, or converts it for chrome://tracing and Perfetto
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    PR(ERROR) << "Usage: shuidb-trace <trace> [--slowest <n>] "
+                 "[--chrome <json>]";
+    return -1;
+  }
+  std::size_t slowest = 10;
+  std::string chrome;
+  for (int i = 2; i < argc; i++) {
+    std::string option = argv[i];
+    if (i + 1 == argc) {
+      PR(ERROR) << "Missing argument to " << option;
+      return -1;
+    } else if (option == "--slowest") {
+      slowest = std::stoul(argv[++i]);
+    } else if (option == "--chrome") {
+      chrome = argv[++i];
+    } else {
+      PR(ERROR) << "Unknown option " << option;
+      return -1;
+    }
+  }
+
+  auto reader = EventTraceReader::Open(argv[1]);
+  if (reader == nullptr) {
+    PR(ERROR) << "Cannot read trace " << argv[1];
+    return -1;
+  }
+  if (chrome.empty()) {
+    print_summary(*reader, slowest);
+    return 0;
+  }
+  std::ofstream ofs(chrome);
+  reader->WriteChromeTrace(ofs);
+  if (!ofs) {
+    PR(ERROR) << "Cannot write " << chrome;
+    return -1;
+  }
+  PR(INFO) << "Wrote " << reader->GetRecords().size() << " stops to " << chrome;
+  return 0;
+}
@@ -0,0 +1,361 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "branch_trace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <span>
+#include <unordered_map>
+
+namespace shuidb {
+
+namespace {
+
+constexpr char kTraceMagic[8] = {'S', 'H', 'U', 'I', 'T', 'R', 'C', '\0'};
+constexpr uint32_t kTraceVersion = 1;
+// The file grows by at least this much at a time
+constexpr std::size_t kGrowSize = 1 << 20;
+// Longest straight-line path followed between two stops, guards against
+// replaying garbage when the trace does not match the files on disk
+constexpr std::size_t kMaxBlockLength = 1 << 16;
+
+std::size_t PutVarint(uint8_t* out, uint64_t value) {
+  std::size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = static_cast<uint8_t>(value) | 0x80;
+    value >>= 7;
+  }
+  out[n++] = static_cast<uint8_t>(value);
+  return n;
+}
+
+bool GetVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 64 && p < end; shift += 7) {
+    auto byte = *p++;
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Small deltas of either sign stay short
+uint64_t ZigZag(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+int64_t UnZigZag(uint64_t value) {
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Read-only view of a module file, unmapped on destruction
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      auto* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        data_ = static_cast<const uint8_t*>(data);
+        size_ = st.st_size;
+      }
+    }
+    close(fd);
+  }
+  ~MappedFile() {
+    if (data_ != nullptr) {
+      munmap(const_cast<uint8_t*>(data_), size_);
+    }
+  }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  std::span<const uint8_t> GetData() const { return {data_, size_}; }
+
+ private:
+  const uint8_t* data_{nullptr};
+  std::size_t size_{0};
+};
+
+}  // namespace
+
+TraceWriter::~TraceWriter() {
+  if (fd_ >= 0) {
+    Close({}, 0);
+  }
+}
+
+bool TraceWriter::Open(const std::string& path, std::uintptr_t start_pc) {
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    return false;
+  }
+  size_ = sizeof(TraceHeader);
+  count_ = 0;
+  last_pc_ = start_pc;
+  if (!Reserve(0)) {
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  TraceHeader header{};
+  std::memcpy(header.magic, kTraceMagic, sizeof(header.magic));
+  header.version = kTraceVersion;
+  header.start_pc = start_pc;
+  std::memcpy(data_, &header, sizeof(header));
+  return true;
+}
+
+bool TraceWriter::Reserve(std::size_t len) {
+  if (size_ + len <= capacity_) {
+    return true;
+  }
+  auto capacity = std::max(capacity_ * 2, size_ + len + kGrowSize);
+  if (ftruncate(fd_, capacity) != 0) {
+    return false;
+  }
+  void* data;
+  if (data_ == nullptr) {
+    data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  } else {
+    data = mremap(data_, capacity_, capacity, MREMAP_MAYMOVE);
+  }
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  data_ = static_cast<uint8_t*>(data);
+  capacity_ = capacity;
+  return true;
+}
+
+bool TraceWriter::Append(std::uintptr_t pc) {
+  // A 64-bit varint takes at most 10 bytes
+  if (!Reserve(10)) {
+    return false;
+  }
+  auto delta = static_cast<int64_t>(pc - last_pc_);
+  size_ += PutVarint(data_ + size_, ZigZag(delta));
+  last_pc_ = pc;
+  count_++;
+  return true;
+}
+
+bool TraceWriter::Close(const std::vector<TraceModule>& modules,
+                        uint32_t flags) {
+  if (fd_ < 0) {
+    return false;
+  }
+  bool ok = data_ != nullptr;
+  auto modules_offset = size_;
+  for (const auto& module : modules) {
+    if (!ok || !Reserve(3 * sizeof(uint64_t) + 10 + module.path.size())) {
+      ok = false;
+      break;
+    }
+    for (uint64_t value : {module.start, module.end, module.offset}) {
+      std::memcpy(data_ + size_, &value, sizeof(value));
+      size_ += sizeof(value);
+    }
+    size_ += PutVarint(data_ + size_, module.path.size());
+    std::memcpy(data_ + size_, module.path.data(), module.path.size());
+    size_ += module.path.size();
+  }
+
+  if (ok) {
+    TraceHeader header;
+    std::memcpy(&header, data_, sizeof(header));
+    header.flags = flags;
+    header.count = count_;
+    header.modules_offset = modules_offset;
+    header.modules_count = modules.size();
+    std::memcpy(data_, &header, sizeof(header));
+  }
+  if (data_ != nullptr) {
+    munmap(data_, capacity_);
+  }
+  ok = ok && ftruncate(fd_, size_) == 0;
+  close(fd_);
+  fd_ = -1;
+  data_ = nullptr;
+  capacity_ = 0;
+  return ok;
+}
+
+std::size_t TraceWriter::GetCount() const { return count_; }
+
+std::size_t TraceWriter::GetSize() const { return size_; }
+
+std::shared_ptr<TraceReader> TraceReader::Open(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(TraceHeader)) {
+    close(fd);
+    return nullptr;
+  }
+  auto* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+
+  std::shared_ptr<TraceReader> reader(
+      new TraceReader(static_cast<const uint8_t*>(data), st.st_size));
+  if (!reader->Parse()) {
+    return nullptr;
+  }
+  return reader;
+}
+
+TraceReader::~TraceReader() { munmap(const_cast<uint8_t*>(data_), size_); }
+
+bool TraceReader::Parse() {
+  std::memcpy(&header_, data_, sizeof(header_));
+  if (std::memcmp(header_.magic, kTraceMagic, sizeof(kTraceMagic)) != 0 ||
+      header_.version != kTraceVersion ||
+      header_.modules_offset < sizeof(TraceHeader) ||
+      header_.modules_offset > size_) {
+    return false;
+  }
+
+  const auto* p = data_ + header_.modules_offset;
+  const auto* end = data_ + size_;
+  for (uint64_t i = 0; i < header_.modules_count; i++) {
+    TraceModule module;
+    uint64_t values[3];
+    uint64_t len;
+    if (end - p < (std::ptrdiff_t)sizeof(values)) {
+      return false;
+    }
+    std::memcpy(values, p, sizeof(values));
+    p += sizeof(values);
+    if (!GetVarint(p, end, len) || len > static_cast<uint64_t>(end - p)) {
+      return false;
+    }
+    module.start = values[0];
+    module.end = values[1];
+    module.offset = values[2];
+    module.path.assign(reinterpret_cast<const char*>(p), len);
+    p += len;
+    modules_.push_back(std::move(module));
+  }
+  std::sort(modules_.begin(), modules_.end(),
+            [](const TraceModule& a, const TraceModule& b) {
+              return a.start < b.start;
+            });
+  return true;
+}
+
+const TraceHeader& TraceReader::GetHeader() const { return header_; }
+
+const std::vector<TraceModule>& TraceReader::GetModules() const {
+  return modules_;
+}
+
+std::vector<std::uintptr_t> TraceReader::GetStops() const {
+  std::vector<std::uintptr_t> stops;
+  stops.reserve(header_.count);
+  const auto* p = data_ + sizeof(TraceHeader);
+  const auto* end = data_ + header_.modules_offset;
+  std::uintptr_t pc = header_.start_pc;
+  uint64_t value;
+  while (stops.size() < header_.count && GetVarint(p, end, value)) {
+    pc += UnZigZag(value);
+    stops.push_back(pc);
+  }
+  return stops;
+}
+
+std::size_t TraceReader::Replay(
+    const std::function<bool(const Instruction&)>& fn) const {
+  std::unordered_map<std::string, std::unique_ptr<MappedFile>> files;
+  // Code at `addr` as found in the module files, nullptr if unknown
+  auto code_at = [&](std::uintptr_t addr, std::size_t& len) -> const uint8_t* {
+    auto it = std::upper_bound(
+        modules_.begin(), modules_.end(), addr,
+        [](std::uintptr_t a, const TraceModule& m) { return a < m.end; });
+    if (it == modules_.end() || addr < it->start) {
+      return nullptr;
+    }
+    auto& file = files[it->path];
+    if (file == nullptr) {
+      file = std::make_unique<MappedFile>(it->path);
+    }
+    auto data = file->GetData();
+    auto offset = it->offset + (addr - it->start);
+    if (offset >= data.size()) {
+      return nullptr;
+    }
+    len = std::min<std::size_t>(data.size() - offset, it->end - addr);
+    return data.data() + offset;
+  };
+
+  bool block_step = header_.flags & kTraceBlockStep;
+  std::size_t visited = 0;
+  std::uintptr_t pc = header_.start_pc;
+  for (auto stop : GetStops()) {
+    auto cur = pc;
+    pc = stop;
+    // Without block stepping every stop is one instruction further
+    auto max_length = block_step ? kMaxBlockLength : 1;
+    for (std::size_t n = 0; n < max_length; n++) {
+      std::size_t len = 0;
+      const auto* code = code_at(cur, len);
+      Instruction insn;
+      if (code == nullptr || !X86Decoder::Decode(code, len, cur, insn)) {
+        break;
+      }
+      visited++;
+      if (!fn(insn)) {
+        return visited;
+      }
+      // Walk on past not-taken conditional jumps, until the branch which
+      // led to the stop
+      auto flow = insn.flow;
+      if (flow == FlowType::kConditionalJump) {
+        if (insn.target == stop) {
+          break;
+        }
+      } else if (flow == FlowType::kSyscall || flow == FlowType::kInterrupt) {
+        // The kernel reports a step after returning to user space
+        if (insn.NextAddress() == stop) {
+          break;
+        }
+      } else if (flow != FlowType::kSequential) {
+        break;
+      }
+      cur = insn.NextAddress();
+    }
+  }
+  return visited;
+}
+
+}  // namespace shuidb
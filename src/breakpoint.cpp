@@ -17,27 +17,422 @@
 #include "breakpoint.h"
 
 #include <sys/ptrace.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <numeric>
+
+#include "memory_operator.h"
+#include "utils/syscall_stats.hpp"
 
 namespace shuidb {
 
-void BreakPoint::Enable() {
-  std::lock_guard<std::mutex> lock(mutex_);
-
-  auto data = ptrace(PTRACE_PEEKDATA, pid_, addr_, nullptr);
-  original_data_ = data & 0xff;
-  uint64_t int3 = 0xcc;
-  uint64_t data_with_int3 = ((data & ~0xff) | int3);
-  ptrace(PTRACE_POKEDATA, pid_, addr_, data_with_int3);
-  enabled_ = true;
-};
-
-void BreakPoint::Disable() {
-  std::lock_guard<std::mutex> lock(mutex_);
-
-  auto data = ptrace(PTRACE_PEEKDATA, pid_, addr_, nullptr);
-  auto restored_data = ((data & ~0xff) | original_data_);
-  ptrace(PTRACE_POKEDATA, pid_, addr_, restored_data);
-  enabled_ = false;
-};
+namespace {
+
+constexpr std::intptr_t kPageMask = ~static_cast<std::intptr_t>(4095);
+constexpr std::size_t kMinSlots = 64;
+
+// Calls `patch(i, byte)` for the byte at each of the sorted, unique `addrs`,
+// after one scatter read of the part of each page they span, and writes the
+// spans back
+template <typename Patch>
+bool PatchPages(pid_t pid, const std::vector<std::intptr_t>& addrs,
+                std::vector<uint8_t>& buffer, Patch patch) {
+  std::vector<iovec> local, remote;
+  std::size_t total = 0;
+  for (std::size_t i = 0; i < addrs.size();) {
+    auto page = addrs[i] & kPageMask;
+    auto j = i;
+    while (j < addrs.size() && (addrs[j] & kPageMask) == page) {
+      j++;
+    }
+    auto len = static_cast<std::size_t>(addrs[j - 1] - addrs[i] + 1);
+    remote.push_back({reinterpret_cast<void*>(addrs[i]), len});
+    total += len;
+    i = j;
+  }
+  buffer.resize(total);
+  auto* data = buffer.data();
+  for (auto& range : remote) {
+    local.push_back({data, range.iov_len});
+    data += range.iov_len;
+  }
+  if (MemoryOperator::ReadMemoryV(pid, local, remote) != total) {
+    return false;
+  }
+
+  std::size_t i = 0;
+  for (const auto& range : local) {
+    auto* bytes = static_cast<uint8_t*>(range.iov_base);
+    auto begin = addrs[i];
+    for (; i < addrs.size() &&
+           addrs[i] < begin + static_cast<std::intptr_t>(range.iov_len);
+         i++) {
+      patch(i, bytes[addrs[i] - begin]);
+    }
+  }
+  return MemoryOperator::WriteMemoryV(pid, local, remote) == total;
+}
+
+}  // namespace
+
+void BreakPointTable::Reset(pid_t pid) {
+  pid_ = pid;
+  slots_.clear();
+  shift_ = 64;
+  addrs_.clear();
+  original_data_.clear();
+  enabled_.clear();
+  hit_counts_.clear();
+  condition_ids_.clear();
+}
+
+std::size_t BreakPointTable::Slot(std::intptr_t addr) const {
+  // Fibonacci hashing, code addresses differ mostly in their low bits
+  return (static_cast<uint64_t>(addr) * 0x9e3779b97f4a7c15ull) >> shift_;
+}
+
+void BreakPointTable::Rehash(std::size_t capacity) {
+  slots_.assign(capacity, 0);
+  shift_ = 64 - __builtin_ctzll(capacity);
+  auto mask = capacity - 1;
+  for (uint32_t i = 0; i < addrs_.size(); i++) {
+    auto slot = Slot(addrs_[i]);
+    while (slots_[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    slots_[slot] = i + 1;
+  }
+}
+
+uint32_t BreakPointTable::Find(std::intptr_t addr) const {
+  if (slots_.empty()) {
+    return kNotFound;
+  }
+  auto mask = slots_.size() - 1;
+  for (auto slot = Slot(addr); slots_[slot] != 0; slot = (slot + 1) & mask) {
+    auto index = slots_[slot] - 1;
+    if (addrs_[index] == addr) {
+      return index;
+    }
+  }
+  return kNotFound;
+}
+
+uint32_t BreakPointTable::Add(std::intptr_t addr) {
+  auto index = Find(addr);
+  if (index != kNotFound) {
+    return index;
+  }
+  index = addrs_.size();
+  addrs_.push_back(addr);
+  original_data_.push_back(0);
+  enabled_.push_back(0);
+  hit_counts_.push_back(0);
+  condition_ids_.push_back(0);
+  if (addrs_.size() * 2 > slots_.size()) {
+    Rehash(std::max(kMinSlots, slots_.size() * 2));
+  } else {
+    auto mask = slots_.size() - 1;
+    auto slot = Slot(addr);
+    while (slots_[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    slots_[slot] = index + 1;
+  }
+  return index;
+}
+
+void BreakPointTable::Remove(uint32_t index) {
+  Disable(index);
+  auto mask = slots_.size() - 1;
+  auto slot_of = [&](uint32_t i) {
+    auto slot = Slot(addrs_[i]);
+    while (slots_[slot] != i + 1) {
+      slot = (slot + 1) & mask;
+    }
+    return slot;
+  };
+
+  // Backward-shift deletion keeps every probe sequence unbroken
+  auto hole = slot_of(index);
+  for (auto next = (hole + 1) & mask; slots_[next] != 0;
+       next = (next + 1) & mask) {
+    auto home = Slot(addrs_[slots_[next] - 1]);
+    if (((next - home) & mask) >= ((next - hole) & mask)) {
+      slots_[hole] = slots_[next];
+      hole = next;
+    }
+  }
+  slots_[hole] = 0;
+
+  auto last = static_cast<uint32_t>(addrs_.size() - 1);
+  if (index != last) {
+    slots_[slot_of(last)] = index + 1;
+    addrs_[index] = addrs_[last];
+    original_data_[index] = original_data_[last];
+    enabled_[index] = enabled_[last];
+    hit_counts_[index] = hit_counts_[last];
+    condition_ids_[index] = condition_ids_[last];
+  }
+  addrs_.pop_back();
+  original_data_.pop_back();
+  enabled_.pop_back();
+  hit_counts_.pop_back();
+  condition_ids_.pop_back();
+}
+
+bool BreakPointTable::Enable(uint32_t index) {
+  if (enabled_[index]) {
+    return true;
+  }
+  errno = 0;
+  auto data = utils::Ptrace(PTRACE_PEEKDATA, pid_, addrs_[index], nullptr);
+  if (errno != 0) {
+    return false;
+  }
+  original_data_[index] = data & 0xff;
+  uint64_t data_with_int3 = ((data & ~0xff) | 0xcc);
+  if (utils::Ptrace(PTRACE_POKEDATA, pid_, addrs_[index], data_with_int3) ==
+      -1) {
+    return false;
+  }
+  enabled_[index] = 1;
+  return true;
+}
+
+bool BreakPointTable::Disable(uint32_t index) {
+  if (!enabled_[index]) {
+    return true;
+  }
+  errno = 0;
+  auto data = utils::Ptrace(PTRACE_PEEKDATA, pid_, addrs_[index], nullptr);
+  if (errno != 0) {
+    return false;
+  }
+  auto restored_data = ((data & ~0xff) | original_data_[index]);
+  if (utils::Ptrace(PTRACE_POKEDATA, pid_, addrs_[index], restored_data) ==
+      -1) {
+    return false;
+  }
+  enabled_[index] = 0;
+  return true;
+}
+
+bool BreakPointTable::SetEnabled(const std::vector<uint32_t>& indices,
+                                 bool enabled) {
+  std::vector<uint32_t> changed;
+  for (auto index : indices) {
+    if (IsEnabled(index) != enabled) {
+      changed.push_back(index);
+    }
+  }
+  std::sort(changed.begin(), changed.end(), [this](uint32_t a, uint32_t b) {
+    return addrs_[a] < addrs_[b];
+  });
+  changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+  std::vector<std::intptr_t> addrs;
+  for (auto index : changed) {
+    addrs.push_back(addrs_[index]);
+  }
+
+  bool ok = PatchPages(pid_, addrs, buffer_, [&](std::size_t i, uint8_t& byte) {
+    auto index = changed[i];
+    if (enabled) {
+      original_data_[index] = byte;
+      byte = 0xcc;
+    } else {
+      byte = original_data_[index];
+    }
+  });
+  if (ok) {
+    for (auto index : changed) {
+      enabled_[index] = enabled;
+    }
+  }
+  return ok;
+}
+
+bool BreakPointTable::Reinstall(pid_t pid) {
+  pid_ = pid;
+  std::vector<uint32_t> order(addrs_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    return addrs_[a] < addrs_[b];
+  });
+  std::vector<std::intptr_t> addrs;
+  for (auto index : order) {
+    addrs.push_back(addrs_[index]);
+  }
+  return PatchPages(pid_, addrs, buffer_, [&](std::size_t i, uint8_t& byte) {
+    auto index = order[i];
+    if (IsEnabled(index)) {
+      byte = 0xcc;
+    } else if (byte == 0xcc) {
+      // Enabled when the fork was taken, the original byte is still known
+      byte = original_data_[index];
+    }
+  });
+}
+
+const std::vector<std::intptr_t>& BreakPointTable::GetAddresses() const {
+  return addrs_;
+}
+
+std::size_t BreakPointTable::Size() const { return addrs_.size(); }
+
+void BreakPointSet::Reset(pid_t pid) {
+  pid_ = pid;
+  installed_ = false;
+  addrs_.clear();
+  original_data_.clear();
+}
+
+void BreakPointSet::Add(std::intptr_t addr) { addrs_.push_back(addr); }
+
+bool BreakPointSet::Install() {
+  if (installed_) {
+    return true;
+  }
+  std::sort(addrs_.begin(), addrs_.end());
+  addrs_.erase(std::unique(addrs_.begin(), addrs_.end()), addrs_.end());
+  original_data_.resize(addrs_.size());
+  installed_ = PatchPages(pid_, addrs_, buffer_,
+                          [this](std::size_t i, uint8_t& byte) {
+                            original_data_[i] = byte;
+                            byte = 0xcc;
+                          });
+  return installed_;
+}
+
+bool BreakPointSet::Remove() {
+  if (!installed_) {
+    return true;
+  }
+  installed_ = !PatchPages(
+      pid_, addrs_, buffer_,
+      [this](std::size_t i, uint8_t& byte) { byte = original_data_[i]; });
+  return !installed_;
+}
+
+bool BreakPointSet::Contains(std::intptr_t addr) const {
+  if (installed_) {
+    return std::binary_search(addrs_.begin(), addrs_.end(), addr);
+  }
+  return std::find(addrs_.begin(), addrs_.end(), addr) != addrs_.end();
+}
+
+bool BreakPointSet::IsInstalled() const { return installed_; }
+
+std::size_t BreakPointSet::Size() const { return addrs_.size(); }
+
+void OneShotBreakPointSet::Reset(pid_t pid) {
+  pid_ = pid;
+  installed_ = false;
+  addrs_.clear();
+  original_data_.clear();
+  hit_bits_.clear();
+  hit_count_ = 0;
+}
+
+void OneShotBreakPointSet::Add(std::intptr_t addr) { addrs_.push_back(addr); }
+
+bool OneShotBreakPointSet::Install() {
+  if (installed_) {
+    return true;
+  }
+  std::sort(addrs_.begin(), addrs_.end());
+  addrs_.erase(std::unique(addrs_.begin(), addrs_.end()), addrs_.end());
+  original_data_.resize(addrs_.size());
+  hit_bits_.assign((addrs_.size() + 63) / 64, 0);
+  hit_count_ = 0;
+  installed_ = PatchPages(pid_, addrs_, buffer_,
+                          [this](std::size_t i, uint8_t& byte) {
+                            original_data_[i] = byte;
+                            byte = 0xcc;
+                          });
+  return installed_;
+}
+
+bool OneShotBreakPointSet::Hit(std::intptr_t addr, pid_t tid) {
+  auto index = Find(addr);
+  if (index == kNotFound || !IsPending(index)) {
+    return false;
+  }
+  // The other threads may be running
+  if (tid == 0) {
+    tid = pid_;
+  }
+  errno = 0;
+  auto data = utils::Ptrace(PTRACE_PEEKDATA, tid, addr, nullptr);
+  if (errno != 0) {
+    return false;
+  }
+  auto restored_data = ((data & ~0xff) | original_data_[index]);
+  if (utils::Ptrace(PTRACE_POKEDATA, tid, addr, restored_data) == -1) {
+    return false;
+  }
+  hit_bits_[index / 64] |= uint64_t{1} << (index % 64);
+  hit_count_++;
+  return true;
+}
+
+bool OneShotBreakPointSet::Remove() {
+  if (!installed_) {
+    return true;
+  }
+  std::vector<std::intptr_t> pending;
+  std::vector<uint8_t> original_data;
+  for (std::size_t i = 0; i < addrs_.size(); i++) {
+    if (!IsHit(i)) {
+      pending.push_back(addrs_[i]);
+      original_data.push_back(original_data_[i]);
+    }
+  }
+  installed_ = !PatchPages(pid_, pending, buffer_,
+                           [&](std::size_t i, uint8_t& byte) {
+                             byte = original_data[i];
+                           });
+  return !installed_;
+}
+
+bool OneShotBreakPointSet::Reinstall(pid_t pid) {
+  pid_ = pid;
+  // Never installed, the fork has no sites either
+  if (original_data_.size() != addrs_.size()) {
+    return true;
+  }
+  return PatchPages(pid_, addrs_, buffer_,
+                    [this](std::size_t i, uint8_t& byte) {
+                      byte = IsPending(i) ? 0xcc : original_data_[i];
+                    });
+}
+
+std::size_t OneShotBreakPointSet::Find(std::intptr_t addr) const {
+  auto it = std::lower_bound(addrs_.begin(), addrs_.end(), addr);
+  if (!installed_ || it == addrs_.end() || *it != addr) {
+    return kNotFound;
+  }
+  return it - addrs_.begin();
+}
+
+bool OneShotBreakPointSet::IsInstalled() const { return installed_; }
+
+bool OneShotBreakPointSet::IsPending(std::size_t index) const {
+  return installed_ && !IsHit(index);
+}
+
+const std::vector<std::intptr_t>& OneShotBreakPointSet::GetAddresses() const {
+  return addrs_;
+}
+
+const std::vector<uint64_t>& OneShotBreakPointSet::GetHitBits() const {
+  return hit_bits_;
+}
+
+std::size_t OneShotBreakPointSet::GetHitCount() const { return hit_count_; }
+
+std::size_t OneShotBreakPointSet::Size() const { return addrs_.size(); }
 
 }  // namespace shuidb
\ No newline at end of file
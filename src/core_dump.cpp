@@ -0,0 +1,394 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "core_dump.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/procfs.h>
+#include <sys/ptrace.h>
+#include <sys/uio.h>
+#include <sys/user.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "memory_operator.h"
+#include "utils/syscall_stats.hpp"
+
+namespace shuidb {
+
+namespace {
+
+constexpr std::size_t kPageSize = 4096;
+// Room for the XSAVE area of any CPU so far
+constexpr std::size_t kMaxXstateSize = 16384;
+// /proc/<pid>/pagemap entry bits
+constexpr uint64_t kPagePresent = 1ull << 63;
+constexpr uint64_t kPageSwapped = 1ull << 62;
+constexpr uint64_t kPageFile = 1ull << 61;
+
+struct Segment {
+  const utils::MemoryRegion* region;
+  std::size_t offset;
+  std::size_t filesz;
+};
+
+struct Chunk {
+  std::uintptr_t addr;
+  std::size_t len;
+  std::size_t offset;
+  // Pages never touched read as zeros and need no read
+  bool anonymous;
+};
+
+std::size_t AlignUp(std::size_t value, std::size_t align) {
+  return (value + align - 1) / align * align;
+}
+
+void AppendNote(std::vector<uint8_t>& notes, const char* name, uint32_t type,
+                const void* desc, std::size_t size) {
+  Elf64_Nhdr header{static_cast<Elf64_Word>(std::strlen(name) + 1),
+                    static_cast<Elf64_Word>(size), type};
+  auto append = [&](const void* data, std::size_t len) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    notes.insert(notes.end(), bytes, bytes + len);
+    notes.resize(AlignUp(notes.size(), 4));
+  };
+  append(&header, sizeof(header));
+  append(name, header.n_namesz);
+  append(desc, size);
+}
+
+std::string ReadProcFile(pid_t pid, const char* name) {
+  std::ifstream ifs("/proc/" + std::to_string(pid) + "/" + name,
+                    std::ios::binary);
+  return {std::istreambuf_iterator<char>(ifs),
+          std::istreambuf_iterator<char>()};
+}
+
+pid_t GetParentPid(pid_t pid) {
+  // `pid (comm) state ppid ...`, comm may contain anything
+  auto stat = ReadProcFile(pid, "stat");
+  auto paren = stat.rfind(')');
+  if (paren == std::string::npos || paren + 4 >= stat.size()) {
+    return 0;
+  }
+  return std::atoi(stat.c_str() + paren + 4);
+}
+
+bool IsZero(const uint8_t* data, std::size_t len) {
+  return data[0] == 0 && std::memcmp(data, data + 1, len - 1) == 0;
+}
+
+// Private file pages the process wrote to turned anonymous
+bool IsModified(int pagemap, const utils::MemoryRegion& region) {
+  std::vector<uint64_t> entries(region.Size() / kPageSize);
+  auto bytes = entries.size() * sizeof(uint64_t);
+  if (pread(pagemap, entries.data(), bytes,
+            region.start / kPageSize * sizeof(uint64_t)) != (ssize_t)bytes) {
+    return true;
+  }
+  return std::any_of(entries.begin(), entries.end(), [](uint64_t entry) {
+    return (entry & kPageSwapped) != 0 ||
+           (entry & (kPagePresent | kPageFile)) == kPagePresent;
+  });
+}
+
+bool PWriteAll(int fd, const uint8_t* data, std::size_t len,
+               std::size_t offset) {
+  while (len > 0) {
+    auto n = pwrite(fd, data, len, offset);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    len -= n;
+    offset += n;
+  }
+  return true;
+}
+
+bool AppendThreadNotes(std::vector<uint8_t>& notes, pid_t pid, pid_t tid,
+                       int signal, bool main_thread,
+                       const std::vector<uint8_t>& process_notes) {
+  user_regs_struct regs;
+  user_fpregs_struct fpregs;
+  if (utils::Ptrace(PTRACE_GETREGS, tid, nullptr, &regs) < 0 ||
+      utils::Ptrace(PTRACE_GETFPREGS, tid, nullptr, &fpregs) < 0) {
+    return false;
+  }
+  elf_prstatus status{};
+  status.pr_info.si_signo = signal;
+  status.pr_cursig = signal;
+  status.pr_pid = tid;
+  status.pr_ppid = GetParentPid(pid);
+  status.pr_pgrp = getpgid(pid);
+  status.pr_sid = getsid(pid);
+  static_assert(sizeof(status.pr_reg) == sizeof(regs));
+  std::memcpy(&status.pr_reg, &regs, sizeof(regs));
+  status.pr_fpvalid = 1;
+  AppendNote(notes, "CORE", NT_PRSTATUS, &status, sizeof(status));
+  // The kernel puts the process notes right after the first NT_PRSTATUS
+  if (main_thread) {
+    notes.insert(notes.end(), process_notes.begin(), process_notes.end());
+  }
+  AppendNote(notes, "CORE", NT_PRFPREG, &fpregs, sizeof(fpregs));
+
+  std::vector<uint8_t> xstate(kMaxXstateSize);
+  iovec iov{xstate.data(), xstate.size()};
+  if (utils::Ptrace(PTRACE_GETREGSET, tid, NT_X86_XSTATE, &iov) == 0) {
+    AppendNote(notes, "LINUX", NT_X86_XSTATE, xstate.data(), iov.iov_len);
+  }
+  return true;
+}
+
+std::vector<uint8_t> BuildProcessNotes(
+    pid_t pid, const std::vector<utils::MemoryRegion>& regions) {
+  std::vector<uint8_t> notes;
+  elf_prpsinfo info{};
+  info.pr_sname = 't';
+  info.pr_state = 4;
+  info.pr_pid = pid;
+  info.pr_ppid = GetParentPid(pid);
+  info.pr_pgrp = getpgid(pid);
+  info.pr_sid = getsid(pid);
+  auto comm = ReadProcFile(pid, "comm");
+  if (!comm.empty() && comm.back() == '\n') {
+    comm.pop_back();
+  }
+  std::strncpy(info.pr_fname, comm.c_str(), sizeof(info.pr_fname) - 1);
+  auto args = ReadProcFile(pid, "cmdline");
+  std::replace(args.begin(), args.end(), '\0', ' ');
+  std::strncpy(info.pr_psargs, args.c_str(), sizeof(info.pr_psargs) - 1);
+  AppendNote(notes, "CORE", NT_PRPSINFO, &info, sizeof(info));
+
+  auto auxv = ReadProcFile(pid, "auxv");
+  AppendNote(notes, "CORE", NT_AUXV, auxv.data(), auxv.size());
+
+  // count, page size, {start, end, offset in pages} each, then the names
+  std::vector<uint64_t> files{0, kPageSize};
+  std::string names;
+  for (const auto& region : regions) {
+    if (region.IsFileBacked()) {
+      files.insert(files.end(),
+                   {region.start, region.end, region.offset / kPageSize});
+      names += region.path;
+      names += '\0';
+      files[0]++;
+    }
+  }
+  std::vector<uint8_t> desc(files.size() * sizeof(uint64_t));
+  std::memcpy(desc.data(), files.data(), desc.size());
+  desc.insert(desc.end(), names.begin(), names.end());
+  AppendNote(notes, "CORE", NT_FILE, desc.data(), desc.size());
+  return notes;
+}
+
+}  // namespace
+
+std::optional<CoreDumpStats> CoreDump::Write(
+    const std::string& path, pid_t pid, const std::vector<pid_t>& threads,
+    const std::vector<utils::MemoryRegion>& regions,
+    const std::vector<std::pair<std::uintptr_t, uint8_t>>& patches,
+    int signal, utils::ThreadPool& pool) {
+  auto pagemap_path = "/proc/" + std::to_string(pid) + "/pagemap";
+  int pagemap = open(pagemap_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (pagemap < 0) {
+    return std::nullopt;
+  }
+  CoreDumpStats stats{threads.size(), 0, 0, 0, 0};
+
+  std::vector<uint8_t> notes;
+  auto process_notes = BuildProcessNotes(pid, regions);
+  for (std::size_t i = 0; i < threads.size(); i++) {
+    if (!AppendThreadNotes(notes, pid, threads[i], i == 0 ? signal : 0,
+                           i == 0, process_notes)) {
+      close(pagemap);
+      return std::nullopt;
+    }
+  }
+
+  // Headers and notes, then the segments at page aligned offsets
+  std::vector<Segment> segments;
+  for (const auto& region : regions) {
+    if (region.path == "[vsyscall]") {
+      continue;
+    }
+    std::size_t filesz = region.Size();
+    bool private_file = region.IsFileBacked() && region.perms.size() > 3 &&
+                        region.perms[3] == 'p';
+    if (!region.IsReadable() || region.path == "[vvar]") {
+      filesz = 0;
+    } else if (private_file && !IsModified(pagemap, region)) {
+      // Enough for a debugger to find the build ID
+      filesz = region.offset == 0 ? kPageSize : 0;
+    }
+    segments.push_back({&region, 0, filesz});
+  }
+  auto notes_offset =
+      sizeof(Elf64_Ehdr) + (segments.size() + 1) * sizeof(Elf64_Phdr);
+  auto offset = AlignUp(notes_offset + notes.size(), kPageSize);
+  std::vector<Chunk> chunks;
+  for (auto& segment : segments) {
+    segment.offset = offset;
+    const auto& region = *segment.region;
+    for (std::size_t done = 0; done < segment.filesz; done += kChunkSize) {
+      chunks.push_back({region.start + done,
+                        std::min(kChunkSize, segment.filesz - done),
+                        offset + done, !region.IsFileBacked()});
+    }
+    offset += segment.filesz;
+    stats.memory_bytes += segment.filesz;
+  }
+  stats.segments = segments.size();
+  stats.file_size = offset;
+
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    close(pagemap);
+    return std::nullopt;
+  }
+  // Whatever is not written stays a hole
+  bool ok = ftruncate(fd, offset) == 0;
+
+  Elf64_Ehdr ehdr{};
+  std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+  ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_ident[EI_OSABI] = ELFOSABI_NONE;
+  ehdr.e_type = ET_CORE;
+  ehdr.e_machine = EM_X86_64;
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_phoff = sizeof(Elf64_Ehdr);
+  ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+  ehdr.e_phentsize = sizeof(Elf64_Phdr);
+  ehdr.e_phnum = static_cast<Elf64_Half>(segments.size() + 1);
+  std::vector<Elf64_Phdr> phdrs;
+  phdrs.push_back({PT_NOTE, 0, notes_offset, 0, 0, notes.size(), 0, 4});
+  for (const auto& segment : segments) {
+    const auto& region = *segment.region;
+    Elf64_Word flags = (region.IsReadable() ? PF_R : 0) |
+                       (region.IsWritable() ? PF_W : 0) |
+                       (region.IsExecutable() ? PF_X : 0);
+    phdrs.push_back({PT_LOAD, flags, segment.offset, region.start, 0,
+                     segment.filesz, region.Size(), kPageSize});
+  }
+  std::vector<uint8_t> header(notes_offset);
+  std::memcpy(header.data(), &ehdr, sizeof(ehdr));
+  std::memcpy(header.data() + sizeof(ehdr), phdrs.data(),
+              phdrs.size() * sizeof(Elf64_Phdr));
+  header.insert(header.end(), notes.begin(), notes.end());
+  ok = ok && PWriteAll(fd, header.data(), header.size(), 0);
+
+  std::atomic<std::size_t> written{0};
+  std::atomic<bool> failed{false};
+  pool.ParallelFor(chunks.size(), [&](std::size_t i) {
+    thread_local std::vector<uint8_t> buffer;
+    thread_local std::vector<uint64_t> entries;
+    thread_local std::vector<iovec> local, remote;
+    const auto& chunk = chunks[i];
+    auto pages = chunk.len / kPageSize;
+    entries.assign(pages, kPagePresent);
+    if (chunk.anonymous) {
+      auto bytes = pages * sizeof(uint64_t);
+      if (pread(pagemap, entries.data(), bytes,
+                chunk.addr / kPageSize * sizeof(uint64_t)) != (ssize_t)bytes) {
+        entries.assign(pages, kPagePresent);
+      }
+    }
+    // Runs of pages which may hold data, read with one syscall
+    buffer.resize(chunk.len);
+    local.clear();
+    remote.clear();
+    std::size_t expected = 0;
+    for (std::size_t page = 0; page < pages; page++) {
+      if ((entries[page] & (kPagePresent | kPageSwapped)) == 0) {
+        continue;
+      }
+      auto addr = chunk.addr + page * kPageSize;
+      if (!remote.empty() &&
+          reinterpret_cast<std::uintptr_t>(remote.back().iov_base) +
+                  remote.back().iov_len ==
+              addr) {
+        remote.back().iov_len += kPageSize;
+        local.back().iov_len += kPageSize;
+      } else {
+        remote.push_back({reinterpret_cast<void*>(addr), kPageSize});
+        local.push_back({buffer.data() + page * kPageSize, kPageSize});
+      }
+      expected += kPageSize;
+    }
+    if (MemoryOperator::ReadMemoryV(pid, local, remote) != expected) {
+      // Zeros for whatever cannot be read
+      for (std::size_t j = 0; j < remote.size(); j++) {
+        auto* data = static_cast<uint8_t*>(local[j].iov_base);
+        auto n = MemoryOperator::ReadMemory(
+            pid, reinterpret_cast<std::uintptr_t>(remote[j].iov_base), data,
+            remote[j].iov_len);
+        std::memset(data + n, 0, remote[j].iov_len - n);
+      }
+    }
+    // Non-zero spans of each run go to the file
+    for (const auto& range : local) {
+      auto* data = static_cast<uint8_t*>(range.iov_base);
+      std::size_t begin = 0;
+      while (begin < range.iov_len) {
+        while (begin < range.iov_len && IsZero(data + begin, kPageSize)) {
+          begin += kPageSize;
+        }
+        auto end = begin;
+        while (end < range.iov_len && !IsZero(data + end, kPageSize)) {
+          end += kPageSize;
+        }
+        if (end > begin) {
+          auto file_offset = chunk.offset + (data + begin - buffer.data());
+          if (!PWriteAll(fd, data + begin, end - begin, file_offset)) {
+            failed = true;
+          }
+          written += end - begin;
+        }
+        begin = end;
+      }
+    }
+  });
+  stats.written_bytes = written;
+
+  for (const auto& [addr, byte] : patches) {
+    auto it = std::find_if(segments.begin(), segments.end(),
+                           [addr = addr](const Segment& segment) {
+                             return addr >= segment.region->start &&
+                                    addr < segment.region->start +
+                                               segment.filesz;
+                           });
+    if (it != segments.end()) {
+      ok = ok && PWriteAll(fd, &byte, 1,
+                           it->offset + (addr - it->region->start));
+    }
+  }
+  close(pagemap);
+  ok = close(fd) == 0 && ok && !failed;
+  if (!ok) {
+    return std::nullopt;
+  }
+  return stats;
+}
+
+}  // namespace shuidb
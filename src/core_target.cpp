@@ -0,0 +1,262 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "core_target.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/procfs.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+namespace shuidb {
+
+namespace {
+
+static_assert(sizeof(elf_gregset_t) == sizeof(user_regs_struct));
+
+constexpr std::size_t Align4(std::size_t n) { return (n + 3) & ~3UL; }
+
+template <typename T>
+T Load(std::span<const uint8_t> bytes, std::size_t pos) {
+  T value;
+  std::memcpy(&value, bytes.data() + pos, sizeof(T));
+  return value;
+}
+
+}  // namespace
+
+std::unique_ptr<CoreTarget> CoreTarget::Open(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Elf64_Ehdr)) {
+    close(fd);
+    return nullptr;
+  }
+  auto* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+
+  std::unique_ptr<CoreTarget> core(
+      new CoreTarget(static_cast<const uint8_t*>(data), st.st_size));
+  if (!core->Parse()) {
+    return nullptr;
+  }
+  return core;
+}
+
+CoreTarget::~CoreTarget() { munmap(const_cast<uint8_t*>(data_), size_); }
+
+bool CoreTarget::Parse() {
+  Elf64_Ehdr ehdr;
+  std::memcpy(&ehdr, data_, sizeof(ehdr));
+  if (std::memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+      ehdr.e_ident[EI_CLASS] != ELFCLASS64 || ehdr.e_type != ET_CORE ||
+      ehdr.e_machine != EM_X86_64) {
+    return false;
+  }
+  if (ehdr.e_phoff + ehdr.e_phnum * sizeof(Elf64_Phdr) > size_) {
+    return false;
+  }
+  std::span<const Elf64_Phdr> phdrs(
+      reinterpret_cast<const Elf64_Phdr*>(data_ + ehdr.e_phoff),
+      ehdr.e_phnum);
+
+  // NT_FILE names the mappings, so the notes go first
+  for (const auto& phdr : phdrs) {
+    if (phdr.p_type == PT_NOTE && phdr.p_offset + phdr.p_filesz <= size_) {
+      ParseNotes({data_ + phdr.p_offset, phdr.p_filesz});
+    }
+  }
+  if (threads_.empty()) {
+    return false;
+  }
+
+  std::vector<const Elf64_Phdr*> loads;
+  for (const auto& phdr : phdrs) {
+    if (phdr.p_type == PT_LOAD && phdr.p_memsz != 0) {
+      loads.push_back(&phdr);
+    }
+  }
+  std::sort(loads.begin(), loads.end(), [](const auto* a, const auto* b) {
+    return a->p_vaddr < b->p_vaddr;
+  });
+  for (const auto* phdr : loads) {
+    Segment segment{phdr->p_vaddr, phdr->p_memsz, 0, nullptr,
+                    regions_.size()};
+    if (phdr->p_offset < size_) {
+      segment.data = data_ + phdr->p_offset;
+      segment.filesz = std::min<std::size_t>(
+          {phdr->p_filesz, phdr->p_memsz, size_ - phdr->p_offset});
+    }
+    segments_.push_back(segment);
+
+    utils::MemoryRegion region{phdr->p_vaddr, phdr->p_vaddr + phdr->p_memsz,
+                               "---p", 0, ""};
+    region.perms[0] = (phdr->p_flags & PF_R) ? 'r' : '-';
+    region.perms[1] = (phdr->p_flags & PF_W) ? 'w' : '-';
+    region.perms[2] = (phdr->p_flags & PF_X) ? 'x' : '-';
+    const auto* file = utils::FindMemoryRegion(files_, region.start);
+    if (file != nullptr) {
+      region.offset = file->offset + (region.start - file->start);
+      region.path = file->path;
+    }
+    regions_.push_back(std::move(region));
+  }
+  return true;
+}
+
+void CoreTarget::ParseNotes(std::span<const uint8_t> notes) {
+  std::size_t pos = 0;
+  while (pos + sizeof(Elf64_Nhdr) <= notes.size()) {
+    auto nhdr = Load<Elf64_Nhdr>(notes, pos);
+    auto name_pos = pos + sizeof(Elf64_Nhdr);
+    auto desc_pos = name_pos + Align4(nhdr.n_namesz);
+    if (desc_pos + nhdr.n_descsz > notes.size()) {
+      return;
+    }
+    pos = desc_pos + Align4(nhdr.n_descsz);
+    std::string_view name(reinterpret_cast<const char*>(&notes[name_pos]),
+                          nhdr.n_namesz);
+    if (name != std::string_view("CORE", 5)) {
+      continue;
+    }
+    auto desc = notes.subspan(desc_pos, nhdr.n_descsz);
+
+    if (nhdr.n_type == NT_PRSTATUS && desc.size() >= sizeof(elf_prstatus)) {
+      auto prstatus = Load<elf_prstatus>(desc, 0);
+      Thread thread{prstatus.pr_pid, {}};
+      std::memcpy(&thread.regs, &prstatus.pr_reg, sizeof(thread.regs));
+      if (threads_.empty()) {
+        signal_ = prstatus.pr_cursig;
+      }
+      threads_.push_back(thread);
+    } else if (nhdr.n_type == NT_FILE && desc.size() >= 16) {
+      // count, page size, count * (start, end, page offset), then the names
+      auto count = Load<uint64_t>(desc, 0);
+      auto page_size = Load<uint64_t>(desc, 8);
+      if (count > (desc.size() - 16) / 24) {
+        continue;
+      }
+      std::string_view names(
+          reinterpret_cast<const char*>(desc.data() + 16 + count * 24),
+          desc.size() - 16 - count * 24);
+      for (uint64_t i = 0; i < count && !names.empty(); i++) {
+        auto entry = 16 + i * 24;
+        auto path = names.substr(0, names.find('\0'));
+        names.remove_prefix(std::min(names.size(), path.size() + 1));
+        files_.push_back({Load<uint64_t>(desc, entry),
+                          Load<uint64_t>(desc, entry + 8), "",
+                          Load<uint64_t>(desc, entry + 16) * page_size,
+                          std::string(path)});
+      }
+      std::sort(files_.begin(), files_.end(),
+                [](const auto& a, const auto& b) { return a.start < b.start; });
+    }
+  }
+}
+
+const CoreTarget::Segment* CoreTarget::FindSegment(
+    std::uintptr_t addr) const {
+  auto it = std::upper_bound(
+      segments_.begin(), segments_.end(), addr,
+      [](std::uintptr_t a, const Segment& s) { return a < s.vaddr; });
+  if (it == segments_.begin()) {
+    return nullptr;
+  }
+  --it;
+  return addr - it->vaddr < it->memsz ? &*it : nullptr;
+}
+
+pid_t CoreTarget::GetPid() const { return threads_.front().tid; }
+
+std::size_t CoreTarget::ReadMemory(std::uintptr_t addr, void* buf,
+                                   std::size_t len) const {
+  auto* out = static_cast<uint8_t*>(buf);
+  std::size_t done = 0;
+  while (done < len) {
+    const auto* segment = FindSegment(addr + done);
+    if (segment == nullptr) {
+      break;
+    }
+    auto offset = addr + done - segment->vaddr;
+    auto n = std::min(len - done, segment->memsz - offset);
+    if (offset < segment->filesz) {
+      n = std::min(n, segment->filesz - offset);
+      std::memcpy(out + done, segment->data + offset, n);
+    } else {
+      // Left out of the core as it was unmodified, the file still has it
+      const auto& region = regions_[segment->region];
+      if (!region.IsFileBacked()) {
+        break;
+      }
+      int fd = open(region.path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0) {
+        break;
+      }
+      auto read = pread(fd, out + done, n, region.offset + offset);
+      close(fd);
+      if (read <= 0) {
+        break;
+      }
+      n = read;
+    }
+    done += n;
+  }
+  return done;
+}
+
+std::optional<user_regs_struct> CoreTarget::GetRegisters(pid_t tid) const {
+  for (const auto& thread : threads_) {
+    if (thread.tid == tid) {
+      return thread.regs;
+    }
+  }
+  return std::nullopt;
+}
+
+std::vector<pid_t> CoreTarget::GetThreads() const {
+  std::vector<pid_t> tids;
+  for (const auto& thread : threads_) {
+    tids.push_back(thread.tid);
+  }
+  return tids;
+}
+
+std::vector<utils::MemoryRegion> CoreTarget::GetRegions() const {
+  return regions_;
+}
+
+std::span<const uint8_t> CoreTarget::GetMemory(std::uintptr_t addr) const {
+  const auto* segment = FindSegment(addr);
+  if (segment == nullptr || addr - segment->vaddr >= segment->filesz) {
+    return {};
+  }
+  auto offset = addr - segment->vaddr;
+  return {segment->data + offset, segment->filesz - offset};
+}
+
+int CoreTarget::GetSignal() const { return signal_; }
+
+}  // namespace shuidb
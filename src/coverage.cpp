@@ -0,0 +1,177 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "coverage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <tuple>
+
+#include "x86_decoder.h"
+
+namespace shuidb {
+
+namespace {
+
+constexpr char kCoverageMagic[8] = {'S', 'H', 'U', 'I', 'C', 'O', 'V', '\0'};
+constexpr uint32_t kCoverageVersion = 1;
+
+// Leaders of the basic blocks of a function: its entry, branch targets and
+// the instructions after branches. Targets which are not instruction starts
+// of a linear sweep are dropped, an int3 there would corrupt the code
+void AddBlockLeaders(const uint8_t* code, std::size_t size, uint64_t addr,
+                     std::vector<uint64_t>& sites) {
+  std::vector<uint64_t> starts;
+  std::vector<uint64_t> leaders{addr};
+  for (std::size_t offset = 0; offset < size;) {
+    Instruction insn;
+    if (!X86Decoder::Decode(code + offset, size - offset, addr + offset,
+                            insn)) {
+      break;
+    }
+    starts.push_back(insn.address);
+    switch (insn.flow) {
+      case FlowType::kConditionalJump:
+      case FlowType::kJump:
+        leaders.push_back(insn.target);
+        leaders.push_back(insn.NextAddress());
+        break;
+      case FlowType::kIndirectJump:
+      case FlowType::kReturn:
+      case FlowType::kHalt:
+        leaders.push_back(insn.NextAddress());
+        break;
+      default:
+        break;
+    }
+    offset += insn.length;
+  }
+  for (auto leader : leaders) {
+    if (std::binary_search(starts.begin(), starts.end(), leader)) {
+      sites.push_back(leader);
+    }
+  }
+}
+
+}  // namespace
+
+std::vector<uint64_t> FindCoverageSites(const ElfFile& elf, CoverageMode mode) {
+  std::vector<uint64_t> sites;
+  auto data = elf.GetData();
+  for (const auto& symbol : elf.GetSymbols()) {
+    if (!symbol.is_function || symbol.size == 0 || symbol.addr == 0) {
+      continue;
+    }
+    if (mode == CoverageMode::kFunctions) {
+      sites.push_back(symbol.addr);
+      continue;
+    }
+    auto offset = elf.VaddrToFileOffset(symbol.addr);
+    if (!offset.has_value() || offset.value() >= data.size()) {
+      continue;
+    }
+    auto size = std::min<uint64_t>(symbol.size, data.size() - offset.value());
+    AddBlockLeaders(data.data() + offset.value(), size, symbol.addr, sites);
+  }
+  std::sort(sites.begin(), sites.end());
+  sites.erase(std::unique(sites.begin(), sites.end()), sites.end());
+  return sites;
+}
+
+bool WriteCoverageBitmap(const std::string& path,
+                         const OneShotBreakPointSet& sites,
+                         CoverageMode mode) {
+  std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+  if (!ofs) {
+    return false;
+  }
+  CoverageHeader header{};
+  std::memcpy(header.magic, kCoverageMagic, sizeof(header.magic));
+  header.version = kCoverageVersion;
+  header.mode = static_cast<uint32_t>(mode);
+  header.count = sites.Size();
+  header.hit_count = sites.GetHitCount();
+  const auto& bits = sites.GetHitBits();
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(bits.data()),
+            bits.size() * sizeof(uint64_t));
+  return static_cast<bool>(ofs);
+}
+
+bool WriteCoverageLcov(const std::string& path,
+                       const OneShotBreakPointSet& sites,
+                       Symbolizer& symbolizer) {
+  struct SourceFile {
+    // Line -> hit
+    std::map<uint32_t, bool> lines;
+    // Line, name, hit
+    std::vector<std::tuple<uint32_t, std::string, bool>> functions;
+  };
+  std::map<std::string, SourceFile> files;
+  const auto& addrs = sites.GetAddresses();
+  for (std::size_t i = 0; i < addrs.size(); i++) {
+    auto symbol = symbolizer.FindSymbol(addrs[i]);
+    if (!symbol.has_value()) {
+      continue;
+    }
+    const auto* table = symbolizer.GetLineTable(symbol->module);
+    auto bias = symbolizer.GetLoadBias(symbol->module);
+    const auto* row = table != nullptr && bias.has_value()
+                          ? table->FindRow(addrs[i] - bias.value())
+                          : nullptr;
+    if (row == nullptr) {
+      continue;
+    }
+    auto& file = files[table->GetFileName(row->file)];
+    bool hit = sites.IsHit(i);
+    file.lines[row->line] |= hit;
+    if (symbol->address == static_cast<std::uintptr_t>(addrs[i])) {
+      file.functions.emplace_back(row->line, symbol->name, hit);
+    }
+  }
+
+  std::ofstream ofs(path, std::ios::trunc);
+  if (!ofs) {
+    return false;
+  }
+  ofs << "TN:\n";
+  for (const auto& [name, file] : files) {
+    ofs << "SF:" << name << "\n";
+    std::size_t functions_hit = 0;
+    for (const auto& [line, function, hit] : file.functions) {
+      ofs << "FN:" << line << "," << function << "\n";
+    }
+    for (const auto& [line, function, hit] : file.functions) {
+      ofs << "FNDA:" << (hit ? 1 : 0) << "," << function << "\n";
+      functions_hit += hit;
+    }
+    ofs << "FNF:" << file.functions.size() << "\n";
+    ofs << "FNH:" << functions_hit << "\n";
+    std::size_t lines_hit = 0;
+    for (const auto& [line, hit] : file.lines) {
+      ofs << "DA:" << line << "," << (hit ? 1 : 0) << "\n";
+      lines_hit += hit;
+    }
+    ofs << "LF:" << file.lines.size() << "\n";
+    ofs << "LH:" << lines_hit << "\n";
+    ofs << "end_of_record\n";
+  }
+  return static_cast<bool>(ofs);
+}
+
+}  // namespace shuidb
@@ -0,0 +1,179 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "deadlock_detector.h"
+
+#include <linux/futex.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "memory_operator.h"
+#include "utils/syscall_stats.hpp"
+
+#ifndef FUTEX_LOCK_PI2
+#define FUTEX_LOCK_PI2 13
+#endif
+
+namespace shuidb {
+
+namespace {
+
+// Waiters whose lock words are fetched by a single process_vm_readv
+constexpr std::size_t kReadBatch = 1024;
+
+// glibc's struct __pthread_mutex_s starts with
+// `int __lock; unsigned int __count; int __owner;`
+struct MutexHead {
+  int32_t lock;
+  uint32_t count;
+  int32_t owner;
+  uint32_t pad;
+};
+
+bool IsWaitOp(int op) {
+  switch (op & FUTEX_CMD_MASK) {
+    case FUTEX_WAIT:
+    case FUTEX_WAIT_BITSET:
+    case FUTEX_LOCK_PI:
+    case FUTEX_LOCK_PI2:
+    case FUTEX_WAIT_REQUEUE_PI:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool IsPiOp(int op) {
+  auto cmd = op & FUTEX_CMD_MASK;
+  return cmd == FUTEX_LOCK_PI || cmd == FUTEX_LOCK_PI2;
+}
+
+}  // namespace
+
+WaitForGraph DeadlockDetector::Analyze(pid_t pid,
+                                       const std::vector<pid_t>& tids,
+                                       utils::ThreadPool& pool) {
+  WaitForGraph graph;
+  graph.num_threads = tids.size();
+
+  for (auto tid : tids) {
+    user_regs_struct regs;
+    if (utils::Ptrace(PTRACE_GETREGS, tid, nullptr, &regs) == -1) {
+      continue;
+    }
+    // Interrupted in the middle of futex(uaddr, op, ...)
+    if (regs.orig_rax == SYS_futex && IsWaitOp(regs.rsi)) {
+      graph.waiters.push_back({tid, regs.rdi, static_cast<int>(regs.rsi),
+                               std::nullopt});
+    }
+  }
+
+  std::vector<MutexHead> heads(graph.waiters.size());
+  auto batches = (graph.waiters.size() + kReadBatch - 1) / kReadBatch;
+  pool.ParallelFor(batches, [&](std::size_t batch) {
+    auto begin = batch * kReadBatch;
+    auto end = std::min(begin + kReadBatch, graph.waiters.size());
+    std::vector<iovec> local, remote;
+    for (auto i = begin; i < end; i++) {
+      local.push_back({&heads[i], sizeof(MutexHead)});
+      remote.push_back({reinterpret_cast<void*>(graph.waiters[i].futex_addr),
+                        sizeof(MutexHead)});
+    }
+    MemoryOperator::ReadMemoryV(pid, local, remote);
+  });
+
+  std::unordered_set<pid_t> known(tids.begin(), tids.end());
+  std::unordered_map<pid_t, pid_t> waits_for;
+  for (std::size_t i = 0; i < graph.waiters.size(); i++) {
+    auto& waiter = graph.waiters[i];
+    const auto& head = heads[i];
+    pid_t owner = 0;
+    if (IsPiOp(waiter.op)) {
+      owner = head.lock & FUTEX_TID_MASK;
+    } else if (head.lock != 0) {
+      // Only meaningful for mutexes, condition variables and semaphores
+      // leave something else there, which the `known` check filters out
+      owner = head.owner;
+    }
+    if (owner != waiter.tid && known.count(owner) != 0) {
+      waiter.owner = owner;
+      waits_for[waiter.tid] = owner;
+    }
+  }
+
+  // Every thread waits for at most one other, so following the edges from
+  // each thread either ends at a running thread or runs into a cycle
+  enum class State { kVisiting, kDone };
+  std::unordered_map<pid_t, State> state;
+  for (const auto& [start, _] : waits_for) {
+    std::vector<pid_t> path;
+    auto tid = start;
+    while (state.count(tid) == 0) {
+      state[tid] = State::kVisiting;
+      path.push_back(tid);
+      auto it = waits_for.find(tid);
+      if (it == waits_for.end()) {
+        break;
+      }
+      tid = it->second;
+    }
+    if (state[tid] == State::kVisiting && waits_for.count(tid) != 0) {
+      auto cycle_begin = std::find(path.begin(), path.end(), tid);
+      graph.cycles.emplace_back(cycle_begin, path.end());
+    }
+    for (auto t : path) {
+      state[t] = State::kDone;
+    }
+  }
+
+  std::unordered_set<pid_t> waited_on;
+  std::unordered_set<pid_t> in_cycle;
+  for (const auto& [_, owner] : waits_for) {
+    waited_on.insert(owner);
+  }
+  for (const auto& cycle : graph.cycles) {
+    in_cycle.insert(cycle.begin(), cycle.end());
+  }
+  for (const auto& [start, _] : waits_for) {
+    if (waited_on.count(start) != 0) {
+      continue;
+    }
+    std::vector<pid_t> chain{start};
+    auto it = waits_for.find(start);
+    while (it != waits_for.end() && in_cycle.count(it->second) == 0) {
+      chain.push_back(it->second);
+      it = waits_for.find(it->second);
+    }
+    if (it != waits_for.end()) {
+      // Ends in a cycle, which is reported on its own
+      chain.push_back(it->second);
+    }
+    if (chain.size() >= kMinChainLength) {
+      graph.chains.push_back(std::move(chain));
+    }
+  }
+  std::sort(graph.chains.begin(), graph.chains.end(),
+            [](const auto& a, const auto& b) { return a.size() > b.size(); });
+  return graph;
+}
+
+}  // namespace shuidb
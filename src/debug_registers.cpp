@@ -0,0 +1,174 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#include "debug_registers.h"
+
+#include <sys/ptrace.h>
+#include <sys/user.h>
+
+#include <cerrno>
+#include <cstddef>
+
+#include "utils/syscall_stats.hpp"
+
+namespace shuidb {
+
+namespace {
+
+constexpr std::size_t kStatusRegister = 6;
+constexpr std::size_t kControlRegister = 7;
+
+std::size_t DebugRegisterOffset(std::size_t index) {
+  return offsetof(struct user, u_debugreg) + index * sizeof(uint64_t);
+}
+
+bool PokeDebugRegister(pid_t pid, std::size_t index, uint64_t value) {
+  return utils::Ptrace(PTRACE_POKEUSER, pid, DebugRegisterOffset(index),
+                       value) == 0;
+}
+
+// R/W and LEN fields of DR7
+uint64_t ControlBits(std::size_t len, WatchKind kind) {
+  uint64_t rw = kind == WatchKind::kExecute ? 0b00
+                : kind == WatchKind::kWrite ? 0b01
+                                            : 0b11;
+  uint64_t size = len == 8 ? 0b10 : len == 4 ? 0b11 : len == 2 ? 0b01 : 0b00;
+  return rw | size << 2;
+}
+
+}  // namespace
+
+void DebugRegisters::Reset(pid_t pid) {
+  threads_ = {pid};
+  slots_ = {};
+}
+
+bool DebugRegisters::AddThread(pid_t tid) {
+  threads_.insert(tid);
+  return IsEmpty() || WriteThread(tid);
+}
+
+void DebugRegisters::RemoveThread(pid_t tid) { threads_.erase(tid); }
+
+bool DebugRegisters::Insert(std::uintptr_t addr, std::size_t len,
+                            WatchKind kind) {
+  if (len != 1 && len != 2 && len != 4 && len != 8) {
+    return false;
+  }
+  if ((kind == WatchKind::kExecute && len != 1) || addr % len != 0) {
+    return false;
+  }
+  for (std::size_t i = 0; i < kSlots; i++) {
+    if (slots_[i].used) {
+      continue;
+    }
+    for (auto tid : threads_) {
+      if (!PokeDebugRegister(tid, i, addr)) {
+        return false;
+      }
+    }
+    slots_[i] = {addr, len, kind, true};
+    if (!WriteControl()) {
+      slots_[i].used = false;
+      return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+bool DebugRegisters::Remove(std::uintptr_t addr, std::size_t len,
+                            WatchKind kind) {
+  for (auto& slot : slots_) {
+    if (slot.used && slot.addr == addr && slot.len == len &&
+        slot.kind == kind) {
+      slot.used = false;
+      return WriteControl();
+    }
+  }
+  return false;
+}
+
+std::optional<DebugRegisters::Hit> DebugRegisters::TakeHit(pid_t tid) {
+  if (IsEmpty()) {
+    return std::nullopt;
+  }
+  errno = 0;
+  auto status = utils::Ptrace(PTRACE_PEEKUSER, tid,
+                              DebugRegisterOffset(kStatusRegister), nullptr);
+  if (errno != 0) {
+    return std::nullopt;
+  }
+  PokeDebugRegister(tid, kStatusRegister, 0);
+  for (std::size_t i = 0; i < kSlots; i++) {
+    if (slots_[i].used && (status >> i & 1) != 0) {
+      return Hit{slots_[i].addr, slots_[i].kind};
+    }
+  }
+  return std::nullopt;
+}
+
+bool DebugRegisters::Reinstall(pid_t pid) {
+  threads_ = {pid};
+  return IsEmpty() || WriteThread(pid);
+}
+
+bool DebugRegisters::Clear() {
+  slots_ = {};
+  return WriteControl();
+}
+
+bool DebugRegisters::IsEmpty() const {
+  for (const auto& slot : slots_) {
+    if (slot.used) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint64_t DebugRegisters::Control() const {
+  uint64_t control = 0;
+  for (std::size_t i = 0; i < kSlots; i++) {
+    if (slots_[i].used) {
+      // Local enable, and the slot's conditions
+      control |= 1UL << (i * 2);
+      control |= ControlBits(slots_[i].len, slots_[i].kind) << (16 + i * 4);
+    }
+  }
+  return control;
+}
+
+bool DebugRegisters::WriteControl() {
+  auto control = Control();
+  bool done = true;
+  for (auto tid : threads_) {
+    done = PokeDebugRegister(tid, kControlRegister, control) && done;
+  }
+  return done;
+}
+
+bool DebugRegisters::WriteThread(pid_t tid) {
+  for (std::size_t i = 0; i < kSlots; i++) {
+    if (slots_[i].used && !PokeDebugRegister(tid, i, slots_[i].addr)) {
+      return false;
+    }
+  }
+  return PokeDebugRegister(tid, kControlRegister, Control());
+}
+
+}  // namespace shuidb
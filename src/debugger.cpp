@@ -16,21 +16,90 @@
 
 #include "debugger.h"
 
-#include <sys/personality.h>
+#include <elf.h>
+#include <sys/mman.h>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
+#include <numeric>
+#include <sstream>
+#include <tuple>
+#include <utility>
 
+#include "branch_trace.h"
 #include "breakpoint.h"
+#include "core_dump.h"
+#include "coverage.h"
+#include "deadlock_detector.h"
+#include "function_caller.h"
+#include "heap_walker.h"
+#include "memory_operator.h"
+#include "memory_search.h"
+#include "process_launcher.h"
 #include "register_operator.h"
+#include "stack_snapshot.h"
+#include "syscall_injector.h"
+#include "thread_stopper.h"
 #include "utils/fs_utils.hpp"
+#include "utils/logger.hpp"
 #include "utils/output_utils.hpp"
 #include "utils/ps_utils.hpp"
 #include "utils/string_utils.hpp"
+#include "utils/syscall_stats.hpp"
+#include "utils/thread_pool.hpp"
+#include "x86_decoder.h"
 
 namespace shuidb {
 
+namespace {
+
+// Largest `display /<n>` dump
+constexpr std::size_t kMaxDisplayBytes = 4096;
+// Matches listed by `find`, the rest are only counted
+constexpr std::size_t kMaxShownMatches = 100;
+// Ranges listed by `snapshot diff`
+constexpr std::size_t kMaxShownRanges = 100;
+// Crashing inputs listed by `fuzz`, the rest are only counted
+constexpr std::size_t kMaxShownCrashes = 10;
+// Every thread the process creates is traced as well
+constexpr long kTraceOptions = PTRACE_O_TRACECLONE;
+// Room for the XSAVE area of any current CPU, AVX-512 needs 0x2b00 bytes
+constexpr std::size_t kMaxXstateSize = 16 * 1024;
+
+// Parts of [begin, end) outside of the sorted `regions`
+std::vector<std::pair<std::uintptr_t, std::uintptr_t>> FindUncovered(
+    std::uintptr_t begin, std::uintptr_t end,
+    const std::vector<utils::MemoryRegion>& regions) {
+  std::vector<std::pair<std::uintptr_t, std::uintptr_t>> parts;
+  for (const auto& region : regions) {
+    if (region.end <= begin) {
+      continue;
+    }
+    if (region.start >= end) {
+      break;
+    }
+    if (region.start > begin) {
+      parts.emplace_back(begin, region.start);
+    }
+    begin = region.end;
+  }
+  if (begin < end) {
+    parts.emplace_back(begin, end);
+  }
+  return parts;
+}
+
+}  // namespace
+
 Debugger::~Debugger() { Quit(); };
 
 void Debugger::RunProc() {
@@ -45,25 +114,39 @@ void Debugger::RunProc() {
     PR(ERROR) << "File " << prog_ << " does not exist";
     throw std::runtime_error("File does not exist");
   }
+  // Forks of the previous run
+  KillCheckpoints();
+  // A rebuilt program is parsed again, everything else stays warm
+  symbolizer_.DropChangedFiles();
 
-  auto pid = fork();
-  if (pid == 0) {
-    // child process
-    // disable ASLR
-    PR(INFO) << "Child process pid: " << std::dec << getpid();
-    PR(INFO) << "Pausing...";
-    personality(ADDR_NO_RANDOMIZE);
-    ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
-    execl(prog_.c_str(), prog_.c_str(), nullptr);
-  } else if (pid >= 1) {
-    // parent process
-    int wait_status;
-    waitpid(pid_, &wait_status, 0);
-    SetRun(pid);
-  } else {
-    PR(ERROR) << "Fork failed";
-    exit(1);
+  auto pid = ProcessLauncher::Launch(prog_, launch_options_);
+  if (!pid.has_value()) {
+    PR(ERROR) << "Cannot start " << prog_ << ": " << strerror(errno);
+    return;
+  }
+  PR(INFO) << "Child process pid: " << std::dec << pid.value();
+  SetRun(pid.value());
+
+  // Stopped at the first instruction of the dynamic loader, the program
+  // starts at AT_ENTRY
+  auto entry = utils::GetAuxValue(pid_, AT_ENTRY);
+  auto pc = RegisterOperator::GetRegisterValue(tid_, Register::RIP);
+  if (entry.has_value() && entry != pc) {
+    auto reason = RunTo(entry.value(), 0);
+    if (reason != StopReason::kStep) {
+      ReportStop(reason);
+    }
   }
+  InstallBreakPoints(true);
+}
+
+void Debugger::SetLaunchOptions(const LaunchOptions& options) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  launch_options_ = options;
+}
+
+LaunchOptions Debugger::GetLaunchOptions() const {
+  return launch_options_;
 }
 
 void Debugger::ContinueExecution() {
@@ -74,65 +157,103 @@ void Debugger::ContinueExecution() {
     return;
   }
   PR(INFO) << "Continue...";
-  ptrace(PTRACE_CONT, pid_, nullptr, nullptr);
-
-  int wait_status;
-  waitpid(pid_, &wait_status, 0);
-  if (WIFEXITED(wait_status)) {
-    PR(INFO) << "Process exited";
-    SetStop();
-  } else if (WIFSTOPPED(wait_status)) {
-    PR(INFO) << "Process stopped";
-  } else {
-    PR(ERROR) << "Unknown wait status";
-  }
+  // Shown before anything the program prints
+  utils::Logger::Get().Flush();
+  ReportStop(Resume(PTRACE_CONT));
+  PrintDisplays();
 }
 
 void Debugger::SetBreakPointAtAddress(std::intptr_t addr) {
   std::lock_guard<std::mutex> lock(mutex_);
+  AddBreakPoint(addr);
+}
 
-  auto base_load_addr = utils::GetProcessLoadAddress(pid_);
-  if (addr < base_load_addr) {
-    PR(WARNING) << "Address 0x" << std::hex << addr << " is not in the program";
-    addr += base_load_addr;
-    PR(WARNING) << "Try to plus the base load address 0x" << std::hex
-                << base_load_addr << ", get 0x" << std::hex << addr;
-  }
+StatusType Debugger::SetBreakPoint(const std::string& location) {
+  std::lock_guard<std::mutex> lock(mutex_);
 
-  if (breakpoints_.find(addr) != breakpoints_.end()) {
-    PR(INFO) << "Breakpoint at address 0x" << std::hex << addr
-             << " already exists";
-    return;
+  // symbol[+offset], unless it is no symbol but a hex number
+  auto text = utils::trim(location);
+  BreakPointLocation symbol{text, "", 0};
+  try {
+    auto plus = text.find('+');
+    if (plus != std::string::npos && plus > 0) {
+      symbol.symbol = utils::trim(text.substr(0, plus));
+      symbol.offset = std::stoull(text.substr(plus + 1), nullptr, 0);
+    }
+    if (IsRunning()) {
+      LoadSymbols();
+    }
+    if (!text.empty() && std::isxdigit(text[0]) &&
+        (!IsRunning() || !ResolveLocation(symbol).has_value())) {
+      std::size_t end = 0;
+      auto addr = std::stoull(text, &end, 16);
+      if (end == text.size()) {
+        return AddBreakPoint(addr);
+      }
+    }
+  } catch (const std::exception&) {
+    symbol.symbol.clear();
   }
+  if (symbol.symbol.empty() ||
+      (!std::isalpha(symbol.symbol[0]) && symbol.symbol[0] != '_')) {
+    PR(ERROR) << "Bad breakpoint location " << location;
+    return StatusType::kBadInput;
+  }
+  return AddBreakPoint(symbol);
+}
+
+StatusType Debugger::ShowBreakPoints() {
+  std::lock_guard<std::mutex> lock(mutex_);
 
-  PR(INFO) << "Set breakpoint at address 0x" << std::hex << addr;
-  auto bp = std::make_shared<BreakPoint>(pid_, addr);
-  bp->Enable();
-  breakpoints_[addr] = bp;
+  if (breakpoint_locations_.empty()) {
+    PR(INFO) << "No breakpoints";
+    return StatusType::kSuccess;
+  }
+  if (IsRunning()) {
+    LoadSymbols();
+  }
+  for (std::size_t i = 0; i < breakpoint_locations_.size(); i++) {
+    std::ostringstream oss;
+    oss << "#" << std::dec << i + 1 << " "
+        << FormatLocation(breakpoint_locations_[i]);
+    auto addr = IsRunning() ? ResolveLocation(breakpoint_locations_[i])
+                            : std::nullopt;
+    auto bp = addr.has_value() ? breakpoints_.Find(addr.value())
+                               : BreakPointTable::kNotFound;
+    if (bp != BreakPointTable::kNotFound) {
+      oss << " at 0x" << std::hex << addr.value() << ", " << std::dec
+          << breakpoints_.GetHitCount(bp) << " hits";
+    } else {
+      oss << " (pending)";
+    }
+    PR(RAW) << oss.str();
+  }
+  return StatusType::kSuccess;
 }
 
 std::vector<std::intptr_t> Debugger::GetBreakPoints() const {
-  std::vector<std::intptr_t> bp_addrs;
-  std::ranges::transform(breakpoints_, std::back_inserter(bp_addrs),
-                         [](const auto& pair) { return pair.first; });
-  return bp_addrs;
+  return breakpoints_.GetAddresses();
 }
 
 std::optional<std::unordered_map<Register, uint64_t>> Debugger::GetRegisters()
     const {
-  if (!IsRunning()) {
+  auto target = GetTarget();
+  if (target == nullptr) {
     PR(ERROR) << "Process is not running";
     return std::nullopt;
   }
-  return RegisterOperator::GetRegisters(pid_);
+  auto regs = target->GetRegisters(target->GetCurrentThread());
+  if (!regs.has_value()) {
+    return std::nullopt;
+  }
+  return RegisterOperator::GetRegisters(regs.value());
 }
 
 void Debugger::DumpRegisters() const {
-  if (!IsRunning()) {
-    PR(ERROR) << "Process is not running";
+  auto registers_map = GetRegisters();
+  if (!registers_map.has_value()) {
     return;
   }
-  auto registers_map = GetRegisters();
   PR(INFO) << "Registers:";
   for (const auto& [reg, val] : registers_map.value()) {
     PR(RAW) << RegisterOperator::GetRegisterName(reg) << " 0x" << std::hex
@@ -141,7 +262,8 @@ void Debugger::DumpRegisters() const {
 }
 
 StatusType Debugger::ReadRegister(const std::string& reg_name) const {
-  if (!IsRunning()) {
+  auto target = GetTarget();
+  if (target == nullptr) {
     PR(ERROR) << "Process is not running";
     return StatusType::kNotRunning;
   }
@@ -151,13 +273,14 @@ StatusType Debugger::ReadRegister(const std::string& reg_name) const {
     PR(ERROR) << "Unknown register name " << reg_name;
     return StatusType::kUnknownRegister;
   }
-  auto reg_value = RegisterOperator::GetRegisterValue(pid_, reg.value());
-  if (!reg_value.has_value()) {
+  auto regs = target->GetRegisters(target->GetCurrentThread());
+  if (!regs.has_value()) {
     PR(ERROR) << "Failed to get register value";
     return StatusType::kFailed;
   }
   PR(INFO) << reg_name << " 0x" << std::setfill('0') << std::setw(16)
-           << std::hex << reg_value.value();
+           << std::hex
+           << RegisterOperator::GetRegisterValue(regs.value(), reg.value());
 
   return StatusType::kSuccess;
 }
@@ -174,32 +297,2807 @@ StatusType Debugger::WriteRegister(const std::string& reg_name,
     PR(ERROR) << "Unknown register name " << reg_name;
     return StatusType::kUnknownRegister;
   };
-  RegisterOperator::SetRegisterValue(pid_, reg.value(), val);
+  RegisterOperator::SetRegisterValue(tid_, reg.value(), val);
   return StatusType::kSuccess;
 }
 
-void Debugger::Quit() {
+StatusType Debugger::Backtrace() {
   std::lock_guard<std::mutex> lock(mutex_);
 
-  PR(INFO) << "Quitting";
+  auto target = GetTarget();
+  if (target == nullptr) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+
+  LoadSymbols();
+  auto stack = StackSnapshot::CaptureThread(*target, target->GetCurrentThread(),
+                                            symbolizer_.GetRegions());
+  if (!stack.has_value()) {
+    PR(ERROR) << "Failed to get registers";
+    return StatusType::kFailed;
+  }
+  StackSnapshot::UnwindStack(stack.value(), symbolizer_);
+  std::vector<std::string> names;
+  for (auto pc : stack->frames) {
+    names.push_back(symbolizer_.Symbolize(pc));
+  }
+  PrintFrames(stack->frames, names);
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::SnapshotStacks() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // Also works on a process we are not tracing, all of its threads are seized
+  // for the duration of the copy
+  if (pid_ == 0) {
+    PR(ERROR) << "No process to snapshot";
+    return StatusType::kNotRunning;
+  }
+
+  utils::ThreadPool pool;
+  auto begin = std::chrono::steady_clock::now();
+  StackSnapshot snapshot;
+  {
+    ThreadStopper stopper(pid_, IsRunning() ? GetThreads()
+                                            : std::vector<pid_t>{});
+    snapshot = StackSnapshot::Capture(pid_, stopper.GetThreads(), pool);
+  }
+  auto resumed = std::chrono::steady_clock::now();
+
+  symbolizer_.Load(pid_);
+  snapshot.Unwind(symbolizer_, pool);
+  auto groups = snapshot.GroupStacks();
+
+  // Symbolize every distinct pc once
+  std::vector<std::uintptr_t> pcs;
+  for (const auto& group : groups) {
+    pcs.insert(pcs.end(), group.frames.begin(), group.frames.end());
+  }
+  std::sort(pcs.begin(), pcs.end());
+  pcs.erase(std::unique(pcs.begin(), pcs.end()), pcs.end());
+  std::vector<std::string> pc_names(pcs.size());
+  pool.ParallelFor(pcs.size(), [&](std::size_t i) {
+    pc_names[i] = symbolizer_.Symbolize(pcs[i]);
+  });
+  auto end = std::chrono::steady_clock::now();
+
+  using std::chrono::duration_cast;
+  using std::chrono::microseconds;
+  PR(INFO) << std::dec << snapshot.GetThreads().size()
+           << " threads, stopped for "
+           << duration_cast<microseconds>(resumed - begin).count()
+           << " us, unwound in "
+           << duration_cast<microseconds>(end - resumed).count() << " us";
+  for (const auto& group : groups) {
+    std::string tids;
+    for (std::size_t i = 0; i < group.tids.size(); i++) {
+      if (i == 8) {
+        tids += ", ...";
+        break;
+      }
+      tids += (i == 0 ? "" : ", ") + std::to_string(group.tids[i]);
+    }
+    PR(INFO) << std::dec << group.tids.size() << " x [" << tids << "]";
+    std::vector<std::string> names;
+    for (auto pc : group.frames) {
+      auto it = std::lower_bound(pcs.begin(), pcs.end(), pc);
+      names.push_back(pc_names[it - pcs.begin()]);
+    }
+    PrintFrames(group.frames, names);
+  }
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::DetectDeadlocks() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (pid_ == 0) {
+    PR(ERROR) << "No process to inspect";
+    return StatusType::kNotRunning;
+  }
+
+  utils::ThreadPool pool;
+  WaitForGraph graph;
+  {
+    ThreadStopper stopper(pid_, IsRunning() ? GetThreads()
+                                            : std::vector<pid_t>{});
+    graph = DeadlockDetector::Analyze(pid_, stopper.GetThreads(), pool);
+  }
+  symbolizer_.Load(pid_);
+
+  PR(INFO) << std::dec << graph.num_threads << " threads, "
+           << graph.waiters.size() << " blocked in futex";
+  std::unordered_map<pid_t, const FutexWaiter*> waiter_of;
+  for (const auto& waiter : graph.waiters) {
+    waiter_of[waiter.tid] = &waiter;
+  }
+  auto describe = [&](pid_t tid) {
+    std::ostringstream oss;
+    oss << std::dec << tid;
+    auto it = waiter_of.find(tid);
+    if (it != waiter_of.end()) {
+      oss << " waits on " << symbolizer_.Symbolize(it->second->futex_addr);
+    } else {
+      oss << " is not blocked";
+    }
+    return oss.str();
+  };
+
+  for (const auto& cycle : graph.cycles) {
+    PR(ERROR) << "Deadlock between " << cycle.size() << " threads:";
+    for (auto tid : cycle) {
+      PR(RAW) << "  " << describe(tid) << " held by "
+              << waiter_of[tid]->owner.value();
+    }
+  }
+  for (const auto& chain : graph.chains) {
+    PR(WARNING) << "Wait chain of " << chain.size() << " threads:";
+    for (std::size_t i = 0; i < chain.size(); i++) {
+      PR(RAW) << "  " << describe(chain[i])
+              << (i + 1 < chain.size() ? "" : " (end of chain)");
+    }
+  }
+  if (graph.cycles.empty()) {
+    PR(INFO) << "No deadlock found";
+  }
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::Disassemble(const std::string& location,
+                                 std::size_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+
+  symbolizer_.Load(pid_);
+  auto pc = RegisterOperator::GetRegisterValue(tid_, Register::RIP);
+  std::uintptr_t addr = pc.value_or(0);
+  if (!location.empty()) {
+    auto sym_addr = symbolizer_.LookupAddress(location);
+    if (sym_addr.has_value()) {
+      addr = sym_addr.value();
+    } else {
+      try {
+        addr = std::stoull(location, 0, 16);
+      } catch (const std::exception&) {
+        PR(ERROR) << "Unknown symbol " << location;
+        return StatusType::kBadInput;
+      }
+    }
+  }
+
+  return PrintInstructions(addr, count);
+}
+
+StatusType Debugger::StepInstruction() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  auto reason = Resume(PTRACE_SINGLESTEP);
+  if (reason != StopReason::kStep) {
+    ReportStop(reason);
+  }
+  if (!IsRunning()) {
+    return StatusType::kSuccess;
+  }
+  auto pc = RegisterOperator::GetRegisterValue(tid_, Register::RIP);
+  auto status = PrintInstructions(pc.value_or(0), 1);
+  PrintDisplays();
+  return status;
+}
+
+StatusType Debugger::NextInstruction() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  auto regs = RegisterOperator::GetRegisters(tid_);
+  if (!regs.has_value()) {
+    PR(ERROR) << "Failed to get registers";
+    return StatusType::kFailed;
+  }
+  auto pc = regs->at(Register::RIP);
+  auto sp = regs->at(Register::RSP);
+  auto code = ReadCode(pc, kMaxInstructionLength);
+  Instruction insn;
+  bool is_call = X86Decoder::Decode(code.data(), code.size(), pc, insn) &&
+                 (insn.flow == FlowType::kCall ||
+                  insn.flow == FlowType::kIndirectCall);
+  // The callee returns with the stack pointer where it is now
+  auto reason =
+      is_call ? RunTo(insn.NextAddress(), sp) : Resume(PTRACE_SINGLESTEP);
+  if (reason != StopReason::kStep) {
+    ReportStop(reason);
+  }
+  if (!IsRunning()) {
+    return StatusType::kSuccess;
+  }
+  pc = RegisterOperator::GetRegisterValue(tid_, Register::RIP).value_or(0);
+  auto status = PrintInstructions(pc, 1);
+  PrintDisplays();
+  return status;
+}
+
+StatusType Debugger::Finish() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+
+  symbolizer_.Load(pid_);
+  auto stack =
+      StackSnapshot::CaptureThread(pid_, tid_, symbolizer_.GetRegions());
+  if (!stack.has_value()) {
+    PR(ERROR) << "Failed to get registers";
+    return StatusType::kFailed;
+  }
+  StackSnapshot::UnwindStack(stack.value(), symbolizer_);
+  if (stack->frames.size() < 2) {
+    PR(ERROR) << "Cannot find the caller of "
+              << symbolizer_.Symbolize(stack->regs.rip);
+    return StatusType::kFailed;
+  }
+  auto ret = stack->frames[1];
+  PR(INFO) << "Run till exit from " << symbolizer_.Symbolize(stack->regs.rip);
+  // `ret` pops the return address, recursive calls returning to the same
+  // place do so deeper in the stack
+  auto reason = RunTo(ret, stack->regs.rsp + 8);
+  if (reason != StopReason::kStep) {
+    ReportStop(reason);
+    PrintDisplays();
+    return StatusType::kIncomplete;
+  }
+  auto rax = RegisterOperator::GetRegisterValue(tid_, Register::RAX);
+  std::ostringstream oss;
+  oss << "Returned to " << symbolizer_.Symbolize(ret) << ", rax 0x" << std::hex
+      << rax.value_or(0);
+  PR(INFO) << oss.str();
+  auto status = PrintInstructions(ret, 1);
+  PrintDisplays();
+  return status;
+}
+
+StatusType Debugger::Step() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return StepLine(true);
+}
+
+StatusType Debugger::Next() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return StepLine(false);
+}
+
+StatusType Debugger::StepLine(bool into) {
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+
+  symbolizer_.Load(pid_);
+  auto stack =
+      StackSnapshot::CaptureThread(pid_, tid_, symbolizer_.GetRegions());
+  if (!stack.has_value()) {
+    PR(ERROR) << "Failed to get registers";
+    return StatusType::kFailed;
+  }
+  std::uintptr_t pc = stack->regs.rip;
+  auto sp = stack->regs.rsp;
+  auto func = symbolizer_.FindSymbol(pc);
+  const auto* table =
+      func.has_value() ? symbolizer_.GetLineTable(func->module) : nullptr;
+  auto bias = func.has_value() ? symbolizer_.GetLoadBias(func->module)
+                               : std::nullopt;
+  const auto* row =
+      table != nullptr ? table->FindRow(pc - bias.value()) : nullptr;
+  if (row == nullptr || func->size == 0) {
+    PR(ERROR) << "No line information for " << symbolizer_.Symbolize(pc);
+    return StatusType::kFailed;
+  }
+  std::uintptr_t func_begin = func->address;
+  std::uintptr_t func_end = func->address + func->size;
+  // Boundaries of the other lines, coming back to the current line (e.g. a
+  // loop on a single line) keeps going
+  std::vector<std::uintptr_t> line_starts;
+  for (auto addr : table->GetLineStarts(func_begin - bias.value(),
+                                        func_end - bias.value())) {
+    const auto* other = table->FindRow(addr);
+    if (other->line != row->line || other->file != row->file) {
+      line_starts.push_back(addr + bias.value());
+    }
+  }
+  auto is_line_start = [&](std::uintptr_t addr) {
+    return std::binary_search(line_starts.begin(), line_starts.end(), addr);
+  };
+
+  // Walk the function's control flow from the pc, every path ends at the
+  // first line boundary it reaches, a return or a jump out of the function
+  auto code = ReadCode(func_begin, func->size);
+  std::vector<std::uintptr_t> targets;
+  std::vector<std::uintptr_t> callees;
+  std::vector<std::uintptr_t> worklist{pc};
+  std::vector<bool> visited(code.size());
+  bool all_lines = false;
+  while (!worklist.empty() && !all_lines) {
+    auto addr = worklist.back();
+    worklist.pop_back();
+    while (addr >= func_begin && addr < func_begin + code.size()) {
+      if (is_line_start(addr)) {
+        targets.push_back(addr);
+        break;
+      }
+      if (visited[addr - func_begin]) {
+        break;
+      }
+      visited[addr - func_begin] = true;
+      Instruction insn;
+      if (!X86Decoder::Decode(code.data() + (addr - func_begin),
+                              code.size() - (addr - func_begin), addr,
+                              insn)) {
+        all_lines = true;
+        break;
+      }
+      auto flow = insn.flow;
+      if (flow == FlowType::kCall && into) {
+        // Stop after the prologue of callees built with line info
+        auto callee = symbolizer_.FindSymbol(insn.target);
+        const auto* callee_table =
+            callee.has_value() ? symbolizer_.GetLineTable(callee->module)
+                               : nullptr;
+        if (callee_table != nullptr) {
+          auto callee_bias = symbolizer_.GetLoadBias(callee->module).value();
+          auto starts = callee_table->GetLineStarts(
+              callee->address - callee_bias,
+              callee->address + callee->size - callee_bias);
+          if (!starts.empty()) {
+            callees.push_back((starts.size() > 1 ? starts[1] : starts[0]) +
+                              callee_bias);
+          }
+        }
+      } else if (flow == FlowType::kConditionalJump) {
+        worklist.push_back(insn.target);
+      } else if (flow == FlowType::kJump) {
+        // Jumps out of the function are tail calls, caught on return
+        addr = insn.target;
+        continue;
+      } else if (flow == FlowType::kIndirectJump) {
+        // Jump tables are not followed, any line of the function may be next
+        all_lines = true;
+        break;
+      } else if (flow == FlowType::kReturn || flow == FlowType::kHalt) {
+        break;
+      }
+      addr = insn.NextAddress();
+    }
+  }
+  if (all_lines) {
+    std::copy_if(line_starts.begin(), line_starts.end(),
+                 std::back_inserter(targets), is_line_start);
+  }
+
+  // The caller, for when the function returns before reaching another line
+  StackSnapshot::UnwindStack(stack.value(), symbolizer_);
+  auto depth = stack->frames.size();
+  std::optional<std::uintptr_t> ret;
+  if (depth > 1) {
+    ret = stack->frames[1];
+    targets.push_back(ret.value());
+  }
+
+  std::sort(callees.begin(), callees.end());
+  targets.insert(targets.end(), callees.begin(), callees.end());
+  std::sort(targets.begin(), targets.end());
+  targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+  temp_breakpoints_.Reset(pid_);
+  for (auto addr : targets) {
+    auto bp = breakpoints_.Find(addr);
+    if (bp == BreakPointTable::kNotFound || !breakpoints_.IsEnabled(bp)) {
+      temp_breakpoints_.Add(addr);
+    }
+  }
+
+  auto thread = tid_;
+  auto reason = StopReason::kStep;
+  while (true) {
+    if (!temp_breakpoints_.Install()) {
+      PR(ERROR) << "Failed to set temporary breakpoints";
+      return StatusType::kFailed;
+    }
+    reason = Resume(PTRACE_CONT);
+    if (IsRunning()) {
+      temp_breakpoints_.Remove();
+    }
+    auto regs = RegisterOperator::GetRegisters(tid_);
+    if (reason != StopReason::kBreakpoint || !regs.has_value()) {
+      break;
+    }
+    pc = regs->at(Register::RIP);
+    if (tid_ != thread) {
+      if (!temp_breakpoints_.Contains(pc)) {
+        // A user breakpoint
+        break;
+      }
+      // Another thread ran into the line boundaries, move it past them
+      reason = Resume(PTRACE_SINGLESTEP);
+      if (reason == StopReason::kExited) {
+        break;
+      }
+      if (pending_signal_ != 0) {
+        thread_signals_[tid_] = std::exchange(pending_signal_, 0);
+      }
+      tid_ = thread;
+      continue;
+    }
+    if (!std::binary_search(targets.begin(), targets.end(), pc)) {
+      // A user breakpoint
+      break;
+    }
+    // Recursive calls run into the same breakpoints in deeper frames
+    bool deeper = false;
+    if (pc == ret) {
+      deeper = regs->at(Register::RSP) <= sp;
+    } else if (!std::binary_search(callees.begin(), callees.end(), pc)) {
+      auto now =
+          StackSnapshot::CaptureThread(pid_, tid_, symbolizer_.GetRegions());
+      if (now.has_value()) {
+        StackSnapshot::UnwindStack(now.value(), symbolizer_);
+        deeper = depth < kMaxFrames && now->frames.size() > depth;
+      }
+    }
+    if (!deeper) {
+      reason = StopReason::kStep;
+      break;
+    }
+    // Off the breakpoint before installing the set again
+    reason = Resume(PTRACE_SINGLESTEP);
+    if (reason != StopReason::kStep) {
+      break;
+    }
+  }
+
+  if (reason != StopReason::kStep) {
+    ReportStop(reason);
+  }
   if (IsRunning()) {
-    kill(pid_, SIGTERM);
-    SetStop();
+    PrintSourceLine(
+        RegisterOperator::GetRegisterValue(tid_, Register::RIP).value_or(0));
   }
+  PrintDisplays();
+  return StatusType::kSuccess;
 }
 
-void Debugger::SetRun(pid_t pid) {
-  pid_ = pid;
-  running_ = true;
+void Debugger::PrintSourceLine(std::uintptr_t pc) {
+  auto func = symbolizer_.FindSymbol(pc);
+  const auto* table =
+      func.has_value() ? symbolizer_.GetLineTable(func->module) : nullptr;
+  const auto* row =
+      table != nullptr
+          ? table->FindRow(pc - symbolizer_.GetLoadBias(func->module).value())
+          : nullptr;
+  if (row == nullptr) {
+    PR(INFO) << symbolizer_.Symbolize(pc);
+    return;
+  }
+  const auto& file = table->GetFileName(row->file);
+  PR(INFO) << symbolizer_.Symbolize(pc) << " at "
+           << file.substr(file.rfind('/') + 1) << ":" << std::dec << row->line;
+  std::ifstream ifs(file);
+  std::string text;
+  for (uint32_t i = 0; i < row->line && std::getline(ifs, text); i++) {
+  }
+  if (ifs) {
+    std::ostringstream oss;
+    oss << std::dec << row->line << "\t" << text;
+    PR(RAW) << oss.str();
+  }
 }
 
-void Debugger::SetStop() {
-  pid_ = 0;
-  running_ = false;
+StatusType Debugger::RecordTrace(const std::string& path,
+                                 std::size_t max_stops) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  auto pc = RegisterOperator::GetRegisterValue(tid_, Register::RIP);
+  TraceWriter writer;
+  if (!pc.has_value() || !writer.Open(path, pc.value())) {
+    PR(ERROR) << "Cannot open " << path;
+    return StatusType::kFailed;
+  }
+
+  // Executable mappings seen so far, re-read when a stop lands outside of
+  // them (e.g. after dlopen)
+  std::vector<utils::MemoryRegion> exec_regions;
+  auto refresh_regions = [&]() {
+    for (auto& region : utils::GetMemoryRegions(pid_)) {
+      auto same = [&](const utils::MemoryRegion& r) {
+        return r.start == region.start && r.path == region.path;
+      };
+      if (region.IsExecutable() &&
+          std::find_if(exec_regions.begin(), exec_regions.end(), same) ==
+              exec_regions.end()) {
+        exec_regions.push_back(std::move(region));
+      }
+    }
+    std::sort(exec_regions.begin(), exec_regions.end(),
+              [](const auto& a, const auto& b) { return a.start < b.start; });
+  };
+  refresh_regions();
+
+  // PTRACE_SINGLEBLOCK silently single-steps where BTF is not available
+  // (e.g. most VMs). The first stops tell which one we got
+  constexpr std::size_t kProbeStops = 64;
+  bool block_step = true;
+  auto prev = pc.value();
+  auto reason = StopReason::kStep;
+  auto begin = std::chrono::steady_clock::now();
+  while (writer.GetCount() < max_stops) {
+    reason = Resume(PTRACE_SINGLEBLOCK);
+    if (reason == StopReason::kExited || reason == StopReason::kBreakpoint) {
+      break;
+    }
+    auto stop = RegisterOperator::GetRegisterValue(tid_, Register::RIP);
+    if (!stop.has_value() || !writer.Append(stop.value())) {
+      reason = StopReason::kExited;
+      break;
+    }
+    if (block_step && writer.GetCount() <= kProbeStops) {
+      auto code = ReadCode(prev, kMaxInstructionLength);
+      Instruction insn;
+      if (X86Decoder::Decode(code.data(), code.size(), prev, insn) &&
+          insn.flow == FlowType::kSequential &&
+          insn.NextAddress() == stop.value()) {
+        block_step = false;
+      }
+    }
+    if (utils::FindMemoryRegion(exec_regions, stop.value()) == nullptr) {
+      refresh_regions();
+    }
+    prev = stop.value();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  std::vector<TraceModule> modules;
+  for (const auto& region : exec_regions) {
+    if (region.IsFileBacked()) {
+      modules.push_back({region.start, region.end, region.offset, region.path});
+    }
+  }
+  auto stops = writer.GetCount();
+  auto bytes = writer.GetSize();
+  if (!writer.Close(modules, block_step ? kTraceBlockStep : 0)) {
+    PR(ERROR) << "Failed to write " << path;
+    return StatusType::kFailed;
+  }
+
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(end - begin)
+                .count();
+  PR(INFO) << std::dec << stops << " stops recorded to " << path << " ("
+           << bytes << " bytes) in " << us / 1000 << " ms, "
+           << (us > 0 ? stops * 1000000 / us : 0) << " stops/s";
+  if (!block_step) {
+    PR(WARNING) << "Branch stepping is not supported here, every instruction "
+                   "was stepped";
+  }
+  if (reason != StopReason::kStep) {
+    ReportStop(reason);
+  }
+  PrintDisplays();
+  return StatusType::kSuccess;
 }
 
-bool Debugger::IsRunning() const { return running_ && pid_ != 0; }
+StatusType Debugger::DumpTrace(const std::string& path, std::size_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
 
-pid_t Debugger::GetPid() const { return pid_; }
+  auto reader = TraceReader::Open(path);
+  if (reader == nullptr) {
+    PR(ERROR) << "Cannot read trace " << path;
+    return StatusType::kBadInput;
+  }
+  const auto& header = reader->GetHeader();
+  std::size_t printed = 0;
+  auto total = reader->Replay([&](const Instruction& insn) {
+    if (printed < count) {
+      std::ostringstream oss;
+      oss << "0x" << std::hex << std::setfill('0') << std::setw(16)
+          << insn.address << "  " << X86Decoder::Format(insn);
+      PR(RAW) << oss.str();
+      printed++;
+    }
+    return true;
+  });
+  PR(INFO) << std::dec << header.count << " stops, " << total
+           << " instructions"
+           << (header.flags & kTraceBlockStep ? "" : " (single-stepped)");
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::StartCoverage(bool blocks,
+                                   const std::vector<std::string>& modules) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  if (coverage_sites_.IsInstalled()) {
+    PR(ERROR) << "Coverage is already running";
+    return StatusType::kFailed;
+  }
+
+  auto begin = std::chrono::steady_clock::now();
+  symbolizer_.Load(pid_);
+  const auto& regions = symbolizer_.GetRegions();
+  auto exe = utils::GetProcessExe(pid_);
+  auto selected = [&](const std::string& path) {
+    if (modules.empty()) {
+      return path == exe;
+    }
+    auto name = path.substr(path.rfind('/') + 1);
+    return std::any_of(modules.begin(), modules.end(), [&](const auto& m) {
+      return name.find(m) != std::string::npos;
+    });
+  };
+
+  coverage_mode_ = blocks ? CoverageMode::kBlocks : CoverageMode::kFunctions;
+  coverage_sites_.Reset(pid_);
+  std::vector<std::string> paths;
+  for (const auto& region : regions) {
+    if (!region.IsExecutable() || !region.IsFileBacked() ||
+        !selected(region.path) ||
+        std::find(paths.begin(), paths.end(), region.path) != paths.end()) {
+      continue;
+    }
+    paths.push_back(region.path);
+    auto elf = symbolizer_.GetElfFile(region.path);
+    auto bias = symbolizer_.GetLoadBias(region.path);
+    if (elf == nullptr || !bias.has_value()) {
+      continue;
+    }
+    for (auto site : FindCoverageSites(*elf, coverage_mode_)) {
+      auto addr = static_cast<std::intptr_t>(site + bias.value());
+      const auto* mapped = utils::FindMemoryRegion(regions, addr);
+      // A user breakpoint would be saved as the original byte
+      if (mapped != nullptr && mapped->IsExecutable() &&
+          breakpoints_.Find(addr) == BreakPointTable::kNotFound) {
+        coverage_sites_.Add(addr);
+      }
+    }
+  }
+  if (paths.empty()) {
+    PR(ERROR) << "No matching module";
+    return StatusType::kBadInput;
+  }
+  memory_cache_.Invalidate();
+  if (!coverage_sites_.Install()) {
+    PR(ERROR) << "Failed to set coverage breakpoints";
+    coverage_sites_.Reset(pid_);
+    return StatusType::kFailed;
+  }
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - begin)
+                .count();
+  PR(INFO) << std::dec << coverage_sites_.Size()
+           << (blocks ? " blocks" : " functions") << " in " << paths.size()
+           << " modules covered, set up in " << us / 1000 << " ms";
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::StopCoverage() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  memory_cache_.Invalidate();
+  if (!coverage_sites_.Remove()) {
+    PR(ERROR) << "Failed to remove coverage breakpoints";
+    return StatusType::kFailed;
+  }
+  PR(INFO) << "Coverage stopped, " << std::dec
+           << coverage_sites_.GetHitCount() << "/" << coverage_sites_.Size()
+           << " sites hit";
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::StartEventTrace(const std::string& path,
+                                     std::size_t max_segments) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto trace = EventTraceWriter::Create(path, max_segments);
+  if (trace == nullptr) {
+    PR(ERROR) << "Cannot create " << path << ": " << strerror(errno);
+    return StatusType::kFailed;
+  }
+  event_trace_ = std::move(trace);
+  event_trace_path_ = path;
+  event_trace_start_ = std::chrono::steady_clock::now();
+  PR(INFO) << "Recording stops to " << path;
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::StopEventTrace() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (event_trace_ == nullptr) {
+    PR(ERROR) << "No event trace recorded";
+    return StatusType::kFailed;
+  }
+  PR(INFO) << "Recorded " << std::dec << event_trace_->GetCount()
+           << " stops to " << event_trace_path_;
+  event_trace_.reset();
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::ShowCoverage() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (coverage_sites_.Size() == 0) {
+    PR(ERROR) << "No coverage recorded";
+    return StatusType::kFailed;
+  }
+  // Hits and sites per module, in address order
+  std::vector<std::tuple<std::string, std::size_t, std::size_t>> counts;
+  const auto& regions = symbolizer_.GetRegions();
+  const auto& sites = coverage_sites_.GetAddresses();
+  for (std::size_t i = 0; i < sites.size(); i++) {
+    const auto* region = utils::FindMemoryRegion(regions, sites[i]);
+    const auto& path = region != nullptr ? region->path : "";
+    if (counts.empty() || std::get<0>(counts.back()) != path) {
+      counts.emplace_back(path, 0, 0);
+    }
+    std::get<1>(counts.back()) += coverage_sites_.IsHit(i);
+    std::get<2>(counts.back())++;
+  }
+  for (const auto& [path, hit, total] : counts) {
+    std::ostringstream oss;
+    oss << std::dec << std::setw(8) << hit << "/" << std::left << std::setw(8)
+        << total << std::right << std::fixed << std::setprecision(1)
+        << std::setw(6) << 100.0 * hit / total << "%  " << path;
+    PR(RAW) << oss.str();
+  }
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::SaveCoverage(const std::string& prefix) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (coverage_sites_.Size() == 0) {
+    PR(ERROR) << "No coverage recorded";
+    return StatusType::kFailed;
+  }
+  if (!WriteCoverageBitmap(prefix + ".cov", coverage_sites_, coverage_mode_) ||
+      !WriteCoverageLcov(prefix + ".info", coverage_sites_, symbolizer_)) {
+    PR(ERROR) << "Failed to write " << prefix << ".cov / " << prefix
+              << ".info";
+    return StatusType::kFailed;
+  }
+  PR(INFO) << "Coverage written to " << prefix << ".cov and " << prefix
+           << ".info";
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::ShowStats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  const auto& stats = memory_cache_.GetStats();
+  auto total = stats.hits + stats.misses + stats.file_reads;
+  std::ostringstream oss;
+  oss << "memory cache: " << std::dec << stats.hits << " hits, "
+      << stats.file_reads << " from files, " << stats.misses
+      << " misses, hit rate " << std::fixed << std::setprecision(1)
+      << (total > 0 ? 100.0 * (stats.hits + stats.file_reads) / total : 0.0)
+      << "%";
+  PR(INFO) << oss.str();
+
+  using utils::SyscallOp;
+  auto syscalls = utils::SyscallStats::Get().Take();
+  auto to_ns = [&](double cycles) { return cycles / syscalls.cycles_per_ns; };
+  const auto& ops = syscalls.ops;
+  auto get = [&](SyscallOp op) -> const auto& {
+    return ops[static_cast<std::size_t>(op)];
+  };
+  // Upper bound of the bucket holding the `q` quantile
+  auto quantile = [&](const utils::SyscallStats::OpStats& op, double q) {
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < op.histogram.size(); i++) {
+      seen += op.histogram[i];
+      if (seen >= q * op.calls) {
+        return to_ns(2.0 * (1UL << i));
+      }
+    }
+    return to_ns(op.cycles);
+  };
+
+  // Blocked in waitpid is the time the process ran
+  auto session = to_ns(syscalls.cycles);
+  auto running = std::min(session, to_ns(get(SyscallOp::kWaitPid).cycles));
+  PR(INFO) << "session: " << utils::format_duration(session) << ", running "
+           << utils::format_duration(running) << ", stopped "
+           << utils::format_duration(session - running);
+  if (syscalls.commands > 0) {
+    oss.str("");
+    oss << "commands: " << syscalls.commands << ", "
+        << double(syscalls.command_syscalls) / syscalls.commands
+        << " syscalls per command, at most "
+        << syscalls.max_command_syscalls;
+    PR(INFO) << oss.str();
+  }
+  const auto& stops = get(SyscallOp::kStopHandling);
+  if (stops.calls > 0) {
+    PR(INFO) << "stops: " << stops.calls << ", handled in "
+             << utils::format_duration(to_ns(stops.cycles) / stops.calls)
+             << " on average, 99% within "
+             << utils::format_duration(quantile(stops, 0.99));
+  }
+
+  PR(INFO) << std::left << std::setw(14) << "operation" << std::right
+           << std::setw(10) << "calls" << std::setw(11) << "total"
+           << std::setw(11) << "average" << std::setw(11) << "p50"
+           << std::setw(11) << "p99" << std::setw(12) << "bytes";
+  for (std::size_t i = 0; i < ops.size(); i++) {
+    if (ops[i].calls == 0) {
+      continue;
+    }
+    PR(RAW) << std::left << std::setw(14) << utils::kSyscallOpNames[i]
+            << std::right << std::setw(10) << ops[i].calls << std::setw(11)
+            << utils::format_duration(to_ns(ops[i].cycles)) << std::setw(11)
+            << utils::format_duration(to_ns(ops[i].cycles) / ops[i].calls)
+            << std::setw(11)
+            << utils::format_duration(quantile(ops[i], 0.5))
+            << std::setw(11)
+            << utils::format_duration(quantile(ops[i], 0.99))
+            << std::setw(12) << ops[i].bytes;
+  }
+  auto read = get(SyscallOp::kPeek).bytes + get(SyscallOp::kVmRead).bytes;
+  auto written = get(SyscallOp::kPoke).bytes + get(SyscallOp::kVmWrite).bytes +
+                 get(SyscallOp::kMemWrite).bytes;
+  PR(INFO) << "memory: " << read << " bytes read, " << written
+           << " bytes written";
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::AddDisplay(const std::string& expr) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // [/<n> | *]<base>[+-<offset>]
+  Display display{next_display_, utils::trim(expr), "", 0, 0, false};
+  std::string rest = display.text;
+  try {
+    if (utils::starts_with(rest, "/")) {
+      std::size_t end = 0;
+      display.len = std::stoul(rest.substr(1), &end);
+      rest = utils::trim(rest.substr(1 + end));
+    } else if (utils::starts_with(rest, "*")) {
+      display.len = 8;
+      display.word = true;
+      rest = utils::trim(rest.substr(1));
+    }
+    auto sign = rest.find_last_of("+-");
+    if (sign != std::string::npos && sign > 0) {
+      display.offset = std::stoll(rest.substr(sign), nullptr, 0);
+      rest = utils::trim(rest.substr(0, sign));
+    }
+  } catch (const std::exception&) {
+    rest.clear();
+  }
+  display.base = utils::starts_with(rest, "$") ? rest.substr(1) : rest;
+  if (display.base.empty() || (display.len == 0 && !display.word &&
+                               utils::starts_with(display.text, "/")) ||
+      display.len > kMaxDisplayBytes) {
+    PR(ERROR) << "Bad display expression " << expr;
+    return StatusType::kBadInput;
+  }
+  next_display_++;
+  displays_.push_back(std::move(display));
+  PrintDisplays();
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::RemoveDisplay(std::size_t number) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = std::find_if(displays_.begin(), displays_.end(),
+                         [&](const Display& d) { return d.number == number; });
+  if (it == displays_.end()) {
+    PR(ERROR) << "No display number " << std::dec << number;
+    return StatusType::kBadInput;
+  }
+  displays_.erase(it);
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::ShowDisplays() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  PrintDisplays();
+  return StatusType::kSuccess;
+}
+
+bool Debugger::RestoreState(const Snapshot& snapshot) {
+  const auto& saved = snapshot.memory->GetRegions();
+  auto regions = utils::GetMemoryRegions(pid_);
+  auto heap_end = [](const std::vector<utils::MemoryRegion>& regions) {
+    for (const auto& region : regions) {
+      if (region.path == "[heap]") {
+        return region.end;
+      }
+    }
+    return std::uintptr_t{0};
+  };
+  // The registers are those of the main thread. Signals due to the state
+  // left behind are dropped, those arriving meanwhile kept
+  tid_ = pid_;
+  pending_signal_ = 0;
+  bool remapped = false;
+  if (snapshot.brk != 0 && heap_end(regions) != heap_end(saved)) {
+    InjectSyscall(SYS_brk, {snapshot.brk});
+    regions = utils::GetMemoryRegions(pid_);
+    remapped = true;
+  }
+  for (const auto& region : regions) {
+    for (auto [begin, end] : FindUncovered(region.start, region.end, saved)) {
+      InjectSyscall(SYS_munmap, {begin, end - begin});
+      remapped = true;
+    }
+  }
+  for (const auto& region : saved) {
+    for (auto [begin, end] : FindUncovered(region.start, region.end, regions)) {
+      // Only anonymous memory can be brought back from the snapshot
+      if (!region.IsReadable() || !region.IsWritable() ||
+          region.IsFileBacked()) {
+        PR(ERROR) << "Cannot restore unmapped " << region.path << " at 0x"
+                  << std::hex << begin;
+        return false;
+      }
+      uint64_t prot = PROT_READ | PROT_WRITE;
+      if (region.IsExecutable()) {
+        prot |= PROT_EXEC;
+      }
+      auto addr = InjectSyscall(
+          SYS_mmap,
+          {begin, end - begin, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED,
+           static_cast<uint64_t>(-1), 0});
+      if (addr != static_cast<long>(begin)) {
+        PR(ERROR) << "Cannot map 0x" << std::hex << begin;
+        return false;
+      }
+      remapped = true;
+    }
+  }
+  if (remapped) {
+    regions = utils::GetMemoryRegions(pid_);
+  }
+
+  auto written = MemorySnapshot::Restore(pid_, regions, *snapshot.memory,
+                                         last_snapshot_.get());
+  if (!written.has_value()) {
+    PR(ERROR) << "Cannot write the memory of " << std::dec << pid_;
+    return false;
+  }
+  MemorySnapshot::ClearSoftDirty(pid_);
+  last_snapshot_ = snapshot.memory;
+  utils::Ptrace(PTRACE_SETREGS, pid_, nullptr, &snapshot.regs);
+  utils::Ptrace(PTRACE_SETFPREGS, pid_, nullptr, &snapshot.fpregs);
+  if (utils::FindMemoryRegion(saved, call_stub_) == nullptr) {
+    // Unmapped as it came after the snapshot
+    call_stub_ = 0;
+  }
+  memory_cache_.Invalidate();
+  return true;
+}
+
+std::optional<uint64_t> Debugger::EvaluateAddress(const std::string& expr) {
+  auto base = utils::trim(expr);
+  int64_t offset = 0;
+  auto sign = base.find_last_of("+-");
+  try {
+    if (sign != std::string::npos && sign > 0) {
+      offset = std::stoll(base.substr(sign), nullptr, 0);
+      base = utils::trim(base.substr(0, sign));
+    }
+    if (utils::starts_with(base, "$")) {
+      auto reg = RegisterOperator::GetRegisterFromName(base.substr(1));
+      if (!reg.has_value()) {
+        return std::nullopt;
+      }
+      auto target = GetTarget();
+      auto regs = target != nullptr
+                      ? target->GetRegisters(target->GetCurrentThread())
+                      : std::nullopt;
+      if (!regs.has_value()) {
+        return std::nullopt;
+      }
+      return RegisterOperator::GetRegisterValue(regs.value(), reg.value()) +
+             offset;
+    }
+    LoadSymbols();
+    auto addr = symbolizer_.LookupAddress(base);
+    if (addr.has_value()) {
+      return addr.value() + offset;
+    }
+    std::size_t end = 0;
+    auto value = std::stoull(base, &end, 16);
+    if (end == base.size()) {
+      return value + offset;
+    }
+  } catch (const std::exception&) {
+  }
+  return std::nullopt;
+}
+
+void Debugger::PrintDisplays() {
+  if (displays_.empty() || !IsRunning()) {
+    return;
+  }
+  auto regs = RegisterOperator::GetRegisters(tid_);
+  if (!regs.has_value()) {
+    return;
+  }
+  bool loaded = false;
+  auto evaluate = [&](const Display& display) -> std::optional<uint64_t> {
+    auto reg = RegisterOperator::GetRegisterFromName(display.base);
+    if (reg.has_value()) {
+      return regs->at(reg.value()) + display.offset;
+    }
+    if (!loaded) {
+      symbolizer_.Load(pid_);
+      loaded = true;
+    }
+    auto addr = symbolizer_.LookupAddress(display.base);
+    if (addr.has_value()) {
+      return addr.value() + display.offset;
+    }
+    try {
+      std::size_t end = 0;
+      auto value = std::stoull(display.base, &end, 16);
+      if (end == display.base.size()) {
+        return value + display.offset;
+      }
+    } catch (const std::exception&) {
+    }
+    return std::nullopt;
+  };
+
+  // Every address first, then one read for all of them
+  std::vector<std::optional<uint64_t>> values;
+  read_planner_.Clear();
+  for (const auto& display : displays_) {
+    values.push_back(evaluate(display));
+    read_planner_.Request(values.back().value_or(0),
+                          values.back().has_value() ? display.len : 0);
+  }
+  read_planner_.Execute(pid_);
+
+  for (std::size_t i = 0; i < displays_.size(); i++) {
+    const auto& display = displays_[i];
+    std::ostringstream oss;
+    oss << std::dec << display.number << ": " << display.text << " =";
+    auto bytes = read_planner_.Get(i);
+    if (!values[i].has_value()) {
+      oss << " <unknown " << display.base << ">";
+    } else if (display.len == 0) {
+      oss << " 0x" << std::hex << values[i].value();
+    } else if (bytes.size() < display.len) {
+      oss << " <cannot read 0x" << std::hex << values[i].value() << ">";
+    } else if (display.word) {
+      uint64_t word;
+      std::memcpy(&word, bytes.data(), sizeof(word));
+      oss << " 0x" << std::hex << std::setfill('0') << std::setw(16) << word;
+    } else {
+      for (std::size_t j = 0; j < bytes.size(); j++) {
+        if (j % 16 == 0) {
+          oss << "\n  0x" << std::hex << std::setfill('0') << std::setw(16)
+              << values[i].value() + j << ":";
+        }
+        oss << " " << std::setw(2) << static_cast<int>(bytes[j]);
+      }
+    }
+    PR(RAW) << oss.str();
+  }
+}
+
+StatusType Debugger::FindMemory(const std::vector<uint8_t>& pattern,
+                                const std::string& range) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  symbolizer_.Load(pid_);
+  std::vector<utils::MemoryRegion> regions;
+  std::uintptr_t begin = 0;
+  std::uintptr_t end = UINTPTR_MAX;
+  auto dash = range.find('-');
+  if (range.empty()) {
+    regions = symbolizer_.GetRegions();
+  } else if (dash != std::string::npos && range[0] != '[') {
+    try {
+      begin = std::stoull(range.substr(0, dash), nullptr, 16);
+      end = std::stoull(range.substr(dash + 1), nullptr, 16);
+    } catch (const std::exception&) {
+      PR(ERROR) << "Bad range " << range;
+      return StatusType::kBadInput;
+    }
+    regions = symbolizer_.GetRegions();
+  } else {
+    for (const auto& region : symbolizer_.GetRegions()) {
+      if (region.path.find(range) != std::string::npos) {
+        regions.push_back(region);
+      }
+    }
+  }
+  if (regions.empty() || begin >= end) {
+    PR(ERROR) << "Nothing to search in " << range;
+    return StatusType::kBadInput;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  utils::ThreadPool pool;
+  auto result = MemorySearch::Search(pid_, regions, begin, end, pattern,
+                                     kMaxShownMatches, pool);
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  for (auto addr : result.matches) {
+    const auto* region = utils::FindMemoryRegion(regions, addr);
+    std::ostringstream oss;
+    oss << "0x" << std::hex << std::setfill('0') << std::setw(16) << addr;
+    if (symbolizer_.FindSymbol(addr).has_value()) {
+      oss << "  <" << symbolizer_.Symbolize(addr) << ">";
+    } else if (region != nullptr && !region->path.empty()) {
+      oss << "  " << region->path;
+    }
+    PR(RAW) << oss.str();
+  }
+  if (result.count > result.matches.size()) {
+    PR(INFO) << std::dec << result.count - result.matches.size()
+             << " more matches not shown";
+  }
+  PR(INFO) << std::dec << result.count << " matches in "
+           << result.bytes_scanned / 1024 << " KB, " << us / 1000
+           << " ms";
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::ShowHeap(std::size_t max_largest) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  symbolizer_.Load(pid_);
+  auto start = std::chrono::steady_clock::now();
+  auto main_arena = symbolizer_.LookupAddress("main_arena");
+  bool from_symbol = main_arena.has_value();
+  std::optional<HeapReport> report;
+  {
+    ThreadStopper stopper(pid_, GetThreads());
+    if (!from_symbol) {
+      main_arena = HeapWalker::FindMainArena(pid_, symbolizer_.GetRegions());
+    }
+    if (main_arena.has_value()) {
+      utils::ThreadPool pool;
+      report = HeapWalker::Walk(pid_, symbolizer_.GetRegions(),
+                                main_arena.value(), max_largest, pool);
+    }
+  }
+  if (!report.has_value()) {
+    PR(ERROR) << "No glibc malloc heap found";
+    return StatusType::kFailed;
+  }
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  auto percent = [](std::size_t part, std::size_t whole) {
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(1)
+        << (whole == 0 ? 0.0 : 100.0 * part / whole) << "%";
+    return oss.str();
+  };
+
+  PR(INFO) << "main_arena at 0x" << std::hex << main_arena.value()
+           << (from_symbol ? "" : ", found by its top chunk");
+  std::ostringstream header;
+  header << std::left << std::setw(20) << "Arena" << std::right
+         << std::setw(6) << "Heaps" << std::setw(12) << "In use"
+         << std::setw(10) << "Chunks" << std::setw(12) << "Free"
+         << std::setw(10) << "Chunks" << std::setw(12) << "Top"
+         << std::setw(8) << "Frag";
+  PR(RAW) << header.str();
+  std::size_t used_bytes = 0, free_bytes = 0, fastbins = 0, tcaches = 0;
+  for (const auto& arena : report->arenas) {
+    std::ostringstream oss;
+    oss << "0x" << std::hex << std::setfill('0') << std::setw(16)
+        << arena.addr << std::setfill(' ') << std::dec << "  "
+        << std::setw(6) << arena.heaps << std::setw(12)
+        << utils::format_bytes(arena.used_bytes) << std::setw(10)
+        << arena.used_count << std::setw(12)
+        << utils::format_bytes(arena.free_bytes) << std::setw(10)
+        << arena.free_count << std::setw(12)
+        << utils::format_bytes(arena.top_size) << std::setw(8)
+        << percent(arena.free_bytes, arena.used_bytes + arena.free_bytes);
+    PR(RAW) << oss.str();
+    if (arena.corrupt) {
+      PR(WARNING) << "Walk of arena 0x" << std::hex << arena.addr
+                  << " stopped at a bad chunk header";
+    }
+    used_bytes += arena.used_bytes;
+    free_bytes += arena.free_bytes;
+    fastbins += arena.fastbin_count;
+    tcaches += arena.tcache_count;
+  }
+
+  PR(INFO) << "Size classes:";
+  std::ostringstream classes;
+  classes << std::setw(20) << "Size" << std::setw(10) << "In use"
+          << std::setw(12) << "Bytes" << std::setw(10) << "Free"
+          << std::setw(12) << "Bytes";
+  PR(RAW) << classes.str();
+  for (const auto& cls : report->classes) {
+    std::ostringstream size, oss;
+    size << cls.min_size;
+    if (cls.max_size != cls.min_size) {
+      size << "-" << cls.max_size;
+    }
+    oss << std::setw(20) << size.str() << std::setw(10) << cls.used_count
+        << std::setw(12) << utils::format_bytes(cls.used_bytes)
+        << std::setw(10) << cls.free_count << std::setw(12)
+        << utils::format_bytes(cls.free_bytes);
+    PR(RAW) << oss.str();
+  }
+
+  if (!report->largest.empty()) {
+    PR(INFO) << "Largest allocations:";
+  }
+  for (const auto& chunk : report->largest) {
+    std::ostringstream oss;
+    oss << "0x" << std::hex << std::setfill('0') << std::setw(16)
+        << chunk.addr << std::setfill(' ') << std::setw(12)
+        << utils::format_bytes(chunk.size)
+        << (chunk.mmapped ? "  mmapped" : "");
+    PR(RAW) << oss.str();
+  }
+
+  PR(INFO) << std::dec << report->arenas.size() << " arenas, "
+           << utils::format_bytes(used_bytes) << " in use, "
+           << utils::format_bytes(free_bytes) << " free ("
+           << percent(free_bytes, used_bytes + free_bytes) << ", " << fastbins
+           << " in fastbins, " << tcaches << " in tcaches), "
+           << report->mmapped_count << " mmapped chunks of "
+           << utils::format_bytes(report->mmapped_bytes);
+  PR(INFO) << "Read " << utils::format_bytes(report->bytes_read) << " in "
+           << us / 1000 << " ms";
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::SaveSnapshot(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  symbolizer_.Load(pid_);
+  auto start = std::chrono::steady_clock::now();
+  Snapshot snapshot{};
+  if (utils::Ptrace(PTRACE_GETREGS, pid_, nullptr, &snapshot.regs) < 0 ||
+      utils::Ptrace(PTRACE_GETFPREGS, pid_, nullptr, &snapshot.fpregs) < 0) {
+    PR(ERROR) << "Cannot read the registers of " << std::dec << pid_;
+    return StatusType::kFailed;
+  }
+  snapshot.brk = std::max(InjectSyscall(SYS_brk).value_or(0), 0L);
+  snapshot.memory = MemorySnapshot::Take(pid_, symbolizer_.GetRegions(),
+                                         last_snapshot_.get());
+  if (snapshot.memory == nullptr) {
+    PR(ERROR) << "Cannot read the page map of " << std::dec << pid_;
+    return StatusType::kFailed;
+  }
+  // Later writes are what the next snapshot has to read
+  MemorySnapshot::ClearSoftDirty(pid_);
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  if (last_snapshot_ != nullptr && !MemorySnapshot::IsSoftDirtySupported()) {
+    PR(WARNING) << "No soft-dirty tracking, read every page";
+  }
+  const auto& memory = *snapshot.memory;
+  PR(INFO) << "Snapshot " << name << ": " << std::dec
+           << memory.GetPages().size() << " pages, " << memory.GetReadPages()
+           << " read, " << memory.GetStoredPages() << " stored, "
+           << us / 1000 << " ms";
+  last_snapshot_ = snapshot.memory;
+  snapshots_[name] = std::move(snapshot);
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::DiffSnapshots(const std::string& a,
+                                   const std::string& b) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it_a = snapshots_.find(a);
+  auto it_b = snapshots_.find(b);
+  if (it_a == snapshots_.end() || it_b == snapshots_.end()) {
+    PR(ERROR) << "No snapshot "
+              << (it_a == snapshots_.end() ? a : b);
+    return StatusType::kBadInput;
+  }
+  auto ranges =
+      MemorySnapshot::Diff(*it_a->second.memory, *it_b->second.memory);
+  const auto& regions = symbolizer_.GetRegions();
+  std::size_t bytes = 0;
+  for (std::size_t i = 0; i < ranges.size(); i++) {
+    bytes += ranges[i].end - ranges[i].begin;
+    if (i >= kMaxShownRanges) {
+      continue;
+    }
+    auto addr = ranges[i].begin;
+    const auto* region = utils::FindMemoryRegion(regions, addr);
+    std::ostringstream oss;
+    oss << "0x" << std::hex << std::setfill('0') << std::setw(16) << addr
+        << "-0x" << std::setw(16) << ranges[i].end << std::dec << " "
+        << std::setfill(' ') << std::setw(6) << ranges[i].end - addr;
+    if (symbolizer_.FindSymbol(addr).has_value()) {
+      oss << "  <" << symbolizer_.Symbolize(addr) << ">";
+    } else if (region != nullptr && !region->path.empty()) {
+      oss << "  " << region->path;
+    }
+    PR(RAW) << oss.str();
+  }
+  if (ranges.size() > kMaxShownRanges) {
+    PR(INFO) << std::dec << ranges.size() - kMaxShownRanges
+             << " more ranges not shown";
+  }
+  PR(INFO) << std::dec << ranges.size() << " ranges, " << bytes
+           << " bytes changed";
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::RestoreSnapshot(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  auto it = snapshots_.find(name);
+  if (it == snapshots_.end()) {
+    PR(ERROR) << "No snapshot " << name;
+    return StatusType::kBadInput;
+  }
+  auto start = std::chrono::steady_clock::now();
+  if (!RestoreState(it->second)) {
+    return StatusType::kFailed;
+  }
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  PR(INFO) << "Restored " << name << " in " << std::dec << us << " us";
+  auto pc = RegisterOperator::GetRegisterValue(tid_, Register::RIP);
+  if (pc.has_value()) {
+    PrintSourceLine(pc.value());
+  }
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::Fuzz(const std::string& name, const std::string& buffer,
+                          const std::string& inputs, std::size_t rounds,
+                          const std::string& size_reg) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  auto it = snapshots_.find(name);
+  if (it == snapshots_.end()) {
+    PR(ERROR) << "No snapshot " << name;
+    return StatusType::kBadInput;
+  }
+  std::optional<Register> size;
+  if (!size_reg.empty()) {
+    size = RegisterOperator::GetRegisterFromName(
+        utils::starts_with(size_reg, "$") ? size_reg.substr(1) : size_reg);
+    if (!size.has_value()) {
+      PR(ERROR) << "Bad register " << size_reg;
+      return StatusType::kBadInput;
+    }
+  }
+  // Inputs are read up front, runs only touch the process
+  std::vector<std::string> paths;
+  std::error_code ec;
+  if (std::filesystem::is_directory(inputs, ec)) {
+    for (const auto& entry : std::filesystem::directory_iterator(inputs, ec)) {
+      if (entry.is_regular_file()) {
+        paths.push_back(entry.path().string());
+      }
+    }
+    std::sort(paths.begin(), paths.end());
+  } else {
+    paths.push_back(inputs);
+  }
+  std::vector<std::string> datas;
+  for (const auto& path : paths) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+      PR(ERROR) << "Cannot read " << path;
+      return StatusType::kBadInput;
+    }
+    datas.emplace_back(std::istreambuf_iterator<char>(ifs),
+                       std::istreambuf_iterator<char>());
+  }
+  if (datas.empty()) {
+    PR(ERROR) << "No inputs in " << inputs;
+    return StatusType::kBadInput;
+  }
+  if (!RestoreState(it->second)) {
+    return StatusType::kFailed;
+  }
+  auto addr = EvaluateAddress(buffer);
+  if (!addr.has_value()) {
+    PR(ERROR) << "Bad buffer address " << buffer;
+    return StatusType::kBadInput;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::size_t runs = 0;
+  std::size_t crashes = 0;
+  for (std::size_t round = 0; round < rounds; round++) {
+    for (std::size_t i = 0; i < datas.size(); i++) {
+      if (runs > 0 && !RestoreState(it->second)) {
+        return StatusType::kFailed;
+      }
+      std::vector<iovec> local{
+          {const_cast<char*>(datas[i].data()), datas[i].size()}};
+      std::vector<iovec> remote{
+          {reinterpret_cast<void*>(addr.value()), datas[i].size()}};
+      if (MemoryOperator::WriteMemoryV(pid_, local, remote) !=
+          datas[i].size()) {
+        PR(ERROR) << "Cannot write " << paths[i] << " at 0x" << std::hex
+                  << addr.value();
+        return StatusType::kFailed;
+      }
+      if (size.has_value()) {
+        RegisterOperator::SetRegisterValue(tid_, size.value(),
+                                           datas[i].size());
+      }
+      auto reason = Resume(PTRACE_CONT);
+      runs++;
+      if (reason == StopReason::kExited) {
+        PR(ERROR) << "Process exited on " << paths[i];
+        return StatusType::kFailed;
+      }
+      if (reason == StopReason::kSignal) {
+        auto signal = std::exchange(pending_signal_, 0);
+        auto pc = RegisterOperator::GetRegisterValue(tid_, Register::RIP);
+        if (crashes++ < kMaxShownCrashes) {
+          PR(WARNING) << "Signal " << std::dec << signal << " at "
+                      << symbolizer_.Symbolize(pc.value_or(0)) << " on "
+                      << paths[i];
+        }
+      }
+    }
+  }
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  // Leave the process as the runs found it
+  RestoreState(it->second);
+  PR(INFO) << std::dec << runs << " runs, " << crashes << " crashes, "
+           << runs * 1000000 / std::max<int64_t>(us, 1) << " runs/s";
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::AddCheckpoint() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  // The fork has the main thread only
+  int signal = 0;
+  auto pid = SyscallInjector::Fork(pid_, kTraceOptions, &signal);
+  KeepSignal(pid_, signal);
+  if (!pid.has_value()) {
+    PR(ERROR) << "Cannot fork " << std::dec << pid_;
+    return StatusType::kFailed;
+  }
+  auto pc = RegisterOperator::GetRegisterValue(pid_, Register::RIP);
+  checkpoints_.push_back({next_checkpoint_++, pid.value(), pc.value_or(0),
+                          breakpoint_hits_, stopped_at_hit_});
+  PR(INFO) << "Checkpoint " << std::dec << checkpoints_.back().number
+           << ": pid " << pid.value();
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::RemoveCheckpoint(std::size_t number) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = std::find_if(
+      checkpoints_.begin(), checkpoints_.end(),
+      [&](const Checkpoint& c) { return c.number == number; });
+  if (it == checkpoints_.end()) {
+    PR(ERROR) << "No checkpoint " << std::dec << number;
+    return StatusType::kBadInput;
+  }
+  kill(it->pid, SIGKILL);
+  utils::WaitPid(it->pid, nullptr, __WALL);
+  MemoryOperator::CloseMemory(it->pid);
+  checkpoints_.erase(it);
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::ShowCheckpoints() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (checkpoints_.empty()) {
+    PR(INFO) << "No checkpoints";
+    return StatusType::kSuccess;
+  }
+  symbolizer_.Load(IsRunning() ? pid_ : checkpoints_.front().pid);
+  for (const auto& checkpoint : checkpoints_) {
+    std::ostringstream oss;
+    oss << std::dec << checkpoint.number << ": pid " << checkpoint.pid
+        << " at " << symbolizer_.Symbolize(checkpoint.pc) << ", "
+        << checkpoint.hits << " breakpoint hits";
+    PR(RAW) << oss.str();
+  }
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::Restart(std::size_t number) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = std::find_if(
+      checkpoints_.begin(), checkpoints_.end(),
+      [&](const Checkpoint& c) { return c.number == number; });
+  if (it == checkpoints_.end()) {
+    PR(ERROR) << "No checkpoint " << std::dec << number;
+    return StatusType::kBadInput;
+  }
+  if (!SwitchTo(*it)) {
+    return StatusType::kFailed;
+  }
+  PR(INFO) << "Restarted checkpoint " << std::dec << number << ": pid "
+           << pid_;
+  PrintSourceLine(it->pc);
+  PrintDisplays();
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::ReverseContinue() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // Stopped at a hit, the one before it. Otherwise the last one
+  auto target = breakpoint_hits_ - (stopped_at_hit_ ? 1 : 0);
+  if (target == 0) {
+    PR(ERROR) << "No earlier breakpoint hit";
+    return StatusType::kFailed;
+  }
+  const Checkpoint* best = nullptr;
+  for (const auto& checkpoint : checkpoints_) {
+    bool before = checkpoint.hits < target ||
+                  (checkpoint.hits == target && checkpoint.at_hit);
+    if (before && (best == nullptr || checkpoint.hits > best->hits ||
+                   (checkpoint.hits == best->hits && checkpoint.at_hit))) {
+      best = &checkpoint;
+    }
+  }
+  if (best == nullptr) {
+    PR(ERROR) << "No checkpoint before breakpoint hit " << std::dec << target;
+    return StatusType::kFailed;
+  }
+  if (!SwitchTo(*best)) {
+    return StatusType::kFailed;
+  }
+  auto reason = StopReason::kBreakpoint;
+  while (breakpoint_hits_ < target) {
+    reason = Resume(PTRACE_CONT);
+    if (reason == StopReason::kExited) {
+      PR(ERROR) << "Process exited before breakpoint hit " << std::dec
+                << target << ", it did not run the same way";
+      return StatusType::kFailed;
+    }
+  }
+  ReportStop(reason);
+  auto pc = RegisterOperator::GetRegisterValue(tid_, Register::RIP);
+  if (pc.has_value()) {
+    PrintSourceLine(pc.value());
+  }
+  PrintDisplays();
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::GenerateCore(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  symbolizer_.Load(pid_);
+  std::vector<std::pair<std::uintptr_t, uint8_t>> patches;
+  for (uint32_t i = 0; i < breakpoints_.Size(); i++) {
+    if (breakpoints_.IsEnabled(i)) {
+      patches.emplace_back(breakpoints_.GetAddress(i),
+                           breakpoints_.GetOriginalData(i));
+    }
+  }
+  for (std::size_t i = 0; i < coverage_sites_.Size(); i++) {
+    if (coverage_sites_.IsPending(i)) {
+      patches.emplace_back(coverage_sites_.GetAddresses()[i],
+                           coverage_sites_.GetOriginalData(i));
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::optional<CoreDumpStats> stats;
+  {
+    ThreadStopper stopper(pid_, GetThreads());
+    // The main thread comes first
+    auto threads = stopper.GetThreads();
+    std::stable_partition(threads.begin(), threads.end(),
+                          [this](pid_t tid) { return tid == pid_; });
+    utils::ThreadPool pool;
+    stats = CoreDump::Write(path, pid_, threads, symbolizer_.GetRegions(),
+                            patches, pending_signal_, pool);
+  }
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  if (!stats.has_value()) {
+    PR(ERROR) << "Cannot write core file " << path;
+    return StatusType::kFailed;
+  }
+  PR(INFO) << "Saved core file " << path << ": " << std::dec
+           << stats->threads << " threads, " << stats->segments
+           << " segments, " << stats->memory_bytes / 1024 << " KB dumped, "
+           << stats->written_bytes / 1024 << " KB written, " << us / 1000
+           << " ms";
+  return StatusType::kSuccess;
+}
+
+std::optional<uint64_t> Debugger::CallFunction(
+    const std::string& function, const std::vector<std::string>& args) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return std::nullopt;
+  }
+  auto func = EvaluateAddress(function);
+  if (!func.has_value()) {
+    PR(ERROR) << "Unknown function " << function;
+    return std::nullopt;
+  }
+  std::vector<uint64_t> values;
+  for (const auto& arg : args) {
+    // Decimal, 0x hex or octal numbers, else an address expression
+    auto text = utils::trim(arg);
+    std::optional<uint64_t> value;
+    try {
+      std::size_t end = 0;
+      auto number = std::stoll(text, &end, 0);
+      if (end == text.size()) {
+        value = number;
+      }
+    } catch (const std::exception&) {
+    }
+    if (!value.has_value()) {
+      value = EvaluateAddress(text);
+    }
+    if (!value.has_value()) {
+      PR(ERROR) << "Bad argument " << arg;
+      return std::nullopt;
+    }
+    values.push_back(value.value());
+  }
+  if (call_stub_ == 0) {
+    int signal = 0;
+    auto stub = FunctionCaller::InjectStub(pid_, &signal);
+    KeepSignal(pid_, signal);
+    if (!stub.has_value()) {
+      PR(ERROR) << "Cannot map the call stub";
+      return std::nullopt;
+    }
+    call_stub_ = stub.value();
+  }
+
+  // Everything the call may change, put back afterwards
+  user_regs_struct regs;
+  if (utils::Ptrace(PTRACE_GETREGS, tid_, nullptr, &regs) == -1) {
+    PR(ERROR) << "Failed to get registers";
+    return std::nullopt;
+  }
+  call_xstate_.resize(kMaxXstateSize);
+  iovec xstate{call_xstate_.data(), call_xstate_.size()};
+  bool has_xstate =
+      utils::Ptrace(PTRACE_GETREGSET, tid_, NT_X86_XSTATE, &xstate) == 0;
+  user_fpregs_struct fpregs;
+  if (!has_xstate) {
+    utils::Ptrace(PTRACE_GETFPREGS, tid_, nullptr, &fpregs);
+  }
+  auto signal = std::exchange(pending_signal_, 0);
+  auto hits = breakpoint_hits_;
+  auto at_hit = stopped_at_hit_;
+  if (!FunctionCaller::SetUpCall(tid_, regs, call_stub_, func.value(),
+                                 values)) {
+    PR(ERROR) << "Cannot set up the call";
+    utils::Ptrace(PTRACE_SETREGS, tid_, nullptr, &regs);
+    pending_signal_ = signal;
+    return std::nullopt;
+  }
+
+  // The other threads stay stopped, as they were
+  auto reason = Resume(PTRACE_CONT, false);
+  if (reason == StopReason::kExited) {
+    ReportStop(reason);
+    return std::nullopt;
+  }
+  std::optional<uint64_t> result;
+  user_regs_struct after;
+  utils::Ptrace(PTRACE_GETREGS, tid_, nullptr, &after);
+  if (reason == StopReason::kStep && FunctionCaller::IsReturn(after,
+                                                              call_stub_)) {
+    result = after.rax;
+  } else {
+    symbolizer_.Load(pid_);
+    PR(WARNING) << "The call stopped at " << symbolizer_.Symbolize(after.rip)
+                << (reason == StopReason::kSignal
+                        ? " by signal " + std::to_string(pending_signal_)
+                        : "")
+                << ", registers are put back";
+  }
+  utils::Ptrace(PTRACE_SETREGS, tid_, nullptr, &regs);
+  if (has_xstate) {
+    utils::Ptrace(PTRACE_SETREGSET, tid_, NT_X86_XSTATE, &xstate);
+  } else {
+    utils::Ptrace(PTRACE_SETFPREGS, tid_, nullptr, &fpregs);
+  }
+  pending_signal_ = signal;
+  breakpoint_hits_ = hits;
+  stopped_at_hit_ = at_hit;
+  memory_cache_.Invalidate();
+
+  if (result.has_value()) {
+    PR(INFO) << function << " returned 0x" << std::hex << result.value()
+             << " (" << std::dec << static_cast<int64_t>(result.value())
+             << ")";
+  }
+  return result;
+}
+
+StatusType Debugger::LoadCore(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto start = std::chrono::steady_clock::now();
+  core_ = CoreTarget::Open(path);
+  if (core_ == nullptr) {
+    PR(ERROR) << "Cannot read core file " << path;
+    return StatusType::kFailed;
+  }
+  symbolizer_.Load(core_->GetRegions());
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  PR(INFO) << "Loaded core file " << path << " of pid " << std::dec
+           << core_->GetPid() << ": " << core_->GetThreads().size()
+           << " threads, " << core_->GetRegions().size() << " segments, "
+           << us / 1000 << " ms";
+  if (core_->GetSignal() != 0) {
+    PR(INFO) << "Terminated by signal " << core_->GetSignal() << " ("
+             << strsignal(core_->GetSignal()) << ")";
+  }
+  auto regs = core_->GetRegisters(core_->GetPid());
+  PR(INFO) << "Stopped at " << symbolizer_.Symbolize(regs->rip);
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::ExamineMemory(const std::string& expr,
+                                   std::size_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto target = GetTarget();
+  if (target == nullptr) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  auto addr = EvaluateAddress(expr);
+  if (!addr.has_value() || count == 0 || count > kMaxDisplayBytes) {
+    PR(ERROR) << "Bad memory expression " << expr;
+    return StatusType::kBadInput;
+  }
+  std::vector<uint8_t> bytes;
+  if (IsRunning()) {
+    bytes = ReadCode(addr.value(), count);
+  } else {
+    bytes.resize(count);
+    bytes.resize(target->ReadMemory(addr.value(), bytes.data(), count));
+  }
+  if (bytes.empty()) {
+    PR(ERROR) << "Cannot access memory at 0x" << std::hex << addr.value();
+    return StatusType::kFailed;
+  }
+
+  for (std::size_t i = 0; i < bytes.size(); i += 16) {
+    auto line = std::min<std::size_t>(16, bytes.size() - i);
+    std::ostringstream oss;
+    oss << "0x" << std::hex << std::setfill('0') << std::setw(16)
+        << addr.value() + i << ":";
+    for (std::size_t j = 0; j < 16; j++) {
+      if (j < line) {
+        oss << " " << std::setw(2) << static_cast<int>(bytes[i + j]);
+      } else {
+        oss << "   ";
+      }
+    }
+    oss << "  ";
+    for (std::size_t j = 0; j < line; j++) {
+      auto c = static_cast<char>(bytes[i + j]);
+      oss << (std::isprint(bytes[i + j]) ? c : '.');
+    }
+    PR(RAW) << oss.str();
+  }
+  if (bytes.size() < count) {
+    PR(WARNING) << "Cannot access memory at 0x" << std::hex
+                << addr.value() + bytes.size();
+  }
+  return StatusType::kSuccess;
+}
+
+StatusType Debugger::ShowThreads() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto target = GetTarget();
+  if (target == nullptr) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  LoadSymbols();
+  // Threads we do not trace yet are stopped for as long as their registers
+  // are read
+  std::optional<ThreadStopper> stopper;
+  if (IsRunning()) {
+    stopper.emplace(pid_, GetThreads());
+  }
+  for (auto tid : target->GetThreads()) {
+    auto regs = target->GetRegisters(tid);
+    std::ostringstream oss;
+    oss << (tid == target->GetCurrentThread() ? "* " : "  ") << std::dec
+        << tid;
+    if (regs.has_value()) {
+      oss << " 0x" << std::hex << std::setfill('0') << std::setw(16)
+          << regs->rip << " in " << symbolizer_.Symbolize(regs->rip);
+    } else {
+      oss << " <registers unavailable>";
+    }
+    PR(RAW) << oss.str();
+  }
+  return StatusType::kSuccess;
+}
+
+void Debugger::ReportStop(StopReason reason) {
+  // Which thread, once there is more than one
+  std::string thread;
+  if (threads_.size() > 1) {
+    thread = " in thread " + std::to_string(tid_);
+  }
+  switch (reason) {
+    case StopReason::kExited:
+      // A crash must not read like a clean exit
+      if (WIFSIGNALED(exit_status_)) {
+        PR(INFO) << "Process killed by signal " << std::dec
+                 << WTERMSIG(exit_status_) << " ("
+                 << strsignal(WTERMSIG(exit_status_)) << ")";
+      } else {
+        PR(INFO) << "Process exited with code " << std::dec
+                 << WEXITSTATUS(exit_status_);
+      }
+      break;
+    case StopReason::kBreakpoint: {
+      auto pc = RegisterOperator::GetRegisterValue(tid_, Register::RIP);
+      PR(INFO) << "Hit breakpoint at 0x" << std::hex << pc.value_or(0)
+               << thread;
+    } break;
+    case StopReason::kSignal:
+      PR(INFO) << "Process stopped by signal " << std::dec << pending_signal_
+               << thread;
+      break;
+    case StopReason::kStep:
+      PR(INFO) << "Process stopped" << thread;
+      break;
+  }
+}
+
+Debugger::StopReason Debugger::Resume(__ptrace_request request,
+                                      bool all_threads) {
+  memory_cache_.Invalidate();
+  stopped_at_hit_ = false;
+  auto signal = static_cast<long>(std::exchange(pending_signal_, 0));
+  auto pc = RegisterOperator::GetRegisterValue(tid_, Register::RIP);
+  auto bp = pc.has_value() ? breakpoints_.Find(pc.value())
+                          : BreakPointTable::kNotFound;
+  if (bp != BreakPointTable::kNotFound && breakpoints_.IsEnabled(bp)) {
+    // Run the original instruction with the int3 lifted, the other threads
+    // stay stopped so that none of them runs past it. Stepping requests
+    // keep their granularity, a continue goes on after one instruction
+    breakpoints_.Disable(bp);
+    auto step = request == PTRACE_CONT ? PTRACE_SINGLESTEP : request;
+    utils::Ptrace(step, tid_, nullptr, signal);
+    running_threads_.insert(tid_);
+    auto reason = WaitStop(step);
+    if (IsRunning()) {
+      breakpoints_.Enable(bp);
+    }
+    if (request != PTRACE_CONT || reason != StopReason::kStep) {
+      return reason;
+    }
+    signal = 0;
+  }
+  if (request == PTRACE_CONT && all_threads) {
+    all_threads_running_ = true;
+    for (auto tid : threads_) {
+      if (tid == tid_ || running_threads_.count(tid) != 0) {
+        continue;
+      }
+      auto it = thread_signals_.find(tid);
+      long sig = it == thread_signals_.end() ? 0 : it->second;
+      if (it != thread_signals_.end()) {
+        thread_signals_.erase(it);
+      }
+      utils::Ptrace(PTRACE_CONT, tid, nullptr, sig);
+      running_threads_.insert(tid);
+    }
+  }
+  utils::Ptrace(request, tid_, nullptr, signal);
+  running_threads_.insert(tid_);
+  return WaitStop(request);
+}
+
+Debugger::StopReason Debugger::WaitStop(__ptrace_request request) {
+  auto resumed = event_trace_ != nullptr
+                     ? std::chrono::steady_clock::now()
+                     : std::chrono::steady_clock::time_point{};
+  // Threads other than the current one only run along with a continue
+  auto restart = [&](pid_t tid) {
+    utils::Ptrace(tid == tid_ ? request : PTRACE_CONT, tid, nullptr, 0);
+    running_threads_.insert(tid);
+  };
+  // The thread of a reported stop becomes the current one
+  auto stop_at = [&](pid_t tid) {
+    tid_ = tid;
+    StopAll();
+  };
+  while (true) {
+    int wait_status;
+    auto tid = utils::WaitPid(-1, &wait_status, __WALL);
+    if (tid == -1) {
+      // Nothing left to wait for, the process was reaped meanwhile
+      TraceStop(EventType::kExit, resumed, 0, exit_status_);
+      SetStop();
+      return StopReason::kExited;
+    }
+    // Until the stop is reported, or the process resumed past a coverage site
+    utils::ScopedSyscallTimer handling(utils::SyscallOp::kStopHandling);
+    if (threads_.count(tid) == 0) {
+      // A new thread may stop before its creation is reported. Anything
+      // else is not ours, e.g. a checkpoint
+      if (!WIFSTOPPED(wait_status) || tid == pid_ ||
+          !std::filesystem::exists("/proc/" + std::to_string(pid_) +
+                                   "/task/" + std::to_string(tid))) {
+        continue;
+      }
+      AddThread(tid);
+    }
+    running_threads_.erase(tid);
+    if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) {
+      if (tid != pid_) {
+        // The main thread is reaped last, once every other one is
+        TraceStop(EventType::kThreadExit, resumed, 0, wait_status, tid);
+        RemoveThread(tid);
+        if (tid == tid_ && !all_threads_running_) {
+          // Stepped through its exit, nothing else runs
+          stop_at(pid_);
+          return StopReason::kStep;
+        }
+        continue;
+      }
+      exit_status_ = wait_status;
+      TraceStop(EventType::kExit, resumed, 0, wait_status);
+      SetStop();
+      return StopReason::kExited;
+    }
+    if (wait_status >> 16 == PTRACE_EVENT_CLONE) {
+      unsigned long new_tid = 0;
+      utils::Ptrace(PTRACE_GETEVENTMSG, tid, nullptr, &new_tid);
+      AddThread(static_cast<pid_t>(new_tid));
+      TraceStop(EventType::kClone, resumed, 0, static_cast<int>(new_tid),
+                tid);
+      restart(tid);
+      continue;
+    }
+    auto signal = WSTOPSIG(wait_status);
+    if (signal == SIGSTOP && initial_stops_.erase(tid) != 0) {
+      debug_registers_.AddThread(tid);
+      if (all_threads_running_) {
+        restart(tid);
+      }
+      continue;
+    }
+    if (signal != SIGTRAP) {
+      stop_at(tid);
+      pending_signal_ = signal;
+      if (event_trace_ != nullptr) {
+        auto pc = RegisterOperator::GetRegisterValue(tid_, Register::RIP);
+        TraceStop(EventType::kSignal, resumed, pc.value_or(0), signal);
+      }
+      return StopReason::kSignal;
+    }
+    siginfo_t info{};
+    utils::Ptrace(PTRACE_GETSIGINFO, tid, nullptr, &info);
+    auto pc = RegisterOperator::GetRegisterValue(tid, Register::RIP);
+    if (info.si_code != SI_KERNEL || !pc.has_value()) {
+      stop_at(tid);
+      TraceStop(EventType::kStep, resumed, pc.value_or(0), info.si_code);
+      return StopReason::kStep;
+    }
+    // int3 leaves the pc after itself
+    auto addr = static_cast<std::intptr_t>(pc.value() - 1);
+    if (module_hook_ != 0 && static_cast<std::uintptr_t>(addr) ==
+                                 module_hook_) {
+      // The module list changed, pending locations may resolve now
+      RegisterOperator::SetRegisterValue(tid, Register::RIP, addr);
+      bool all_threads = all_threads_running_;
+      stop_at(tid);
+      InstallBreakPoints(false);
+      if (request != PTRACE_CONT) {
+        return StopReason::kStep;
+      }
+      return Resume(PTRACE_CONT, all_threads);
+    }
+    auto bp = breakpoints_.Find(addr);
+    bool is_user =
+        bp != BreakPointTable::kNotFound && breakpoints_.IsEnabled(bp);
+    bool is_temporary = temp_breakpoints_.IsInstalled() &&
+                        temp_breakpoints_.Contains(addr);
+    if (is_user || is_temporary) {
+      RegisterOperator::SetRegisterValue(tid, Register::RIP, addr);
+      stop_at(tid);
+      if (is_user) {
+        breakpoints_.RecordHit(bp);
+        breakpoint_hits_++;
+        stopped_at_hit_ = true;
+      }
+      TraceStop(EventType::kBreakpoint, resumed, addr,
+                is_user ? static_cast<int>(bp) : -1);
+      return StopReason::kBreakpoint;
+    }
+    if (!coverage_sites_.Hit(addr, tid)) {
+      stop_at(tid);
+      TraceStop(EventType::kStep, resumed, pc.value(), info.si_code);
+      return StopReason::kStep;
+    }
+    // A coverage site, run the original instruction as if nothing happened
+    TraceStop(EventType::kCoverage, resumed, addr, 0);
+    RegisterOperator::SetRegisterValue(tid, Register::RIP, addr);
+    restart(tid);
+    resumed = event_trace_ != nullptr ? std::chrono::steady_clock::now()
+                                      : std::chrono::steady_clock::time_point{};
+  }
+}
+
+void Debugger::StopAll() {
+  auto stopping = event_trace_ != nullptr
+                      ? std::chrono::steady_clock::now()
+                      : std::chrono::steady_clock::time_point{};
+  all_threads_running_ = false;
+  // New threads stop on their own
+  for (auto tid : running_threads_) {
+    if (initial_stops_.count(tid) == 0) {
+      syscall(SYS_tgkill, pid_, tid, SIGSTOP);
+    }
+  }
+  while (!running_threads_.empty()) {
+    int wait_status;
+    auto tid = utils::WaitPid(-1, &wait_status, __WALL);
+    if (tid == -1) {
+      running_threads_.clear();
+      break;
+    }
+    if (threads_.count(tid) == 0) {
+      if (!WIFSTOPPED(wait_status) || tid == pid_ ||
+          !std::filesystem::exists("/proc/" + std::to_string(pid_) +
+                                   "/task/" + std::to_string(tid))) {
+        continue;
+      }
+      AddThread(tid);
+    }
+    running_threads_.erase(tid);
+    if (WIFEXITED(wait_status) || WIFSIGNALED(wait_status)) {
+      if (tid == pid_) {
+        // Taken for the exit of the process on the next resume
+        exit_status_ = wait_status;
+      } else {
+        TraceStop(EventType::kThreadExit, stopping, 0, wait_status, tid);
+      }
+      RemoveThread(tid);
+      continue;
+    }
+    auto signal = WSTOPSIG(wait_status);
+    if (wait_status >> 16 == PTRACE_EVENT_CLONE) {
+      unsigned long new_tid = 0;
+      utils::Ptrace(PTRACE_GETEVENTMSG, tid, nullptr, &new_tid);
+      AddThread(static_cast<pid_t>(new_tid));
+      TraceStop(EventType::kClone, stopping, 0, static_cast<int>(new_tid),
+                tid);
+    } else if (signal == SIGSTOP) {
+      // Ours, or the first stop of a new thread
+      if (initial_stops_.erase(tid) != 0) {
+        debug_registers_.AddThread(tid);
+      }
+      continue;
+    } else if (signal == SIGTRAP) {
+      // One of our int3s is hit again once the thread resumes, anything else
+      // (a step of another thread) is dropped
+      siginfo_t info{};
+      utils::Ptrace(PTRACE_GETSIGINFO, tid, nullptr, &info);
+      auto pc = RegisterOperator::GetRegisterValue(tid, Register::RIP);
+      if (info.si_code == SI_KERNEL && pc.has_value()) {
+        auto addr = static_cast<std::intptr_t>(pc.value() - 1);
+        auto bp = breakpoints_.Find(addr);
+        if ((bp != BreakPointTable::kNotFound && breakpoints_.IsEnabled(bp)) ||
+            (temp_breakpoints_.IsInstalled() &&
+             temp_breakpoints_.Contains(addr)) ||
+            coverage_sites_.Hit(addr, tid)) {
+          RegisterOperator::SetRegisterValue(tid, Register::RIP, addr);
+        }
+      }
+    } else {
+      thread_signals_[tid] = signal;
+    }
+    // Our SIGSTOP is still pending
+    utils::Ptrace(PTRACE_CONT, tid, nullptr, 0);
+    running_threads_.insert(tid);
+  }
+}
+
+void Debugger::AddThread(pid_t tid) {
+  if (threads_.insert(tid).second) {
+    initial_stops_.insert(tid);
+    running_threads_.insert(tid);
+  }
+}
+
+void Debugger::RemoveThread(pid_t tid) {
+  threads_.erase(tid);
+  debug_registers_.RemoveThread(tid);
+  running_threads_.erase(tid);
+  initial_stops_.erase(tid);
+  thread_signals_.erase(tid);
+}
+
+void Debugger::KillProcess() {
+  kill(pid_, SIGKILL);
+  // Every thread reports its exit, the main thread last
+  for (auto tid : threads_) {
+    if (tid != pid_) {
+      utils::WaitPid(tid, nullptr, __WALL);
+    }
+  }
+  utils::WaitPid(pid_, nullptr, __WALL);
+  MemoryOperator::CloseMemory(pid_);
+  threads_.clear();
+  running_threads_.clear();
+  initial_stops_.clear();
+  thread_signals_.clear();
+}
+
+void Debugger::KeepSignal(pid_t tid, int signal) {
+  if (signal == 0) {
+    return;
+  }
+  auto& due = tid == tid_ ? pending_signal_ : thread_signals_[tid];
+  if (due == 0) {
+    due = signal;
+  } else {
+    syscall(SYS_tkill, tid, signal);
+  }
+}
+
+std::optional<long> Debugger::InjectSyscall(
+    long nr, const std::array<uint64_t, 6>& args) {
+  int signal = 0;
+  auto result = SyscallInjector::Call(pid_, nr, args, &signal);
+  KeepSignal(pid_, signal);
+  return result;
+}
+
+void Debugger::TraceStop(EventType type,
+                         std::chrono::steady_clock::time_point resumed,
+                         uint64_t pc, int value, pid_t tid) {
+  if (event_trace_ == nullptr) {
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  auto ns = [](std::chrono::steady_clock::duration d) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+  };
+  event_trace_->Append({ns(now - event_trace_start_), ns(now - resumed), pc,
+                        tid == 0 ? tid_ : tid, type, value, 0});
+}
+
+Debugger::StopReason Debugger::RunTo(std::uintptr_t addr, uint64_t min_sp) {
+  bool temporary = breakpoints_.Find(addr) == BreakPointTable::kNotFound;
+  auto bp = breakpoints_.Add(addr);
+  bool was_enabled = breakpoints_.IsEnabled(bp);
+  breakpoints_.Enable(bp);
+  auto thread = tid_;
+
+  StopReason reason;
+  while (true) {
+    reason = Resume(PTRACE_CONT);
+    if (reason != StopReason::kBreakpoint) {
+      break;
+    }
+    auto regs = RegisterOperator::GetRegisters(tid_);
+    if (!regs.has_value() || regs->at(Register::RIP) != addr) {
+      break;
+    }
+    if (tid_ != thread && was_enabled) {
+      break;
+    }
+    if (!was_enabled) {
+      // Our own stop, not one of the user's breakpoints
+      breakpoint_hits_--;
+      stopped_at_hit_ = false;
+    }
+    // Another thread passing by goes on, stepped over the breakpoint first
+    if (tid_ == thread && regs->at(Register::RSP) >= min_sp) {
+      reason = StopReason::kStep;
+      break;
+    }
+  }
+
+  if (IsRunning() && !was_enabled) {
+    breakpoints_.Disable(bp);
+  }
+  if (temporary) {
+    breakpoints_.Remove(bp);
+  }
+  return reason;
+}
+
+std::vector<uint8_t> Debugger::ReadCode(std::uintptr_t addr,
+                                        std::size_t len) {
+  std::vector<uint8_t> code(len);
+  code.resize(ReadCode(addr, code.data(), len));
+  return code;
+}
+
+std::size_t Debugger::ReadCode(std::uintptr_t addr, void* buf,
+                               std::size_t len) {
+  auto size = memory_cache_.Read(addr, buf, len);
+  auto* code = static_cast<uint8_t*>(buf);
+  // Show the instructions under our int3s. Large reads walk the breakpoints
+  // rather than look up every byte
+  auto patch = [&](uint32_t bp) {
+    if (bp != BreakPointTable::kNotFound && breakpoints_.IsEnabled(bp)) {
+      code[breakpoints_.GetAddress(bp) - addr] =
+          breakpoints_.GetOriginalData(bp);
+    }
+  };
+  if (size > breakpoints_.Size()) {
+    const auto& addrs = breakpoints_.GetAddresses();
+    for (std::size_t i = 0; i < addrs.size(); i++) {
+      if (static_cast<std::uintptr_t>(addrs[i]) - addr < size) {
+        patch(i);
+      }
+    }
+  } else {
+    for (std::size_t i = 0; i < size; i++) {
+      patch(breakpoints_.Find(addr + i));
+    }
+  }
+  if (coverage_sites_.IsInstalled()) {
+    const auto& sites = coverage_sites_.GetAddresses();
+    for (auto it = std::lower_bound(sites.begin(), sites.end(),
+                                    static_cast<std::intptr_t>(addr));
+         it != sites.end() && static_cast<std::uintptr_t>(*it) < addr + size;
+         ++it) {
+      auto index = it - sites.begin();
+      if (coverage_sites_.IsPending(index)) {
+        code[*it - addr] = coverage_sites_.GetOriginalData(index);
+      }
+    }
+  }
+  return size;
+}
+
+StatusType Debugger::PrintInstructions(std::uintptr_t addr,
+                                       std::size_t count) {
+  symbolizer_.Load(pid_);
+  // One read for the whole listing
+  auto code = ReadCode(addr, count * kMaxInstructionLength);
+  if (code.empty()) {
+    PR(ERROR) << "Cannot read memory at 0x" << std::hex << addr;
+    return StatusType::kFailed;
+  }
+
+  auto pc = RegisterOperator::GetRegisterValue(tid_, Register::RIP);
+  std::size_t offset = 0;
+  for (std::size_t i = 0; i < count && offset < code.size(); i++) {
+    auto insn_addr = addr + offset;
+    Instruction insn;
+    std::string text;
+    std::size_t len = 1;
+    if (X86Decoder::Decode(code.data() + offset, code.size() - offset,
+                           insn_addr, insn)) {
+      text = X86Decoder::Format(insn);
+      len = insn.length;
+      bool has_target = insn.HasDirectTarget() || insn.rip_relative;
+      if (has_target && symbolizer_.FindSymbol(insn.target).has_value()) {
+        text += "  <" + symbolizer_.Symbolize(insn.target) + ">";
+      }
+    } else {
+      text = "(bad)";
+    }
+
+    std::ostringstream oss;
+    oss << (pc.has_value() && insn_addr == pc.value() ? "=> " : "   ") << "0x"
+        << std::hex << std::setfill('0') << std::setw(16) << insn_addr
+        << "  ";
+    std::ostringstream bytes;
+    for (std::size_t j = 0; j < len; j++) {
+      bytes << std::hex << std::setfill('0') << std::setw(2)
+            << static_cast<int>(code[offset + j]) << " ";
+    }
+    oss << std::left << std::setfill(' ') << std::setw(30) << bytes.str()
+        << text;
+    PR(RAW) << oss.str();
+    offset += len;
+  }
+  return StatusType::kSuccess;
+}
+
+void Debugger::Quit() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  PR(INFO) << "Quitting";
+  if (IsRunning()) {
+    // A stopped tracee would only see a SIGTERM once resumed, and stay
+    // around until we exit
+    KillProcess();
+    SetStop();
+  }
+  KillCheckpoints();
+}
+
+std::size_t Debugger::ReadMemory(std::uintptr_t addr, void* buf,
+                                 std::size_t len) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return IsRunning() ? ReadCode(addr, buf, len) : 0;
+}
+
+std::size_t Debugger::WriteMemory(std::uintptr_t addr, const void* buf,
+                                  std::size_t len) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    return 0;
+  }
+  std::vector<uint32_t> covered;
+  const auto& addrs = breakpoints_.GetAddresses();
+  for (uint32_t i = 0; i < addrs.size(); i++) {
+    if (static_cast<std::uintptr_t>(addrs[i]) - addr < len &&
+        breakpoints_.IsEnabled(i)) {
+      covered.push_back(i);
+    }
+  }
+  // Lifted around the write, enabling saves the new bytes
+  breakpoints_.SetEnabled(covered, false);
+  auto written = memory_cache_.Write(addr, buf, len);
+  breakpoints_.SetEnabled(covered, true);
+  return written;
+}
+
+bool Debugger::ReadRegisterSets(user_regs_struct* regs,
+                                user_fpregs_struct* fpregs) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return IsRunning() &&
+         utils::Ptrace(PTRACE_GETREGS, tid_, nullptr, regs) == 0 &&
+         utils::Ptrace(PTRACE_GETFPREGS, tid_, nullptr, fpregs) == 0;
+}
+
+bool Debugger::WriteRegisterSets(const user_regs_struct& regs,
+                                 const user_fpregs_struct& fpregs) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return IsRunning() &&
+         utils::Ptrace(PTRACE_SETREGS, tid_, nullptr, &regs) == 0 &&
+         utils::Ptrace(PTRACE_SETFPREGS, tid_, nullptr, &fpregs) == 0;
+}
+
+bool Debugger::InsertBreakPoint(std::uintptr_t addr) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return IsRunning() && breakpoints_.Enable(breakpoints_.Add(addr));
+}
+
+bool Debugger::RemoveBreakPoint(std::uintptr_t addr) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto bp = breakpoints_.Find(addr);
+  if (!IsRunning() || bp == BreakPointTable::kNotFound) {
+    return false;
+  }
+  breakpoints_.Remove(bp);
+  return true;
+}
+
+bool Debugger::InsertWatchPoint(std::uintptr_t addr, std::size_t len,
+                                WatchKind kind) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return IsRunning() && debug_registers_.Insert(addr, len, kind);
+}
+
+bool Debugger::RemoveWatchPoint(std::uintptr_t addr, std::size_t len,
+                                WatchKind kind) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return IsRunning() && debug_registers_.Remove(addr, len, kind);
+}
+
+Debugger::StopInfo Debugger::RunUntilStop(bool step, int signal) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  StopInfo info{std::nullopt, 0, false, std::nullopt};
+  if (!IsRunning()) {
+    info.exit_status = exit_status_;
+    return info;
+  }
+  pending_signal_ = signal;
+  switch (Resume(step ? PTRACE_SINGLESTEP : PTRACE_CONT)) {
+    case StopReason::kExited:
+      info.exit_status = exit_status_;
+      break;
+    case StopReason::kSignal:
+      // The frontend decides whether it is delivered
+      info.signal = std::exchange(pending_signal_, 0);
+      break;
+    case StopReason::kBreakpoint:
+      info.signal = SIGTRAP;
+      info.breakpoint = true;
+      break;
+    case StopReason::kStep:
+      info.signal = SIGTRAP;
+      info.hit = debug_registers_.TakeHit(tid_);
+      break;
+  }
+  return info;
+}
+
+void Debugger::Detach() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (!IsRunning()) {
+    return;
+  }
+  std::vector<uint32_t> all(breakpoints_.Size());
+  std::iota(all.begin(), all.end(), 0);
+  breakpoints_.SetEnabled(all, false);
+  if (coverage_sites_.IsInstalled()) {
+    coverage_sites_.Remove();
+  }
+  debug_registers_.Clear();
+  KillCheckpoints();
+  for (auto tid : threads_) {
+    long sig = 0;
+    if (tid == tid_) {
+      sig = std::exchange(pending_signal_, 0);
+    } else if (thread_signals_.count(tid) != 0) {
+      sig = thread_signals_[tid];
+    }
+    utils::Ptrace(PTRACE_DETACH, tid, nullptr, sig);
+  }
+  SetStop();
+}
+
+Debugger::BreakPointLocation Debugger::LocateAddress(
+    std::uintptr_t addr) const {
+  const auto* region = utils::FindMemoryRegion(symbolizer_.GetRegions(), addr);
+  if (region == nullptr || !region->IsFileBacked()) {
+    return {"", "", addr};
+  }
+  // A function entry by name, so that it survives a rebuild
+  auto symbol = symbolizer_.FindSymbol(addr);
+  if (symbol.has_value() && symbol->address == addr) {
+    return {std::string(symbol->name), "", 0};
+  }
+  auto bias = symbolizer_.GetLoadBias(region->path);
+  if (!bias.has_value()) {
+    return {"", "", addr};
+  }
+  return {"", region->path, addr - bias.value()};
+}
+
+std::optional<std::uintptr_t> Debugger::ResolveLocation(
+    const BreakPointLocation& location) const {
+  if (!location.symbol.empty()) {
+    auto addr = symbolizer_.LookupAddress(location.symbol);
+    return addr.has_value() ? std::optional(addr.value() + location.offset)
+                            : std::nullopt;
+  }
+  if (location.module.empty()) {
+    return location.offset;
+  }
+  auto bias = symbolizer_.GetLoadBias(location.module);
+  return bias.has_value() ? std::optional(location.offset + bias.value())
+                          : std::nullopt;
+}
+
+std::string Debugger::FormatLocation(
+    const BreakPointLocation& location) const {
+  std::ostringstream oss;
+  if (!location.symbol.empty()) {
+    oss << location.symbol;
+    if (location.offset != 0) {
+      oss << "+0x" << std::hex << location.offset;
+    }
+  } else {
+    oss << "0x" << std::hex << location.offset;
+    if (!location.module.empty()) {
+      oss << " in "
+          << std::filesystem::path(location.module).filename().string();
+    }
+  }
+  return oss.str();
+}
+
+StatusType Debugger::AddBreakPoint(std::intptr_t addr) {
+  if (!IsRunning()) {
+    return AddBreakPoint({"", "", static_cast<uint64_t>(addr)});
+  }
+  auto base_load_addr = utils::GetProcessLoadAddress(pid_);
+  if (addr < base_load_addr) {
+    PR(WARNING) << "Address 0x" << std::hex << addr << " is not in the program";
+    addr += base_load_addr;
+    PR(WARNING) << "Try to plus the base load address 0x" << std::hex
+                << base_load_addr << ", get 0x" << std::hex << addr;
+  }
+  symbolizer_.Load(pid_);
+  return AddBreakPoint(LocateAddress(addr));
+}
+
+StatusType Debugger::AddBreakPoint(const BreakPointLocation& location) {
+  auto addr = IsRunning() ? ResolveLocation(location) : std::nullopt;
+  bool known = std::find(breakpoint_locations_.begin(),
+                         breakpoint_locations_.end(),
+                         location) != breakpoint_locations_.end();
+  if (addr.has_value() &&
+      breakpoints_.Find(addr.value()) != BreakPointTable::kNotFound) {
+    known = true;
+  }
+  if (known) {
+    PR(INFO) << "Breakpoint at " << FormatLocation(location)
+             << " already exists";
+    return StatusType::kSuccess;
+  }
+  breakpoint_locations_.push_back(location);
+  if (!addr.has_value()) {
+    PR(INFO) << "Set breakpoint at " << FormatLocation(location)
+             << (IsRunning() ? ", pending until a module defines it"
+                             : ", pending until the program runs");
+    if (IsRunning()) {
+      InstallBreakPoints(false);
+    }
+    return StatusType::kSuccess;
+  }
+  PR(INFO) << "Set breakpoint at address 0x" << std::hex << addr.value();
+  breakpoints_.Enable(breakpoints_.Add(addr.value()));
+  memory_cache_.Invalidate();
+  return StatusType::kSuccess;
+}
+
+void Debugger::InstallBreakPoints(bool report) {
+  if (breakpoint_locations_.empty() || !IsRunning()) {
+    return;
+  }
+  LoadSymbols();
+  std::vector<uint32_t> indices;
+  std::vector<uint32_t> fresh;
+  std::vector<std::uintptr_t> addrs;
+  for (const auto& location : breakpoint_locations_) {
+    auto addr = ResolveLocation(location);
+    if (addr.has_value() &&
+        utils::FindMemoryRegion(symbolizer_.GetRegions(), addr.value())) {
+      auto index = breakpoints_.Add(addr.value());
+      indices.push_back(index);
+      addrs.push_back(addr.value());
+      if (!breakpoints_.IsEnabled(index)) {
+        fresh.push_back(index);
+      }
+    }
+  }
+  // All pages at once, or one by one when some cannot be patched
+  if (!breakpoints_.SetEnabled(fresh, true)) {
+    for (auto index : fresh) {
+      breakpoints_.Enable(index);
+    }
+  }
+  auto installed = std::count_if(
+      indices.begin(), indices.end(),
+      [this](uint32_t index) { return breakpoints_.IsEnabled(index); });
+  std::sort(fresh.begin(), fresh.end(), std::greater<>());
+  for (auto index : fresh) {
+    if (!breakpoints_.IsEnabled(index)) {
+      breakpoints_.Remove(index);
+    }
+  }
+
+  // The rest may come with a module loaded later
+  bool pending = addrs.size() < breakpoint_locations_.size();
+  if (pending && module_hook_ == 0) {
+    auto hook = symbolizer_.LookupAddress("_dl_debug_state");
+    if (hook.has_value() && breakpoints_.Enable(breakpoints_.Add(*hook))) {
+      module_hook_ = hook.value();
+    }
+  } else if (!pending && module_hook_ != 0) {
+    auto bp = breakpoints_.Find(module_hook_);
+    if (bp != BreakPointTable::kNotFound &&
+        std::find(addrs.begin(), addrs.end(), module_hook_) == addrs.end()) {
+      breakpoints_.Remove(bp);
+    }
+    module_hook_ = 0;
+  }
+  memory_cache_.Invalidate();
+  if (report || !fresh.empty()) {
+    PR(INFO) << std::dec << installed << " of "
+             << breakpoint_locations_.size() << " breakpoints installed";
+  }
+}
+
+std::shared_ptr<const Target> Debugger::GetTarget() const {
+  if (IsRunning()) {
+    return std::make_shared<ProcessTarget>(pid_, tid_);
+  }
+  return core_;
+}
+
+void Debugger::LoadSymbols() {
+  if (!IsRunning() && core_ != nullptr) {
+    symbolizer_.Load(core_->GetRegions());
+  } else {
+    symbolizer_.Load(pid_);
+  }
+}
+
+void Debugger::SetRun(pid_t pid) {
+  // A relaunch may get the pid of a process written to before
+  MemoryOperator::CloseMemory(pid);
+  module_hook_ = 0;
+  pid_ = pid;
+  tid_ = pid;
+  threads_ = {pid};
+  running_ = true;
+  utils::Ptrace(PTRACE_SETOPTIONS, pid, nullptr, kTraceOptions);
+  breakpoints_.Reset(pid);
+  coverage_sites_.Reset(pid);
+  debug_registers_.Reset(pid);
+  memory_cache_.Reset(pid);
+  snapshots_.clear();
+  last_snapshot_.reset();
+  breakpoint_hits_ = 0;
+  stopped_at_hit_ = false;
+  call_stub_ = 0;
+}
+
+bool Debugger::SwitchTo(const Checkpoint& checkpoint) {
+  auto pid = SyscallInjector::Fork(checkpoint.pid, PTRACE_O_EXITKILL);
+  if (!pid.has_value()) {
+    PR(ERROR) << "Cannot fork checkpoint " << std::dec << checkpoint.number;
+    return false;
+  }
+  if (IsRunning()) {
+    KillProcess();
+  }
+  pid_ = pid.value();
+  tid_ = pid_;
+  threads_ = {pid_};
+  running_ = true;
+  utils::Ptrace(PTRACE_SETOPTIONS, pid_, nullptr,
+                kTraceOptions | PTRACE_O_EXITKILL);
+  // The fork has the code of when the checkpoint was taken
+  breakpoints_.Reinstall(pid_);
+  coverage_sites_.Reinstall(pid_);
+  debug_registers_.Reinstall(pid_);
+  memory_cache_.Reset(pid_);
+  last_snapshot_.reset();
+  pending_signal_ = 0;
+  breakpoint_hits_ = checkpoint.hits;
+  stopped_at_hit_ = checkpoint.at_hit;
+  // The fork may predate the stub
+  call_stub_ = 0;
+  return true;
+}
+
+void Debugger::KillCheckpoints() {
+  for (const auto& checkpoint : checkpoints_) {
+    kill(checkpoint.pid, SIGKILL);
+    utils::WaitPid(checkpoint.pid, nullptr, __WALL);
+    MemoryOperator::CloseMemory(checkpoint.pid);
+  }
+  checkpoints_.clear();
+}
+
+void Debugger::SetStop() {
+  MemoryOperator::CloseMemory(pid_);
+  pid_ = 0;
+  tid_ = 0;
+  running_ = false;
+  threads_.clear();
+  running_threads_.clear();
+  initial_stops_.clear();
+  thread_signals_.clear();
+  all_threads_running_ = false;
+}
+
+void Debugger::PrintFrames(const std::vector<std::uintptr_t>& frames,
+                           const std::vector<std::string>& names) const {
+  for (std::size_t i = 0; i < frames.size(); i++) {
+    PR(RAW) << "#" << std::left << std::setw(3) << i << std::right << "0x"
+            << std::hex << std::setfill('0') << std::setw(16) << frames[i]
+            << " in " << names[i];
+  }
+}
+
+bool Debugger::IsRunning() const { return running_ && pid_ != 0; }
+
+pid_t Debugger::GetPid() const { return pid_; }
+
+pid_t Debugger::GetCurrentThread() const { return tid_; }
+
+bool Debugger::SelectThread(pid_t tid) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!IsRunning() || threads_.count(tid) == 0) {
+    return false;
+  }
+  if (tid == tid_) {
+    return true;
+  }
+  // The pending signal belongs to the thread which took it
+  if (pending_signal_ != 0) {
+    thread_signals_[tid_] = pending_signal_;
+  }
+  auto it = thread_signals_.find(tid);
+  pending_signal_ = it == thread_signals_.end() ? 0 : it->second;
+  if (it != thread_signals_.end()) {
+    thread_signals_.erase(it);
+  }
+  tid_ = tid;
+  return true;
+}
+
+std::vector<pid_t> Debugger::GetThreads() const {
+  return {threads_.begin(), threads_.end()};
+}
 
 }  // namespace shuidb
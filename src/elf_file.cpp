@@ -0,0 +1,219 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "elf_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace shuidb {
+
+std::shared_ptr<ElfFile> ElfFile::Open(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Elf64_Ehdr)) {
+    close(fd);
+    return nullptr;
+  }
+  auto* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+
+  std::shared_ptr<ElfFile> elf(
+      new ElfFile(path, static_cast<const uint8_t*>(data), st.st_size));
+  if (!elf->Parse()) {
+    return nullptr;
+  }
+  return elf;
+}
+
+ElfFile::~ElfFile() { munmap(const_cast<uint8_t*>(data_), size_); }
+
+bool ElfFile::Parse() {
+  const auto& ehdr = GetHeader();
+  if (std::memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+      ehdr.e_ident[EI_CLASS] != ELFCLASS64) {
+    return false;
+  }
+  if (ehdr.e_phoff + ehdr.e_phnum * sizeof(Elf64_Phdr) > size_ ||
+      ehdr.e_shoff + ehdr.e_shnum * sizeof(Elf64_Shdr) > size_) {
+    return false;
+  }
+  sections_ = {reinterpret_cast<const Elf64_Shdr*>(data_ + ehdr.e_shoff),
+               ehdr.e_shnum};
+
+  for (const auto& shdr : sections_) {
+    if (shdr.sh_type == SHT_SYMTAB || shdr.sh_type == SHT_DYNSYM) {
+      LoadSymbols(shdr);
+    }
+  }
+  std::sort(symbols_.begin(), symbols_.end(),
+            [](const ElfSymbol& a, const ElfSymbol& b) {
+              return a.addr != b.addr ? a.addr < b.addr : a.size > b.size;
+            });
+  // .symtab and .dynsym usually overlap
+  symbols_.erase(std::unique(symbols_.begin(), symbols_.end(),
+                             [](const ElfSymbol& a, const ElfSymbol& b) {
+                               return a.addr == b.addr && a.name == b.name;
+                             }),
+                 symbols_.end());
+  return true;
+}
+
+void ElfFile::LoadSymbols(const Elf64_Shdr& symtab) {
+  if (symtab.sh_link >= sections_.size() ||
+      symtab.sh_offset + symtab.sh_size > size_) {
+    return;
+  }
+  const auto& strtab = sections_[symtab.sh_link];
+  if (strtab.sh_offset + strtab.sh_size > size_) {
+    return;
+  }
+  const char* strs = reinterpret_cast<const char*>(data_ + strtab.sh_offset);
+  const auto* syms =
+      reinterpret_cast<const Elf64_Sym*>(data_ + symtab.sh_offset);
+  auto count = symtab.sh_size / sizeof(Elf64_Sym);
+
+  for (std::size_t i = 0; i < count; i++) {
+    const auto& sym = syms[i];
+    auto type = ELF64_ST_TYPE(sym.st_info);
+    if (type != STT_FUNC && type != STT_OBJECT && type != STT_GNU_IFUNC) {
+      continue;
+    }
+    if (sym.st_shndx == SHN_UNDEF || sym.st_value == 0 ||
+        sym.st_name >= strtab.sh_size) {
+      continue;
+    }
+    symbols_.push_back({std::string_view(strs + sym.st_name), sym.st_value,
+                        sym.st_size, type != STT_OBJECT});
+  }
+}
+
+const std::string& ElfFile::GetPath() const { return path_; }
+
+std::span<const uint8_t> ElfFile::GetData() const { return {data_, size_}; }
+
+const Elf64_Ehdr& ElfFile::GetHeader() const {
+  return *reinterpret_cast<const Elf64_Ehdr*>(data_);
+}
+
+std::span<const Elf64_Phdr> ElfFile::GetProgramHeaders() const {
+  const auto& ehdr = GetHeader();
+  return {reinterpret_cast<const Elf64_Phdr*>(data_ + ehdr.e_phoff),
+          ehdr.e_phnum};
+}
+
+std::optional<std::span<const uint8_t>> ElfFile::GetSection(
+    std::string_view name) const {
+  const auto& ehdr = GetHeader();
+  if (ehdr.e_shstrndx >= sections_.size()) {
+    return std::nullopt;
+  }
+  const char* names =
+      reinterpret_cast<const char*>(data_ + sections_[ehdr.e_shstrndx].sh_offset);
+  for (const auto& shdr : sections_) {
+    if (name != names + shdr.sh_name) {
+      continue;
+    }
+    if (shdr.sh_type == SHT_NOBITS || shdr.sh_offset + shdr.sh_size > size_) {
+      return std::nullopt;
+    }
+    return std::span<const uint8_t>(data_ + shdr.sh_offset, shdr.sh_size);
+  }
+  return std::nullopt;
+}
+
+std::optional<uint64_t> ElfFile::GetSectionAddress(
+    std::string_view name) const {
+  const auto& ehdr = GetHeader();
+  if (ehdr.e_shstrndx >= sections_.size()) {
+    return std::nullopt;
+  }
+  const char* names =
+      reinterpret_cast<const char*>(data_ + sections_[ehdr.e_shstrndx].sh_offset);
+  for (const auto& shdr : sections_) {
+    if (name == names + shdr.sh_name) {
+      return shdr.sh_addr;
+    }
+  }
+  return std::nullopt;
+}
+
+const std::vector<ElfSymbol>& ElfFile::GetSymbols() const { return symbols_; }
+
+const ElfSymbol* ElfFile::FindSymbol(uint64_t vaddr) const {
+  auto it = std::upper_bound(
+      symbols_.begin(), symbols_.end(), vaddr,
+      [](uint64_t addr, const ElfSymbol& sym) { return addr < sym.addr; });
+  // Walk back over zero-sized symbols and aliases sharing the same address
+  while (it != symbols_.begin()) {
+    --it;
+    if (vaddr < it->addr + std::max<uint64_t>(it->size, 1)) {
+      return &*it;
+    }
+    if (it->size != 0) {
+      return nullptr;
+    }
+  }
+  return nullptr;
+}
+
+const ElfSymbol* ElfFile::LookupSymbol(std::string_view name) const {
+  auto it = std::find_if(symbols_.begin(), symbols_.end(),
+                         [name](const ElfSymbol& sym) {
+                           return sym.name == name;
+                         });
+  return it == symbols_.end() ? nullptr : &*it;
+}
+
+std::optional<uint64_t> ElfFile::FileOffsetToVaddr(uint64_t offset) const {
+  for (const auto& phdr : GetProgramHeaders()) {
+    if (phdr.p_type != PT_LOAD) {
+      continue;
+    }
+    // Mappings start at page boundaries, so the offset may fall a little
+    // before the segment's own file range
+    auto page_offset = phdr.p_offset & ~(uint64_t)0xfff;
+    if (offset >= page_offset && offset < phdr.p_offset + phdr.p_filesz) {
+      return phdr.p_vaddr - phdr.p_offset + offset;
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<uint64_t> ElfFile::VaddrToFileOffset(uint64_t vaddr) const {
+  for (const auto& phdr : GetProgramHeaders()) {
+    if (phdr.p_type != PT_LOAD) {
+      continue;
+    }
+    if (vaddr >= phdr.p_vaddr && vaddr < phdr.p_vaddr + phdr.p_filesz) {
+      return phdr.p_offset + (vaddr - phdr.p_vaddr);
+    }
+  }
+  return std::nullopt;
+}
+
+}  // namespace shuidb
@@ -0,0 +1,253 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "event_trace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <iomanip>
+#include <utility>
+
+namespace shuidb {
+
+namespace {
+
+constexpr char kMagic[8] = {'S', 'H', 'U', 'I', 'D', 'B', 'E', 'V'};
+constexpr uint32_t kVersion = 1;
+
+static_assert(sizeof(EventTraceHeader) <= EventTraceWriter::kHeaderSize);
+static_assert(sizeof(EventSegmentHeader) <=
+              EventTraceWriter::kSegmentHeaderSize);
+
+std::size_t Bucket(uint64_t ns) {
+  return ns == 0 ? 0 : std::bit_width(ns) - 1;
+}
+
+// Microseconds with three decimals
+void WriteMicroseconds(std::ostream& os, uint64_t ns) {
+  os << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << ns % 1000
+     << std::setfill(' ');
+}
+
+}  // namespace
+
+std::unique_ptr<EventTraceWriter> EventTraceWriter::Create(
+    const std::string& path, std::size_t max_segments) {
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return nullptr;
+  }
+  EventTraceHeader header{};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.record_size = sizeof(EventRecord);
+  header.segment_size = kSegmentSize;
+  header.max_segments = max_segments;
+  if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      ftruncate(fd, kHeaderSize) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  return std::unique_ptr<EventTraceWriter>(
+      new EventTraceWriter(fd, max_segments));
+}
+
+EventTraceWriter::~EventTraceWriter() {
+  if (segment_ != nullptr) {
+    munmap(segment_, kSegmentSize);
+  }
+  close(fd_);
+}
+
+bool EventTraceWriter::NextSegment() {
+  auto index = max_segments_ == 0 ? sequence_ : sequence_ % max_segments_;
+  auto offset = kHeaderSize + index * kSegmentSize;
+  if (index >= segments_) {
+    if (ftruncate(fd_, offset + kSegmentSize) != 0) {
+      return false;
+    }
+    segments_ = index + 1;
+  }
+  // Populated now rather than faulted in by the appends
+  auto* data = mmap(nullptr, kSegmentSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd_, offset);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  if (segment_ != nullptr) {
+    munmap(segment_, kSegmentSize);
+  }
+  segment_ = static_cast<EventSegmentHeader*>(data);
+  segment_->sequence = ++sequence_;
+  segment_->count = 0;
+  records_ = reinterpret_cast<EventRecord*>(static_cast<uint8_t*>(data) +
+                                            kSegmentHeaderSize);
+  return true;
+}
+
+std::shared_ptr<EventTraceReader> EventTraceReader::Open(
+    const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      st.st_size < (off_t)EventTraceWriter::kHeaderSize) {
+    close(fd);
+    return nullptr;
+  }
+  auto* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+
+  std::shared_ptr<EventTraceReader> reader(
+      new EventTraceReader(static_cast<const uint8_t*>(data), st.st_size));
+  if (!reader->Parse()) {
+    return nullptr;
+  }
+  return reader;
+}
+
+EventTraceReader::~EventTraceReader() {
+  munmap(const_cast<uint8_t*>(data_), size_);
+}
+
+bool EventTraceReader::Parse() {
+  std::memcpy(&header_, data_, sizeof(header_));
+  if (std::memcmp(header_.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header_.version != kVersion ||
+      header_.record_size != sizeof(EventRecord) ||
+      header_.segment_size <= EventTraceWriter::kSegmentHeaderSize) {
+    return false;
+  }
+  auto capacity = (header_.segment_size -
+                   EventTraceWriter::kSegmentHeaderSize) /
+                  sizeof(EventRecord);
+
+  // Ring segments are reused, the sequence numbers give the order
+  std::vector<std::pair<EventSegmentHeader, const uint8_t*>> segments;
+  for (auto offset = EventTraceWriter::kHeaderSize;
+       offset + header_.segment_size <= size_;
+       offset += header_.segment_size) {
+    EventSegmentHeader segment;
+    std::memcpy(&segment, data_ + offset, sizeof(segment));
+    if (segment.sequence != 0) {
+      segments.emplace_back(segment, data_ + offset);
+    }
+  }
+  std::sort(segments.begin(), segments.end(),
+            [](const auto& a, const auto& b) {
+              return a.first.sequence < b.first.sequence;
+            });
+  for (const auto& [segment, base] : segments) {
+    auto count = std::min<std::size_t>(segment.count, capacity);
+    auto offset = records_.size();
+    records_.resize(offset + count);
+    std::memcpy(records_.data() + offset,
+                base + EventTraceWriter::kSegmentHeaderSize,
+                count * sizeof(EventRecord));
+  }
+  return true;
+}
+
+const EventTraceHeader& EventTraceReader::GetHeader() const {
+  return header_;
+}
+
+const std::vector<EventRecord>& EventTraceReader::GetRecords() const {
+  return records_;
+}
+
+EventTraceSummary EventTraceReader::Summarize(std::size_t slowest) const {
+  EventTraceSummary summary;
+  summary.records = records_.size();
+  if (records_.empty()) {
+    return summary;
+  }
+  summary.duration_ns = records_.back().time_ns - records_.front().time_ns;
+  for (std::size_t i = 0; i < records_.size(); i++) {
+    const auto& record = records_[i];
+    summary.types[record.type]++;
+    if (record.type == EventType::kBreakpoint) {
+      summary.hits[record.pc]++;
+    } else if (record.type == EventType::kClone) {
+      summary.threads[record.value].created_ns = record.time_ns;
+    } else if (record.type == EventType::kThreadExit) {
+      summary.threads[record.tid].exited_ns = record.time_ns;
+    }
+    summary.latency[Bucket(record.latency_ns)]++;
+    if (i > 0) {
+      auto prev = records_[i - 1].time_ns;
+      summary.inter_arrival[Bucket(
+          record.time_ns > prev ? record.time_ns - prev : 0)]++;
+    }
+  }
+  summary.slowest.resize(std::min(slowest, records_.size()));
+  std::partial_sort_copy(records_.begin(), records_.end(),
+                         summary.slowest.begin(), summary.slowest.end(),
+                         [](const EventRecord& a, const EventRecord& b) {
+                           return a.latency_ns > b.latency_ns;
+                         });
+  return summary;
+}
+
+void EventTraceReader::WriteChromeTrace(std::ostream& os) const {
+  os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  for (std::size_t i = 0; i < records_.size(); i++) {
+    const auto& record = records_[i];
+    auto start = record.time_ns - std::min(record.latency_ns, record.time_ns);
+    os << (i == 0 ? "" : ",") << "\n{\"name\":\""
+       << GetEventTypeName(record.type) << "\",\"ph\":\"X\",\"pid\":"
+       << record.tid << ",\"tid\":" << record.tid << ",\"ts\":";
+    WriteMicroseconds(os, start);
+    os << ",\"dur\":";
+    WriteMicroseconds(os, record.time_ns - start);
+    os << ",\"args\":{\"pc\":\"0x" << std::hex << record.pc << std::dec
+       << "\",\"value\":" << record.value << "}}";
+  }
+  os << "\n]}\n";
+}
+
+const char* GetEventTypeName(EventType type) {
+  switch (type) {
+    case EventType::kStep:
+      return "step";
+    case EventType::kBreakpoint:
+      return "breakpoint";
+    case EventType::kCoverage:
+      return "coverage";
+    case EventType::kSignal:
+      return "signal";
+    case EventType::kExit:
+      return "exit";
+    case EventType::kClone:
+      return "clone";
+    case EventType::kThreadExit:
+      return "thread exit";
+  }
+  return "unknown";
+}
+
+}  // namespace shuidb
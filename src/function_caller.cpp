@@ -0,0 +1,90 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "function_caller.h"
+
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+
+#include "memory_operator.h"
+#include "syscall_injector.h"
+#include "utils/syscall_stats.hpp"
+
+namespace shuidb {
+
+namespace {
+
+constexpr std::size_t kStubSize = 4096;
+constexpr std::size_t kRegisterArgs = 6;
+
+}  // namespace
+
+std::optional<std::uintptr_t> FunctionCaller::InjectStub(pid_t pid,
+                                                         int* signal) {
+  auto addr = SyscallInjector::Call(
+      pid, SYS_mmap,
+      {0, kStubSize, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS,
+       static_cast<uint64_t>(-1), 0},
+      signal);
+  // Errors are -4095..-1
+  if (!addr.has_value() || static_cast<unsigned long>(addr.value()) >
+                               static_cast<unsigned long>(-4096L)) {
+    return std::nullopt;
+  }
+  // Written through /proc/<pid>/mem, which ignores the page protection
+  uint8_t int3 = 0xcc;
+  iovec local{&int3, 1};
+  iovec remote{reinterpret_cast<void*>(addr.value()), 1};
+  if (MemoryOperator::WriteMemoryV(pid, {local}, {remote}) != 1) {
+    return std::nullopt;
+  }
+  return addr.value();
+}
+
+bool FunctionCaller::SetUpCall(pid_t pid, const user_regs_struct& regs,
+                               std::uintptr_t stub, std::uintptr_t func,
+                               const std::vector<uint64_t>& args) {
+  auto call = regs;
+  decltype(call.rdi)* arg_regs[kRegisterArgs] = {
+      &call.rdi, &call.rsi, &call.rdx, &call.rcx, &call.r8, &call.r9};
+  std::vector<uint64_t> stack{stub};
+  for (std::size_t i = 0; i < args.size(); i++) {
+    if (i < kRegisterArgs) {
+      *arg_regs[i] = args[i];
+    } else {
+      stack.push_back(args[i]);
+    }
+  }
+  // The stack arguments start 16-byte aligned, right above the return
+  // address
+  auto sp = regs.rsp - kRedZone - (stack.size() - 1) * 8;
+  sp = (sp & ~0xfUL) - 8;
+  iovec local{stack.data(), stack.size() * 8};
+  iovec remote{reinterpret_cast<void*>(sp), stack.size() * 8};
+  if (MemoryOperator::WriteMemoryV(pid, {local}, {remote}) != local.iov_len) {
+    return false;
+  }
+  call.rsp = sp;
+  call.rip = func;
+  // Vector registers used by a variadic call
+  call.rax = 0;
+  // Not in a syscall, so the kernel does not try to restart one
+  call.orig_rax = -1;
+  return utils::Ptrace(PTRACE_SETREGS, pid, nullptr, &call) == 0;
+}
+
+}  // namespace shuidb
@@ -0,0 +1,925 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#include "gdb_server.h"
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <sstream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "utils/output_utils.hpp"
+#include "utils/ps_utils.hpp"
+#include "utils/string_utils.hpp"
+
+namespace shuidb {
+
+namespace {
+
+struct RemoteRegister {
+  const char* name;
+  std::size_t bits;
+  const char* type;
+  // Index into kFeatures
+  std::size_t feature;
+};
+
+constexpr const char* kFeatures[] = {
+    "org.gnu.gdb.i386.core", "org.gnu.gdb.i386.sse",
+    "org.gnu.gdb.i386.linux", "org.gnu.gdb.i386.segments"};
+
+// In the order of the `g` packet, that of gdb's amd64 Linux target
+constexpr RemoteRegister kRegisters[] = {
+    {"rax", 64, "int64", 0},     {"rbx", 64, "int64", 0},
+    {"rcx", 64, "int64", 0},     {"rdx", 64, "int64", 0},
+    {"rsi", 64, "int64", 0},     {"rdi", 64, "int64", 0},
+    {"rbp", 64, "data_ptr", 0},  {"rsp", 64, "data_ptr", 0},
+    {"r8", 64, "int64", 0},      {"r9", 64, "int64", 0},
+    {"r10", 64, "int64", 0},     {"r11", 64, "int64", 0},
+    {"r12", 64, "int64", 0},     {"r13", 64, "int64", 0},
+    {"r14", 64, "int64", 0},     {"r15", 64, "int64", 0},
+    {"rip", 64, "code_ptr", 0},  {"eflags", 32, "int32", 0},
+    {"cs", 32, "int32", 0},      {"ss", 32, "int32", 0},
+    {"ds", 32, "int32", 0},      {"es", 32, "int32", 0},
+    {"fs", 32, "int32", 0},      {"gs", 32, "int32", 0},
+    {"st0", 80, "i387_ext", 0},  {"st1", 80, "i387_ext", 0},
+    {"st2", 80, "i387_ext", 0},  {"st3", 80, "i387_ext", 0},
+    {"st4", 80, "i387_ext", 0},  {"st5", 80, "i387_ext", 0},
+    {"st6", 80, "i387_ext", 0},  {"st7", 80, "i387_ext", 0},
+    {"fctrl", 32, "int", 0},     {"fstat", 32, "int", 0},
+    {"ftag", 32, "int", 0},      {"fiseg", 32, "int", 0},
+    {"fioff", 32, "int", 0},     {"foseg", 32, "int", 0},
+    {"fooff", 32, "int", 0},     {"fop", 32, "int", 0},
+    {"xmm0", 128, "vec128", 1},  {"xmm1", 128, "vec128", 1},
+    {"xmm2", 128, "vec128", 1},  {"xmm3", 128, "vec128", 1},
+    {"xmm4", 128, "vec128", 1},  {"xmm5", 128, "vec128", 1},
+    {"xmm6", 128, "vec128", 1},  {"xmm7", 128, "vec128", 1},
+    {"xmm8", 128, "vec128", 1},  {"xmm9", 128, "vec128", 1},
+    {"xmm10", 128, "vec128", 1}, {"xmm11", 128, "vec128", 1},
+    {"xmm12", 128, "vec128", 1}, {"xmm13", 128, "vec128", 1},
+    {"xmm14", 128, "vec128", 1}, {"xmm15", 128, "vec128", 1},
+    {"mxcsr", 32, "int", 1},     {"orig_rax", 64, "int", 2},
+    {"fs_base", 64, "int", 3},   {"gs_base", 64, "int", 3},
+};
+
+constexpr std::size_t kNumRemoteRegisters =
+    sizeof(kRegisters) / sizeof(kRegisters[0]);
+
+// Calls `f(field, size)` with the bytes of each register of kRegisters in
+// turn, which may read or write them. Registers narrower than their field
+// take its low bytes
+template <typename F>
+void ForEachRegister(user_regs_struct& regs, user_fpregs_struct& fpregs,
+                     uint32_t& ftag, F&& f) {
+  for (auto* field :
+       {&regs.rax, &regs.rbx, &regs.rcx, &regs.rdx, &regs.rsi, &regs.rdi,
+        &regs.rbp, &regs.rsp, &regs.r8, &regs.r9, &regs.r10, &regs.r11,
+        &regs.r12, &regs.r13, &regs.r14, &regs.r15, &regs.rip}) {
+    f(field, 8);
+  }
+  for (auto* field : {&regs.eflags, &regs.cs, &regs.ss, &regs.ds, &regs.es,
+                      &regs.fs, &regs.gs}) {
+    f(field, 4);
+  }
+  // 16 bytes apart in the FXSAVE area
+  for (std::size_t i = 0; i < 8; i++) {
+    f(&fpregs.st_space[i * 4], 10);
+  }
+  uint32_t control[] = {fpregs.cwd,
+                        fpregs.swd,
+                        ftag,
+                        static_cast<uint32_t>(fpregs.rip >> 32),
+                        static_cast<uint32_t>(fpregs.rip),
+                        static_cast<uint32_t>(fpregs.rdp >> 32),
+                        static_cast<uint32_t>(fpregs.rdp),
+                        fpregs.fop};
+  for (auto& value : control) {
+    f(&value, 4);
+  }
+  fpregs.cwd = control[0];
+  fpregs.swd = control[1];
+  ftag = control[2];
+  fpregs.rip = static_cast<uint64_t>(control[3]) << 32 | control[4];
+  fpregs.rdp = static_cast<uint64_t>(control[5]) << 32 | control[6];
+  fpregs.fop = control[7];
+  for (std::size_t i = 0; i < 16; i++) {
+    f(&fpregs.xmm_space[i * 4], 16);
+  }
+  f(&fpregs.mxcsr, 4);
+  f(&regs.orig_rax, 8);
+  f(&regs.fs_base, 8);
+  f(&regs.gs_base, 8);
+}
+
+// The x87 tag word from the abridged one of FXSAVE, one bit per register:
+// 0 valid, 1 zero, 2 special, 3 empty
+uint32_t ExpandTag(const user_fpregs_struct& fpregs) {
+  auto top = (fpregs.swd >> 11) & 7;
+  uint32_t tag = 0;
+  for (unsigned reg = 0; reg < 8; reg++) {
+    uint32_t value = 3;
+    if ((fpregs.ftw >> reg & 1) != 0) {
+      // st_space is ordered from the top of the stack
+      const auto* st = reinterpret_cast<const uint8_t*>(fpregs.st_space) +
+                       ((reg - top) & 7) * 16;
+      uint64_t fraction;
+      std::memcpy(&fraction, st, sizeof(fraction));
+      auto exponent = (st[9] << 8 | st[8]) & 0x7fff;
+      if (exponent == 0x7fff) {
+        value = 2;
+      } else if (exponent == 0) {
+        value = fraction == 0 ? 1 : 2;
+      } else {
+        value = fraction >> 63 != 0 ? 0 : 2;
+      }
+    }
+    tag |= value << (reg * 2);
+  }
+  return tag;
+}
+
+uint16_t AbridgeTag(uint32_t tag) {
+  uint16_t ftw = 0;
+  for (unsigned reg = 0; reg < 8; reg++) {
+    if ((tag >> (reg * 2) & 3) != 3) {
+      ftw |= 1 << reg;
+    }
+  }
+  return ftw;
+}
+
+// Linux signals 1 to 31 by the numbers of the protocol, which are gdb's own
+constexpr int kGdbSignals[] = {0,  1,  2,  3,  4,  5,  6,  10, 8,  9,  30,
+                               11, 31, 13, 14, 15, 143, 20, 19, 17, 18, 21,
+                               22, 16, 24, 25, 26, 27, 28, 23, 32, 12};
+constexpr int kGdbRealtime32 = 77;
+constexpr int kGdbRealtime33 = 45;
+constexpr int kGdbRealtime64 = 78;
+
+int ToGdbSignal(int signal) {
+  if (signal >= 0 && signal < 32) {
+    return kGdbSignals[signal];
+  }
+  if (signal == 32) {
+    return kGdbRealtime32;
+  }
+  if (signal == 64) {
+    return kGdbRealtime64;
+  }
+  return signal < 64 ? signal - 33 + kGdbRealtime33 : signal;
+}
+
+int FromGdbSignal(int signal) {
+  for (int host = 0; host <= 64; host++) {
+    if (ToGdbSignal(host) == signal) {
+      return host;
+    }
+  }
+  return 0;
+}
+
+std::string ToHex(const void* data, std::size_t len) {
+  static constexpr char kDigits[] = "0123456789abcdef";
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  std::string hex(len * 2, '0');
+  for (std::size_t i = 0; i < len; i++) {
+    hex[i * 2] = kDigits[bytes[i] >> 4];
+    hex[i * 2 + 1] = kDigits[bytes[i] & 0xf];
+  }
+  return hex;
+}
+
+std::string ToHex(uint64_t value) {
+  std::ostringstream oss;
+  oss << std::hex << value;
+  return oss.str();
+}
+
+std::optional<std::vector<uint8_t>> FromHex(const std::string& hex) {
+  if (hex.size() % 2 != 0) {
+    return std::nullopt;
+  }
+  std::vector<uint8_t> bytes(hex.size() / 2);
+  for (std::size_t i = 0; i < bytes.size(); i++) {
+    auto digit = [](char c) {
+      return c >= 'a' ? c - 'a' + 10 : c >= 'A' ? c - 'A' + 10 : c - '0';
+    };
+    if (!std::isxdigit(hex[i * 2]) || !std::isxdigit(hex[i * 2 + 1])) {
+      return std::nullopt;
+    }
+    bytes[i] = digit(hex[i * 2]) << 4 | digit(hex[i * 2 + 1]);
+  }
+  return bytes;
+}
+
+std::optional<uint64_t> ParseHex(const std::string& text) {
+  try {
+    std::size_t end = 0;
+    auto value = std::stoull(text, &end, 16);
+    if (end == text.size()) {
+      return value;
+    }
+  } catch (const std::exception&) {
+  }
+  return std::nullopt;
+}
+
+// `<addr>,<len>` of memory packets
+std::optional<std::pair<uint64_t, uint64_t>> ParseRange(
+    const std::string& text) {
+  auto comma = text.find(',');
+  if (comma == std::string::npos) {
+    return std::nullopt;
+  }
+  auto addr = ParseHex(text.substr(0, comma));
+  auto len = ParseHex(text.substr(comma + 1));
+  if (!addr.has_value() || !len.has_value()) {
+    return std::nullopt;
+  }
+  return std::make_pair(addr.value(), len.value());
+}
+
+// Binary data escapes #, $, } and * as } followed by the byte xor 0x20
+std::string Escape(const std::string& data) {
+  std::string escaped;
+  escaped.reserve(data.size());
+  for (char c : data) {
+    if (c == '#' || c == '$' || c == '}' || c == '*') {
+      escaped += '}';
+      escaped += static_cast<char>(c ^ 0x20);
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+std::string Unescape(const std::string& data) {
+  std::string unescaped;
+  unescaped.reserve(data.size());
+  for (std::size_t i = 0; i < data.size(); i++) {
+    if (data[i] == '}' && i + 1 < data.size()) {
+      unescaped += static_cast<char>(data[++i] ^ 0x20);
+    } else {
+      unescaped += data[i];
+    }
+  }
+  return unescaped;
+}
+
+uint8_t Checksum(const std::string& payload) {
+  uint8_t sum = 0;
+  for (char c : payload) {
+    sum += static_cast<uint8_t>(c);
+  }
+  return sum;
+}
+
+const std::string& TargetDescription() {
+  static const std::string xml = [] {
+    std::ostringstream oss;
+    oss << "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+        << "<target><architecture>i386:x86-64</architecture>"
+        << "<osabi>GNU/Linux</osabi>";
+    std::size_t feature = SIZE_MAX;
+    for (const auto& reg : kRegisters) {
+      if (reg.feature != feature) {
+        if (feature != SIZE_MAX) {
+          oss << "</feature>";
+        }
+        feature = reg.feature;
+        oss << "<feature name=\"" << kFeatures[feature] << "\">";
+        if (feature == 1) {
+          oss << "<vector id=\"v4f\" type=\"ieee_single\" count=\"4\"/>"
+              << "<vector id=\"v2d\" type=\"ieee_double\" count=\"2\"/>"
+              << "<vector id=\"v16i8\" type=\"int8\" count=\"16\"/>"
+              << "<vector id=\"v8i16\" type=\"int16\" count=\"8\"/>"
+              << "<vector id=\"v4i32\" type=\"int32\" count=\"4\"/>"
+              << "<vector id=\"v2i64\" type=\"int64\" count=\"2\"/>"
+              << "<union id=\"vec128\">"
+              << "<field name=\"v4_float\" type=\"v4f\"/>"
+              << "<field name=\"v2_double\" type=\"v2d\"/>"
+              << "<field name=\"v16_int8\" type=\"v16i8\"/>"
+              << "<field name=\"v8_int16\" type=\"v8i16\"/>"
+              << "<field name=\"v4_int32\" type=\"v4i32\"/>"
+              << "<field name=\"v2_int64\" type=\"v2i64\"/>"
+              << "<field name=\"uint128\" type=\"uint128\"/></union>";
+        }
+      }
+      oss << "<reg name=\"" << reg.name << "\" bitsize=\"" << reg.bits
+          << "\" type=\"" << reg.type << "\"/>";
+    }
+    oss << "</feature></target>";
+    return oss.str();
+  }();
+  return xml;
+}
+
+// `<annex>:<offset>,<length>` of qXfer reads, served from `data`
+std::string ReadXfer(const std::string& data, const std::string& args) {
+  auto colon = args.rfind(':');
+  auto range = ParseRange(args.substr(colon + 1));
+  if (colon == std::string::npos || !range.has_value()) {
+    return "E01";
+  }
+  auto [offset, len] = range.value();
+  if (offset >= data.size()) {
+    return "l";
+  }
+  len = std::min<uint64_t>(len, GdbServer::kPacketSize / 2);
+  return (offset + len >= data.size() ? "l" : "m") +
+         Escape(data.substr(offset, len));
+}
+
+}  // namespace
+
+StatusType GdbServer::Serve(int in_fd, int out_fd) {
+  if (!debugger_.IsRunning()) {
+    PR(ERROR) << "Process is not running";
+    return StatusType::kNotRunning;
+  }
+  in_fd_ = in_fd;
+  out_fd_ = out_fd;
+  input_.clear();
+  ack_ = true;
+  done_ = false;
+  last_stop_ = {std::nullopt, SIGTRAP, false, std::nullopt};
+  registers_.reset();
+
+  while (!done_) {
+    auto packet = ReadPacket();
+    if (!packet.has_value()) {
+      break;
+    }
+    PR(DEBUG) << "<- " << packet.value();
+    auto reply = Handle(packet.value());
+    if (reply.has_value()) {
+      PR(DEBUG) << "-> " << reply.value();
+    }
+    if (reply.has_value() && !WritePacket(reply.value())) {
+      break;
+    }
+    if (packet == "QStartNoAckMode") {
+      ack_ = false;
+    }
+  }
+  return StatusType::kSuccess;
+}
+
+StatusType GdbServer::ServeUnixSocket(const std::string& path) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    PR(ERROR) << "Socket path too long: " << path;
+    return StatusType::kBadInput;
+  }
+  std::strcpy(addr.sun_path, path.c_str());
+  int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  unlink(path.c_str());
+  if (listen_fd == -1 ||
+      bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) ==
+          -1 ||
+      listen(listen_fd, 1) == -1) {
+    PR(ERROR) << "Cannot listen on " << path << ": " << strerror(errno);
+    if (listen_fd != -1) {
+      close(listen_fd);
+    }
+    return StatusType::kFailed;
+  }
+  PR(INFO) << "Listening on " << path;
+  int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+  close(listen_fd);
+  unlink(path.c_str());
+  if (fd == -1) {
+    PR(ERROR) << "Cannot accept a connection: " << strerror(errno);
+    return StatusType::kFailed;
+  }
+  auto status = Serve(fd, fd);
+  close(fd);
+  return status;
+}
+
+bool GdbServer::Fill() {
+  char buf[4096];
+  auto n = read(in_fd_, buf, sizeof(buf));
+  if (n <= 0) {
+    return false;
+  }
+  input_.append(buf, n);
+  return true;
+}
+
+std::optional<std::string> GdbServer::ReadPacket() {
+  while (true) {
+    // Acks and interrupts while stopped are dropped on the way
+    auto start = input_.find('$');
+    if (start == std::string::npos) {
+      input_.clear();
+    } else {
+      input_.erase(0, start);
+      auto end = input_.find('#');
+      if (end != std::string::npos && input_.size() >= end + 3) {
+        auto payload = input_.substr(1, end - 1);
+        auto checksum = ParseHex(input_.substr(end + 1, 2));
+        input_.erase(0, end + 3);
+        bool valid = checksum == Checksum(payload);
+        if (ack_ && write(out_fd_, valid ? "+" : "-", 1) != 1) {
+          return std::nullopt;
+        }
+        if (valid || !ack_) {
+          return payload;
+        }
+        continue;
+      }
+    }
+    if (!Fill()) {
+      return std::nullopt;
+    }
+  }
+}
+
+bool GdbServer::WritePacket(const std::string& payload) {
+  std::ostringstream oss;
+  oss << '$' << payload << '#' << ToHex(Checksum(payload) >> 4)
+      << ToHex(Checksum(payload) & 0xf);
+  auto packet = oss.str();
+  while (true) {
+    std::size_t written = 0;
+    while (written < packet.size()) {
+      auto n = write(out_fd_, packet.data() + written, packet.size() - written);
+      if (n <= 0) {
+        return false;
+      }
+      written += n;
+    }
+    if (!ack_) {
+      return true;
+    }
+    // Resent until acknowledged, a new packet counts as an ack
+    if (input_.empty() && !Fill()) {
+      return false;
+    }
+    auto ack = input_[0];
+    if (ack == '+' || ack == '-') {
+      input_.erase(0, 1);
+    }
+    if (ack != '-') {
+      return true;
+    }
+  }
+}
+
+std::optional<std::string> GdbServer::Handle(const std::string& packet) {
+  if (packet.empty()) {
+    return "";
+  }
+  auto args = packet.substr(1);
+  switch (packet[0]) {
+    case '?':
+      return StopReply();
+    case 'g':
+      return ReadRegisters();
+    case 'G':
+      return WriteRegisters(args);
+    case 'p': {
+      auto number = ParseHex(args);
+      return number.has_value() ? ReadRegister(number.value()) : "E01";
+    }
+    case 'P': {
+      auto equal = args.find('=');
+      auto number = ParseHex(args.substr(0, equal));
+      if (equal == std::string::npos || !number.has_value()) {
+        return "E01";
+      }
+      return WriteRegister(number.value(), args.substr(equal + 1));
+    }
+    case 'm': {
+      auto range = ParseRange(args);
+      return range.has_value() ? ReadMemory(range->first, range->second)
+                               : "E01";
+    }
+    case 'M':
+    case 'X': {
+      auto colon = args.find(':');
+      auto range = ParseRange(args.substr(0, colon));
+      if (colon == std::string::npos || !range.has_value()) {
+        return "E01";
+      }
+      auto data = args.substr(colon + 1);
+      if (packet[0] == 'M') {
+        auto bytes = FromHex(data);
+        if (!bytes.has_value()) {
+          return "E01";
+        }
+        data.assign(bytes->begin(), bytes->end());
+      } else {
+        data = Unescape(data);
+      }
+      if (data.size() != range->second) {
+        return "E01";
+      }
+      return WriteMemory(range->first, data);
+    }
+    case 'Z':
+    case 'z':
+      return HandleBreakPoint(args, packet[0] == 'Z');
+    case 'c':
+    case 's':
+      return Resume(packet[0] == 's', 0);
+    case 'C':
+    case 'S': {
+      auto signal = ParseHex(args.substr(0, args.find(';')));
+      return Resume(packet[0] == 'S',
+                    FromGdbSignal(static_cast<int>(signal.value_or(0))));
+    }
+    case 'v':
+      if (packet == "vCont?") {
+        return "vCont;c;C;s;S;t";
+      }
+      if (packet.rfind("vCont;", 0) == 0) {
+        return HandleVCont(packet);
+      }
+      if (packet.rfind("vKill", 0) == 0) {
+        debugger_.Quit();
+        done_ = true;
+        return "OK";
+      }
+      return "";
+    case 'k':
+      // No reply is due
+      debugger_.Quit();
+      done_ = true;
+      return std::nullopt;
+    case 'D':
+      debugger_.Detach();
+      done_ = true;
+      return "OK";
+    case 'H': {
+      // H<op><thread>: one current thread serves both g and c. -1 and 0
+      // leave it as it is
+      auto thread = args.substr(std::min<std::size_t>(args.size(), 1));
+      if (thread == "-1" || thread == "0") {
+        return "OK";
+      }
+      auto tid = ParseHex(thread);
+      if (!tid.has_value() ||
+          !debugger_.SelectThread(static_cast<pid_t>(tid.value()))) {
+        return "E01";
+      }
+      registers_.reset();
+      return "OK";
+    }
+    case 'T': {
+      auto tid = ParseHex(args);
+      auto threads = debugger_.GetThreads();
+      return tid.has_value() &&
+                     std::count(threads.begin(), threads.end(),
+                                static_cast<pid_t>(tid.value())) != 0
+                 ? "OK"
+                 : "E01";
+    }
+    case 'q':
+    case 'Q':
+      return HandleQuery(packet);
+    default:
+      return "";
+  }
+}
+
+std::string GdbServer::HandleQuery(const std::string& packet) {
+  auto pid = debugger_.GetPid();
+  if (packet.rfind("qSupported", 0) == 0) {
+    return "PacketSize=" + ToHex(kPacketSize) +
+           ";QStartNoAckMode+;qXfer:features:read+;qXfer:threads:read+;"
+           "swbreak+;hwbreak+;vContSupported+";
+  }
+  if (packet == "QStartNoAckMode") {
+    return "OK";
+  }
+  if (packet == "qAttached") {
+    // Started by us, killed when the frontend quits
+    return "0";
+  }
+  if (packet == "qC") {
+    return "QC" + ToHex(debugger_.GetCurrentThread());
+  }
+  if (packet == "qfThreadInfo") {
+    std::string reply = "m";
+    for (auto tid : debugger_.GetThreads()) {
+      reply += (reply.size() > 1 ? "," : "") + ToHex(tid);
+    }
+    return reply;
+  }
+  if (packet == "qsThreadInfo") {
+    return "l";
+  }
+  if (packet.rfind("qSymbol", 0) == 0) {
+    return "OK";
+  }
+  constexpr std::string_view kFeaturesRead = "qXfer:features:read:";
+  if (packet.rfind(kFeaturesRead, 0) == 0) {
+    auto args = packet.substr(kFeaturesRead.size());
+    if (args.rfind("target.xml:", 0) != 0) {
+      return "E00";
+    }
+    return ReadXfer(TargetDescription(), args);
+  }
+  constexpr std::string_view kThreadsRead = "qXfer:threads:read:";
+  if (packet.rfind(kThreadsRead, 0) == 0) {
+    // The main thread first, as gdb numbers them in this order
+    auto tids = debugger_.GetThreads();
+    std::stable_partition(tids.begin(), tids.end(),
+                          [pid](pid_t tid) { return tid == pid; });
+    std::ostringstream oss;
+    oss << "<?xml version=\"1.0\"?><threads>";
+    for (auto tid : tids) {
+      oss << "<thread id=\"" << ToHex(tid) << "\" name=\""
+          << utils::GetThreadName(pid, tid) << "\"/>";
+    }
+    oss << "</threads>";
+    return ReadXfer(oss.str(), packet.substr(kThreadsRead.size()));
+  }
+  return "";
+}
+
+std::string GdbServer::HandleVCont(const std::string& packet) {
+  // vCont;<action>[:<thread>]... The first action naming a traced thread
+  // makes it the current one, or the first for all of them applies to the
+  // current thread. Continuing resumes every thread either way
+  for (const auto& action : utils::split(packet.substr(6), ';')) {
+    auto colon = action.find(':');
+    if (colon != std::string::npos) {
+      auto thread = action.substr(colon + 1);
+      auto tid = ParseHex(thread);
+      if (thread != "-1" &&
+          (!tid.has_value() ||
+           !debugger_.SelectThread(static_cast<pid_t>(tid.value())))) {
+        continue;
+      }
+    }
+    auto command = action.substr(0, colon);
+    if (command.empty()) {
+      return "E01";
+    }
+    int signal = 0;
+    if (command[0] == 'C' || command[0] == 'S') {
+      signal = FromGdbSignal(
+          static_cast<int>(ParseHex(command.substr(1)).value_or(0)));
+    }
+    switch (command[0]) {
+      case 'c':
+      case 'C':
+        return Resume(false, signal);
+      case 's':
+      case 'S':
+        return Resume(true, signal);
+      case 't':
+        // Already stopped
+        return StopReply();
+      default:
+        return "E01";
+    }
+  }
+  return StopReply();
+}
+
+std::string GdbServer::HandleBreakPoint(const std::string& args,
+                                        bool insert) {
+  // <type>,<addr>,<kind>
+  auto fields = utils::split(args, ',');
+  if (fields.size() < 3) {
+    return "E01";
+  }
+  auto addr = ParseHex(fields[1]);
+  auto kind = ParseHex(fields[2]);
+  if (!addr.has_value() || !kind.has_value()) {
+    return "E01";
+  }
+  bool done;
+  if (fields[0] == "0") {
+    done = insert ? debugger_.InsertBreakPoint(addr.value())
+                  : debugger_.RemoveBreakPoint(addr.value());
+  } else if (fields[0] == "1" || fields[0] == "2" || fields[0] == "4") {
+    // Read-only watchpoints (3) have no x86 equivalent
+    auto watch = fields[0] == "1"   ? WatchKind::kExecute
+                 : fields[0] == "2" ? WatchKind::kWrite
+                                    : WatchKind::kAccess;
+    auto len = watch == WatchKind::kExecute ? 1 : kind.value();
+    done = insert ? debugger_.InsertWatchPoint(addr.value(), len, watch)
+                  : debugger_.RemoveWatchPoint(addr.value(), len, watch);
+  } else {
+    return "";
+  }
+  return done ? "OK" : "E01";
+}
+
+std::string GdbServer::ReadRegisters() {
+  auto* cache = GetRegisterCache();
+  if (cache == nullptr) {
+    return "E01";
+  }
+  std::string hex;
+  ForEachRegister(cache->regs, cache->fpregs, cache->ftag,
+                  [&hex](void* field, std::size_t size) {
+                    hex += ToHex(field, size);
+                  });
+  return hex;
+}
+
+std::string GdbServer::WriteRegisters(const std::string& hex) {
+  auto* cache = GetRegisterCache();
+  auto bytes = FromHex(hex);
+  if (cache == nullptr || !bytes.has_value()) {
+    return "E01";
+  }
+  auto updated = *cache;
+  std::size_t offset = 0;
+  // A short packet leaves the registers after it as they are
+  ForEachRegister(updated.regs, updated.fpregs, updated.ftag,
+                  [&](void* field, std::size_t size) {
+                    if (offset + size <= bytes->size()) {
+                      std::memcpy(field, bytes->data() + offset, size);
+                    }
+                    offset += size;
+                  });
+  return StoreRegisters(updated) ? "OK" : "E01";
+}
+
+std::string GdbServer::ReadRegister(std::size_t number) {
+  auto* cache = GetRegisterCache();
+  if (cache == nullptr || number >= kNumRemoteRegisters) {
+    return "E01";
+  }
+  std::string hex;
+  std::size_t index = 0;
+  ForEachRegister(cache->regs, cache->fpregs, cache->ftag,
+                  [&](void* field, std::size_t size) {
+                    if (index++ == number) {
+                      hex = ToHex(field, size);
+                    }
+                  });
+  return hex;
+}
+
+std::string GdbServer::WriteRegister(std::size_t number,
+                                     const std::string& hex) {
+  auto* cache = GetRegisterCache();
+  auto bytes = FromHex(hex);
+  if (cache == nullptr || !bytes.has_value() ||
+      number >= kNumRemoteRegisters ||
+      bytes->size() != kRegisters[number].bits / 8) {
+    return "E01";
+  }
+  auto updated = *cache;
+  std::size_t index = 0;
+  ForEachRegister(updated.regs, updated.fpregs, updated.ftag,
+                  [&](void* field, std::size_t size) {
+                    if (index++ == number) {
+                      std::memcpy(field, bytes->data(), size);
+                    }
+                  });
+  return StoreRegisters(updated) ? "OK" : "E01";
+}
+
+std::string GdbServer::ReadMemory(std::uintptr_t addr, std::size_t len) {
+  std::vector<uint8_t> buf(std::min(len, kPacketSize / 2));
+  auto size = debugger_.ReadMemory(addr, buf.data(), buf.size());
+  if (size == 0 && len != 0) {
+    return "E01";
+  }
+  return ToHex(buf.data(), size);
+}
+
+std::string GdbServer::WriteMemory(std::uintptr_t addr,
+                                   const std::string& data) {
+  if (data.empty()) {
+    // Probes whether X packets are supported
+    return "OK";
+  }
+  return debugger_.WriteMemory(addr, data.data(), data.size()) == data.size()
+             ? "OK"
+             : "E01";
+}
+
+std::string GdbServer::Resume(bool step, int signal) {
+  registers_.reset();
+  if (step) {
+    last_stop_ = debugger_.RunUntilStop(true, signal);
+    return StopReply();
+  }
+
+  // Watches the connection for Ctrl-C until the process stops
+  int wake[2];
+  if (pipe(wake) == -1) {
+    return "E01";
+  }
+  auto pid = debugger_.GetPid();
+  std::string received;
+  std::thread watcher([this, pid, &wake, &received] {
+    pollfd fds[2] = {{in_fd_, POLLIN, 0}, {wake[0], POLLIN, 0}};
+    while (poll(fds, 2, -1) > 0 && fds[1].revents == 0) {
+      char c;
+      if (read(in_fd_, &c, 1) != 1) {
+        break;
+      }
+      if (c == '\x03') {
+        // To the process, as a Ctrl-C in its terminal would
+        kill(pid, SIGINT);
+      } else {
+        received += c;
+      }
+    }
+  });
+  last_stop_ = debugger_.RunUntilStop(false, signal);
+  (void)!write(wake[1], "", 1);
+  watcher.join();
+  close(wake[0]);
+  close(wake[1]);
+  input_ += received;
+  return StopReply();
+}
+
+std::string GdbServer::StopReply() const {
+  if (last_stop_.exit_status.has_value()) {
+    auto status = last_stop_.exit_status.value();
+    char reply[4];
+    std::snprintf(reply, sizeof(reply), "%c%02x",
+                  WIFEXITED(status) ? 'W' : 'X',
+                  WIFEXITED(status) ? WEXITSTATUS(status)
+                                    : ToGdbSignal(WTERMSIG(status)));
+    return reply;
+  }
+  char signal[3];
+  std::snprintf(signal, sizeof(signal), "%02x",
+                ToGdbSignal(last_stop_.signal));
+  auto reply = std::string("T") + signal + "thread:" +
+               ToHex(debugger_.GetCurrentThread()) + ";";
+  if (last_stop_.breakpoint) {
+    reply += "swbreak:;";
+  } else if (last_stop_.hit.has_value()) {
+    switch (last_stop_.hit->kind) {
+      case WatchKind::kExecute:
+        reply += "hwbreak:;";
+        break;
+      case WatchKind::kWrite:
+        reply += "watch:" + ToHex(last_stop_.hit->addr) + ";";
+        break;
+      case WatchKind::kAccess:
+        reply += "awatch:" + ToHex(last_stop_.hit->addr) + ";";
+        break;
+    }
+  }
+  return reply;
+}
+
+GdbServer::RegisterCache* GdbServer::GetRegisterCache() {
+  if (!registers_.has_value()) {
+    RegisterCache cache;
+    if (!debugger_.ReadRegisterSets(&cache.regs, &cache.fpregs)) {
+      return nullptr;
+    }
+    cache.ftag = ExpandTag(cache.fpregs);
+    registers_ = cache;
+  }
+  return &registers_.value();
+}
+
+bool GdbServer::StoreRegisters(const RegisterCache& cache) {
+  auto fpregs = cache.fpregs;
+  fpregs.ftw = AbridgeTag(cache.ftag);
+  if (!debugger_.WriteRegisterSets(cache.regs, fpregs)) {
+    registers_.reset();
+    return false;
+  }
+  registers_ = cache;
+  registers_->fpregs.ftw = fpregs.ftw;
+  return true;
+}
+
+}  // namespace shuidb
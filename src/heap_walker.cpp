@@ -0,0 +1,588 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "heap_walker.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <span>
+#include <unordered_set>
+
+#include "memory_operator.h"
+#include "read_planner.h"
+#include "utils/string_utils.hpp"
+
+namespace shuidb {
+
+namespace {
+
+// struct malloc_state
+constexpr std::size_t kFastBinsOffset = 0x10;
+constexpr std::size_t kFastBins = 10;
+constexpr std::size_t kTopOffset = 0x60;
+constexpr std::size_t kBinsOffset = 0x70;
+constexpr std::size_t kNextOffset = 0x870;
+constexpr std::size_t kArenaSize = 0x898;
+// struct heap_info starts with ar_ptr, prev and size
+constexpr std::size_t kHeapInfoSize = 24;
+// Thread arena heaps are aligned to their maximum size
+constexpr std::uintptr_t kHeapMaxSize = 64 << 20;
+// struct tcache_perthread_struct: uint16_t counts[64], then the list heads
+constexpr std::size_t kTcacheBins = 64;
+constexpr std::size_t kTcacheSize = kTcacheBins * 10;
+
+constexpr std::size_t kHeaderSize = 16;
+constexpr std::size_t kMinChunkSize = 32;
+constexpr std::size_t kAlignment = 16;
+constexpr uint64_t kPrevInUse = 1;
+constexpr uint64_t kIsMmapped = 2;
+constexpr uint64_t kFlagMask = 7;
+constexpr std::size_t kPageSize = 4096;
+// Followed lists longer than this are taken as corrupt
+constexpr std::size_t kMaxListLength = 1 << 24;
+constexpr std::size_t kMaxArenas = 1 << 16;
+
+constexpr std::size_t kExactClasses = HeapWalker::kExactSizeLimit / kAlignment;
+constexpr std::size_t kClasses = kExactClasses + 64;
+
+std::size_t GetClass(std::size_t size) {
+  if (size <= HeapWalker::kExactSizeLimit) {
+    return size / kAlignment - 1;
+  }
+  return kExactClasses + std::bit_width(size - 1) -
+         std::bit_width(HeapWalker::kExactSizeLimit);
+}
+
+uint64_t GetWord(std::span<const uint8_t> data, std::size_t offset) {
+  uint64_t word;
+  std::memcpy(&word, data.data() + offset, sizeof(word));
+  return word;
+}
+
+std::uintptr_t AlignUp(std::uintptr_t addr) {
+  return (addr + kAlignment - 1) & ~(kAlignment - 1);
+}
+
+// A run of chunk headers: the brk heap of main_arena or one heap of a
+// thread arena
+struct Segment {
+  std::uintptr_t start;
+  std::uintptr_t end;
+  // Into HeapReport::arenas
+  std::size_t arena;
+  // The top chunk of the arena, when in this segment
+  std::uintptr_t top;
+};
+
+struct SegmentResult {
+  std::vector<HeapSizeClass> classes;
+  HeapArena totals{};
+  // Min-heap by size
+  std::vector<HeapChunk> largest;
+  // In-use chunks with the size of a tcache_perthread_struct
+  std::vector<std::uintptr_t> tcaches;
+  std::size_t bytes_read{0};
+};
+
+bool BySizeDescending(const HeapChunk& a, const HeapChunk& b) {
+  return a.size > b.size;
+}
+
+void KeepLargest(std::vector<HeapChunk>& largest, const HeapChunk& chunk,
+                 std::size_t max) {
+  if (largest.size() < max) {
+    largest.push_back(chunk);
+    std::push_heap(largest.begin(), largest.end(), BySizeDescending);
+  } else if (max > 0 && chunk.size > largest.front().size) {
+    std::pop_heap(largest.begin(), largest.end(), BySizeDescending);
+    largest.back() = chunk;
+    std::push_heap(largest.begin(), largest.end(), BySizeDescending);
+  }
+}
+
+// Part of a segment around the walk, refilled with one read
+class Window {
+ public:
+  Window(pid_t pid, std::uintptr_t end) : pid_(pid), end_(end) {}
+
+  // Whether [addr, addr + len) is in the window, reading from `addr` on
+  // when it is not
+  bool Ensure(std::uintptr_t addr, std::size_t len) {
+    if (addr >= base_ && addr + len <= base_ + size_) {
+      return true;
+    }
+    if (addr + len > end_) {
+      return false;
+    }
+    buf_.resize(std::min<std::size_t>(HeapWalker::kWindowSize, end_ - addr));
+    base_ = addr;
+    size_ = MemoryOperator::ReadMemory(pid_, addr, buf_.data(), buf_.size());
+    bytes_read_ += size_;
+    return len <= size_;
+  }
+  uint64_t Word(std::uintptr_t addr) const {
+    return GetWord(buf_, addr - base_);
+  }
+  std::size_t GetBytesRead() const { return bytes_read_; }
+
+ private:
+  pid_t pid_;
+  std::uintptr_t end_;
+  std::uintptr_t base_{0};
+  std::size_t size_{0};
+  std::vector<uint8_t> buf_;
+  std::size_t bytes_read_{0};
+};
+
+void Count(SegmentResult& result, const HeapChunk& chunk, bool used,
+           std::size_t max_largest) {
+  auto& cls = result.classes[GetClass(chunk.size)];
+  auto& totals = result.totals;
+  if (used) {
+    cls.used_count++;
+    cls.used_bytes += chunk.size;
+    totals.used_count++;
+    totals.used_bytes += chunk.size;
+    KeepLargest(result.largest, chunk, max_largest);
+  } else {
+    cls.free_count++;
+    cls.free_bytes += chunk.size;
+    totals.free_count++;
+    totals.free_bytes += chunk.size;
+    totals.largest_free = std::max(totals.largest_free, chunk.size);
+  }
+}
+
+// A chunk is free when the next one has PREV_INUSE clear, except for
+// tcache and fastbin chunks
+SegmentResult WalkSegment(pid_t pid, const Segment& segment,
+                          std::size_t max_largest) {
+  SegmentResult result;
+  result.classes.resize(kClasses);
+  Window window(pid, segment.end);
+  auto p = segment.start;
+  while (p < segment.end) {
+    if (!window.Ensure(p, kHeaderSize)) {
+      result.totals.corrupt = true;
+      break;
+    }
+    auto size = window.Word(p + 8) & ~kFlagMask;
+    if (p == segment.top) {
+      result.totals.top_size = size;
+      break;
+    }
+    // Fencepost closing a heap which got a successor
+    if (size == kHeaderSize) {
+      break;
+    }
+    auto next = p + size;
+    if (size < kMinChunkSize || size % kAlignment != 0 ||
+        next < p || !window.Ensure(next, kHeaderSize)) {
+      result.totals.corrupt = true;
+      break;
+    }
+    bool used = window.Word(next + 8) & kPrevInUse;
+    if (used && size == AlignUp(kTcacheSize + kHeaderSize)) {
+      result.tcaches.push_back(p);
+    }
+    Count(result, {p, size, false}, used, max_largest);
+    p = next;
+  }
+  result.bytes_read = window.GetBytesRead();
+  return result;
+}
+
+// Chunks which malloc mmapped on its own start their mapping, with
+// IS_MMAPPED as their only flag and a size in pages. Neighbouring ones may
+// share a mapping
+SegmentResult WalkMmapped(pid_t pid, const utils::MemoryRegion& region,
+                          std::size_t max_largest) {
+  SegmentResult result;
+  result.classes.resize(kClasses);
+  auto p = region.start;
+  while (p + kHeaderSize <= region.end) {
+    uint64_t header[2];
+    if (MemoryOperator::ReadMemory(pid, p, header, sizeof(header)) !=
+        sizeof(header)) {
+      break;
+    }
+    result.bytes_read += sizeof(header);
+    auto size = header[1] & ~kFlagMask;
+    if (header[0] != 0 || (header[1] & kFlagMask) != kIsMmapped ||
+        size == 0 || size % kPageSize != 0 || size > region.end - p) {
+      break;
+    }
+    auto& cls = result.classes[GetClass(size)];
+    cls.used_count++;
+    cls.used_bytes += size;
+    result.totals.used_count++;
+    result.totals.used_bytes += size;
+    KeepLargest(result.largest, {p, size, true}, max_largest);
+    p += size;
+  }
+  return result;
+}
+
+// Sorted by start, to validate list pointers
+class SegmentIndex {
+ public:
+  explicit SegmentIndex(std::vector<Segment> segments)
+      : segments_(std::move(segments)) {
+    std::sort(segments_.begin(), segments_.end(),
+              [](const Segment& a, const Segment& b) {
+                return a.start < b.start;
+              });
+  }
+
+  // The segment holding a chunk at `addr`
+  const Segment* Find(std::uintptr_t addr) const {
+    if (addr % kAlignment != 0) {
+      return nullptr;
+    }
+    auto it = std::upper_bound(
+        segments_.begin(), segments_.end(), addr,
+        [](std::uintptr_t addr, const Segment& s) { return addr < s.start; });
+    if (it == segments_.begin() || addr + kMinChunkSize > (--it)->end) {
+      return nullptr;
+    }
+    return &*it;
+  }
+
+ private:
+  std::vector<Segment> segments_;
+};
+
+struct FreeList {
+  // Current chunk
+  std::uintptr_t chunk;
+  // Chunks left to follow, from the tcache counts
+  std::size_t remaining;
+  // Tcache links point after the header, fastbin links at the chunk
+  bool tcache;
+};
+
+// Links are mangled with their own address since glibc 2.32, plain before
+std::uintptr_t DecodeLink(const SegmentIndex& index, std::uintptr_t chunk,
+                          uint64_t link, bool tcache) {
+  auto skip = tcache ? kHeaderSize : 0;
+  for (auto next : {link ^ ((chunk + kHeaderSize) >> 12), link}) {
+    if (next != 0 && index.Find(next - skip) != nullptr) {
+      return next - skip;
+    }
+  }
+  return 0;
+}
+
+// The lists found in candidate tcache_perthread_structs which hold up
+std::vector<FreeList> ReadTcaches(pid_t pid, const SegmentIndex& index,
+                                  const std::vector<std::uintptr_t>& tcaches,
+                                  std::size_t& bytes_read) {
+  ReadPlanner planner;
+  for (auto addr : tcaches) {
+    planner.Request(addr + kHeaderSize, kTcacheSize);
+  }
+  bytes_read += planner.Execute(pid);
+  std::vector<FreeList> lists;
+  for (std::size_t i = 0; i < tcaches.size(); i++) {
+    auto data = planner.Get(i);
+    if (data.size() < kTcacheSize) {
+      continue;
+    }
+    std::vector<FreeList> found;
+    bool valid = true;
+    for (std::size_t bin = 0; bin < kTcacheBins && valid; bin++) {
+      uint16_t count;
+      std::memcpy(&count, data.data() + bin * 2, sizeof(count));
+      auto head = GetWord(data, kTcacheBins * 2 + bin * 8);
+      if (count == 0 || head == 0) {
+        valid = count == 0 && head == 0;
+      } else if (index.Find(head - kHeaderSize) != nullptr) {
+        found.push_back({head - kHeaderSize, count, true});
+      } else {
+        valid = false;
+      }
+    }
+    if (valid) {
+      lists.insert(lists.end(), found.begin(), found.end());
+    }
+  }
+  return lists;
+}
+
+}  // namespace
+
+std::optional<std::uintptr_t> HeapWalker::FindMainArena(
+    pid_t pid, const std::vector<utils::MemoryRegion>& regions) {
+  auto heap = std::find_if(regions.begin(), regions.end(),
+                           [](const auto& r) { return r.path == "[heap]"; });
+  if (heap == regions.end()) {
+    return std::nullopt;
+  }
+  auto in_heap = [&](uint64_t addr) {
+    return addr >= heap->start && addr + kHeaderSize <= heap->end;
+  };
+  for (std::size_t i = 0; i < regions.size(); i++) {
+    const auto& region = regions[i];
+    auto name = region.path.substr(region.path.rfind('/') + 1);
+    if (!region.IsWritable() || !(utils::starts_with(name, "libc.so") ||
+                                  utils::starts_with(name, "libc-"))) {
+      continue;
+    }
+    // The data of libc, and its bss right after it
+    auto end = region.end;
+    if (i + 1 < regions.size() && regions[i + 1].start == end &&
+        regions[i + 1].path.empty() && regions[i + 1].IsWritable()) {
+      end = regions[i + 1].end;
+    }
+    std::vector<uint8_t> data(end - region.start);
+    data.resize(MemoryOperator::ReadMemory(pid, region.start, data.data(),
+                                           data.size()));
+    for (std::size_t offset = 0; offset + kArenaSize <= data.size();
+         offset += 8) {
+      auto addr = region.start + offset;
+      auto top = GetWord(data, offset + kTopOffset);
+      auto unsorted_fd = GetWord(data, offset + kBinsOffset);
+      auto unsorted_bk = GetWord(data, offset + kBinsOffset + 8);
+      // An empty unsorted bin points at itself, 0x10 before its links
+      if (top % kAlignment != 0 || !in_heap(top) ||
+          (unsorted_fd != addr + kTopOffset && !in_heap(unsorted_fd)) ||
+          (unsorted_bk != addr + kTopOffset && !in_heap(unsorted_bk)) ||
+          GetWord(data, offset + kNextOffset) == 0) {
+        continue;
+      }
+      uint64_t size;
+      if (MemoryOperator::ReadMemory(pid, top + 8, &size, sizeof(size)) !=
+          sizeof(size)) {
+        continue;
+      }
+      auto top_end = top + (size & ~kFlagMask);
+      if (top_end <= heap->end && top_end + kPageSize > heap->end) {
+        return addr;
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+std::optional<HeapReport> HeapWalker::Walk(
+    pid_t pid, const std::vector<utils::MemoryRegion>& regions,
+    std::uintptr_t main_arena, std::size_t max_largest,
+    utils::ThreadPool& pool) {
+  HeapReport report{};
+  std::vector<Segment> segments;
+  std::vector<std::uintptr_t> fastbins;
+  auto read_arena = [&](std::uintptr_t addr) -> std::optional<uint64_t> {
+    std::vector<uint8_t> arena(kArenaSize);
+    if (MemoryOperator::ReadMemory(pid, addr, arena.data(), arena.size()) !=
+        arena.size()) {
+      return std::nullopt;
+    }
+    report.bytes_read += arena.size();
+    for (std::size_t i = 0; i < kFastBins; i++) {
+      auto head = GetWord(arena, kFastBinsOffset + i * 8);
+      if (head != 0) {
+        fastbins.push_back(head);
+      }
+    }
+    report.arenas.push_back({});
+    report.arenas.back().addr = addr;
+    return GetWord(arena, kTopOffset);
+  };
+
+  auto main_top = read_arena(main_arena);
+  if (!main_top.has_value()) {
+    return std::nullopt;
+  }
+  // The brk heap ends with the top chunk
+  auto heap = std::find_if(regions.begin(), regions.end(),
+                           [](const auto& r) { return r.path == "[heap]"; });
+  uint64_t top_size;
+  if (heap != regions.end() &&
+      MemoryOperator::ReadMemory(pid, main_top.value() + 8, &top_size,
+                                 sizeof(top_size)) == sizeof(top_size)) {
+    auto end = main_top.value() + (top_size & ~kFlagMask);
+    segments.push_back({heap->start, std::min(end, heap->end), 0,
+                        main_top.value()});
+  }
+
+  // Thread arenas are linked from main_arena in a ring
+  std::unordered_set<std::uintptr_t> seen{main_arena};
+  uint64_t next;
+  auto addr = main_arena;
+  while (MemoryOperator::ReadMemory(pid, addr + kNextOffset, &next,
+                                    sizeof(next)) == sizeof(next) &&
+         next != 0 && seen.insert(next).second && seen.size() < kMaxArenas) {
+    addr = next;
+    auto top = read_arena(addr);
+    if (!top.has_value()) {
+      break;
+    }
+    // Heaps from the one holding the top chunk back to the first one, which
+    // has the arena right after its heap_info
+    std::vector<std::pair<std::uintptr_t, uint64_t>> heaps;
+    auto h = top.value() & ~(kHeapMaxSize - 1);
+    uint64_t info[3];
+    while (h != 0 && heaps.size() < kMaxArenas &&
+           MemoryOperator::ReadMemory(pid, h, info, sizeof(info)) ==
+               sizeof(info) &&
+           info[0] == addr) {
+      heaps.emplace_back(h, info[2]);
+      h = info[1];
+    }
+    if (heaps.empty() || h != 0) {
+      report.arenas.back().corrupt = true;
+      continue;
+    }
+    auto info_size = addr - heaps.back().first;
+    for (auto [start, size] : heaps) {
+      auto first = start == heaps.back().first ? AlignUp(addr + kArenaSize)
+                                               : start + info_size;
+      segments.push_back(
+          {first, start + size, report.arenas.size() - 1, top.value()});
+    }
+    report.bytes_read += heaps.size() * kHeapInfoSize;
+  }
+
+  // Mappings which may hold chunks mmapped on their own
+  std::vector<const utils::MemoryRegion*> mmapped;
+  for (const auto& region : regions) {
+    bool in_heap = std::any_of(
+        segments.begin(), segments.end(), [&](const Segment& s) {
+          return s.arena != 0 && region.start < s.end &&
+                 (s.start & ~(kHeapMaxSize - 1)) < region.end;
+        });
+    if (region.path.empty() && region.IsReadable() && region.IsWritable() &&
+        !in_heap) {
+      mmapped.push_back(&region);
+    }
+  }
+
+  // One heap or mapping per task
+  std::vector<SegmentResult> results(segments.size() + mmapped.size());
+  pool.ParallelFor(results.size(), [&](std::size_t i) {
+    results[i] = i < segments.size()
+                     ? WalkSegment(pid, segments[i], max_largest)
+                     : WalkMmapped(pid, *mmapped[i - segments.size()],
+                                   max_largest);
+  });
+
+  std::vector<HeapSizeClass> classes(kClasses);
+  std::vector<HeapChunk> largest;
+  std::vector<std::uintptr_t> tcaches;
+  for (std::size_t i = 0; i < results.size(); i++) {
+    const auto& result = results[i];
+    for (std::size_t c = 0; c < kClasses; c++) {
+      classes[c].used_count += result.classes[c].used_count;
+      classes[c].used_bytes += result.classes[c].used_bytes;
+      classes[c].free_count += result.classes[c].free_count;
+      classes[c].free_bytes += result.classes[c].free_bytes;
+    }
+    largest.insert(largest.end(), result.largest.begin(),
+                   result.largest.end());
+    tcaches.insert(tcaches.end(), result.tcaches.begin(),
+                   result.tcaches.end());
+    report.bytes_read += result.bytes_read;
+    if (i >= segments.size()) {
+      report.mmapped_count += result.totals.used_count;
+      report.mmapped_bytes += result.totals.used_bytes;
+      continue;
+    }
+    auto& arena = report.arenas[segments[i].arena];
+    const auto& totals = result.totals;
+    arena.heaps++;
+    arena.used_count += totals.used_count;
+    arena.used_bytes += totals.used_bytes;
+    arena.free_count += totals.free_count;
+    arena.free_bytes += totals.free_bytes;
+    arena.largest_free = std::max(arena.largest_free, totals.largest_free);
+    arena.top_size += totals.top_size;
+    arena.corrupt = arena.corrupt || totals.corrupt;
+  }
+
+  // Tcache and fastbin chunks were counted as in use, the lists are
+  // followed in lockstep so each step is one read
+  SegmentIndex index(segments);
+  auto lists = ReadTcaches(pid, index, tcaches, report.bytes_read);
+  for (auto head : fastbins) {
+    if (index.Find(head) != nullptr) {
+      lists.push_back({head, kMaxListLength, false});
+    }
+  }
+  std::unordered_set<std::uintptr_t> freed;
+  ReadPlanner planner;
+  while (!lists.empty()) {
+    planner.Clear();
+    for (const auto& list : lists) {
+      planner.Request(list.chunk, kHeaderSize + 8);
+    }
+    report.bytes_read += planner.Execute(pid);
+    std::vector<FreeList> next_lists;
+    for (std::size_t i = 0; i < lists.size(); i++) {
+      auto list = lists[i];
+      auto data = planner.Get(i);
+      if (data.size() < kHeaderSize + 8 || !freed.insert(list.chunk).second) {
+        continue;
+      }
+      auto size = GetWord(data, 8) & ~kFlagMask;
+      if (size < kMinChunkSize || size > kExactSizeLimit + kHeaderSize) {
+        continue;
+      }
+      auto& cls = classes[GetClass(size)];
+      cls.used_count--;
+      cls.used_bytes -= size;
+      cls.free_count++;
+      cls.free_bytes += size;
+      auto& arena = report.arenas[index.Find(list.chunk)->arena];
+      arena.used_count--;
+      arena.used_bytes -= size;
+      arena.free_count++;
+      arena.free_bytes += size;
+      arena.largest_free = std::max(arena.largest_free, size);
+      (list.tcache ? arena.tcache_count : arena.fastbin_count)++;
+      list.chunk = DecodeLink(index, list.chunk, GetWord(data, kHeaderSize),
+                              list.tcache);
+      if (list.chunk != 0 && --list.remaining > 0) {
+        next_lists.push_back(list);
+      }
+    }
+    lists = std::move(next_lists);
+  }
+
+  for (std::size_t c = 0; c < kClasses; c++) {
+    auto& cls = classes[c];
+    if (cls.used_count == 0 && cls.free_count == 0) {
+      continue;
+    }
+    if (c < kExactClasses) {
+      cls.min_size = cls.max_size = (c + 1) * kAlignment;
+    } else {
+      auto bits = c - kExactClasses + std::bit_width(kExactSizeLimit);
+      cls.min_size = (std::size_t{1} << (bits - 1)) + kAlignment;
+      cls.max_size = std::size_t{1} << bits;
+    }
+    report.classes.push_back(cls);
+  }
+  std::erase_if(largest, [&](const HeapChunk& chunk) {
+    return freed.count(chunk.addr) != 0;
+  });
+  std::sort(largest.begin(), largest.end(), BySizeDescending);
+  largest.resize(std::min(largest.size(), max_largest));
+  report.largest = std::move(largest);
+  return report;
+}
+
+}  // namespace shuidb
@@ -0,0 +1,456 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "line_table.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+namespace shuidb {
+
+namespace {
+
+// DWARF 5 line header entry formats
+constexpr uint64_t kLnctPath = 0x1;
+constexpr uint64_t kLnctDirectoryIndex = 0x2;
+
+enum Form : uint64_t {
+  kFormData2 = 0x05,
+  kFormData4 = 0x06,
+  kFormData8 = 0x07,
+  kFormString = 0x08,
+  kFormBlock = 0x09,
+  kFormBlock1 = 0x0a,
+  kFormData1 = 0x0b,
+  kFormStrp = 0x0e,
+  kFormUdata = 0x0f,
+  kFormData16 = 0x1e,
+  kFormLineStrp = 0x1f,
+};
+
+enum StandardOpcode : uint8_t {
+  kExtended = 0,
+  kCopy = 1,
+  kAdvancePc = 2,
+  kAdvanceLine = 3,
+  kSetFile = 4,
+  kSetColumn = 5,
+  kNegateStmt = 6,
+  kSetBasicBlock = 7,
+  kConstAddPc = 8,
+  kFixedAdvancePc = 9,
+  kSetPrologueEnd = 10,
+  kSetEpilogueBegin = 11,
+  kSetIsa = 12,
+};
+
+enum ExtendedOpcode : uint8_t {
+  kEndSequence = 1,
+  kSetAddress = 2,
+  kDefineFile = 3,
+};
+
+// Bounds-checked little-endian reads, every read past the end yields zero and
+// clears `Ok`
+class ByteReader {
+ public:
+  explicit ByteReader(std::span<const uint8_t> data) : data_(data) {}
+
+  bool Ok() const { return ok_; }
+  bool AtEnd() const { return !ok_ || pos_ >= data_.size(); }
+  std::size_t Position() const { return pos_; }
+  std::size_t Remaining() const { return ok_ ? data_.size() - pos_ : 0; }
+
+  void Seek(std::size_t pos) {
+    ok_ = ok_ && pos <= data_.size();
+    pos_ = ok_ ? pos : pos_;
+  }
+  void Skip(std::size_t len) { Seek(pos_ + len); }
+  std::span<const uint8_t> Sub(std::size_t len) {
+    if (len > Remaining()) {
+      ok_ = false;
+      return {};
+    }
+    auto sub = data_.subspan(pos_, len);
+    pos_ += len;
+    return sub;
+  }
+
+  template <typename T>
+  T Read() {
+    T value{};
+    if (sizeof(T) > Remaining()) {
+      ok_ = false;
+      return value;
+    }
+    std::memcpy(&value, data_.data() + pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return value;
+  }
+  uint64_t ReadOffset(bool dwarf64) {
+    return dwarf64 ? Read<uint64_t>() : Read<uint32_t>();
+  }
+  uint64_t ReadUleb() {
+    uint64_t value = 0;
+    for (int shift = 0; !AtEnd(); shift += 7) {
+      auto byte = data_[pos_++];
+      if (shift < 64) {
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      }
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+    ok_ = false;
+    return 0;
+  }
+  int64_t ReadSleb() {
+    int64_t value = 0;
+    for (int shift = 0; !AtEnd(); shift += 7) {
+      auto byte = data_[pos_++];
+      if (shift < 64) {
+        value |= static_cast<int64_t>(byte & 0x7f) << shift;
+      }
+      if ((byte & 0x80) == 0) {
+        if (shift + 7 < 64 && (byte & 0x40) != 0) {
+          value |= -(static_cast<int64_t>(1) << (shift + 7));
+        }
+        return value;
+      }
+    }
+    ok_ = false;
+    return 0;
+  }
+  std::string_view ReadString() {
+    auto rest = data_.subspan(std::min(pos_, data_.size()));
+    const auto* begin = reinterpret_cast<const char*>(rest.data());
+    auto len = strnlen(begin, rest.size());
+    if (len == rest.size()) {
+      ok_ = false;
+      return {};
+    }
+    pos_ += len + 1;
+    return {begin, len};
+  }
+
+ private:
+  std::span<const uint8_t> data_;
+  std::size_t pos_{0};
+  bool ok_{true};
+};
+
+std::string_view StringAt(std::span<const uint8_t> section, uint64_t offset) {
+  if (offset >= section.size()) {
+    return {};
+  }
+  const auto* begin = reinterpret_cast<const char*>(section.data() + offset);
+  return {begin, strnlen(begin, section.size() - offset)};
+}
+
+std::string JoinPath(std::string_view dir, std::string_view name) {
+  if (dir.empty() || (!name.empty() && name[0] == '/')) {
+    return std::string(name);
+  }
+  return std::string(dir) + "/" + std::string(name);
+}
+
+}  // namespace
+
+std::optional<LineTable> LineTable::Parse(const ElfFile& elf) {
+  auto section = elf.GetSection(".debug_line");
+  if (!section.has_value()) {
+    return std::nullopt;
+  }
+  auto str = elf.GetSection(".debug_str").value_or(std::span<const uint8_t>{});
+  auto line_str =
+      elf.GetSection(".debug_line_str").value_or(std::span<const uint8_t>{});
+
+  LineTable table;
+  ByteReader reader(section.value());
+  while (!reader.AtEnd()) {
+    uint64_t len = reader.Read<uint32_t>();
+    bool dwarf64 = len == 0xffffffff;
+    if (dwarf64) {
+      len = reader.Read<uint64_t>();
+    }
+    auto unit = reader.Sub(len);
+    if (!reader.Ok()) {
+      break;
+    }
+    // A unit we cannot read does not spoil the others
+    table.ParseUnit(unit, dwarf64, str, line_str);
+  }
+  if (table.rows_.empty()) {
+    return std::nullopt;
+  }
+  // Where sequences touch, the end of one sorts before the start of the next
+  std::stable_sort(table.rows_.begin(), table.rows_.end(),
+                   [](const LineRow& a, const LineRow& b) {
+                     if (a.address != b.address) {
+                       return a.address < b.address;
+                     }
+                     return a.end_sequence && !b.end_sequence;
+                   });
+  return table;
+}
+
+bool LineTable::ParseUnit(std::span<const uint8_t> unit, bool dwarf64,
+                          std::span<const uint8_t> str,
+                          std::span<const uint8_t> line_str) {
+  ByteReader r(unit);
+  auto version = r.Read<uint16_t>();
+  if (version < 2 || version > 5) {
+    return false;
+  }
+  if (version >= 5) {
+    auto address_size = r.Read<uint8_t>();
+    r.Read<uint8_t>();  // segment selector size
+    if (address_size != 8) {
+      return false;
+    }
+  }
+  auto header_length = r.ReadOffset(dwarf64);
+  auto program = r.Position() + header_length;
+  auto min_inst_length = r.Read<uint8_t>();
+  if (version >= 4) {
+    r.Read<uint8_t>();  // maximum operations per instruction, VLIW only
+  }
+  bool default_is_stmt = r.Read<uint8_t>() != 0;
+  auto line_base = r.Read<int8_t>();
+  auto line_range = r.Read<uint8_t>();
+  auto opcode_base = r.Read<uint8_t>();
+  std::vector<uint8_t> opcode_lengths(opcode_base);
+  for (int i = 1; i < opcode_base; i++) {
+    opcode_lengths[i] = r.Read<uint8_t>();
+  }
+  if (!r.Ok() || line_range == 0 || opcode_base == 0) {
+    return false;
+  }
+
+  // Global index of each file of this unit
+  std::vector<uint32_t> file_ids;
+  std::vector<std::string> dirs;
+  if (version >= 5) {
+    // Directory and file tables share one self-describing layout
+    auto read_entries = [&](bool is_dir) {
+      std::vector<std::pair<uint64_t, uint64_t>> formats(r.Read<uint8_t>());
+      for (auto& [type, form] : formats) {
+        type = r.ReadUleb();
+        form = r.ReadUleb();
+      }
+      auto count = r.ReadUleb();
+      for (uint64_t i = 0; i < count && r.Ok(); i++) {
+        std::string_view path;
+        uint64_t dir = 0;
+        for (const auto& [type, form] : formats) {
+          std::string_view s;
+          uint64_t value = 0;
+          switch (form) {
+            case kFormString:
+              s = r.ReadString();
+              break;
+            case kFormStrp:
+              s = StringAt(str, r.ReadOffset(dwarf64));
+              break;
+            case kFormLineStrp:
+              s = StringAt(line_str, r.ReadOffset(dwarf64));
+              break;
+            case kFormData1:
+              value = r.Read<uint8_t>();
+              break;
+            case kFormData2:
+              value = r.Read<uint16_t>();
+              break;
+            case kFormData4:
+              value = r.Read<uint32_t>();
+              break;
+            case kFormData8:
+              value = r.Read<uint64_t>();
+              break;
+            case kFormUdata:
+              value = r.ReadUleb();
+              break;
+            case kFormData16:
+              r.Skip(16);
+              break;
+            case kFormBlock:
+              r.Skip(r.ReadUleb());
+              break;
+            case kFormBlock1:
+              r.Skip(r.Read<uint8_t>());
+              break;
+            default:
+              return false;
+          }
+          if (type == kLnctPath) {
+            path = s;
+          } else if (type == kLnctDirectoryIndex) {
+            dir = value;
+          }
+        }
+        if (is_dir) {
+          dirs.emplace_back(path);
+        } else {
+          file_ids.push_back(files_.size());
+          files_.push_back(JoinPath(dir < dirs.size() ? dirs[dir] : "", path));
+        }
+      }
+      return r.Ok();
+    };
+    if (!read_entries(true) || !read_entries(false)) {
+      return false;
+    }
+  } else {
+    // Directory 0 is the compilation directory, which only the CU knows
+    dirs.emplace_back();
+    for (auto dir = r.ReadString(); !dir.empty(); dir = r.ReadString()) {
+      dirs.emplace_back(dir);
+    }
+    // Files are numbered from 1
+    file_ids.push_back(files_.size());
+    files_.emplace_back();
+    for (auto name = r.ReadString(); !name.empty(); name = r.ReadString()) {
+      auto dir = r.ReadUleb();
+      r.ReadUleb();  // modification time
+      r.ReadUleb();  // length
+      file_ids.push_back(files_.size());
+      files_.push_back(JoinPath(dir < dirs.size() ? dirs[dir] : "", name));
+    }
+  }
+  if (!r.Ok()) {
+    return false;
+  }
+
+  r.Seek(program);
+  uint64_t address = 0;
+  uint64_t file = 1;
+  int64_t line = 1;
+  bool is_stmt = default_is_stmt;
+  std::vector<LineRow> sequence;
+  auto emit = [&](bool end_sequence) {
+    auto id = file < file_ids.size() ? file_ids[file] : UINT32_MAX;
+    sequence.push_back({address, id, static_cast<uint32_t>(line), is_stmt,
+                        end_sequence});
+  };
+
+  while (!r.AtEnd()) {
+    auto opcode = r.Read<uint8_t>();
+    if (opcode >= opcode_base) {
+      auto adjusted = opcode - opcode_base;
+      address += (adjusted / line_range) * min_inst_length;
+      line += line_base + adjusted % line_range;
+      emit(false);
+      continue;
+    }
+    switch (opcode) {
+      case kExtended: {
+        auto len = r.ReadUleb();
+        auto end = r.Position() + len;
+        auto sub_opcode = len > 0 ? r.Read<uint8_t>() : 0;
+        if (sub_opcode == kEndSequence) {
+          emit(true);
+          // Code dropped by the linker keeps its sequences at address 0
+          if (sequence.front().address != 0) {
+            rows_.insert(rows_.end(), sequence.begin(), sequence.end());
+          }
+          sequence.clear();
+          address = 0;
+          file = 1;
+          line = 1;
+          is_stmt = default_is_stmt;
+        } else if (sub_opcode == kSetAddress && len == 9) {
+          address = r.Read<uint64_t>();
+        } else if (sub_opcode == kDefineFile) {
+          auto name = r.ReadString();
+          auto dir = r.ReadUleb();
+          file_ids.push_back(files_.size());
+          files_.push_back(JoinPath(dir < dirs.size() ? dirs[dir] : "", name));
+        }
+        r.Seek(end);
+      } break;
+      case kCopy:
+        emit(false);
+        break;
+      case kAdvancePc:
+        address += r.ReadUleb() * min_inst_length;
+        break;
+      case kAdvanceLine:
+        line += r.ReadSleb();
+        break;
+      case kSetFile:
+        file = r.ReadUleb();
+        break;
+      case kNegateStmt:
+        is_stmt = !is_stmt;
+        break;
+      case kConstAddPc:
+        address += ((255 - opcode_base) / line_range) * min_inst_length;
+        break;
+      case kFixedAdvancePc:
+        address += r.Read<uint16_t>();
+        break;
+      case kSetBasicBlock:
+      case kSetPrologueEnd:
+      case kSetEpilogueBegin:
+        break;
+      case kSetColumn:
+      case kSetIsa:
+      default:
+        // Unknown standard opcodes declare their number of ULEB operands
+        for (int i = 0; i < opcode_lengths[opcode]; i++) {
+          r.ReadUleb();
+        }
+        break;
+    }
+  }
+  return r.Ok();
+}
+
+const LineRow* LineTable::FindRow(uint64_t addr) const {
+  auto it = std::upper_bound(
+      rows_.begin(), rows_.end(), addr,
+      [](uint64_t a, const LineRow& row) { return a < row.address; });
+  if (it == rows_.begin()) {
+    return nullptr;
+  }
+  --it;
+  return it->end_sequence ? nullptr : &*it;
+}
+
+std::vector<uint64_t> LineTable::GetLineStarts(uint64_t begin,
+                                               uint64_t end) const {
+  std::vector<uint64_t> starts;
+  auto it = std::lower_bound(
+      rows_.begin(), rows_.end(), begin,
+      [](const LineRow& row, uint64_t a) { return row.address < a; });
+  for (; it != rows_.end() && it->address < end; ++it) {
+    if (it->is_stmt && !it->end_sequence &&
+        (starts.empty() || starts.back() != it->address)) {
+      starts.push_back(it->address);
+    }
+  }
+  return starts;
+}
+
+const std::string& LineTable::GetFileName(uint32_t file) const {
+  static const std::string kUnknown;
+  return file < files_.size() ? files_[file] : kUnknown;
+}
+
+std::size_t LineTable::Size() const { return rows_.size(); }
+
+}  // namespace shuidb
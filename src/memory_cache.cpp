@@ -0,0 +1,157 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "memory_cache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "memory_operator.h"
+
+namespace shuidb {
+
+namespace {
+
+constexpr std::uintptr_t kPageMask = ~(MemoryCache::kPageSize - 1);
+
+// Start addresses of the mappings without anonymous (copied on write) pages,
+// from /proc/<pid>/smaps
+std::map<std::uintptr_t, bool> ReadPristineRegions(pid_t pid) {
+  std::map<std::uintptr_t, bool> pristine;
+  std::ifstream ifs("/proc/" + std::to_string(pid) + "/smaps");
+  std::string line;
+  std::uintptr_t start = 0;
+  while (std::getline(ifs, line)) {
+    if (line.rfind("Anonymous:", 0) == 0) {
+      std::istringstream iss(line.substr(10));
+      uint64_t kb = 0;
+      iss >> kb;
+      pristine[start] = kb == 0;
+    } else if (!line.empty() && std::isxdigit(line[0]) &&
+               line.find('-') != std::string::npos &&
+               line.find(':') > line.find(' ')) {
+      // e.g. `00400000-00452000 r--p 00000000 08:02 173521 /usr/bin/dbus`
+      start = std::stoul(line.substr(0, line.find('-')), 0, 16);
+    }
+  }
+  return pristine;
+}
+
+}  // namespace
+
+void MemoryCache::Reset(pid_t pid) {
+  pid_ = pid;
+  Invalidate();
+  written_pages_.clear();
+  pristine_.clear();
+  stats_ = {};
+}
+
+void MemoryCache::Invalidate() {
+  pages_.clear();
+  storage_.clear();
+}
+
+bool MemoryCache::IsFileBacked(std::uintptr_t page) {
+  const auto* region =
+      utils::FindMemoryRegion(symbolizer_.GetRegions(), page);
+  if (region == nullptr || !region->IsFileBacked() || region->IsWritable() ||
+      written_pages_.count(page) != 0) {
+    return false;
+  }
+  // Our breakpoints are the only writes to text, and callers mask them
+  if (region->IsExecutable()) {
+    return true;
+  }
+  if (pristine_.count(region->start) == 0) {
+    pristine_ = ReadPristineRegions(pid_);
+  }
+  auto it = pristine_.find(region->start);
+  return it != pristine_.end() && it->second;
+}
+
+const MemoryCache::Page& MemoryCache::LoadPage(std::uintptr_t page) {
+  auto offset = storage_.size();
+  storage_.resize(offset + kPageSize);
+  auto size =
+      MemoryOperator::ReadMemory(pid_, page, &storage_[offset], kPageSize);
+  stats_.misses++;
+  return pages_[page] = {offset, size};
+}
+
+std::size_t MemoryCache::Read(std::uintptr_t addr, void* buf,
+                              std::size_t len) {
+  auto* out = static_cast<uint8_t*>(buf);
+  std::size_t total = 0;
+  while (total < len) {
+    auto cur = addr + total;
+    auto page = cur & kPageMask;
+    auto n = std::min(len - total, page + kPageSize - cur);
+
+    auto it = pages_.find(page);
+    if (it != pages_.end()) {
+      stats_.hits++;
+    } else if (IsFileBacked(page)) {
+      const auto* bytes = symbolizer_.GetFileBytes(cur, n);
+      if (bytes != nullptr) {
+        stats_.file_reads++;
+        std::memcpy(out + total, bytes, n);
+        total += n;
+        continue;
+      }
+    }
+    const auto& cached = it != pages_.end() ? it->second : LoadPage(page);
+    auto in_page = cur - page;
+    if (cached.size <= in_page) {
+      break;
+    }
+    n = std::min(n, cached.size - in_page);
+    std::memcpy(out + total, &storage_[cached.offset + in_page], n);
+    total += n;
+  }
+  return total;
+}
+
+std::size_t MemoryCache::Write(std::uintptr_t addr, const void* buf,
+                               std::size_t len) {
+  std::vector<iovec> local{{const_cast<void*>(buf), len}};
+  std::vector<iovec> remote{{reinterpret_cast<void*>(addr), len}};
+  auto written = MemoryOperator::WriteMemoryV(pid_, local, remote);
+  const auto* in = static_cast<const uint8_t*>(buf);
+  for (auto page = addr & kPageMask; page < addr + written;
+       page += kPageSize) {
+    written_pages_.insert(page);
+    auto it = pages_.find(page);
+    if (it == pages_.end()) {
+      continue;
+    }
+    auto begin = std::max(addr, page);
+    auto end = std::min(addr + written, page + it->second.size);
+    if (begin < end) {
+      std::memcpy(&storage_[it->second.offset + (begin - page)],
+                  in + (begin - addr), end - begin);
+    }
+  }
+  return written;
+}
+
+const MemoryCacheStats& MemoryCache::GetStats() const { return stats_; }
+
+}  // namespace shuidb
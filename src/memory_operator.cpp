@@ -16,16 +16,160 @@
 
 #include "memory_operator.h"
 
+#include <fcntl.h>
+#include <limits.h>
 #include <sys/ptrace.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "utils/syscall_stats.hpp"
+
 namespace shuidb {
 
+namespace {
+
+std::mutex mem_fds_mutex;
+// /proc/<pid>/mem of every process written to, open until it goes away
+std::unordered_map<pid_t, int> mem_fds;
+
+int OpenMemory(pid_t pid) {
+  std::lock_guard<std::mutex> lock(mem_fds_mutex);
+  auto it = mem_fds.find(pid);
+  if (it != mem_fds.end()) {
+    return it->second;
+  }
+  auto mem_path = "/proc/" + std::to_string(pid) + "/mem";
+  int fd = open(mem_path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    mem_fds.emplace(pid, fd);
+  }
+  return fd;
+}
+
+}  // namespace
+
 void MemoryOperator::WriteMemory(pid_t pid, uint64_t addr, uint64_t data) {
-  ptrace(PTRACE_POKEDATA, pid, addr, data);
+  utils::Ptrace(PTRACE_POKEDATA, pid, addr, data);
 }
 
 uint64_t MemoryOperator::ReadMemory(pid_t pid, uint64_t addr) {
-  return ptrace(PTRACE_PEEKDATA, pid, addr, nullptr);
+  return utils::Ptrace(PTRACE_PEEKDATA, pid, addr, nullptr);
+}
+
+std::size_t MemoryOperator::ReadMemory(pid_t pid, uint64_t addr, void* buf,
+                                       std::size_t len) {
+  std::size_t total = 0;
+  auto* out = static_cast<uint8_t*>(buf);
+  while (total < len) {
+    iovec local{out + total, len - total};
+    iovec remote{reinterpret_cast<void*>(addr + total), len - total};
+    auto n = utils::ProcessVmReadv(pid, &local, 1, &remote, 1);
+    if (n <= 0) {
+      break;
+    }
+    total += n;
+  }
+  if (total == len) {
+    return total;
+  }
+
+  // process_vm_readv refuses some mappings (e.g. PROT_NONE guard pages or
+  // [vvar]), so the remaining part is read word by word
+  while (total < len) {
+    errno = 0;
+    auto word = utils::Ptrace(PTRACE_PEEKDATA, pid, addr + total, nullptr);
+    if (errno != 0) {
+      break;
+    }
+    auto n = std::min(sizeof(word), len - total);
+    std::memcpy(out + total, &word, n);
+    total += n;
+  }
+  return total;
+}
+
+std::size_t MemoryOperator::ReadMemoryV(pid_t pid,
+                                        const std::vector<iovec>& local,
+                                        const std::vector<iovec>& remote) {
+  std::size_t total = 0;
+  for (std::size_t begin = 0; begin < remote.size(); begin += IOV_MAX) {
+    auto count = std::min<std::size_t>(IOV_MAX, remote.size() - begin);
+    auto n = utils::ProcessVmReadv(pid, &local[begin], count, &remote[begin],
+                                   count);
+    std::size_t expected = 0;
+    for (std::size_t i = begin; i < begin + count; i++) {
+      expected += remote[i].iov_len;
+    }
+    if (n == (ssize_t)expected) {
+      total += n;
+      continue;
+    }
+    // The kernel stops at the first unreadable range
+    for (std::size_t i = begin; i < begin + count; i++) {
+      total += ReadMemory(pid, reinterpret_cast<uint64_t>(remote[i].iov_base),
+                          local[i].iov_base, remote[i].iov_len);
+    }
+  }
+  return total;
+}
+
+std::size_t MemoryOperator::WriteMemoryV(pid_t pid,
+                                         const std::vector<iovec>& local,
+                                         const std::vector<iovec>& remote) {
+  int fd = OpenMemory(pid);
+  bool reopened = false;
+  std::size_t total = 0;
+  for (std::size_t i = 0; i < remote.size(); i++) {
+    auto addr = reinterpret_cast<uint64_t>(remote[i].iov_base);
+    const auto* in = static_cast<const uint8_t*>(local[i].iov_base);
+    auto len = remote[i].iov_len;
+    std::size_t done = 0;
+    if (fd >= 0) {
+      auto n = utils::PwriteMemory(fd, in, len, addr);
+      if (n <= 0 && len > 0 && !reopened) {
+        // The fd still points at the address space the process had before
+        // an exec, or at a process which reused the pid
+        CloseMemory(pid);
+        fd = OpenMemory(pid);
+        reopened = true;
+        n = fd >= 0 ? utils::PwriteMemory(fd, in, len, addr) : -1;
+      }
+      done = n > 0 ? n : 0;
+    }
+    // Word by word for the rest, keeping the bytes past the end of the range
+    while (done < len) {
+      uint64_t word = 0;
+      auto n = std::min(sizeof(word), len - done);
+      if (n < sizeof(word)) {
+        errno = 0;
+        word = utils::Ptrace(PTRACE_PEEKDATA, pid, addr + done, nullptr);
+        if (errno != 0) {
+          break;
+        }
+      }
+      std::memcpy(&word, in + done, n);
+      if (utils::Ptrace(PTRACE_POKEDATA, pid, addr + done, word) == -1) {
+        break;
+      }
+      done += n;
+    }
+    total += done;
+  }
+  return total;
+}
+
+void MemoryOperator::CloseMemory(pid_t pid) {
+  std::lock_guard<std::mutex> lock(mem_fds_mutex);
+  auto it = mem_fds.find(pid);
+  if (it != mem_fds.end()) {
+    close(it->second);
+    mem_fds.erase(it);
+  }
 }
 
 }  // namespace shuidb
\ No newline at end of file
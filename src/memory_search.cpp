@@ -0,0 +1,261 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "memory_search.h"
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include "memory_operator.h"
+#include "utils/string_utils.hpp"
+
+namespace shuidb {
+
+namespace {
+
+// Candidate positions are those where the first and the last byte of the
+// pattern both match, checked a vector at a time, then confirmed with
+// memcmp. Rare bytes at either end make candidates rare
+std::size_t FindScalar(const uint8_t* data, std::size_t limit,
+                       const uint8_t* pattern, std::size_t len,
+                       std::size_t from, std::vector<std::size_t>& matches,
+                       std::size_t max_matches) {
+  std::size_t count = 0;
+  while (from < limit) {
+    const auto* p = static_cast<const uint8_t*>(
+        std::memchr(data + from, pattern[0], limit - from));
+    if (p == nullptr) {
+      break;
+    }
+    auto i = static_cast<std::size_t>(p - data);
+    if (std::memcmp(p, pattern, len) == 0) {
+      if (matches.size() < max_matches) {
+        matches.push_back(i);
+      }
+      count++;
+    }
+    from = i + 1;
+  }
+  return count;
+}
+
+__attribute__((target("sse2"))) std::size_t FindSse2(
+    const uint8_t* data, std::size_t limit, const uint8_t* pattern,
+    std::size_t len, std::vector<std::size_t>& matches,
+    std::size_t max_matches) {
+  auto first = _mm_set1_epi8(static_cast<char>(pattern[0]));
+  auto last = _mm_set1_epi8(static_cast<char>(pattern[len - 1]));
+  std::size_t count = 0;
+  std::size_t i = 0;
+  for (; i + 16 <= limit; i += 16) {
+    auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    auto b = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(data + i + len - 1));
+    auto mask = static_cast<uint32_t>(_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last))));
+    for (; mask != 0; mask &= mask - 1) {
+      auto at = i + __builtin_ctz(mask);
+      if (std::memcmp(data + at, pattern, len) == 0) {
+        if (matches.size() < max_matches) {
+          matches.push_back(at);
+        }
+        count++;
+      }
+    }
+  }
+  return count + FindScalar(data, limit, pattern, len, i, matches,
+                            max_matches);
+}
+
+__attribute__((target("avx2"))) std::size_t FindAvx2(
+    const uint8_t* data, std::size_t limit, const uint8_t* pattern,
+    std::size_t len, std::vector<std::size_t>& matches,
+    std::size_t max_matches) {
+  auto first = _mm256_set1_epi8(static_cast<char>(pattern[0]));
+  auto last = _mm256_set1_epi8(static_cast<char>(pattern[len - 1]));
+  std::size_t count = 0;
+  std::size_t i = 0;
+  for (; i + 32 <= limit; i += 32) {
+    auto a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    auto b = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(data + i + len - 1));
+    auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last))));
+    for (; mask != 0; mask &= mask - 1) {
+      auto at = i + __builtin_ctz(mask);
+      if (std::memcmp(data + at, pattern, len) == 0) {
+        if (matches.size() < max_matches) {
+          matches.push_back(at);
+        }
+        count++;
+      }
+    }
+  }
+  return count + FindScalar(data, limit, pattern, len, i, matches,
+                            max_matches);
+}
+
+int HexDigit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  c = std::tolower(c);
+  return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+}  // namespace
+
+std::optional<std::vector<uint8_t>> MemorySearch::ParsePattern(
+    char kind, const std::string& text) {
+  std::vector<uint8_t> pattern;
+  if (kind == 's') {
+    pattern.assign(text.begin(), text.end());
+  } else if (kind == 'w') {
+    try {
+      std::size_t end = 0;
+      uint64_t value = std::stoull(text, &end, 0);
+      if (end != text.size()) {
+        return std::nullopt;
+      }
+      pattern.resize(sizeof(value));
+      std::memcpy(pattern.data(), &value, sizeof(value));
+    } catch (const std::exception&) {
+      return std::nullopt;
+    }
+  } else if (kind == 'b') {
+    std::string digits;
+    for (char c : text) {
+      if (!std::isspace(static_cast<unsigned char>(c))) {
+        digits += c;
+      }
+    }
+    if (utils::starts_with(digits, "0x")) {
+      digits = digits.substr(2);
+    }
+    if (digits.size() % 2 != 0) {
+      return std::nullopt;
+    }
+    for (std::size_t i = 0; i < digits.size(); i += 2) {
+      auto high = HexDigit(digits[i]);
+      auto low = HexDigit(digits[i + 1]);
+      if (high < 0 || low < 0) {
+        return std::nullopt;
+      }
+      pattern.push_back(high << 4 | low);
+    }
+  }
+  if (pattern.empty()) {
+    return std::nullopt;
+  }
+  return pattern;
+}
+
+SearchKernel MemorySearch::GetBestKernel() {
+  static const auto kernel = __builtin_cpu_supports("avx2")
+                                 ? SearchKernel::kAvx2
+                                 : SearchKernel::kSse2;
+  return kernel;
+}
+
+std::size_t MemorySearch::FindPattern(std::span<const uint8_t> data,
+                                      std::span<const uint8_t> pattern,
+                                      std::vector<std::size_t>& matches,
+                                      std::size_t max_matches) {
+  return FindPattern(data, pattern, matches, max_matches, GetBestKernel());
+}
+
+std::size_t MemorySearch::FindPattern(std::span<const uint8_t> data,
+                                      std::span<const uint8_t> pattern,
+                                      std::vector<std::size_t>& matches,
+                                      std::size_t max_matches,
+                                      SearchKernel kernel) {
+  if (pattern.empty() || data.size() < pattern.size()) {
+    return 0;
+  }
+  // Positions a match can start at
+  auto limit = data.size() - pattern.size() + 1;
+  switch (kernel) {
+    case SearchKernel::kAvx2:
+      return FindAvx2(data.data(), limit, pattern.data(), pattern.size(),
+                      matches, max_matches);
+    case SearchKernel::kSse2:
+      return FindSse2(data.data(), limit, pattern.data(), pattern.size(),
+                      matches, max_matches);
+    case SearchKernel::kScalar:
+      break;
+  }
+  return FindScalar(data.data(), limit, pattern.data(), pattern.size(), 0,
+                    matches, max_matches);
+}
+
+SearchResult MemorySearch::Search(
+    pid_t pid, const std::vector<utils::MemoryRegion>& regions,
+    std::uintptr_t begin, std::uintptr_t end, std::span<const uint8_t> pattern,
+    std::size_t max_matches, utils::ThreadPool& pool) {
+  // Chunks overlap by the pattern length - 1, so that matches start in
+  // their own part only
+  struct Chunk {
+    std::uintptr_t start;
+    std::size_t len;
+    std::size_t read_len;
+  };
+  std::vector<Chunk> chunks;
+  for (const auto& region : regions) {
+    // [vvar] is not readable through process_vm_readv
+    if (!region.IsReadable() || utils::starts_with(region.path, "[vvar") ||
+        region.path == "[vsyscall]") {
+      continue;
+    }
+    auto start = std::max(region.start, begin);
+    auto stop = std::min(region.end, end);
+    for (auto at = start; at < stop; at += kChunkSize) {
+      auto len = std::min(kChunkSize, stop - at);
+      auto read_len = std::min(len + pattern.size() - 1, stop - at);
+      chunks.push_back({at, len, read_len});
+    }
+  }
+
+  std::vector<std::vector<std::size_t>> matches(chunks.size());
+  std::vector<std::size_t> counts(chunks.size());
+  std::vector<std::size_t> scanned(chunks.size());
+  pool.ParallelFor(chunks.size(), [&](std::size_t i) {
+    thread_local std::vector<uint8_t> buffer;
+    const auto& chunk = chunks[i];
+    buffer.resize(chunk.read_len);
+    auto n = MemoryOperator::ReadMemory(pid, chunk.start, buffer.data(),
+                                        chunk.read_len);
+    counts[i] =
+        FindPattern({buffer.data(), n}, pattern, matches[i], max_matches);
+    scanned[i] = std::min(n, chunk.len);
+  });
+
+  SearchResult result{{}, 0, 0};
+  for (std::size_t i = 0; i < chunks.size(); i++) {
+    for (auto offset : matches[i]) {
+      if (result.matches.size() < max_matches) {
+        result.matches.push_back(chunks[i].start + offset);
+      }
+    }
+    result.count += counts[i];
+    result.bytes_scanned += scanned[i];
+  }
+  return result;
+}
+
+}  // namespace shuidb
@@ -0,0 +1,432 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "memory_snapshot.h"
+
+#include <fcntl.h>
+#include <immintrin.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <string>
+
+#include "memory_operator.h"
+#include "utils/string_utils.hpp"
+#include "utils/syscall_stats.hpp"
+
+namespace shuidb {
+
+namespace {
+
+// /proc/<pid>/pagemap entry bits
+constexpr uint64_t kPagePresent = 1ull << 63;
+constexpr uint64_t kPageSwapped = 1ull << 62;
+constexpr uint64_t kPageSoftDirty = 1ull << 55;
+
+constexpr std::size_t kPageSize = MemorySnapshot::kPageSize;
+const std::array<uint8_t, kPageSize> kZeroPage{};
+// Changes closer than a word apart are reported as one range
+constexpr std::size_t kMergeGap = sizeof(uint64_t);
+
+const std::array<uint32_t, 256>& GetCrcTable() {
+  static const auto table = [] {
+    std::array<uint32_t, 256> table;
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int j = 0; j < 8; j++) {
+        crc = (crc >> 1) ^ (crc & 1 ? 0x82f63b78 : 0);
+      }
+      table[i] = crc;
+    }
+    return table;
+  }();
+  return table;
+}
+
+__attribute__((target("sse4.2"))) uint32_t Crc32cSse42(const uint8_t* data,
+                                                        std::size_t len,
+                                                        uint32_t crc) {
+  uint64_t crc64 = crc;
+  std::size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t value;
+    std::memcpy(&value, data + i, sizeof(value));
+    crc64 = _mm_crc32_u64(crc64, value);
+  }
+  crc = static_cast<uint32_t>(crc64);
+  for (; i < len; i++) {
+    crc = _mm_crc32_u8(crc, data[i]);
+  }
+  return crc;
+}
+
+bool IsSnapshotted(const utils::MemoryRegion& region) {
+  return region.IsReadable() && region.IsWritable() &&
+         !utils::starts_with(region.path, "[vvar") &&
+         region.path != "[vsyscall]";
+}
+
+}  // namespace
+
+uint32_t MemorySnapshot::Crc32c(const uint8_t* data, std::size_t len) {
+  static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+  uint32_t crc = ~0u;
+  if (has_sse42) {
+    return ~Crc32cSse42(data, len, crc);
+  }
+  const auto& table = GetCrcTable();
+  for (std::size_t i = 0; i < len; i++) {
+    crc = (crc >> 8) ^ table[(crc ^ data[i]) & 0xff];
+  }
+  return ~crc;
+}
+
+bool MemorySnapshot::ClearSoftDirty(pid_t pid) {
+  auto path = "/proc/" + std::to_string(pid) + "/clear_refs";
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = write(fd, "4", 1) == 1;
+  close(fd);
+  return ok;
+}
+
+bool MemorySnapshot::IsSoftDirtySupported() {
+  // Clears our own bits and dirties a fresh page
+  static const bool supported = [] {
+    auto* page = static_cast<volatile uint8_t*>(
+        mmap(nullptr, kPageSize, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if (page == MAP_FAILED) {
+      return false;
+    }
+    page[0] = 1;
+    uint64_t entry = 0;
+    if (ClearSoftDirty(getpid())) {
+      page[0] = 2;
+      int fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+      if (fd >= 0) {
+        auto offset = reinterpret_cast<std::uintptr_t>(page) / kPageSize * 8;
+        if (pread(fd, &entry, sizeof(entry), offset) != sizeof(entry)) {
+          entry = 0;
+        }
+        close(fd);
+      }
+    }
+    munmap(const_cast<uint8_t*>(page), kPageSize);
+    return (entry & kPageSoftDirty) != 0;
+  }();
+  return supported;
+}
+
+std::shared_ptr<MemorySnapshot> MemorySnapshot::Take(
+    pid_t pid, const std::vector<utils::MemoryRegion>& regions,
+    const MemorySnapshot* base) {
+  auto path = "/proc/" + std::to_string(pid) + "/pagemap";
+  int pagemap = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (pagemap < 0) {
+    return nullptr;
+  }
+  auto snapshot = std::make_shared<MemorySnapshot>();
+  snapshot->regions_ = regions;
+  bool soft_dirty = base != nullptr && IsSoftDirtySupported();
+  // Pages to read, as indices into pages_, with their page in `base`
+  std::vector<std::size_t> reads;
+  std::vector<const SnapshotPage*> olds;
+  std::size_t base_index = 0;
+  std::vector<uint64_t> entries;
+  for (const auto& region : regions) {
+    if (!IsSnapshotted(region)) {
+      continue;
+    }
+    auto count = region.Size() / kPageSize;
+    entries.assign(count, 0);
+    auto bytes = count * sizeof(uint64_t);
+    if (pread(pagemap, entries.data(), bytes,
+              region.start / kPageSize * sizeof(uint64_t)) != (ssize_t)bytes) {
+      continue;
+    }
+    for (std::size_t i = 0; i < count; i++) {
+      // Never touched anonymous pages read as zeros, and are left out. File
+      // pages not mapped in yet still have the file contents
+      if ((entries[i] & (kPagePresent | kPageSwapped)) == 0 &&
+          !region.IsFileBacked()) {
+        continue;
+      }
+      auto addr = region.start + i * kPageSize;
+      const SnapshotPage* old = nullptr;
+      if (base != nullptr) {
+        const auto& base_pages = base->pages_;
+        while (base_index < base_pages.size() &&
+               base_pages[base_index].addr < addr) {
+          base_index++;
+        }
+        if (base_index < base_pages.size() &&
+            base_pages[base_index].addr == addr) {
+          old = &base_pages[base_index];
+        }
+      }
+      if (soft_dirty && old != nullptr &&
+          (entries[i] & kPageSoftDirty) == 0) {
+        snapshot->pages_.push_back(*old);
+        continue;
+      }
+      reads.push_back(snapshot->pages_.size());
+      olds.push_back(old);
+      snapshot->pages_.push_back({addr, 0, nullptr});
+    }
+  }
+  close(pagemap);
+
+  // Runs of adjacent pages are read as one range, all with one syscall
+  std::vector<uint8_t> buffer(reads.size() * kPageSize);
+  std::vector<iovec> local, remote;
+  for (std::size_t j = 0; j < reads.size(); j++) {
+    auto addr = snapshot->pages_[reads[j]].addr;
+    auto* data = buffer.data() + j * kPageSize;
+    if (!remote.empty() &&
+        reinterpret_cast<std::uintptr_t>(remote.back().iov_base) +
+                remote.back().iov_len ==
+            addr) {
+      remote.back().iov_len += kPageSize;
+      local.back().iov_len += kPageSize;
+    } else {
+      remote.push_back({reinterpret_cast<void*>(addr), kPageSize});
+      local.push_back({data, kPageSize});
+    }
+  }
+  MemoryOperator::ReadMemoryV(pid, local, remote);
+  snapshot->read_pages_ = reads.size();
+
+  // Unchanged pages are shared with the base, the others are stored
+  std::vector<std::size_t> stored;
+  for (std::size_t j = 0; j < reads.size(); j++) {
+    auto& page = snapshot->pages_[reads[j]];
+    const auto* data = buffer.data() + j * kPageSize;
+    page.crc = Crc32c(data, kPageSize);
+    const auto* old = olds[j];
+    if (old != nullptr && old->crc == page.crc &&
+        std::memcmp(old->data, data, kPageSize) == 0) {
+      page.data = old->data;
+    } else {
+      stored.push_back(j);
+    }
+  }
+  auto store = std::make_shared<std::vector<uint8_t>>(stored.size() *
+                                                      kPageSize);
+  for (std::size_t k = 0; k < stored.size(); k++) {
+    auto* data = store->data() + k * kPageSize;
+    std::memcpy(data, buffer.data() + stored[k] * kPageSize, kPageSize);
+    snapshot->pages_[reads[stored[k]]].data = data;
+  }
+  snapshot->stored_pages_ = stored.size();
+  if (base != nullptr) {
+    snapshot->stores_ = base->stores_;
+  }
+  snapshot->stores_.push_back(std::move(store));
+  return snapshot;
+}
+
+std::optional<std::size_t> MemorySnapshot::Restore(
+    pid_t pid, const std::vector<utils::MemoryRegion>& regions,
+    const MemorySnapshot& target, const MemorySnapshot* dirty_base) {
+  auto path = "/proc/" + std::to_string(pid) + "/pagemap";
+  int pagemap = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (pagemap < 0) {
+    return std::nullopt;
+  }
+  bool soft_dirty = dirty_base != nullptr && IsSoftDirtySupported();
+  // Pages which may differ from `target`
+  std::vector<std::uintptr_t> addrs;
+  std::vector<uint64_t> entries;
+  std::size_t target_index = 0;
+  for (const auto& region : regions) {
+    if (!IsSnapshotted(region)) {
+      continue;
+    }
+    auto count = region.Size() / kPageSize;
+    entries.assign(count, 0);
+    auto bytes = count * sizeof(uint64_t);
+    if (pread(pagemap, entries.data(), bytes,
+              region.start / kPageSize * sizeof(uint64_t)) != (ssize_t)bytes) {
+      close(pagemap);
+      return std::nullopt;
+    }
+    auto mask = soft_dirty ? kPageSoftDirty : kPagePresent | kPageSwapped;
+    for (std::size_t i = 0; i < count; i++) {
+      auto addr = region.start + i * kPageSize;
+      while (target_index < target.pages_.size() &&
+             target.pages_[target_index].addr < addr) {
+        target_index++;
+      }
+      // Dropped anonymous pages (e.g. MADV_DONTNEED) read as zeros now
+      bool dropped = (entries[i] & (kPagePresent | kPageSwapped)) == 0 &&
+                     !region.IsFileBacked() &&
+                     target_index < target.pages_.size() &&
+                     target.pages_[target_index].addr == addr;
+      if ((entries[i] & mask) != 0 || dropped) {
+        addrs.push_back(addr);
+      }
+    }
+  }
+  close(pagemap);
+  if (soft_dirty && dirty_base != &target) {
+    // The bits are relative to `dirty_base`, add what it has different
+    const auto& pa = dirty_base->pages_;
+    const auto& pb = target.pages_;
+    std::size_t i = 0, j = 0;
+    while (i < pa.size() || j < pb.size()) {
+      std::uintptr_t addr;
+      if (j == pb.size() || (i < pa.size() && pa[i].addr < pb[j].addr)) {
+        addr = pa[i++].addr;
+      } else if (i == pa.size() || pb[j].addr < pa[i].addr) {
+        addr = pb[j++].addr;
+      } else {
+        addr = pa[i].addr;
+        bool same = pa[i++].data == pb[j++].data;
+        if (same) {
+          continue;
+        }
+      }
+      const auto* region = utils::FindMemoryRegion(regions, addr);
+      if (region != nullptr && IsSnapshotted(*region)) {
+        addrs.push_back(addr);
+      }
+    }
+    std::sort(addrs.begin(), addrs.end());
+    addrs.erase(std::unique(addrs.begin(), addrs.end()), addrs.end());
+  }
+
+  std::vector<iovec> local, remote;
+  const auto& pages = target.pages_;
+  auto page = pages.begin();
+  for (auto addr : addrs) {
+    page = std::lower_bound(
+        page, pages.end(), addr,
+        [](const SnapshotPage& p, std::uintptr_t a) { return p.addr < a; });
+    const uint8_t* data = kZeroPage.data();
+    if (page != pages.end() && page->addr == addr) {
+      data = page->data;
+    }
+    local.push_back({const_cast<uint8_t*>(data), kPageSize});
+    remote.push_back({reinterpret_cast<void*>(addr), kPageSize});
+  }
+  if (!soft_dirty) {
+    // Everything present is a candidate, only write what really changed
+    std::vector<uint8_t> buffer(addrs.size() * kPageSize);
+    std::vector<iovec> current;
+    for (std::size_t k = 0; k < addrs.size(); k++) {
+      current.push_back({buffer.data() + k * kPageSize, kPageSize});
+    }
+    MemoryOperator::ReadMemoryV(pid, current, remote);
+    std::size_t kept = 0;
+    for (std::size_t k = 0; k < addrs.size(); k++) {
+      if (std::memcmp(buffer.data() + k * kPageSize, local[k].iov_base,
+                      kPageSize) != 0) {
+        local[kept] = local[k];
+        remote[kept] = remote[k];
+        kept++;
+      }
+    }
+    local.resize(kept);
+    remote.resize(kept);
+  }
+
+  // Writable pages take process_vm_writev, IOV_MAX pages per call
+  auto total = local.size() * kPageSize;
+  std::size_t written = 0;
+  for (std::size_t begin = 0; begin < remote.size(); begin += IOV_MAX) {
+    auto count = std::min<std::size_t>(IOV_MAX, remote.size() - begin);
+    auto n = utils::ProcessVmWritev(pid, &local[begin], count,
+                                    &remote[begin], count);
+    if (n != static_cast<ssize_t>(count * kPageSize)) {
+      break;
+    }
+    written += n;
+  }
+  if (written != total &&
+      MemoryOperator::WriteMemoryV(pid, local, remote) != total) {
+    return std::nullopt;
+  }
+  return local.size();
+}
+
+std::vector<ChangedRange> MemorySnapshot::Diff(const MemorySnapshot& a,
+                                               const MemorySnapshot& b) {
+  std::vector<ChangedRange> ranges;
+  auto compare = [&](std::uintptr_t addr, const uint8_t* old_data,
+                     const uint8_t* new_data) {
+    for (std::size_t i = 0; i < kPageSize;) {
+      // A word at a time until something differs
+      uint64_t x, y;
+      std::memcpy(&x, old_data + i, sizeof(x));
+      std::memcpy(&y, new_data + i, sizeof(y));
+      if (x == y) {
+        i += sizeof(x);
+        continue;
+      }
+      for (auto end = i + sizeof(x); i < end; i++) {
+        if (old_data[i] == new_data[i]) {
+          continue;
+        }
+        if (!ranges.empty() && ranges.back().end + kMergeGap >= addr + i) {
+          ranges.back().end = addr + i + 1;
+        } else {
+          ranges.push_back({addr + i, addr + i + 1});
+        }
+      }
+    }
+  };
+
+  const auto& pa = a.pages_;
+  const auto& pb = b.pages_;
+  std::size_t i = 0, j = 0;
+  while (i < pa.size() || j < pb.size()) {
+    if (j == pb.size() || (i < pa.size() && pa[i].addr < pb[j].addr)) {
+      compare(pa[i].addr, pa[i].data, kZeroPage.data());
+      i++;
+    } else if (i == pa.size() || pb[j].addr < pa[i].addr) {
+      compare(pb[j].addr, kZeroPage.data(), pb[j].data);
+      j++;
+    } else {
+      if (pa[i].data != pb[j].data) {
+        compare(pa[i].addr, pa[i].data, pb[j].data);
+      }
+      i++;
+      j++;
+    }
+  }
+  return ranges;
+}
+
+const std::vector<SnapshotPage>& MemorySnapshot::GetPages() const {
+  return pages_;
+}
+
+std::size_t MemorySnapshot::GetReadPages() const { return read_pages_; }
+
+std::size_t MemorySnapshot::GetStoredPages() const { return stored_pages_; }
+
+const std::vector<utils::MemoryRegion>& MemorySnapshot::GetRegions() const {
+  return regions_;
+}
+
+}  // namespace shuidb
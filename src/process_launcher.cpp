@@ -0,0 +1,153 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "process_launcher.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/personality.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include <cerrno>
+#include <memory>
+
+namespace shuidb {
+
+namespace {
+
+constexpr std::size_t kChildStackSize = 64 * 1024;
+
+// Everything the child needs, prepared by the parent: the child must not
+// allocate as it shares our heap
+struct ChildArgs {
+  const char* path;
+  char* const* argv;
+  char* const* envp;
+  const char* cwd;
+  const char* files[3];
+  // Signal mask of the parent before it blocked every signal for the clone
+  const sigset_t* mask;
+  // Set by the child when it fails before the exec
+  int error;
+};
+
+[[noreturn]] void ChildFail(ChildArgs* child) {
+  child->error = errno;
+  _exit(127);
+}
+
+int ChildMain(void* arg) {
+  auto* child = static_cast<ChildArgs*>(arg);
+  // Our handlers would run on the memory of the parent, the program gets
+  // the default ones. Ignored signals stay ignored, as across any exec
+  for (int sig = 1; sig < NSIG; sig++) {
+    struct sigaction action;
+    if (sigaction(sig, nullptr, &action) == 0 &&
+        action.sa_handler != SIG_DFL && action.sa_handler != SIG_IGN) {
+      signal(sig, SIG_DFL);
+    }
+  }
+  personality(ADDR_NO_RANDOMIZE);
+  if (ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) == -1) {
+    ChildFail(child);
+  }
+  if (child->cwd != nullptr && chdir(child->cwd) == -1) {
+    ChildFail(child);
+  }
+  constexpr int kOutput = O_WRONLY | O_CREAT | O_TRUNC;
+  constexpr int kFlags[3] = {O_RDONLY, kOutput, kOutput};
+  for (int fd = 0; fd < 3; fd++) {
+    if (child->files[fd] == nullptr) {
+      continue;
+    }
+    int file = open(child->files[fd], kFlags[fd], 0644);
+    if (file == -1 || (file != fd && dup2(file, fd) == -1)) {
+      ChildFail(child);
+    }
+    if (file != fd) {
+      close(file);
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, child->mask, nullptr);
+  execve(child->path, child->argv, child->envp);
+  ChildFail(child);
+}
+
+std::vector<char*> ToPointers(const std::vector<std::string>& strings) {
+  std::vector<char*> pointers;
+  for (const auto& s : strings) {
+    pointers.push_back(const_cast<char*>(s.c_str()));
+  }
+  pointers.push_back(nullptr);
+  return pointers;
+}
+
+const char* OrNull(const std::string& s) {
+  return s.empty() ? nullptr : s.c_str();
+}
+
+}  // namespace
+
+std::optional<pid_t> ProcessLauncher::Launch(const std::string& prog,
+                                             const LaunchOptions& options) {
+  std::vector<std::string> args{prog};
+  args.insert(args.end(), options.args.begin(), options.args.end());
+  auto argv = ToPointers(args);
+  std::vector<char*> env;
+  if (options.env.has_value()) {
+    env = ToPointers(options.env.value());
+  }
+  ChildArgs child{prog.c_str(),
+                  argv.data(),
+                  options.env.has_value() ? env.data() : environ,
+                  OrNull(options.cwd),
+                  {OrNull(options.stdin_path), OrNull(options.stdout_path),
+                   OrNull(options.stderr_path)},
+                  nullptr,
+                  0};
+
+  // No signal may reach the child before it drops our handlers, as
+  // posix_spawn does
+  sigset_t all, mask;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &mask);
+  child.mask = &mask;
+  // We are suspended until the child execs or exits, its stack can go
+  // right after
+  auto stack = std::make_unique<char[]>(kChildStackSize);
+  auto pid = clone(ChildMain, stack.get() + kChildStackSize,
+                   CLONE_VM | CLONE_VFORK | SIGCHLD, &child);
+  pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+  if (pid == -1) {
+    return std::nullopt;
+  }
+  if (child.error != 0) {
+    waitpid(pid, nullptr, 0);
+    errno = child.error;
+    return std::nullopt;
+  }
+  int wait_status;
+  if (waitpid(pid, &wait_status, 0) == -1 || !WIFSTOPPED(wait_status)) {
+    errno = ECHILD;
+    return std::nullopt;
+  }
+  return pid;
+}
+
+}  // namespace shuidb
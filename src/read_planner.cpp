@@ -0,0 +1,106 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "read_planner.h"
+
+#include <sys/uio.h>
+
+#include <algorithm>
+
+#include "memory_operator.h"
+
+namespace shuidb {
+
+void ReadPlanner::Clear() {
+  requests_.clear();
+  ranges_.clear();
+}
+
+ReadPlanner::Handle ReadPlanner::Request(std::uintptr_t addr,
+                                         std::size_t len) {
+  requests_.push_back({addr, len, 0, 0});
+  return requests_.size() - 1;
+}
+
+std::size_t ReadPlanner::Execute(pid_t pid) {
+  ranges_.clear();
+  for (const auto& request : requests_) {
+    if (request.len > 0) {
+      ranges_.push_back(request);
+    }
+  }
+  std::sort(ranges_.begin(), ranges_.end(),
+            [](const Range& a, const Range& b) { return a.addr < b.addr; });
+  std::size_t merged = 0;
+  for (std::size_t i = 0; i < ranges_.size(); i++) {
+    if (merged > 0 && ranges_[i].addr <= ranges_[merged - 1].addr +
+                                             ranges_[merged - 1].len) {
+      auto& last = ranges_[merged - 1];
+      last.len = std::max(last.addr + last.len,
+                          ranges_[i].addr + ranges_[i].len) -
+                 last.addr;
+    } else {
+      ranges_[merged++] = ranges_[i];
+    }
+  }
+  ranges_.resize(merged);
+
+  std::size_t total = 0;
+  for (auto& range : ranges_) {
+    range.offset = total;
+    range.size = range.len;
+    total += range.len;
+  }
+  arena_.resize(total);
+  std::vector<iovec> local, remote;
+  for (const auto& range : ranges_) {
+    local.push_back({arena_.data() + range.offset, range.len});
+    remote.push_back({reinterpret_cast<void*>(range.addr), range.len});
+  }
+  auto n = MemoryOperator::ReadMemoryV(pid, local, remote);
+  if (n == total) {
+    return n;
+  }
+  // Some range is not fully readable, find out how much of each is
+  n = 0;
+  for (auto& range : ranges_) {
+    range.size = MemoryOperator::ReadMemory(
+        pid, range.addr, arena_.data() + range.offset, range.len);
+    n += range.size;
+  }
+  return n;
+}
+
+std::span<const uint8_t> ReadPlanner::Get(Handle handle) const {
+  const auto& request = requests_[handle];
+  auto it = std::upper_bound(
+      ranges_.begin(), ranges_.end(), request.addr,
+      [](std::uintptr_t addr, const Range& r) { return addr < r.addr; });
+  if (request.len == 0 || it == ranges_.begin()) {
+    return {};
+  }
+  --it;
+  auto skip = request.addr - it->addr;
+  if (skip >= it->size) {
+    return {};
+  }
+  return {arena_.data() + it->offset + skip,
+          std::min(request.len, it->size - skip)};
+}
+
+std::size_t ReadPlanner::GetRangeCount() const { return ranges_.size(); }
+
+}  // namespace shuidb
@@ -23,27 +23,32 @@
 #include <unordered_map>
 
 #include "register_def.h"
+#include "utils/syscall_stats.hpp"
 
 namespace shuidb {
 
 std::optional<std::unordered_map<Register, uint64_t>>
 RegisterOperator::GetRegisters(pid_t pid) {
   user_regs_struct regs;
-  if (ptrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+  if (utils::Ptrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
     return std::nullopt;
   }
+  return GetRegisters(regs);
+};
 
+std::unordered_map<Register, uint64_t> RegisterOperator::GetRegisters(
+    const user_regs_struct& regs) {
   std::unordered_map<Register, uint64_t> registers;
   for (const auto& rd : kRegisterDescriptors) {
-    registers[rd.reg] = RegisterOperator::GetRegisterValue(pid, rd.reg).value();
+    registers[rd.reg] = RegisterOperator::GetRegisterValue(regs, rd.reg);
   }
   return registers;
-};
+}
 
 std::optional<uint64_t> RegisterOperator::GetRegisterValue(pid_t pid,
                                                            Register reg) {
   user_regs_struct regs;
-  if (ptrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
+  if (utils::Ptrace(PTRACE_GETREGS, pid, nullptr, &regs) == -1) {
     return std::nullopt;
   }
 
@@ -113,7 +118,7 @@ uint64_t RegisterOperator::GetRegisterValue(const user_regs_struct& regs,
 void RegisterOperator::SetRegisterValue(pid_t pid, Register reg,
                                         uint64_t value) {
   user_regs_struct regs;
-  ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+  utils::Ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
   switch (reg) {
     case Register::RAX:
       regs.rax = value;
@@ -197,7 +202,7 @@ void RegisterOperator::SetRegisterValue(pid_t pid, Register reg,
       regs.es = value;
       break;
   }
-  ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
+  utils::Ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
 };
 
 std::optional<uint64_t> RegisterOperator::GetRegisterValueFromDwarfRegister(
@@ -0,0 +1,193 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "stack_snapshot.h"
+
+#include <sys/ptrace.h>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+#include "utils/syscall_stats.hpp"
+
+namespace shuidb {
+
+namespace {
+
+// Upper bound of words scanned for return addresses when the frame pointer
+// chain is broken
+constexpr std::size_t kScanWindow = 16 * 1024;
+
+void CopyStack(const Target& target, ThreadStack& stack,
+               const std::vector<utils::MemoryRegion>& regions,
+               std::size_t max_stack_bytes) {
+  auto sp = static_cast<std::uintptr_t>(stack.regs.rsp);
+  const auto* region = utils::FindMemoryRegion(regions, sp);
+  stack.stack_base = sp;
+  if (region == nullptr) {
+    return;
+  }
+  auto len = std::min<std::size_t>(region->end - sp, max_stack_bytes);
+  stack.stack_bytes.resize(len);
+  auto n = target.ReadMemory(sp, stack.stack_bytes.data(), len);
+  stack.stack_bytes.resize(n);
+}
+
+// Whether `addr` directly follows a call instruction, checked against the
+// on-disk bytes of the module
+bool IsReturnAddress(const Symbolizer& symbolizer, std::uintptr_t addr) {
+  const auto* region = utils::FindMemoryRegion(symbolizer.GetRegions(), addr);
+  if (region == nullptr || !region->IsExecutable()) {
+    return false;
+  }
+  const auto* code = symbolizer.GetFileBytes(addr - 7, 7);
+  if (code == nullptr) {
+    // Anonymous executable memory (e.g. JIT), nothing to check against
+    return !region->IsFileBacked();
+  }
+  // call rel32, or call r/m64 (ff /2) with 0, 1, 4 or 5 bytes following the
+  // ModRM byte
+  bool after_call = code[2] == 0xe8;
+  for (int len : {2, 3, 6, 7}) {
+    after_call |= code[7 - len] == 0xff && ((code[8 - len] >> 3) & 7) == 2;
+  }
+  if (!after_call) {
+    return false;
+  }
+  // Function pointers spilled on the stack (e.g. `main` passed to
+  // __libc_start_main) may follow a noreturn call by accident
+  auto sym = symbolizer.FindSymbol(addr);
+  return !sym.has_value() || sym->address != addr;
+}
+
+}  // namespace
+
+StackSnapshot StackSnapshot::Capture(pid_t pid,
+                                     const std::vector<pid_t>& tids,
+                                     utils::ThreadPool& pool,
+                                     std::size_t max_stack_bytes) {
+  StackSnapshot snapshot;
+  auto regions = utils::GetMemoryRegions(pid);
+
+  for (auto tid : tids) {
+    ThreadStack stack{};
+    stack.tid = tid;
+    if (utils::Ptrace(PTRACE_GETREGS, tid, nullptr, &stack.regs) == -1) {
+      continue;
+    }
+    snapshot.threads_.push_back(std::move(stack));
+  }
+
+  ProcessTarget target(pid);
+  pool.ParallelFor(snapshot.threads_.size(), [&](std::size_t i) {
+    CopyStack(target, snapshot.threads_[i], regions, max_stack_bytes);
+  });
+  return snapshot;
+}
+
+std::optional<ThreadStack> StackSnapshot::CaptureThread(
+    pid_t pid, pid_t tid, const std::vector<utils::MemoryRegion>& regions,
+    std::size_t max_stack_bytes) {
+  return CaptureThread(ProcessTarget(pid), tid, regions, max_stack_bytes);
+}
+
+std::optional<ThreadStack> StackSnapshot::CaptureThread(
+    const Target& target, pid_t tid,
+    const std::vector<utils::MemoryRegion>& regions,
+    std::size_t max_stack_bytes) {
+  auto regs = target.GetRegisters(tid);
+  if (!regs.has_value()) {
+    return std::nullopt;
+  }
+  ThreadStack stack{};
+  stack.tid = tid;
+  stack.regs = regs.value();
+  CopyStack(target, stack, regions, max_stack_bytes);
+  return stack;
+}
+
+void StackSnapshot::UnwindStack(ThreadStack& stack,
+                                const Symbolizer& symbolizer) {
+  auto stack_end = stack.stack_base + stack.stack_bytes.size();
+  auto read_word = [&](std::uintptr_t addr) {
+    uint64_t word = 0;
+    std::memcpy(&word, stack.stack_bytes.data() + (addr - stack.stack_base),
+                sizeof(word));
+    return word;
+  };
+
+  stack.frames.clear();
+  stack.frames.push_back(stack.regs.rip);
+
+  // Follow the rbp chain, and scan the words below each saved frame pointer
+  // for return addresses of frames built without one (most of libc)
+  std::uintptr_t cur = stack.stack_base;
+  std::uintptr_t fp = stack.regs.rbp;
+  while (stack.frames.size() < kMaxFrames) {
+    bool fp_valid = fp >= cur && fp + 16 <= stack_end && fp % 8 == 0;
+    auto limit = fp_valid ? fp : std::min(stack_end, cur + kScanWindow);
+    for (auto addr = cur; addr + 8 <= limit; addr += 8) {
+      auto word = read_word(addr);
+      if (IsReturnAddress(symbolizer, word)) {
+        stack.frames.push_back(word);
+        if (stack.frames.size() == kMaxFrames) {
+          return;
+        }
+      }
+    }
+    if (!fp_valid) {
+      break;
+    }
+    auto ret = read_word(fp + 8);
+    if (!IsReturnAddress(symbolizer, ret)) {
+      break;
+    }
+    stack.frames.push_back(ret);
+    cur = fp + 16;
+    fp = read_word(fp);
+  }
+}
+
+void StackSnapshot::Unwind(const Symbolizer& symbolizer,
+                           utils::ThreadPool& pool) {
+  pool.ParallelFor(threads_.size(), [&](std::size_t i) {
+    UnwindStack(threads_[i], symbolizer);
+  });
+}
+
+std::vector<StackGroup> StackSnapshot::GroupStacks() const {
+  std::map<std::vector<std::uintptr_t>, std::vector<pid_t>> groups;
+  for (const auto& thread : threads_) {
+    groups[thread.frames].push_back(thread.tid);
+  }
+
+  std::vector<StackGroup> result;
+  for (auto& [frames, tids] : groups) {
+    result.push_back({std::move(tids), frames});
+  }
+  std::stable_sort(result.begin(), result.end(),
+                   [](const StackGroup& a, const StackGroup& b) {
+                     return a.tids.size() > b.tids.size();
+                   });
+  return result;
+}
+
+const std::vector<ThreadStack>& StackSnapshot::GetThreads() const {
+  return threads_;
+}
+
+}  // namespace shuidb
@@ -0,0 +1,199 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "symbolizer.h"
+
+#include <cxxabi.h>
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+namespace shuidb {
+
+namespace {
+
+// The name itself when it is not a C++ one
+std::string Demangle(std::string_view name) {
+  std::string text(name);
+  int status = 0;
+  char* demangled =
+      abi::__cxa_demangle(text.c_str(), nullptr, nullptr, &status);
+  if (status == 0 && demangled != nullptr) {
+    text = demangled;
+  }
+  std::free(demangled);
+  return text;
+}
+
+}  // namespace
+
+void Symbolizer::Load(pid_t pid) { Load(utils::GetMemoryRegions(pid)); }
+
+void Symbolizer::Load(std::vector<utils::MemoryRegion> regions) {
+  regions_ = std::move(regions);
+  load_bias_.clear();
+  modules_.clear();
+
+  for (const auto& region : regions_) {
+    if (!region.IsFileBacked() || load_bias_.count(region.path) != 0) {
+      continue;
+    }
+    auto it = files_.find(region.path);
+    if (it == files_.end()) {
+      stamps_[region.path] = GetFileStamp(region.path);
+      it = files_.emplace(region.path, ElfFile::Open(region.path)).first;
+    }
+    if (it->second == nullptr) {
+      continue;
+    }
+    auto vaddr = it->second->FileOffsetToVaddr(region.offset);
+    if (vaddr.has_value()) {
+      load_bias_[region.path] = region.start - vaddr.value();
+      modules_.push_back(region.path);
+    }
+  }
+}
+
+const std::vector<utils::MemoryRegion>& Symbolizer::GetRegions() const {
+  return regions_;
+}
+
+void Symbolizer::DropChangedFiles() {
+  for (auto it = files_.begin(); it != files_.end();) {
+    const auto& path = it->first;
+    if (stamps_[path] == GetFileStamp(path)) {
+      ++it;
+      continue;
+    }
+    stamps_.erase(path);
+    line_tables_.erase(path);
+    it = files_.erase(it);
+  }
+}
+
+Symbolizer::FileStamp Symbolizer::GetFileStamp(const std::string& path) {
+  struct stat st {};
+  if (stat(path.c_str(), &st) != 0) {
+    return {};
+  }
+  return {st.st_dev, st.st_ino, st.st_size,
+          st.st_mtim.tv_sec * 1000000000L + st.st_mtim.tv_nsec};
+}
+
+std::optional<SymbolInfo> Symbolizer::FindSymbol(std::uintptr_t addr) const {
+  const auto* region = utils::FindMemoryRegion(regions_, addr);
+  if (region == nullptr || !region->IsFileBacked()) {
+    return std::nullopt;
+  }
+  auto elf = GetElfFile(region->path);
+  auto bias = GetLoadBias(region->path);
+  if (elf == nullptr || !bias.has_value()) {
+    return std::nullopt;
+  }
+  const auto* sym = elf->FindSymbol(addr - bias.value());
+  if (sym == nullptr) {
+    return std::nullopt;
+  }
+  return SymbolInfo{sym->name, sym->addr + bias.value(), sym->size,
+                    region->path};
+}
+
+std::string Symbolizer::Symbolize(std::uintptr_t addr) const {
+  std::ostringstream oss;
+  auto sym = FindSymbol(addr);
+  if (!sym.has_value()) {
+    oss << "0x" << std::hex << addr;
+    return oss.str();
+  }
+  oss << Demangle(sym->name);
+  if (addr != sym->address) {
+    oss << "+0x" << std::hex << addr - sym->address;
+  }
+  oss << " (" << sym->module.substr(sym->module.rfind('/') + 1) << ")";
+  return oss.str();
+}
+
+std::optional<std::uintptr_t> Symbolizer::LookupAddress(
+    std::string_view name) const {
+  for (const auto& path : modules_) {
+    const auto* sym = GetElfFile(path)->LookupSymbol(name);
+    if (sym != nullptr) {
+      return sym->addr + load_bias_.at(path);
+    }
+  }
+  // A C++ function by its demangled name, with or without the parameters
+  for (const auto& path : modules_) {
+    for (const auto& sym : GetElfFile(path)->GetSymbols()) {
+      if (!sym.is_function || sym.name.substr(0, 2) != "_Z") {
+        continue;
+      }
+      auto text = Demangle(sym.name);
+      if (text == name || (text.size() > name.size() &&
+                           text.compare(0, name.size(), name) == 0 &&
+                           text[name.size()] == '(')) {
+        return sym.addr + load_bias_.at(path);
+      }
+    }
+  }
+  return std::nullopt;
+}
+
+std::shared_ptr<const ElfFile> Symbolizer::GetElfFile(
+    const std::string& path) const {
+  auto it = files_.find(path);
+  return it == files_.end() ? nullptr : it->second;
+}
+
+const uint8_t* Symbolizer::GetFileBytes(std::uintptr_t addr,
+                                        std::size_t len) const {
+  const auto* region = utils::FindMemoryRegion(regions_, addr);
+  if (region == nullptr || !region->IsFileBacked() ||
+      addr + len > region->end) {
+    return nullptr;
+  }
+  auto elf = GetElfFile(region->path);
+  if (elf == nullptr) {
+    return nullptr;
+  }
+  auto offset = addr - region->start + region->offset;
+  auto data = elf->GetData();
+  if (offset + len > data.size()) {
+    return nullptr;
+  }
+  return data.data() + offset;
+}
+
+std::optional<std::intptr_t> Symbolizer::GetLoadBias(
+    const std::string& path) const {
+  auto it = load_bias_.find(path);
+  if (it == load_bias_.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+const LineTable* Symbolizer::GetLineTable(const std::string& path) {
+  auto it = line_tables_.find(path);
+  if (it == line_tables_.end()) {
+    auto elf = GetElfFile(path);
+    auto table = elf != nullptr ? LineTable::Parse(*elf) : std::nullopt;
+    it = line_tables_.emplace(path, std::move(table)).first;
+  }
+  return it->second.has_value() ? &it->second.value() : nullptr;
+}
+
+}  // namespace shuidb
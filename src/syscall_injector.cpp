@@ -0,0 +1,129 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "syscall_injector.h"
+
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <vector>
+
+#include "utils/syscall_stats.hpp"
+
+namespace shuidb {
+
+namespace {
+
+constexpr uint8_t kSyscall[] = {0x0f, 0x05};
+
+}  // namespace
+
+std::optional<long> SyscallInjector::Call(
+    pid_t pid, long nr, const std::array<uint64_t, 6>& args, int* signal) {
+  user_regs_struct saved;
+  if (utils::Ptrace(PTRACE_GETREGS, pid, nullptr, &saved) < 0) {
+    return std::nullopt;
+  }
+  errno = 0;
+  auto word = utils::Ptrace(PTRACE_PEEKTEXT, pid, saved.rip, nullptr);
+  if (errno != 0) {
+    return std::nullopt;
+  }
+  auto patched = word;
+  std::memcpy(&patched, kSyscall, sizeof(kSyscall));
+  auto regs = saved;
+  regs.rax = nr;
+  regs.rdi = args[0];
+  regs.rsi = args[1];
+  regs.rdx = args[2];
+  regs.r10 = args[3];
+  regs.r8 = args[4];
+  regs.r9 = args[5];
+  // Not in a syscall, so the kernel does not try to restart one
+  regs.orig_rax = -1;
+  utils::Ptrace(PTRACE_POKETEXT, pid, saved.rip, patched);
+  utils::Ptrace(PTRACE_SETREGS, pid, nullptr, &regs);
+
+  std::optional<long> result;
+  // Signals not delivered during the step, raised again afterwards
+  std::vector<int> later;
+  while (utils::Ptrace(PTRACE_SINGLESTEP, pid, nullptr, 0) == 0) {
+    int wait_status;
+    if (utils::WaitPid(pid, &wait_status, 0) < 0 || !WIFSTOPPED(wait_status)) {
+      return std::nullopt;
+    }
+    // Event stops (e.g. of a traced fork) and signals come before the step
+    // is done
+    if ((wait_status >> 16) != 0) {
+      continue;
+    }
+    if (WSTOPSIG(wait_status) != SIGTRAP) {
+      if (signal != nullptr && *signal == 0) {
+        *signal = WSTOPSIG(wait_status);
+      } else {
+        later.push_back(WSTOPSIG(wait_status));
+      }
+      continue;
+    }
+    if (utils::Ptrace(PTRACE_GETREGS, pid, nullptr, &regs) == 0) {
+      result = static_cast<long>(regs.rax);
+    }
+    break;
+  }
+  utils::Ptrace(PTRACE_POKETEXT, pid, saved.rip, word);
+  utils::Ptrace(PTRACE_SETREGS, pid, nullptr, &saved);
+  for (auto sig : later) {
+    syscall(SYS_tkill, pid, sig);
+  }
+  return result;
+}
+
+std::optional<pid_t> SyscallInjector::Fork(pid_t pid, long options,
+                                           int* signal) {
+  user_regs_struct saved;
+  if (utils::Ptrace(PTRACE_GETREGS, pid, nullptr, &saved) < 0) {
+    return std::nullopt;
+  }
+  errno = 0;
+  auto word = utils::Ptrace(PTRACE_PEEKTEXT, pid, saved.rip, nullptr);
+  if (errno != 0) {
+    return std::nullopt;
+  }
+  utils::Ptrace(PTRACE_SETOPTIONS, pid, nullptr,
+                options | PTRACE_O_TRACEFORK);
+  auto child = Call(pid, SYS_fork, {}, signal);
+  utils::Ptrace(PTRACE_SETOPTIONS, pid, nullptr, options);
+  if (!child.has_value() || child.value() <= 0) {
+    return std::nullopt;
+  }
+  // The child starts with a SIGSTOP, past the planted syscall
+  pid_t child_pid = child.value();
+  int wait_status;
+  if (utils::WaitPid(child_pid, &wait_status, __WALL) < 0) {
+    return std::nullopt;
+  }
+  utils::Ptrace(PTRACE_SETOPTIONS, child_pid, nullptr, PTRACE_O_EXITKILL);
+  utils::Ptrace(PTRACE_POKETEXT, child_pid, saved.rip, word);
+  utils::Ptrace(PTRACE_SETREGS, child_pid, nullptr, &saved);
+  return child_pid;
+}
+
+}  // namespace shuidb
@@ -0,0 +1,56 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "target.h"
+
+#include <sys/ptrace.h>
+
+#include <algorithm>
+
+#include "memory_operator.h"
+#include "utils/syscall_stats.hpp"
+
+namespace shuidb {
+
+pid_t ProcessTarget::GetPid() const { return pid_; }
+
+pid_t ProcessTarget::GetCurrentThread() const { return tid_; }
+
+std::size_t ProcessTarget::ReadMemory(std::uintptr_t addr, void* buf,
+                                      std::size_t len) const {
+  return MemoryOperator::ReadMemory(pid_, addr, buf, len);
+}
+
+std::optional<user_regs_struct> ProcessTarget::GetRegisters(pid_t tid) const {
+  user_regs_struct regs;
+  if (utils::Ptrace(PTRACE_GETREGS, tid, nullptr, &regs) == -1) {
+    return std::nullopt;
+  }
+  return regs;
+}
+
+std::vector<pid_t> ProcessTarget::GetThreads() const {
+  auto threads = utils::GetThreadIds(pid_);
+  std::stable_partition(threads.begin(), threads.end(),
+                        [this](pid_t tid) { return tid == pid_; });
+  return threads;
+}
+
+std::vector<utils::MemoryRegion> ProcessTarget::GetRegions() const {
+  return utils::GetMemoryRegions(pid_);
+}
+
+}  // namespace shuidb
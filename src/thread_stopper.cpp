@@ -0,0 +1,87 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "thread_stopper.h"
+
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+
+#include "utils/ps_utils.hpp"
+#include "utils/syscall_stats.hpp"
+
+namespace shuidb {
+
+ThreadStopper::ThreadStopper(pid_t pid, const std::vector<pid_t>& traced)
+    : threads_(traced) {
+  // Threads may be spawned while we are stopping the others, so keep going
+  // until a pass finds nothing new
+  bool found_new = true;
+  while (found_new) {
+    found_new = false;
+    std::vector<pid_t> batch;
+    for (auto tid : utils::GetThreadIds(pid)) {
+      if (std::find(threads_.begin(), threads_.end(), tid) != threads_.end()) {
+        continue;
+      }
+      if (utils::Ptrace(PTRACE_SEIZE, tid, nullptr, nullptr) == -1) {
+        // Exited in the meantime
+        continue;
+      }
+      threads_.push_back(tid);
+      batch.push_back(tid);
+      found_new = true;
+    }
+    // Interrupt the whole batch before waiting, so all threads stop at once
+    // instead of one after another
+    for (auto tid : batch) {
+      utils::Ptrace(PTRACE_INTERRUPT, tid, nullptr, nullptr);
+    }
+    for (auto tid : batch) {
+      int wait_status;
+      if (utils::WaitPid(tid, &wait_status, __WALL) == -1 ||
+          !WIFSTOPPED(wait_status)) {
+        continue;
+      }
+      seized_.push_back(tid);
+      if (wait_status >> 16 == 0 && WSTOPSIG(wait_status) != SIGTRAP) {
+        // A signal arrived before our interrupt, hand it back on detach
+        signals_[tid] = WSTOPSIG(wait_status);
+      }
+    }
+  }
+
+  std::sort(threads_.begin(), threads_.end());
+}
+
+ThreadStopper::~ThreadStopper() { Resume(); }
+
+const std::vector<pid_t>& ThreadStopper::GetThreads() const {
+  return threads_;
+}
+
+void ThreadStopper::Resume() {
+  for (auto tid : seized_) {
+    auto it = signals_.find(tid);
+    long sig = it == signals_.end() ? 0 : it->second;
+    utils::Ptrace(PTRACE_DETACH, tid, nullptr, sig);
+  }
+  seized_.clear();
+  signals_.clear();
+}
+
+}  // namespace shuidb
@@ -0,0 +1,1713 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "x86_decoder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
+namespace shuidb {
+
+namespace {
+
+// Operand kinds, named after the notation of the Intel SDM opcode maps
+enum OperandKind : uint8_t {
+  None,
+  // ModRM r/m
+  Eb,
+  Ew,
+  Ed,
+  Eq,
+  Ev,
+  Ey,
+  M,
+  // ModRM reg
+  Gb,
+  Gw,
+  Gd,
+  Gq,
+  Gv,
+  Gy,
+  Sw,
+  Cd,
+  Dd,
+  // ModRM r/m, register only
+  Ry,
+  // Immediates and branch displacements
+  Ib,
+  Ibs,
+  Iw,
+  Iz,
+  Iv,
+  I1,
+  Jb,
+  Jz,
+  // Fixed registers
+  AL,
+  CL,
+  DX,
+  rAX,
+  eAX,
+  // Register in the low 3 bits of the opcode
+  Zb,
+  Zv,
+  Zq,
+  // Absolute memory offset
+  Ob,
+  Ov,
+  // SIMD, P/Q/N are MMX registers without a mandatory prefix
+  Vx,
+  Wx,
+  Px,
+  Qx,
+  Nx,
+};
+
+enum EntryFlags : uint8_t {
+  kValid = 1 << 0,
+  kModrm = 1 << 1,
+  kPrefix = 1 << 2,
+  kGroup = 1 << 3,
+  kEscape = 1 << 4,
+  kX87 = 1 << 5,
+  kVex = 1 << 6,
+  // Group whose variants have immediates of their own
+  kVariantImmediates = 1 << 7,
+};
+
+struct Entry {
+  // Indexed by the mandatory prefix: none, 0x66, 0xf3, 0xf2
+  std::array<const char*, 4> mnemonics{};
+  std::array<uint8_t, 3> operands{};
+  FlowType flow = FlowType::kSequential;
+  uint8_t group = 0;
+  uint8_t flags = 0;
+  // Immediate operands, precomputed so decoding does not walk `operands`
+  uint8_t imm = None;
+  uint8_t imm2 = None;
+};
+
+constexpr bool NeedsModrm(uint8_t op) {
+  return (op >= Eb && op <= Ry) || (op >= Vx && op <= Nx);
+}
+
+constexpr bool IsImmediate(uint8_t op) {
+  return (op >= Ib && op <= Jz && op != I1) || op == Ob || op == Ov;
+}
+
+constexpr Entry MakeEntry(std::array<const char*, 4> mnemonics, uint8_t a,
+                          uint8_t b, uint8_t c, FlowType flow) {
+  Entry e;
+  e.mnemonics = mnemonics;
+  e.operands = {a, b, c};
+  e.flow = flow;
+  e.flags = kValid;
+  if (NeedsModrm(a) || NeedsModrm(b) || NeedsModrm(c)) {
+    e.flags |= kModrm;
+  }
+  for (auto op : e.operands) {
+    if (IsImmediate(op)) {
+      (e.imm == None ? e.imm : e.imm2) = op;
+    }
+  }
+  return e;
+}
+
+constexpr Entry Op(const char* mnemonic, uint8_t a = None, uint8_t b = None,
+                   uint8_t c = None) {
+  return MakeEntry({mnemonic}, a, b, c, FlowType::kSequential);
+}
+
+constexpr Entry Branch(const char* mnemonic, FlowType flow, uint8_t a = None,
+                       uint8_t b = None) {
+  return MakeEntry({mnemonic}, a, b, None, flow);
+}
+
+constexpr Entry Sse(const char* none, const char* p66, const char* pf3,
+                    const char* pf2, uint8_t a, uint8_t b, uint8_t c = None) {
+  return MakeEntry({none, p66, pf3, pf2}, a, b, c, FlowType::kSequential);
+}
+
+constexpr Entry Group(uint8_t group, uint8_t a = None, uint8_t b = None) {
+  Entry e = MakeEntry({}, a, b, None, FlowType::kSequential);
+  e.group = group;
+  e.flags |= kGroup | kModrm;
+  return e;
+}
+
+constexpr Entry Special(uint8_t flags) {
+  Entry e;
+  e.flags = flags;
+  return e;
+}
+
+enum GroupId : uint8_t {
+  kNoGroup,
+  kGroup1,
+  kGroup1A,
+  kGroup2,
+  kGroup3b,
+  kGroup3v,
+  kGroup4,
+  kGroup5,
+  kGroup11b,
+  kGroup11v,
+  kGroup6,
+  kGroup7,
+  kGroup8,
+  kGroup9,
+  kGroup12,
+  kGroup13,
+  kGroup14,
+  kGroup15,
+  kGroup16,
+  kGroupP,
+  kNumGroups,
+};
+
+constexpr const char* kJcc[16] = {"jo", "jno", "jb", "jae", "je", "jne",
+                                  "jbe", "ja", "js", "jns", "jp", "jnp",
+                                  "jl", "jge", "jle", "jg"};
+constexpr const char* kSetcc[16] = {
+    "seto", "setno", "setb", "setae", "sete", "setne", "setbe", "seta",
+    "sets", "setns", "setp", "setnp", "setl", "setge", "setle", "setg"};
+constexpr const char* kCmovcc[16] = {
+    "cmovo", "cmovno", "cmovb", "cmovae", "cmove", "cmovne", "cmovbe", "cmova",
+    "cmovs", "cmovns", "cmovp", "cmovnp", "cmovl", "cmovge", "cmovle", "cmovg"};
+
+constexpr auto kOneByte = [] {
+  std::array<Entry, 256> t{};
+  const char* alu[8] = {"add", "or", "adc", "sbb", "and", "sub", "xor", "cmp"};
+  for (int i = 0; i < 8; i++) {
+    t[i * 8 + 0] = Op(alu[i], Eb, Gb);
+    t[i * 8 + 1] = Op(alu[i], Ev, Gv);
+    t[i * 8 + 2] = Op(alu[i], Gb, Eb);
+    t[i * 8 + 3] = Op(alu[i], Gv, Ev);
+    t[i * 8 + 4] = Op(alu[i], AL, Ib);
+    t[i * 8 + 5] = Op(alu[i], rAX, Iz);
+  }
+  t[0x0f] = Special(kEscape);
+  for (int p : {0x26, 0x2e, 0x36, 0x3e, 0x64, 0x65, 0x66, 0x67, 0xf0, 0xf2,
+                0xf3}) {
+    t[p] = Special(kPrefix);
+  }
+  for (int i = 0; i < 8; i++) {
+    t[0x50 + i] = Op("push", Zq);
+    t[0x58 + i] = Op("pop", Zq);
+    t[0x90 + i] = Op("xchg", Zv, rAX);
+    t[0xb0 + i] = Op("mov", Zb, Ib);
+    t[0xb8 + i] = Op("mov", Zv, Iv);
+    t[0xd8 + i] = Special(kValid | kModrm | kX87);
+  }
+  t[0x62] = Special(kVex);
+  t[0x63] = Op("movsxd", Gv, Ed);
+  t[0x68] = Op("push", Iz);
+  t[0x69] = Op("imul", Gv, Ev, Iz);
+  t[0x6a] = Op("push", Ibs);
+  t[0x6b] = Op("imul", Gv, Ev, Ibs);
+  t[0x6c] = Op("ins");
+  t[0x6d] = Op("ins");
+  t[0x6e] = Op("outs");
+  t[0x6f] = Op("outs");
+  for (int i = 0; i < 16; i++) {
+    t[0x70 + i] = Branch(kJcc[i], FlowType::kConditionalJump, Jb);
+  }
+  t[0x80] = Group(kGroup1, Eb, Ib);
+  t[0x81] = Group(kGroup1, Ev, Iz);
+  t[0x83] = Group(kGroup1, Ev, Ibs);
+  t[0x84] = Op("test", Eb, Gb);
+  t[0x85] = Op("test", Ev, Gv);
+  t[0x86] = Op("xchg", Eb, Gb);
+  t[0x87] = Op("xchg", Ev, Gv);
+  t[0x88] = Op("mov", Eb, Gb);
+  t[0x89] = Op("mov", Ev, Gv);
+  t[0x8a] = Op("mov", Gb, Eb);
+  t[0x8b] = Op("mov", Gv, Ev);
+  t[0x8c] = Op("mov", Ev, Sw);
+  t[0x8d] = Op("lea", Gv, M);
+  t[0x8e] = Op("mov", Sw, Ew);
+  t[0x8f] = Group(kGroup1A, Eq);
+  t[0x90] = Op("nop");
+  t[0x98] = Op("cwde");
+  t[0x99] = Op("cdq");
+  t[0x9b] = Op("fwait");
+  t[0x9c] = Op("pushfq");
+  t[0x9d] = Op("popfq");
+  t[0x9e] = Op("sahf");
+  t[0x9f] = Op("lahf");
+  t[0xa0] = Op("mov", AL, Ob);
+  t[0xa1] = Op("mov", rAX, Ov);
+  t[0xa2] = Op("mov", Ob, AL);
+  t[0xa3] = Op("mov", Ov, rAX);
+  t[0xa4] = Op("movs");
+  t[0xa5] = Op("movs");
+  t[0xa6] = Op("cmps");
+  t[0xa7] = Op("cmps");
+  t[0xa8] = Op("test", AL, Ib);
+  t[0xa9] = Op("test", rAX, Iz);
+  t[0xaa] = Op("stos");
+  t[0xab] = Op("stos");
+  t[0xac] = Op("lods");
+  t[0xad] = Op("lods");
+  t[0xae] = Op("scas");
+  t[0xaf] = Op("scas");
+  t[0xc0] = Group(kGroup2, Eb, Ib);
+  t[0xc1] = Group(kGroup2, Ev, Ib);
+  t[0xc2] = Branch("ret", FlowType::kReturn, Iw);
+  t[0xc3] = Branch("ret", FlowType::kReturn);
+  t[0xc4] = Special(kVex);
+  t[0xc5] = Special(kVex);
+  t[0xc6] = Group(kGroup11b, Eb, Ib);
+  t[0xc7] = Group(kGroup11v, Ev, Iz);
+  t[0xc8] = Op("enter", Iw, Ib);
+  t[0xc9] = Op("leave");
+  t[0xca] = Branch("retf", FlowType::kReturn, Iw);
+  t[0xcb] = Branch("retf", FlowType::kReturn);
+  t[0xcc] = Branch("int3", FlowType::kInterrupt);
+  t[0xcd] = Branch("int", FlowType::kInterrupt, Ib);
+  t[0xcf] = Branch("iretq", FlowType::kReturn);
+  t[0xd0] = Group(kGroup2, Eb, I1);
+  t[0xd1] = Group(kGroup2, Ev, I1);
+  t[0xd2] = Group(kGroup2, Eb, CL);
+  t[0xd3] = Group(kGroup2, Ev, CL);
+  t[0xd7] = Op("xlat");
+  t[0xe0] = Branch("loopne", FlowType::kConditionalJump, Jb);
+  t[0xe1] = Branch("loope", FlowType::kConditionalJump, Jb);
+  t[0xe2] = Branch("loop", FlowType::kConditionalJump, Jb);
+  t[0xe3] = Branch("jrcxz", FlowType::kConditionalJump, Jb);
+  t[0xe4] = Op("in", AL, Ib);
+  t[0xe5] = Op("in", eAX, Ib);
+  t[0xe6] = Op("out", Ib, AL);
+  t[0xe7] = Op("out", Ib, eAX);
+  t[0xe8] = Branch("call", FlowType::kCall, Jz);
+  t[0xe9] = Branch("jmp", FlowType::kJump, Jz);
+  t[0xeb] = Branch("jmp", FlowType::kJump, Jb);
+  t[0xec] = Op("in", AL, DX);
+  t[0xed] = Op("in", eAX, DX);
+  t[0xee] = Op("out", DX, AL);
+  t[0xef] = Op("out", DX, eAX);
+  t[0xf1] = Branch("int1", FlowType::kInterrupt);
+  t[0xf4] = Branch("hlt", FlowType::kHalt);
+  t[0xf5] = Op("cmc");
+  t[0xf6] = Group(kGroup3b, Eb);
+  t[0xf7] = Group(kGroup3v, Ev);
+  t[0xf8] = Op("clc");
+  t[0xf9] = Op("stc");
+  t[0xfa] = Op("cli");
+  t[0xfb] = Op("sti");
+  t[0xfc] = Op("cld");
+  t[0xfd] = Op("std");
+  t[0xfe] = Group(kGroup4, Eb);
+  t[0xff] = Group(kGroup5, Ev);
+  return t;
+}();
+
+constexpr auto kMap0F = [] {
+  std::array<Entry, 256> t{};
+  t[0x00] = Group(kGroup6, Ew);
+  t[0x01] = Group(kGroup7, M);
+  t[0x02] = Op("lar", Gv, Ew);
+  t[0x03] = Op("lsl", Gv, Ew);
+  t[0x05] = Branch("syscall", FlowType::kSyscall);
+  t[0x06] = Op("clts");
+  t[0x07] = Branch("sysretq", FlowType::kReturn);
+  t[0x08] = Op("invd");
+  t[0x09] = Op("wbinvd");
+  t[0x0b] = Branch("ud2", FlowType::kInterrupt);
+  t[0x0d] = Group(kGroupP, M);
+  t[0x0e] = Op("femms");
+  t[0x0f] = Op("3dnow", Px, Qx, Ib);
+  t[0x10] = Sse("movups", "movupd", "movss", "movsd", Vx, Wx);
+  t[0x11] = Sse("movups", "movupd", "movss", "movsd", Wx, Vx);
+  t[0x12] = Sse("movlps", "movlpd", "movsldup", "movddup", Vx, Wx);
+  t[0x13] = Sse("movlps", "movlpd", nullptr, nullptr, M, Vx);
+  t[0x14] = Sse("unpcklps", "unpcklpd", nullptr, nullptr, Vx, Wx);
+  t[0x15] = Sse("unpckhps", "unpckhpd", nullptr, nullptr, Vx, Wx);
+  t[0x16] = Sse("movhps", "movhpd", "movshdup", nullptr, Vx, Wx);
+  t[0x17] = Sse("movhps", "movhpd", nullptr, nullptr, M, Vx);
+  t[0x18] = Group(kGroup16, M);
+  for (int i = 0x19; i <= 0x1f; i++) {
+    t[i] = Op("nop", Ev);
+  }
+  t[0x20] = Op("mov", Ry, Cd);
+  t[0x21] = Op("mov", Ry, Dd);
+  t[0x22] = Op("mov", Cd, Ry);
+  t[0x23] = Op("mov", Dd, Ry);
+  t[0x28] = Sse("movaps", "movapd", nullptr, nullptr, Vx, Wx);
+  t[0x29] = Sse("movaps", "movapd", nullptr, nullptr, Wx, Vx);
+  t[0x2a] = Sse("cvtpi2ps", "cvtpi2pd", "cvtsi2ss", "cvtsi2sd", Vx, Ey);
+  t[0x2b] = Sse("movntps", "movntpd", nullptr, nullptr, M, Vx);
+  t[0x2c] = Sse("cvttps2pi", "cvttpd2pi", "cvttss2si", "cvttsd2si", Gy, Wx);
+  t[0x2d] = Sse("cvtps2pi", "cvtpd2pi", "cvtss2si", "cvtsd2si", Gy, Wx);
+  t[0x2e] = Sse("ucomiss", "ucomisd", nullptr, nullptr, Vx, Wx);
+  t[0x2f] = Sse("comiss", "comisd", nullptr, nullptr, Vx, Wx);
+  t[0x30] = Op("wrmsr");
+  t[0x31] = Op("rdtsc");
+  t[0x32] = Op("rdmsr");
+  t[0x33] = Op("rdpmc");
+  t[0x34] = Branch("sysenter", FlowType::kSyscall);
+  t[0x35] = Branch("sysexit", FlowType::kReturn);
+  t[0x37] = Op("getsec");
+  t[0x38] = t[0x3a] = Special(kEscape);
+  for (int i = 0; i < 16; i++) {
+    t[0x40 + i] = Op(kCmovcc[i], Gv, Ev);
+    t[0x80 + i] = Branch(kJcc[i], FlowType::kConditionalJump, Jz);
+    t[0x90 + i] = Op(kSetcc[i], Eb);
+  }
+  t[0x50] = Sse("movmskps", "movmskpd", nullptr, nullptr, Gd, Wx);
+  t[0x51] = Sse("sqrtps", "sqrtpd", "sqrtss", "sqrtsd", Vx, Wx);
+  t[0x52] = Sse("rsqrtps", nullptr, "rsqrtss", nullptr, Vx, Wx);
+  t[0x53] = Sse("rcpps", nullptr, "rcpss", nullptr, Vx, Wx);
+  t[0x54] = Sse("andps", "andpd", nullptr, nullptr, Vx, Wx);
+  t[0x55] = Sse("andnps", "andnpd", nullptr, nullptr, Vx, Wx);
+  t[0x56] = Sse("orps", "orpd", nullptr, nullptr, Vx, Wx);
+  t[0x57] = Sse("xorps", "xorpd", nullptr, nullptr, Vx, Wx);
+  t[0x58] = Sse("addps", "addpd", "addss", "addsd", Vx, Wx);
+  t[0x59] = Sse("mulps", "mulpd", "mulss", "mulsd", Vx, Wx);
+  t[0x5a] = Sse("cvtps2pd", "cvtpd2ps", "cvtss2sd", "cvtsd2ss", Vx, Wx);
+  t[0x5b] = Sse("cvtdq2ps", "cvtps2dq", "cvttps2dq", nullptr, Vx, Wx);
+  t[0x5c] = Sse("subps", "subpd", "subss", "subsd", Vx, Wx);
+  t[0x5d] = Sse("minps", "minpd", "minss", "minsd", Vx, Wx);
+  t[0x5e] = Sse("divps", "divpd", "divss", "divsd", Vx, Wx);
+  t[0x5f] = Sse("maxps", "maxpd", "maxss", "maxsd", Vx, Wx);
+
+  // MMX instructions, which operate on xmm registers with a 0x66 prefix
+  struct {
+    uint8_t opcode;
+    const char* mnemonic;
+  } mmx[] = {
+      {0x60, "punpcklbw"}, {0x61, "punpcklwd"}, {0x62, "punpckldq"},
+      {0x63, "packsswb"},  {0x64, "pcmpgtb"},   {0x65, "pcmpgtw"},
+      {0x66, "pcmpgtd"},   {0x67, "packuswb"},  {0x68, "punpckhbw"},
+      {0x69, "punpckhwd"}, {0x6a, "punpckhdq"}, {0x6b, "packssdw"},
+      {0x74, "pcmpeqb"},   {0x75, "pcmpeqw"},   {0x76, "pcmpeqd"},
+      {0xd1, "psrlw"},     {0xd2, "psrld"},     {0xd3, "psrlq"},
+      {0xd4, "paddq"},     {0xd5, "pmullw"},    {0xd8, "psubusb"},
+      {0xd9, "psubusw"},   {0xda, "pminub"},    {0xdb, "pand"},
+      {0xdc, "paddusb"},   {0xdd, "paddusw"},   {0xde, "pmaxub"},
+      {0xdf, "pandn"},     {0xe0, "pavgb"},     {0xe1, "psraw"},
+      {0xe2, "psrad"},     {0xe3, "pavgw"},     {0xe4, "pmulhuw"},
+      {0xe5, "pmulhw"},    {0xe8, "psubsb"},    {0xe9, "psubsw"},
+      {0xea, "pminsw"},    {0xeb, "por"},       {0xec, "paddsb"},
+      {0xed, "paddsw"},    {0xee, "pmaxsw"},    {0xef, "pxor"},
+      {0xf1, "psllw"},     {0xf2, "pslld"},     {0xf3, "psllq"},
+      {0xf4, "pmuludq"},   {0xf5, "pmaddwd"},   {0xf6, "psadbw"},
+      {0xf8, "psubb"},     {0xf9, "psubw"},     {0xfa, "psubd"},
+      {0xfb, "psubq"},     {0xfc, "paddb"},     {0xfd, "paddw"},
+      {0xfe, "paddd"},
+  };
+  for (const auto& m : mmx) {
+    t[m.opcode] = Sse(m.mnemonic, m.mnemonic, nullptr, nullptr, Px, Qx);
+  }
+  t[0x6c] = Sse(nullptr, "punpcklqdq", nullptr, nullptr, Vx, Wx);
+  t[0x6d] = Sse(nullptr, "punpckhqdq", nullptr, nullptr, Vx, Wx);
+  t[0x6e] = Sse("movd", "movd", nullptr, nullptr, Px, Ey);
+  t[0x6f] = Sse("movq", "movdqa", "movdqu", nullptr, Px, Qx);
+  t[0x70] = Sse("pshufw", "pshufd", "pshufhw", "pshuflw", Px, Qx, Ib);
+  t[0x71] = Group(kGroup12, Nx, Ib);
+  t[0x72] = Group(kGroup13, Nx, Ib);
+  t[0x73] = Group(kGroup14, Nx, Ib);
+  t[0x77] = Op("emms");
+  t[0x78] = Op("vmread", Ey, Gy);
+  t[0x79] = Op("vmwrite", Gy, Ey);
+  t[0x7c] = Sse(nullptr, "haddpd", nullptr, "haddps", Vx, Wx);
+  t[0x7d] = Sse(nullptr, "hsubpd", nullptr, "hsubps", Vx, Wx);
+  t[0x7e] = Sse("movd", "movd", "movq", nullptr, Ey, Px);
+  t[0x7f] = Sse("movq", "movdqa", "movdqu", nullptr, Qx, Px);
+  t[0xa0] = Op("push fs");
+  t[0xa1] = Op("pop fs");
+  t[0xa2] = Op("cpuid");
+  t[0xa3] = Op("bt", Ev, Gv);
+  t[0xa4] = Op("shld", Ev, Gv, Ib);
+  t[0xa5] = Op("shld", Ev, Gv, CL);
+  t[0xa8] = Op("push gs");
+  t[0xa9] = Op("pop gs");
+  t[0xaa] = Op("rsm");
+  t[0xab] = Op("bts", Ev, Gv);
+  t[0xac] = Op("shrd", Ev, Gv, Ib);
+  t[0xad] = Op("shrd", Ev, Gv, CL);
+  t[0xae] = Group(kGroup15, M);
+  t[0xaf] = Op("imul", Gv, Ev);
+  t[0xb0] = Op("cmpxchg", Eb, Gb);
+  t[0xb1] = Op("cmpxchg", Ev, Gv);
+  t[0xb2] = Op("lss", Gv, M);
+  t[0xb3] = Op("btr", Ev, Gv);
+  t[0xb4] = Op("lfs", Gv, M);
+  t[0xb5] = Op("lgs", Gv, M);
+  t[0xb6] = Op("movzx", Gv, Eb);
+  t[0xb7] = Op("movzx", Gv, Ew);
+  t[0xb8] = Sse("jmpe", nullptr, "popcnt", nullptr, Gv, Ev);
+  t[0xb9] = Branch("ud1", FlowType::kInterrupt, Gv, Ev);
+  t[0xba] = Group(kGroup8, Ev, Ib);
+  t[0xbb] = Op("btc", Ev, Gv);
+  t[0xbc] = Sse("bsf", nullptr, "tzcnt", nullptr, Gv, Ev);
+  t[0xbd] = Sse("bsr", nullptr, "lzcnt", nullptr, Gv, Ev);
+  t[0xbe] = Op("movsx", Gv, Eb);
+  t[0xbf] = Op("movsx", Gv, Ew);
+  t[0xc0] = Op("xadd", Eb, Gb);
+  t[0xc1] = Op("xadd", Ev, Gv);
+  t[0xc2] = Sse("cmpps", "cmppd", "cmpss", "cmpsd", Vx, Wx, Ib);
+  t[0xc3] = Op("movnti", M, Gy);
+  t[0xc4] = Sse("pinsrw", "pinsrw", nullptr, nullptr, Px, Ed, Ib);
+  t[0xc5] = Sse("pextrw", "pextrw", nullptr, nullptr, Gd, Nx, Ib);
+  t[0xc6] = Sse("shufps", "shufpd", nullptr, nullptr, Vx, Wx, Ib);
+  t[0xc7] = Group(kGroup9, M);
+  for (int i = 0; i < 8; i++) {
+    t[0xc8 + i] = Op("bswap", Zv);
+  }
+  t[0xd0] = Sse(nullptr, "addsubpd", nullptr, "addsubps", Vx, Wx);
+  t[0xd6] = Sse(nullptr, "movq", "movq2dq", "movdq2q", Wx, Vx);
+  t[0xd7] = Sse("pmovmskb", "pmovmskb", nullptr, nullptr, Gd, Nx);
+  t[0xe6] = Sse(nullptr, "cvttpd2dq", "cvtdq2pd", "cvtpd2dq", Vx, Wx);
+  t[0xe7] = Sse("movntq", "movntdq", nullptr, nullptr, M, Px);
+  t[0xf0] = Sse(nullptr, nullptr, nullptr, "lddqu", Vx, M);
+  t[0xf7] = Sse("maskmovq", "maskmovdqu", nullptr, nullptr, Px, Nx);
+  t[0xff] = Branch("ud0", FlowType::kInterrupt, Gv, Ev);
+  return t;
+}();
+
+struct SparseEntry {
+  uint8_t opcode;
+  Entry entry;
+};
+
+// The 0f38 and 0f3a maps are sparse, and every opcode in them carries a ModRM
+// byte (plus an imm8 for 0f3a), so unknown opcodes still decode to the right
+// length
+constexpr std::array<Entry, 256> BuildSparseMap(
+    const SparseEntry* entries, std::size_t count, uint8_t a, uint8_t b,
+    uint8_t c) {
+  std::array<Entry, 256> t{};
+  for (auto& e : t) {
+    e = Op(nullptr, a, b, c);
+  }
+  for (std::size_t i = 0; i < count; i++) {
+    auto e = entries[i].entry;
+    if (e.mnemonics[1] == nullptr && e.mnemonics[2] == nullptr &&
+        e.mnemonics[3] == nullptr) {
+      // 0x66 selects the xmm form, not a 16-bit operand size
+      e.mnemonics[1] = e.mnemonics[0];
+    }
+    t[entries[i].opcode] = e;
+  }
+  return t;
+}
+
+constexpr SparseEntry kMap0F38Entries[] = {
+    {0x00, Op("pshufb", Px, Qx)},
+    {0x01, Op("phaddw", Px, Qx)},
+    {0x02, Op("phaddd", Px, Qx)},
+    {0x03, Op("phaddsw", Px, Qx)},
+    {0x04, Op("pmaddubsw", Px, Qx)},
+    {0x05, Op("phsubw", Px, Qx)},
+    {0x06, Op("phsubd", Px, Qx)},
+    {0x07, Op("phsubsw", Px, Qx)},
+    {0x08, Op("psignb", Px, Qx)},
+    {0x09, Op("psignw", Px, Qx)},
+    {0x0a, Op("psignd", Px, Qx)},
+    {0x0b, Op("pmulhrsw", Px, Qx)},
+    {0x10, Op("pblendvb", Vx, Wx)},
+    {0x14, Op("blendvps", Vx, Wx)},
+    {0x15, Op("blendvpd", Vx, Wx)},
+    {0x16, Op("permps", Vx, Wx)},
+    {0x17, Op("ptest", Vx, Wx)},
+    {0x18, Op("broadcastss", Vx, Wx)},
+    {0x19, Op("broadcastsd", Vx, Wx)},
+    {0x1c, Op("pabsb", Px, Qx)},
+    {0x1d, Op("pabsw", Px, Qx)},
+    {0x1e, Op("pabsd", Px, Qx)},
+    {0x20, Op("pmovsxbw", Vx, Wx)},
+    {0x21, Op("pmovsxbd", Vx, Wx)},
+    {0x22, Op("pmovsxbq", Vx, Wx)},
+    {0x23, Op("pmovsxwd", Vx, Wx)},
+    {0x24, Op("pmovsxwq", Vx, Wx)},
+    {0x25, Op("pmovsxdq", Vx, Wx)},
+    {0x28, Op("pmuldq", Vx, Wx)},
+    {0x29, Op("pcmpeqq", Vx, Wx)},
+    {0x2a, Op("movntdqa", Vx, M)},
+    {0x2b, Op("packusdw", Vx, Wx)},
+    {0x30, Op("pmovzxbw", Vx, Wx)},
+    {0x31, Op("pmovzxbd", Vx, Wx)},
+    {0x32, Op("pmovzxbq", Vx, Wx)},
+    {0x33, Op("pmovzxwd", Vx, Wx)},
+    {0x34, Op("pmovzxwq", Vx, Wx)},
+    {0x35, Op("pmovzxdq", Vx, Wx)},
+    {0x36, Op("permd", Vx, Wx)},
+    {0x37, Op("pcmpgtq", Vx, Wx)},
+    {0x38, Op("pminsb", Vx, Wx)},
+    {0x39, Op("pminsd", Vx, Wx)},
+    {0x3a, Op("pminuw", Vx, Wx)},
+    {0x3b, Op("pminud", Vx, Wx)},
+    {0x3c, Op("pmaxsb", Vx, Wx)},
+    {0x3d, Op("pmaxsd", Vx, Wx)},
+    {0x3e, Op("pmaxuw", Vx, Wx)},
+    {0x3f, Op("pmaxud", Vx, Wx)},
+    {0x40, Op("pmulld", Vx, Wx)},
+    {0x41, Op("phminposuw", Vx, Wx)},
+    {0x45, Op("psrlvd", Vx, Wx)},
+    {0x46, Op("psravd", Vx, Wx)},
+    {0x47, Op("psllvd", Vx, Wx)},
+    {0x58, Op("pbroadcastd", Vx, Wx)},
+    {0x59, Op("pbroadcastq", Vx, Wx)},
+    {0x78, Op("pbroadcastb", Vx, Wx)},
+    {0x79, Op("pbroadcastw", Vx, Wx)},
+    {0xdb, Op("aesimc", Vx, Wx)},
+    {0xdc, Op("aesenc", Vx, Wx)},
+    {0xdd, Op("aesenclast", Vx, Wx)},
+    {0xde, Op("aesdec", Vx, Wx)},
+    {0xdf, Op("aesdeclast", Vx, Wx)},
+    {0xf0, Sse("movbe", nullptr, nullptr, "crc32", Gv, Ev)},
+    {0xf1, Sse("movbe", nullptr, nullptr, "crc32", Ev, Gv)},
+    {0xf6, Sse(nullptr, "adcx", "adox", nullptr, Gy, Ey)},
+};
+
+constexpr SparseEntry kMap0F3AEntries[] = {
+    {0x00, Op("permq", Vx, Wx, Ib)},
+    {0x01, Op("permpd", Vx, Wx, Ib)},
+    {0x02, Op("pblendd", Vx, Wx, Ib)},
+    {0x04, Op("permilps", Vx, Wx, Ib)},
+    {0x05, Op("permilpd", Vx, Wx, Ib)},
+    {0x06, Op("perm2f128", Vx, Wx, Ib)},
+    {0x08, Op("roundps", Vx, Wx, Ib)},
+    {0x09, Op("roundpd", Vx, Wx, Ib)},
+    {0x0a, Op("roundss", Vx, Wx, Ib)},
+    {0x0b, Op("roundsd", Vx, Wx, Ib)},
+    {0x0c, Op("blendps", Vx, Wx, Ib)},
+    {0x0d, Op("blendpd", Vx, Wx, Ib)},
+    {0x0e, Op("pblendw", Vx, Wx, Ib)},
+    {0x0f, Op("palignr", Px, Qx, Ib)},
+    {0x14, Op("pextrb", Ed, Vx, Ib)},
+    {0x15, Op("pextrw", Ed, Vx, Ib)},
+    {0x16, Op("pextrd", Ey, Vx, Ib)},
+    {0x17, Op("extractps", Ed, Vx, Ib)},
+    {0x18, Op("insertf128", Vx, Wx, Ib)},
+    {0x19, Op("extractf128", Wx, Vx, Ib)},
+    {0x20, Op("pinsrb", Vx, Ed, Ib)},
+    {0x21, Op("insertps", Vx, Wx, Ib)},
+    {0x22, Op("pinsrd", Vx, Ey, Ib)},
+    {0x38, Op("inserti128", Vx, Wx, Ib)},
+    {0x39, Op("extracti128", Wx, Vx, Ib)},
+    {0x40, Op("dpps", Vx, Wx, Ib)},
+    {0x41, Op("dppd", Vx, Wx, Ib)},
+    {0x42, Op("mpsadbw", Vx, Wx, Ib)},
+    {0x44, Op("pclmulqdq", Vx, Wx, Ib)},
+    {0x46, Op("perm2i128", Vx, Wx, Ib)},
+    {0x4a, Op("blendvps", Vx, Wx, Ib)},
+    {0x4b, Op("blendvpd", Vx, Wx, Ib)},
+    {0x4c, Op("pblendvb", Vx, Wx, Ib)},
+    {0x60, Op("pcmpestrm", Vx, Wx, Ib)},
+    {0x61, Op("pcmpestri", Vx, Wx, Ib)},
+    {0x62, Op("pcmpistrm", Vx, Wx, Ib)},
+    {0x63, Op("pcmpistri", Vx, Wx, Ib)},
+    {0xcc, Op("sha1rnds4", Vx, Wx, Ib)},
+    {0xdf, Op("aeskeygenassist", Vx, Wx, Ib)},
+};
+
+constexpr auto kMap0F38 = BuildSparseMap(
+    kMap0F38Entries, std::size(kMap0F38Entries), Vx, Wx, None);
+constexpr auto kMap0F3A = BuildSparseMap(
+    kMap0F3AEntries, std::size(kMap0F3AEntries), Vx, Wx, Ib);
+
+// Indexed by the ModRM reg field. An entry without operands inherits them from
+// the opcode entry
+constexpr auto kGroups = [] {
+  std::array<std::array<Entry, 8>, kNumGroups> g{};
+  const char* group1[8] = {"add", "or", "adc", "sbb", "and", "sub", "xor",
+                           "cmp"};
+  const char* group2[8] = {"rol", "ror", "rcl", "rcr", "shl", "shr", "sal",
+                           "sar"};
+  const char* group3[8] = {"test", "test", "not",  "neg",
+                           "mul",  "imul", "div", "idiv"};
+  for (int i = 0; i < 8; i++) {
+    g[kGroup1][i] = Op(group1[i]);
+    g[kGroup2][i] = Op(group2[i]);
+    g[kGroup3b][i] = Op(group3[i]);
+    g[kGroup3v][i] = Op(group3[i]);
+  }
+  g[kGroup3b][0] = g[kGroup3b][1] = Op("test", Eb, Ib);
+  g[kGroup3v][0] = g[kGroup3v][1] = Op("test", Ev, Iz);
+  g[kGroup1A][0] = Op("pop");
+  g[kGroup4][0] = Op("inc");
+  g[kGroup4][1] = Op("dec");
+  g[kGroup5][0] = Op("inc");
+  g[kGroup5][1] = Op("dec");
+  g[kGroup5][2] = Branch("call", FlowType::kIndirectCall, Eq);
+  g[kGroup5][3] = Branch("call far", FlowType::kIndirectCall, M);
+  g[kGroup5][4] = Branch("jmp", FlowType::kIndirectJump, Eq);
+  g[kGroup5][5] = Branch("jmp far", FlowType::kIndirectJump, M);
+  g[kGroup5][6] = Op("push", Eq);
+  g[kGroup11b][0] = Op("mov");
+  g[kGroup11b][7] = Op("xabort", Ib);
+  g[kGroup11v][0] = Op("mov");
+  g[kGroup11v][7] = Branch("xbegin", FlowType::kConditionalJump, Jz);
+  const char* group6[6] = {"sldt", "str", "lldt", "ltr", "verr", "verw"};
+  for (int i = 0; i < 6; i++) {
+    g[kGroup6][i] = Op(group6[i]);
+  }
+  const char* group7[8] = {"sgdt", "sidt",     "lgdt", "lidt",
+                           "smsw", "rstorssp", "lmsw", "invlpg"};
+  const char* group15[8] = {"fxsave", "fxrstor", "ldmxcsr",  "stmxcsr",
+                            "xsave",  "xrstor",  "xsaveopt", "clflush"};
+  const char* group16[8] = {"prefetchnta", "prefetcht0", "prefetcht1",
+                            "prefetcht2",  "nop",        "nop",
+                            "nop",         "nop"};
+  for (int i = 0; i < 8; i++) {
+    g[kGroup7][i] = Op(group7[i]);
+    g[kGroup15][i] = Op(group15[i]);
+    g[kGroup16][i] = Op(group16[i]);
+    g[kGroupP][i] = Op(i == 1 ? "prefetchw" : "prefetch");
+  }
+  g[kGroup7][4] = Op("smsw", Ew);
+  g[kGroup7][6] = Op("lmsw", Ew);
+  g[kGroup8][4] = Op("bt");
+  g[kGroup8][5] = Op("bts");
+  g[kGroup8][6] = Op("btr");
+  g[kGroup8][7] = Op("btc");
+  g[kGroup9][1] = Op("cmpxchg8b");
+  g[kGroup9][3] = Op("xrstors");
+  g[kGroup9][4] = Op("xsavec");
+  g[kGroup9][5] = Op("xsaves");
+  g[kGroup9][6] = Op("rdrand", Ev);
+  g[kGroup9][7] = Op("rdseed", Ev);
+  g[kGroup12][2] = Sse("psrlw", "psrlw", nullptr, nullptr, Nx, Ib);
+  g[kGroup12][4] = Sse("psraw", "psraw", nullptr, nullptr, Nx, Ib);
+  g[kGroup12][6] = Sse("psllw", "psllw", nullptr, nullptr, Nx, Ib);
+  g[kGroup13][2] = Sse("psrld", "psrld", nullptr, nullptr, Nx, Ib);
+  g[kGroup13][4] = Sse("psrad", "psrad", nullptr, nullptr, Nx, Ib);
+  g[kGroup13][6] = Sse("pslld", "pslld", nullptr, nullptr, Nx, Ib);
+  g[kGroup14][2] = Sse("psrlq", "psrlq", nullptr, nullptr, Nx, Ib);
+  g[kGroup14][3] = Sse(nullptr, "psrldq", nullptr, nullptr, Nx, Ib);
+  g[kGroup14][6] = Sse("psllq", "psllq", nullptr, nullptr, Nx, Ib);
+  g[kGroup14][7] = Sse(nullptr, "pslldq", nullptr, nullptr, Nx, Ib);
+  return g;
+}();
+
+// The maps indexed by OpcodeMap, so the map is picked by arithmetic rather
+// than by a branch
+constexpr auto kMaps = [] {
+  std::array<std::array<Entry, 256>, 4> maps = {kOneByte, kMap0F, kMap0F38,
+                                                kMap0F3A};
+  for (auto& map : maps) {
+    for (auto& entry : map) {
+      if (!(entry.flags & kGroup)) {
+        continue;
+      }
+      for (const auto& variant : kGroups[entry.group]) {
+        if (variant.operands[0] != None &&
+            (variant.imm != entry.imm || variant.imm2 != entry.imm2)) {
+          entry.flags |= kVariantImmediates;
+        }
+      }
+    }
+  }
+  return maps;
+}();
+
+static_assert(kMaps[0][0xf7].flags & kVariantImmediates);
+static_assert(!(kMaps[0][0x81].flags & kVariantImmediates));
+
+// Prefix bytes as bits, so a run of legacy prefixes folds into one byte
+enum PrefixBits : uint8_t {
+  kRex = 1 << 0,
+  kSegment = 1 << 1,
+  kOperandSize = 1 << 2,
+  kAddressSize = 1 << 3,
+  kLock = 1 << 4,
+  kRep = 1 << 5,
+  kRepne = 1 << 6,
+};
+
+constexpr auto kPrefixBits = [] {
+  std::array<uint8_t, 256> t{};
+  for (int p : {0x26, 0x2e, 0x36, 0x3e, 0x64, 0x65}) {
+    t[p] = kSegment;
+  }
+  t[0x66] = kOperandSize;
+  t[0x67] = kAddressSize;
+  t[0xf0] = kLock;
+  t[0xf3] = kRep;
+  t[0xf2] = kRepne;
+  for (int p = 0x40; p < 0x50; p++) {
+    t[p] = kRex;
+  }
+  return t;
+}();
+
+enum ModrmLayout : uint8_t {
+  kDispSizeMask = 0x7,
+  kHasSib = 1 << 3,
+  kRipRelative = 1 << 4,
+  // SIB without a base register when its base field is 5
+  kSibNoBase = 1 << 5,
+};
+
+// Displacement size and SIB presence for each ModRM byte, 64-bit addressing
+// (the 0x67 prefix does not change the layout in long mode)
+constexpr auto kModrmLayouts = [] {
+  std::array<uint8_t, 256> t{};
+  for (int modrm = 0; modrm < 256; modrm++) {
+    int mod = modrm >> 6, rm = modrm & 7;
+    if (mod == 3) {
+      continue;
+    }
+    uint8_t layout = mod == 1 ? 1 : mod == 2 ? 4 : 0;
+    if (rm == 4) {
+      layout |= kHasSib | (mod == 0 ? kSibNoBase : 0);
+    } else if (mod == 0 && rm == 5) {
+      layout |= 4 | kRipRelative;
+    }
+    t[modrm] = layout;
+  }
+  return t;
+}();
+
+static_assert(kOneByte[0x01].flags == (kValid | kModrm));
+static_assert(kOneByte[0xe8].flow == FlowType::kCall);
+static_assert(kMap0F3A[0xff].operands[2] == Ib);
+
+// How to read a displacement or immediate of `size` bytes out of the 8
+// bytes at its offset
+struct FieldLayout {
+  // Shifted up and back down to sign-extend, then masked
+  uint8_t shift = 0;
+  uint8_t size = 0;
+  // All ones when the field is present, so absent fields read as 0
+  uint8_t offset_mask = 0;
+  bool relative = false;
+  uint64_t mask = 0;
+
+  int64_t Read(uint64_t bytes) const {
+    return (static_cast<int64_t>(bytes << shift) >> shift) & mask;
+  }
+};
+
+constexpr FieldLayout MakeFieldLayout(uint8_t size, bool zero_extended,
+                                      bool relative = false) {
+  FieldLayout layout;
+  if (size != 0) {
+    layout.shift = 64 - size * 8;
+    layout.size = size;
+    layout.offset_mask = 0xff;
+    layout.relative = relative;
+    layout.mask = zero_extended ? ~0ull >> layout.shift : ~0ull;
+  }
+  return layout;
+}
+
+// Displacements by size, always sign-extended
+constexpr auto kDisplacements = [] {
+  std::array<FieldLayout, 5> t{};
+  for (uint8_t size : {1, 4}) {
+    t[size] = MakeFieldLayout(size, false);
+  }
+  return t;
+}();
+
+// Immediate operands, indexed by operand kind and by 0x66 (bit 0), REX.W
+// (bit 1) and 0x67 (bit 2)
+constexpr auto kImmediates = [] {
+  std::array<std::array<FieldLayout, 8>, Nx + 1> t{};
+  for (int mode = 0; mode < 8; mode++) {
+    bool operand_size = mode & 1, rex_w = mode & 2, address_size = mode & 4;
+    uint8_t z = operand_size && !rex_w ? 2 : 4;
+    uint8_t v = rex_w ? 8 : operand_size ? 2 : 4;
+    t[Ib][mode] = MakeFieldLayout(1, true);
+    t[Ibs][mode] = MakeFieldLayout(1, false);
+    t[Jb][mode] = MakeFieldLayout(1, false, true);
+    t[Iw][mode] = MakeFieldLayout(2, true);
+    t[Iz][mode] = MakeFieldLayout(z, false);
+    t[Jz][mode] = MakeFieldLayout(z, false, true);
+    t[Iv][mode] = MakeFieldLayout(v, false);
+    t[Ob][mode] = t[Ov][mode] = MakeFieldLayout(address_size ? 4 : 8, true);
+  }
+  return t;
+}();
+
+uint64_t Load64(const uint8_t* p) {
+  uint64_t value;
+  std::memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// Decode reads ahead of the bytes it has validated, up to 35 bytes into the
+// instruction, shorter inputs are copied into a zero-padded buffer first
+constexpr std::size_t kPaddedSize = 48;
+
+// What the legacy, REX and VEX prefixes leave for decoding the rest
+struct Prefixes {
+  uint8_t bits = 0;
+  uint8_t segment = 0;
+  uint8_t rex = 0;
+  uint8_t vex_size = 0;
+  uint8_t vex_vvvv = 0;
+  uint8_t vex_l = 0;
+  uint8_t evex_high = 0;
+  // Implied by the VEX map rather than by the opcode
+  uint8_t default_imm = None;
+  // EVEX disp8*N
+  int32_t disp8_scale = 1;
+};
+
+// Everything after the opcode: ModRM, SIB, displacement and immediates.
+// `bytes` holds the 8 bytes from `i` on. Inlined into both paths of Decode,
+// the common one passes constant prefixes and most of their handling folds
+// away. The presence of each field is masked in rather than branched on, it
+// does not predict well in real code. Every field is assigned, as soon as it
+// is known so that few values stay live, zero-initializing first costs more
+// than the rest of the decode. The fields are never read back
+[[gnu::always_inline]] inline bool DecodeOperands(
+    const uint8_t* code, std::size_t i, std::size_t limit,
+    std::uintptr_t address, const Prefixes& prefixes, OpcodeMap map,
+    uint8_t opcode, const Entry* entry, uint8_t flags, uint64_t bytes,
+    Instruction& insn) {
+  insn.address = address;
+  insn.map = map;
+  insn.opcode = opcode;
+  insn.rex = prefixes.rex;
+  insn.segment = prefixes.segment;
+  insn.vex_size = prefixes.vex_size;
+  insn.vex_vvvv = prefixes.vex_vvvv;
+  insn.vex_l = prefixes.vex_l;
+  insn.evex_high = prefixes.evex_high;
+
+  // The reg field of group opcodes selects the actual entry
+  uint64_t has_modrm = (flags & kModrm) != 0;
+  uint64_t modrm = bytes & 0xff & -has_modrm;
+  uint64_t layout = kModrmLayouts[bytes & 0xff] & -has_modrm;
+  insn.has_modrm = has_modrm;
+  insn.modrm = modrm;
+  // Selected by a mask, which of the two it is does not predict well
+  auto group_mask = -static_cast<std::uintptr_t>((flags & kGroup) != 0);
+  auto group = reinterpret_cast<std::uintptr_t>(
+      &kGroups[entry->group][(modrm >> 3) & 7]);
+  auto plain = reinterpret_cast<std::uintptr_t>(entry);
+  const auto* variant = reinterpret_cast<const Entry*>(
+      plain ^ ((plain ^ group) & group_mask));
+  if (!(flags & variant->flags & kValid)) {
+    return false;
+  }
+  insn.flow = variant->flow;
+  insn.operands = (variant->operands[0] != None ? variant : entry)->operands;
+
+  // The mandatory prefix of SSE instructions picks the variant instead of
+  // changing the operand size or repeating
+  unsigned mandatory = 0;
+  if (prefixes.bits & (kOperandSize | kRep | kRepne)) {
+    if ((prefixes.bits & kRepne) && variant->mnemonics[3] != nullptr) {
+      mandatory = 3;
+    } else if ((prefixes.bits & kRep) && variant->mnemonics[2] != nullptr) {
+      mandatory = 2;
+    } else if ((prefixes.bits & kOperandSize) &&
+               variant->mnemonics[1] != nullptr) {
+      mandatory = 1;
+    }
+  }
+  bool legacy = prefixes.vex_size == 0;
+  bool operand_size =
+      legacy && (prefixes.bits & kOperandSize) && mandatory != 1;
+  bool address_size = prefixes.bits & kAddressSize;
+  constexpr uint8_t kMandatoryPrefixes[4] = {0, 0x66, 0xf3, 0xf2};
+  insn.operand_size = operand_size;
+  insn.address_size = address_size;
+  insn.lock = prefixes.bits & kLock;
+  insn.rep = legacy && (prefixes.bits & kRep) && mandatory != 2;
+  insn.repne = legacy && (prefixes.bits & kRepne) && mandatory != 3;
+  insn.mandatory_prefix = kMandatoryPrefixes[mandatory];
+  insn.mnemonic = variant->mnemonics[mandatory];
+  // Variants whose operands differ from the unprefixed form, tested on the
+  // mandatory prefix first since it is almost always absent
+  if (mandatory == 2 && map == OpcodeMap::k0F && opcode == 0x7e) {
+    insn.operands = {Vx, Wx, None};
+  } else if (mandatory == 3 && map == OpcodeMap::k0F38 &&
+             (opcode & 0xfe) == 0xf0) {
+    insn.operands = {Gy, static_cast<uint8_t>(opcode == 0xf0 ? Eb : Ev),
+                     None};
+  }
+
+  // [index*scale + disp32] without a base register, mod 0 has no
+  // displacement otherwise
+  uint64_t has_sib = (layout & kHasSib) != 0;
+  uint64_t sib = (bytes >> 8) & 0xff & -has_sib;
+  uint64_t disp_size = layout & kDispSizeMask;
+  disp_size |= (((sib & 7) == 5) & ((layout & kSibNoBase) != 0)) << 2;
+  i += has_modrm + has_sib;
+  const auto& disp_layout = kDisplacements[disp_size];
+  int32_t disp = disp_layout.Read(Load64(code + i));
+  disp *= disp_size == 1 ? prefixes.disp8_scale : 1;
+  insn.has_sib = has_sib;
+  insn.sib = sib;
+  insn.disp_offset = i & disp_layout.offset_mask;
+  insn.disp_size = disp_size;
+  insn.disp = disp;
+  i += disp_size;
+
+  // Immediates, `enter` is the only instruction with two of them
+  const Entry* imm_source = entry;
+  if (flags & kVariantImmediates) {
+    imm_source = variant->operands[0] != None ? variant : entry;
+  }
+  unsigned imm_kind = imm_source->imm;
+  imm_kind = imm_kind == None ? prefixes.default_imm : imm_kind;
+  auto mode =
+      operand_size | ((prefixes.rex >> 2) & 0x2) | (address_size << 2);
+  const auto& imm_layout = kImmediates[imm_kind][mode];
+  const auto& imm2_layout = kImmediates[imm_source->imm2][mode];
+  int64_t imm = imm_layout.Read(Load64(code + i));
+  insn.imm_offset = i & imm_layout.offset_mask;
+  insn.imm_size = imm_layout.size;
+  insn.imm = imm;
+  i += imm_layout.size;
+  insn.imm2 = imm2_layout.Read(Load64(code + i));
+  i += imm2_layout.size;
+  if (i > limit) {
+    return false;
+  }
+  insn.length = i;
+
+  // Branch targets from the immediate, data from a rip-relative displacement
+  uint64_t relative = imm_layout.relative;
+  uint64_t rip_relative = (layout & kRipRelative) != 0;
+  int64_t offset = disp + ((imm - disp) & -relative);
+  std::uintptr_t target = address + i + offset;
+  insn.rip_relative = rip_relative;
+  insn.target = target & -(relative | rip_relative);
+  return true;
+}
+
+// Prefixed instructions, and the maps the common path leaves out
+[[gnu::noinline]] bool DecodeGeneral(const uint8_t* code, std::size_t limit,
+                                     std::uintptr_t address,
+                                     Instruction& insn) {
+  // Legacy prefixes, and a REX followed by another prefix, which is ignored
+  Prefixes prefixes;
+  std::size_t i = 0;
+  while (kPrefixBits[code[i]] > kRex ||
+         (kPrefixBits[code[i]] == kRex && kPrefixBits[code[i + 1]] != 0)) {
+    auto bits = kPrefixBits[code[i]];
+    // Of 0xf2 and 0xf3 the last one wins
+    prefixes.bits &= bits & (kRep | kRepne) ? ~(kRep | kRepne) : 0xff;
+    prefixes.bits |= bits & ~kRex;
+    prefixes.segment = bits == kSegment ? code[i] : prefixes.segment;
+    if (++i >= limit) {
+      return false;
+    }
+  }
+  if (kPrefixBits[code[i]] == kRex) {
+    prefixes.rex = code[i++];
+  }
+
+  auto map = OpcodeMap::kOneByte;
+  auto opcode = code[i++];
+  if (opcode == 0x0f) {
+    map = OpcodeMap::k0F;
+    opcode = code[i++];
+  }
+  const Entry* entry = &kMaps[static_cast<int>(map)][opcode];
+  auto flags = entry->flags;
+  if (flags & kEscape) {
+    map = opcode == 0x38 ? OpcodeMap::k0F38 : OpcodeMap::k0F3A;
+    opcode = code[i++];
+  } else if (flags & kVex) {
+    // c5: 2-byte VEX, c4: 3-byte VEX, 62: EVEX. The inverted R/X/B bits are
+    // folded into `rex` so the operand decoding is shared with legacy code
+    uint8_t vex_map = 1, pp = 0;
+    auto& p = prefixes;
+    p.vex_size = opcode == 0xc5 ? 2 : opcode == 0xc4 ? 3 : 4;
+    auto b1 = code[i];
+    if (opcode == 0xc5) {
+      p.rex = 0x40 | ((~b1 >> 5) & 0x4);
+      p.vex_vvvv = (~b1 >> 3) & 0xf;
+      p.vex_l = (b1 >> 2) & 1;
+      pp = b1 & 3;
+    } else {
+      auto b2 = code[i + 1];
+      p.rex = 0x40 | ((~b1 >> 5) & 0x7) | ((b2 >> 4) & 0x8);
+      p.vex_vvvv = (~b2 >> 3) & 0xf;
+      if (opcode == 0xc4) {
+        vex_map = b1 & 0x1f;
+        p.vex_l = (b2 >> 2) & 1;
+      } else {
+        auto b3 = code[i + 2];
+        vex_map = b1 & 0x7;
+        p.vex_l = (b3 >> 5) & 3;
+        p.evex_high = ((~b1 >> 4) & 0x1) | ((~b3 >> 2) & 0x2);
+        // Scaled by the vector length, or by the element size for broadcasts
+        p.disp8_scale = b3 & 0x10 ? (p.rex & 0x8 ? 8 : 4) : 16 << p.vex_l;
+      }
+      pp = b2 & 3;
+    }
+    i += p.vex_size - 1;
+    constexpr uint8_t kVexPrefixes[4] = {0, kOperandSize, kRep, kRepne};
+    p.bits &= ~(kOperandSize | kRep | kRepne);
+    p.bits |= kVexPrefixes[pp];
+    opcode = code[i++];
+    // 0f38 also stands for the AVX-512 FP16 maps, which share its generic
+    // layout
+    map = vex_map == 1   ? OpcodeMap::k0F
+          : vex_map == 3 ? OpcodeMap::k0F3A
+                         : OpcodeMap::k0F38;
+    p.default_imm = vex_map == 3 ? Ib : None;
+  }
+  if (flags & (kEscape | kVex)) {
+    entry = &kMaps[static_cast<int>(map)][opcode];
+    flags = entry->flags;
+  }
+  // vzeroupper / vzeroall are the only VEX opcodes without ModRM
+  if (prefixes.vex_size != 0 && (map != OpcodeMap::k0F || opcode != 0x77)) {
+    flags |= kModrm;
+  }
+  if (flags & kX87) {
+    map = OpcodeMap::kX87;
+  }
+  return DecodeOperands(code, i, limit, address, prefixes, map, opcode, entry,
+                        flags, Load64(code + i), insn);
+}
+
+// `code` has kPaddedSize readable bytes
+bool DecodePadded(const uint8_t* code, std::size_t limit,
+                  std::uintptr_t address, Instruction& insn) {
+  // The common case, an optional REX and a one-byte or 0f opcode. The REX
+  // and the escape are shifted out of one load
+  auto bytes = Load64(code);
+  bool has_rex = (bytes & 0xf0) == 0x40;
+  uint8_t rex = bytes & -static_cast<uint64_t>(has_rex);
+  bytes >>= has_rex * 8;
+  // A legacy prefix, or a second REX, after the optional REX
+  auto prefix = kPrefixBits[bytes & 0xff];
+  bool escape = (bytes & 0xff) == 0x0f;
+  bytes >>= escape * 8;
+  uint8_t opcode = bytes;
+  const Entry* entry = &kMaps[escape][opcode];
+  uint8_t flags = entry->flags;
+  if (prefix != 0 || (flags & (kEscape | kVex | kX87))) {
+    return DecodeGeneral(code, limit, address, insn);
+  }
+  Prefixes prefixes;
+  prefixes.rex = rex;
+  return DecodeOperands(code, has_rex + escape + 1, limit, address, prefixes,
+                        static_cast<OpcodeMap>(escape), opcode, entry, flags,
+                        bytes >> 8, insn);
+}
+
+[[gnu::noinline]] bool DecodeShort(const uint8_t* code, std::size_t len,
+                                   std::uintptr_t address,
+                                   Instruction& insn) {
+  uint8_t padded[kPaddedSize] = {};
+  std::memcpy(padded, code, len);
+  return DecodePadded(padded, len, address, insn);
+}
+
+}  // namespace
+
+bool X86Decoder::Decode(const uint8_t* code, std::size_t len,
+                        std::uintptr_t address, Instruction& insn) {
+  // Fields are read whether or not the instruction has them, so shorter
+  // inputs are padded and the length is checked once at the end
+  if (len < kPaddedSize) {
+    return DecodeShort(code, std::min(len, kMaxInstructionLength), address,
+                       insn);
+  }
+  return DecodePadded(code, kMaxInstructionLength, address, insn);
+}
+
+namespace {
+
+constexpr const char* kRegs64[16] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp",
+                                     "rsi", "rdi", "r8",  "r9",  "r10", "r11",
+                                     "r12", "r13", "r14", "r15"};
+constexpr const char* kRegs32[16] = {"eax",  "ecx",  "edx",  "ebx",
+                                     "esp",  "ebp",  "esi",  "edi",
+                                     "r8d",  "r9d",  "r10d", "r11d",
+                                     "r12d", "r13d", "r14d", "r15d"};
+constexpr const char* kRegs16[16] = {"ax",   "cx",   "dx",   "bx",
+                                     "sp",   "bp",   "si",   "di",
+                                     "r8w",  "r9w",  "r10w", "r11w",
+                                     "r12w", "r13w", "r14w", "r15w"};
+constexpr const char* kRegs8[16] = {"al",  "cl",  "dl",   "bl",   "spl",  "bpl",
+                                    "sil", "dil", "r8b",  "r9b",  "r10b", "r11b",
+                                    "r12b", "r13b", "r14b", "r15b"};
+// Without a REX prefix, 4-7 name the high bytes of the first four registers
+constexpr const char* kRegs8Legacy[8] = {"al", "cl", "dl", "bl",
+                                         "ah", "ch", "dh", "bh"};
+constexpr const char* kSegments[8] = {"es", "cs", "ss", "ds",
+                                      "fs", "gs", "?",  "?"};
+
+std::string Hex(uint64_t value) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "0x%lx", value);
+  return buf;
+}
+
+uint64_t Truncate(int64_t value, uint8_t bits) {
+  return bits == 64 ? value : value & ((1ull << bits) - 1);
+}
+
+class Formatter {
+ public:
+  explicit Formatter(const Instruction& insn) : insn_(insn) {}
+
+  std::string Operand(uint8_t kind) const {
+    switch (kind) {
+      case Eb:
+        return Rm(8, "byte");
+      case Ew:
+        return Rm(16, "word");
+      case Ed:
+        return Rm(32, "dword");
+      case Eq:
+        return Rm(64, "qword");
+      case Ev:
+        return Rm(OperandBits(), SizeKeyword(OperandBits()));
+      case Ey:
+        return Rm(insn_.rex & 0x8 ? 64 : 32, insn_.rex & 0x8 ? "qword" : "dword");
+      case M:
+        return Memory("");
+      case Gb:
+        return Gpr(Reg(), 8);
+      case Gw:
+        return Gpr(Reg(), 16);
+      case Gd:
+        return Gpr(Reg(), 32);
+      case Gq:
+        return Gpr(Reg(), 64);
+      case Gv:
+        return Gpr(Reg(), OperandBits());
+      case Gy:
+        return Gpr(Reg(), insn_.rex & 0x8 ? 64 : 32);
+      case Sw:
+        return kSegments[(insn_.modrm >> 3) & 7];
+      case Cd:
+        return "cr" + std::to_string(Reg());
+      case Dd:
+        return "dr" + std::to_string(Reg());
+      case Ry:
+        return Gpr(Rm(), 64);
+      case Ib:
+        return Hex(insn_.imm);
+      case Ibs:
+      case Iz:
+      case Iv:
+        return Hex(Truncate(insn_.imm, OperandBits()));
+      case Iw:
+        return Hex(insn_.imm);
+      case I1:
+        return "1";
+      case Jb:
+      case Jz:
+        return Hex(insn_.target);
+      case AL:
+        return "al";
+      case CL:
+        return "cl";
+      case DX:
+        return "dx";
+      case rAX:
+        return Gpr(0, OperandBits());
+      case eAX:
+        return insn_.operand_size ? "ax" : "eax";
+      case Zb:
+        return Gpr(OpcodeReg(), 8);
+      case Zv:
+        return Gpr(OpcodeReg(), OperandBits());
+      case Zq:
+        return Gpr(OpcodeReg(), insn_.operand_size ? 16 : 64);
+      case Ob:
+      case Ov: {
+        auto bits = kind == Ob ? 8 : OperandBits();
+        return std::string(SizeKeyword(bits)) + " ptr " + Segment() + "[" +
+               Hex(insn_.imm) + "]";
+      }
+      case Vx:
+        return Simd(SimdReg());
+      case Wx:
+        return IsRegisterForm() ? Simd(SimdRm()) : Memory(SimdMemorySize());
+      case Px:
+        return Mmx(SimdReg());
+      case Qx:
+        return IsRegisterForm() ? Mmx(SimdRm())
+                                : Memory(IsMmx() ? "qword" : SimdMemorySize());
+      case Nx:
+        return Mmx(SimdRm());
+      default:
+        return "";
+    }
+  }
+
+  // VEX encoded non-destructive source, e.g. the middle xmm of
+  // `vaddps xmm0, xmm1, xmm2`
+  std::string VexSource() const {
+    return Simd(insn_.vex_vvvv | ((insn_.evex_high & 0x2) << 3));
+  }
+
+ private:
+  uint8_t OperandBits() const {
+    if (insn_.rex & 0x8) {
+      return 64;
+    }
+    return insn_.operand_size ? 16 : 32;
+  }
+
+  static const char* SizeKeyword(uint8_t bits) {
+    switch (bits) {
+      case 8:
+        return "byte";
+      case 16:
+        return "word";
+      case 32:
+        return "dword";
+      default:
+        return "qword";
+    }
+  }
+
+  bool IsRegisterForm() const { return (insn_.modrm >> 6) == 3; }
+  unsigned Reg() const {
+    return ((insn_.modrm >> 3) & 7) | ((insn_.rex & 0x4) << 1);
+  }
+  unsigned Rm() const { return (insn_.modrm & 7) | ((insn_.rex & 0x1) << 3); }
+  // EVEX reaches xmm16-31 through R' and, for register operands, X
+  unsigned SimdReg() const { return Reg() | ((insn_.evex_high & 0x1) << 4); }
+  unsigned SimdRm() const {
+    return insn_.vex_size == 4 ? Rm() | ((insn_.rex & 0x2) << 3) : Rm();
+  }
+  unsigned OpcodeReg() const {
+    return (insn_.opcode & 7) | ((insn_.rex & 0x1) << 3);
+  }
+  bool IsMmx() const {
+    return insn_.mandatory_prefix == 0 && insn_.vex_size == 0;
+  }
+
+  std::string Gpr(unsigned num, uint8_t bits) const {
+    switch (bits) {
+      case 8:
+        return insn_.rex != 0 ? kRegs8[num] : kRegs8Legacy[num & 7];
+      case 16:
+        return kRegs16[num];
+      case 32:
+        return kRegs32[num];
+      default:
+        return kRegs64[num];
+    }
+  }
+
+  std::string Simd(unsigned num) const {
+    const char* prefix = "xmm";
+    if (insn_.vex_size != 0 && insn_.vex_l == 1) {
+      prefix = "ymm";
+    } else if (insn_.vex_size != 0 && insn_.vex_l >= 2) {
+      prefix = "zmm";
+    }
+    return prefix + std::to_string(num);
+  }
+
+  std::string Mmx(unsigned num) const {
+    return IsMmx() ? "mm" + std::to_string(num & 7) : Simd(num);
+  }
+
+  const char* SimdMemorySize() const {
+    std::string_view m = insn_.mnemonic != nullptr ? insn_.mnemonic : "";
+    if (m.starts_with("cvtss") || m.starts_with("cvttss")) {
+      return "dword";
+    }
+    if (m.starts_with("cvtsd") || m.starts_with("cvttsd") || m == "movq" ||
+        m.starts_with("movlp") || m.starts_with("movhp")) {
+      return "qword";
+    }
+    if (insn_.mandatory_prefix == 0xf3 && m.ends_with("ss")) {
+      return "dword";
+    }
+    if (insn_.mandatory_prefix == 0xf2 && m.ends_with("sd")) {
+      return "qword";
+    }
+    if (insn_.vex_size != 0 && insn_.vex_l == 1) {
+      return "ymmword";
+    }
+    if (insn_.vex_size != 0 && insn_.vex_l >= 2) {
+      return "zmmword";
+    }
+    return "xmmword";
+  }
+
+  std::string Rm(uint8_t bits, const char* size) const {
+    return IsRegisterForm() ? Gpr(Rm(), bits) : Memory(size);
+  }
+
+  std::string Segment() const {
+    // Only fs and gs still mean something in 64-bit mode
+    if (insn_.segment == 0x64) {
+      return "fs:";
+    }
+    if (insn_.segment == 0x65) {
+      return "gs:";
+    }
+    return "";
+  }
+
+  std::string Memory(const char* size) const {
+    std::string out;
+    if (size[0] != '\0') {
+      out = std::string(size) + " ptr ";
+    }
+    out += Segment() + "[";
+    const auto* const* regs = insn_.address_size ? kRegs32 : kRegs64;
+    std::string terms;
+    if (insn_.rip_relative) {
+      terms = insn_.address_size ? "eip" : "rip";
+    } else if (insn_.has_sib) {
+      unsigned base = (insn_.sib & 7) | ((insn_.rex & 0x1) << 3);
+      unsigned index = ((insn_.sib >> 3) & 7) | ((insn_.rex & 0x2) << 2);
+      if (!((insn_.sib & 7) == 5 && (insn_.modrm >> 6) == 0)) {
+        terms = regs[base];
+      }
+      if (index != 4) {
+        if (!terms.empty()) {
+          terms += "+";
+        }
+        terms += regs[index];
+        if ((insn_.sib >> 6) != 0) {
+          terms += "*" + std::to_string(1 << (insn_.sib >> 6));
+        }
+      }
+    } else {
+      terms = regs[Rm()];
+    }
+    out += terms;
+    if (terms.empty()) {
+      out += Hex(static_cast<uint32_t>(insn_.disp));
+    } else if (insn_.disp > 0) {
+      out += "+" + Hex(insn_.disp);
+    } else if (insn_.disp < 0) {
+      out += "-" + Hex(-static_cast<int64_t>(insn_.disp));
+    }
+    return out + "]";
+  }
+
+  const Instruction& insn_;
+};
+
+// Register forms of 0f 01, indexed by the ModRM byte
+const char* Group7RegisterForm(uint8_t modrm) {
+  switch (modrm) {
+    case 0xc1:
+      return "vmcall";
+    case 0xc2:
+      return "vmlaunch";
+    case 0xc3:
+      return "vmresume";
+    case 0xc4:
+      return "vmxoff";
+    case 0xc8:
+      return "monitor";
+    case 0xc9:
+      return "mwait";
+    case 0xca:
+      return "clac";
+    case 0xcb:
+      return "stac";
+    case 0xd0:
+      return "xgetbv";
+    case 0xd1:
+      return "xsetbv";
+    case 0xd5:
+      return "xend";
+    case 0xd6:
+      return "xtest";
+    case 0xee:
+      return "rdpkru";
+    case 0xef:
+      return "wrpkru";
+    case 0xf8:
+      return "swapgs";
+    case 0xf9:
+      return "rdtscp";
+    default:
+      return nullptr;
+  }
+}
+
+std::string FormatX87(const Instruction& insn) {
+  // Memory forms, with the operand size of each (0 for environment/state)
+  static constexpr const char* kMemory[8][8] = {
+      {"fadd", "fmul", "fcom", "fcomp", "fsub", "fsubr", "fdiv", "fdivr"},
+      {"fld", nullptr, "fst", "fstp", "fldenv", "fldcw", "fnstenv", "fnstcw"},
+      {"fiadd", "fimul", "ficom", "ficomp", "fisub", "fisubr", "fidiv",
+       "fidivr"},
+      {"fild", "fisttp", "fist", "fistp", nullptr, "fld", nullptr, "fstp"},
+      {"fadd", "fmul", "fcom", "fcomp", "fsub", "fsubr", "fdiv", "fdivr"},
+      {"fld", "fisttp", "fst", "fstp", "frstor", nullptr, "fnsave", "fnstsw"},
+      {"fiadd", "fimul", "ficom", "ficomp", "fisub", "fisubr", "fidiv",
+       "fidivr"},
+      {"fild", "fisttp", "fist", "fistp", "fbld", "fild", "fbstp", "fistp"},
+  };
+  static constexpr const char* kSizes[8][8] = {
+      {"dword", "dword", "dword", "dword", "dword", "dword", "dword", "dword"},
+      {"dword", "", "dword", "dword", "", "word", "", "word"},
+      {"dword", "dword", "dword", "dword", "dword", "dword", "dword", "dword"},
+      {"dword", "dword", "dword", "dword", "", "tbyte", "", "tbyte"},
+      {"qword", "qword", "qword", "qword", "qword", "qword", "qword", "qword"},
+      {"qword", "qword", "qword", "qword", "", "", "", "word"},
+      {"word", "word", "word", "word", "word", "word", "word", "word"},
+      {"word", "word", "word", "word", "tbyte", "qword", "tbyte", "qword"},
+  };
+  static constexpr const char* kD9[32] = {
+      "fchs",  "fabs",   "(bad)",  "(bad)",   "ftst",    "fxam",    "(bad)",
+      "(bad)", "fld1",   "fldl2t", "fldl2e",  "fldpi",   "fldlg2",  "fldln2",
+      "fldz",  "(bad)",  "f2xm1",  "fyl2x",   "fptan",   "fpatan",  "fxtract",
+      "fprem1", "fdecstp", "fincstp", "fprem", "fyl2xp1", "fsqrt", "fsincos",
+      "frndint", "fscale", "fsin",   "fcos"};
+
+  unsigned row = insn.opcode & 7;
+  unsigned reg = (insn.modrm >> 3) & 7;
+  unsigned sti = insn.modrm & 7;
+  if ((insn.modrm >> 6) != 3) {
+    const char* mnemonic = kMemory[row][reg];
+    if (mnemonic == nullptr) {
+      return "(bad)";
+    }
+    std::string size = kSizes[row][reg];
+    auto operand = Formatter(insn).Operand(M);
+    if (!size.empty()) {
+      operand.insert(0, size + " ptr ");
+    }
+    return std::string(mnemonic) + " " + operand;
+  }
+
+  auto st = "st(" + std::to_string(sti) + ")";
+  const char* arith[8] = {"fadd", "fmul", "fcom", "fcomp",
+                          "fsub", "fsubr", "fdiv", "fdivr"};
+  switch (insn.opcode) {
+    case 0xd8:
+      return std::string(arith[reg]) + " st, " + st;
+    case 0xd9:
+      if (reg == 0) {
+        return "fld " + st;
+      }
+      if (reg == 1) {
+        return "fxch " + st;
+      }
+      if (insn.modrm == 0xd0) {
+        return "fnop";
+      }
+      if (reg >= 4) {
+        return kD9[insn.modrm - 0xe0];
+      }
+      return "(bad)";
+    case 0xda: {
+      const char* cmov[4] = {"fcmovb", "fcmove", "fcmovbe", "fcmovu"};
+      if (reg < 4) {
+        return std::string(cmov[reg]) + " st, " + st;
+      }
+      return insn.modrm == 0xe9 ? "fucompp" : "(bad)";
+    }
+    case 0xdb: {
+      const char* cmov[4] = {"fcmovnb", "fcmovne", "fcmovnbe", "fcmovnu"};
+      if (reg < 4) {
+        return std::string(cmov[reg]) + " st, " + st;
+      }
+      if (insn.modrm == 0xe2) {
+        return "fnclex";
+      }
+      if (insn.modrm == 0xe3) {
+        return "fninit";
+      }
+      if (reg == 5) {
+        return "fucomi st, " + st;
+      }
+      if (reg == 6) {
+        return "fcomi st, " + st;
+      }
+      return "(bad)";
+    }
+    case 0xdc: {
+      // The sub/div pairs are swapped with the destination in st(i)
+      const char* ops[8] = {"fadd", "fmul", "fcom",  "fcomp",
+                            "fsubr", "fsub", "fdivr", "fdiv"};
+      return std::string(ops[reg]) + " " + st + ", st";
+    }
+    case 0xdd: {
+      const char* ops[8] = {"ffree", nullptr, "fst",  "fstp",
+                            "fucom", "fucomp", nullptr, nullptr};
+      return ops[reg] != nullptr ? std::string(ops[reg]) + " " + st : "(bad)";
+    }
+    case 0xde: {
+      if (insn.modrm == 0xd9) {
+        return "fcompp";
+      }
+      const char* ops[8] = {"faddp",  "fmulp", nullptr,  nullptr,
+                            "fsubrp", "fsubp", "fdivrp", "fdivp"};
+      return ops[reg] != nullptr ? std::string(ops[reg]) + " " + st + ", st"
+                                 : "(bad)";
+    }
+    default:
+      if (insn.modrm == 0xe0) {
+        return "fnstsw ax";
+      }
+      if (reg == 5) {
+        return "fucomip st, " + st;
+      }
+      if (reg == 6) {
+        return "fcomip st, " + st;
+      }
+      return "(bad)";
+  }
+}
+
+bool IsStringOp(const Instruction& insn) {
+  if (insn.map != OpcodeMap::kOneByte) {
+    return false;
+  }
+  auto op = insn.opcode;
+  return (op >= 0x6c && op <= 0x6f) || (op >= 0xa4 && op <= 0xa7) ||
+         (op >= 0xaa && op <= 0xaf);
+}
+
+// VEX instructions whose vvvv field is unused, so an all-ones vvvv is not
+// xmm0
+bool HasVexSource(const Instruction& insn) {
+  if (insn.vex_vvvv != 0) {
+    return true;
+  }
+  bool simd = (insn.operands[0] == Vx && insn.operands[1] == Wx) ||
+              (insn.operands[0] == Px && insn.operands[1] == Qx);
+  if (!simd) {
+    return false;
+  }
+  std::string_view m = insn.mnemonic;
+  for (std::string_view unary :
+       {"mov", "cvt", "broadcast", "pbroadcast", "pmov", "ptest", "ucomi",
+        "comi", "pshuf", "pabs", "phminposuw", "aesimc", "aeskeygenassist",
+        "lddqu", "sqrtp", "rcpp", "rsqrtp", "roundp", "permq", "permpd",
+        "pcmpestr", "pcmpistr", "permilp"}) {
+    if (m.starts_with(unary)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+std::string X86Decoder::Format(const Instruction& insn) {
+  if (insn.map == OpcodeMap::kX87) {
+    return FormatX87(insn);
+  }
+
+  std::string out;
+  if (insn.lock) {
+    out += "lock ";
+  }
+  if (IsStringOp(insn)) {
+    bool compares = insn.opcode == 0xa6 || insn.opcode == 0xa7 ||
+                    insn.opcode == 0xae || insn.opcode == 0xaf;
+    if (insn.rep) {
+      out += compares ? "repe " : "rep ";
+    } else if (insn.repne) {
+      out += "repne ";
+    }
+  } else if (insn.repne && insn.IsBranch()) {
+    out += "bnd ";
+  }
+
+  std::string mnemonic = insn.mnemonic != nullptr ? insn.mnemonic : "";
+  auto operands = insn.operands;
+  bool register_form = insn.has_modrm && (insn.modrm >> 6) == 3;
+  unsigned reg = (insn.modrm >> 3) & 7;
+  bool rex_w = insn.rex & 0x8;
+
+  if (insn.map == OpcodeMap::kOneByte) {
+    if (IsStringOp(insn)) {
+      const char* suffix = insn.opcode & 1
+                               ? (rex_w ? "q" : insn.operand_size ? "w" : "d")
+                               : "b";
+      mnemonic += suffix;
+    } else if (insn.opcode == 0x90 && (insn.rex & 0x1)) {
+      mnemonic = "xchg";
+      operands = {Zv, rAX, None};
+    } else if (insn.opcode == 0x90 && insn.rep) {
+      return "pause";
+    } else if (insn.opcode == 0x98) {
+      mnemonic = rex_w ? "cdqe" : insn.operand_size ? "cbw" : "cwde";
+    } else if (insn.opcode == 0x99) {
+      mnemonic = rex_w ? "cqo" : insn.operand_size ? "cwd" : "cdq";
+    }
+  } else if (insn.map == OpcodeMap::k0F) {
+    if (insn.opcode == 0x1e && insn.rep &&
+        (insn.modrm == 0xfa || insn.modrm == 0xfb)) {
+      return insn.modrm == 0xfa ? "endbr64" : "endbr32";
+    }
+    if (insn.opcode == 0x01 && register_form) {
+      const char* name = Group7RegisterForm(insn.modrm);
+      return name != nullptr ? name : "(bad)";
+    }
+    if (insn.opcode == 0xae && register_form) {
+      if (insn.rep && reg < 4) {
+        const char* names[4] = {"rdfsbase", "rdgsbase", "wrfsbase",
+                                "wrgsbase"};
+        return std::string(names[reg]) + " " +
+               (rex_w ? kRegs64 : kRegs32)[(insn.modrm & 7) |
+                                           ((insn.rex & 0x1) << 3)];
+      }
+      const char* fences[8] = {nullptr, nullptr, nullptr, nullptr,
+                               nullptr, "lfence", "mfence", "sfence"};
+      return fences[reg] != nullptr ? fences[reg] : "(bad)";
+    }
+    if (insn.opcode == 0xc7 && reg == 1 && rex_w) {
+      mnemonic = "cmpxchg16b";
+    }
+    if ((insn.opcode == 0x6e || insn.opcode == 0x7e) && rex_w &&
+        insn.mandatory_prefix != 0xf3) {
+      mnemonic = "movq";
+    }
+    if (insn.opcode == 0x77 && insn.vex_size != 0) {
+      return insn.vex_l ? "vzeroall" : "vzeroupper";
+    }
+  } else if (insn.map == OpcodeMap::k0F3A && rex_w) {
+    if (insn.opcode == 0x16) {
+      mnemonic = "pextrq";
+    } else if (insn.opcode == 0x22) {
+      mnemonic = "pinsrq";
+    }
+  }
+
+  bool simd = std::any_of(operands.begin(), operands.end(), [](uint8_t op) {
+    return op >= Vx && op <= Nx;
+  });
+  // VEX encodings of opcodes outside the SIMD tables (mask registers, BMI)
+  // are not covered
+  if (mnemonic.empty() || (insn.vex_size != 0 && !simd)) {
+    return "(bad)";
+  }
+  if (insn.vex_size != 0) {
+    mnemonic.insert(0, "v");
+  }
+  out += mnemonic;
+
+  Formatter formatter(insn);
+  bool first = true;
+  for (std::size_t i = 0; i < operands.size() && operands[i] != None; i++) {
+    out += first ? " " : ", ";
+    first = false;
+    out += formatter.Operand(operands[i]);
+    if (i == 0 && insn.vex_size != 0 && HasVexSource(insn)) {
+      out += ", " + formatter.VexSource();
+    }
+  }
+  return out;
+}
+
+}  // namespace shuidb
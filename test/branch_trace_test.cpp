@@ -0,0 +1,98 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "branch_trace.h"
+
+#include <unistd.h>
+
+#include <fstream>
+
+#include "gtest/gtest.h"
+
+namespace shuidb {
+
+class BranchTraceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    auto prefix = "/tmp/shuidb_trace_" + std::to_string(getpid());
+    trace_path_ = prefix + ".trace";
+    code_path_ = prefix + ".bin";
+  }
+  void TearDown() override {
+    unlink(trace_path_.c_str());
+    unlink(code_path_.c_str());
+  }
+
+  std::string trace_path_;
+  std::string code_path_;
+};
+
+TEST_F(BranchTraceTest, RoundTripTest) {
+  std::vector<std::uintptr_t> stops{0x401000, 0x400ff0, 0x7ffff7dd0000,
+                                    0x401005};
+  TraceWriter writer;
+  ASSERT_TRUE(writer.Open(trace_path_, 0x400000));
+  for (auto pc : stops) {
+    ASSERT_TRUE(writer.Append(pc));
+  }
+  ASSERT_TRUE(writer.Close({{0x400000, 0x402000, 0x1000, "/bin/true"}},
+                           kTraceBlockStep));
+
+  auto reader = TraceReader::Open(trace_path_);
+  ASSERT_NE(reader, nullptr);
+  ASSERT_EQ(reader->GetHeader().start_pc, 0x400000);
+  ASSERT_EQ(reader->GetHeader().flags, kTraceBlockStep);
+  ASSERT_EQ(reader->GetStops(), stops);
+  ASSERT_EQ(reader->GetModules().size(), 1);
+  ASSERT_EQ(reader->GetModules()[0].offset, 0x1000);
+  ASSERT_EQ(reader->GetModules()[0].path, "/bin/true");
+}
+
+TEST_F(BranchTraceTest, ReplayTest) {
+  // 0x1000: mov eax, 1; jmp 0x1009; nop; nop
+  // 0x1009: cmp eax, 1; jne 0x1000; ret
+  std::vector<uint8_t> code{0xb8, 0x01, 0x00, 0x00, 0x00, 0xeb, 0x02, 0x90,
+                            0x90, 0x83, 0xf8, 0x01, 0x75, 0xf2, 0xc3};
+  std::ofstream(code_path_, std::ios::binary)
+      .write(reinterpret_cast<const char*>(code.data()), code.size());
+
+  TraceWriter writer;
+  ASSERT_TRUE(writer.Open(trace_path_, 0x1000));
+  // Taken branches only, the jne falls through
+  writer.Append(0x1009);
+  writer.Append(0x2000);
+  ASSERT_TRUE(writer.Close({{0x1000, 0x1000 + code.size(), 0, code_path_}},
+                           kTraceBlockStep));
+
+  auto reader = TraceReader::Open(trace_path_);
+  ASSERT_NE(reader, nullptr);
+  std::vector<std::uintptr_t> path;
+  auto count = reader->Replay([&](const Instruction& insn) {
+    path.push_back(insn.address);
+    return true;
+  });
+  ASSERT_EQ(count, 5);
+  ASSERT_EQ(path, (std::vector<std::uintptr_t>{0x1000, 0x1005, 0x1009, 0x100c,
+                                               0x100e}));
+}
+
+TEST_F(BranchTraceTest, BadFileTest) {
+  std::ofstream(trace_path_) << "not a trace";
+  ASSERT_EQ(TraceReader::Open(trace_path_), nullptr);
+  ASSERT_EQ(TraceReader::Open("/nonexistent/trace"), nullptr);
+}
+
+}  // namespace shuidb
@@ -0,0 +1,157 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "breakpoint.h"
+
+#include <random>
+#include <unordered_set>
+
+#include "debugger.h"
+#include "gtest/gtest.h"
+#include "memory_operator.h"
+#include "symbolizer.h"
+
+namespace shuidb {
+
+TEST(BreakPointTableTest, AddFindRemoveTest) {
+  BreakPointTable table;
+  std::mt19937_64 rng(42);
+  std::vector<std::intptr_t> addrs;
+  for (int i = 0; i < 50000; i++) {
+    addrs.push_back(0x400000 + rng() % (1 << 24));
+  }
+  for (auto addr : addrs) {
+    auto index = table.Add(addr);
+    ASSERT_EQ(table.GetAddress(index), addr);
+  }
+  for (auto addr : addrs) {
+    auto index = table.Find(addr);
+    ASSERT_NE(index, BreakPointTable::kNotFound);
+    ASSERT_EQ(table.GetAddress(index), addr);
+  }
+
+  // Every other one goes, the dense indices are compacted
+  for (std::size_t i = 0; i < addrs.size(); i += 2) {
+    auto index = table.Find(addrs[i]);
+    if (index != BreakPointTable::kNotFound) {
+      table.Remove(index);
+    }
+  }
+  std::unordered_set<std::intptr_t> removed;
+  for (std::size_t i = 0; i < addrs.size(); i += 2) {
+    removed.insert(addrs[i]);
+  }
+  for (auto addr : addrs) {
+    auto index = table.Find(addr);
+    if (removed.count(addr) != 0) {
+      ASSERT_EQ(index, BreakPointTable::kNotFound);
+    } else {
+      ASSERT_NE(index, BreakPointTable::kNotFound);
+      ASSERT_EQ(table.GetAddress(index), addr);
+    }
+  }
+  std::unordered_set<std::intptr_t> unique(addrs.begin(), addrs.end());
+  ASSERT_EQ(table.Size(), unique.size() - removed.size());
+  ASSERT_EQ(table.Find(0x1234), BreakPointTable::kNotFound);
+}
+
+TEST(BreakPointTableTest, SetEnabledTest) {
+  Debugger debugger("examples/hello_world");
+  debugger.RunProc();
+  auto pid = debugger.GetPid();
+  Symbolizer symbolizer(pid);
+  const auto* exec = &symbolizer.GetRegions()[0];
+  for (const auto& region : symbolizer.GetRegions()) {
+    if (region.IsExecutable()) {
+      exec = &region;
+      break;
+    }
+  }
+  ASSERT_TRUE(exec->IsExecutable());
+
+  std::vector<uint8_t> before(exec->Size());
+  ASSERT_EQ(MemoryOperator::ReadMemory(pid, exec->start, before.data(),
+                                       before.size()),
+            before.size());
+  BreakPointTable table;
+  table.Reset(pid);
+  std::vector<uint32_t> indices;
+  for (auto addr = exec->start; addr < exec->end; addr += 7) {
+    indices.push_back(table.Add(addr));
+  }
+
+  ASSERT_TRUE(table.SetEnabled(indices, true));
+  std::vector<uint8_t> patched(before.size());
+  MemoryOperator::ReadMemory(pid, exec->start, patched.data(), patched.size());
+  for (std::size_t i = 0; i < patched.size(); i++) {
+    ASSERT_EQ(patched[i], i % 7 == 0 ? 0xcc : before[i]);
+  }
+  for (auto index : indices) {
+    ASSERT_TRUE(table.IsEnabled(index));
+    ASSERT_EQ(table.GetOriginalData(index),
+              before[table.GetAddress(index) - exec->start]);
+  }
+
+  ASSERT_TRUE(table.SetEnabled(indices, false));
+  MemoryOperator::ReadMemory(pid, exec->start, patched.data(), patched.size());
+  ASSERT_EQ(patched, before);
+}
+
+TEST(OneShotBreakPointSetTest, HitTest) {
+  Debugger debugger("examples/hello_world");
+  debugger.RunProc();
+  auto pid = debugger.GetPid();
+  Symbolizer symbolizer(pid);
+  const auto* exec = &symbolizer.GetRegions()[0];
+  for (const auto& region : symbolizer.GetRegions()) {
+    if (region.IsExecutable()) {
+      exec = &region;
+      break;
+    }
+  }
+  ASSERT_TRUE(exec->IsExecutable());
+
+  std::vector<uint8_t> before(exec->Size());
+  MemoryOperator::ReadMemory(pid, exec->start, before.data(), before.size());
+  OneShotBreakPointSet set;
+  set.Reset(pid);
+  for (auto addr = exec->end - 5; addr >= exec->start + 5; addr -= 5) {
+    set.Add(addr);
+  }
+  ASSERT_TRUE(set.Install());
+  ASSERT_EQ(set.Find(exec->start + 1), OneShotBreakPointSet::kNotFound);
+  auto hit = static_cast<std::uintptr_t>(set.GetAddresses()[3]);
+  ASSERT_TRUE(set.Hit(hit));
+  ASSERT_FALSE(set.Hit(hit));
+  ASSERT_TRUE(set.IsHit(3));
+  ASSERT_EQ(set.GetHitCount(), 1);
+
+  std::vector<uint8_t> patched(before.size());
+  MemoryOperator::ReadMemory(pid, exec->start, patched.data(), patched.size());
+  for (std::size_t i = 0; i < patched.size(); i++) {
+    auto addr = exec->start + i;
+    bool pending = (exec->end - addr) % 5 == 0 && addr >= exec->start + 5 &&
+                   addr != hit;
+    ASSERT_EQ(patched[i], pending ? 0xcc : before[i]);
+  }
+
+  ASSERT_TRUE(set.Remove());
+  MemoryOperator::ReadMemory(pid, exec->start, patched.data(), patched.size());
+  ASSERT_EQ(patched, before);
+  ASSERT_TRUE(set.IsHit(3));
+}
+
+}  // namespace shuidb
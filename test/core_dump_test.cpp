@@ -0,0 +1,90 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "core_dump.h"
+
+#include <elf.h>
+#include <sys/procfs.h>
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "debugger.h"
+#include "gtest/gtest.h"
+#include "memory_operator.h"
+#include "register_operator.h"
+#include "symbolizer.h"
+
+namespace shuidb {
+
+TEST(CoreDumpTest, GenerateCoreTest) {
+  Debugger debugger("examples/hello_world");
+  debugger.RunProc();
+  auto pid = debugger.GetPid();
+  auto main = Symbolizer(pid).LookupAddress("main").value();
+  debugger.SetBreakPointAtAddress(main);
+  debugger.ContinueExecution();
+  auto path = "/tmp/shuidb_core_" + std::to_string(getpid());
+  ASSERT_EQ(debugger.GenerateCore(path), StatusType::kSuccess);
+
+  std::ifstream ifs(path, std::ios::binary);
+  std::string core{std::istreambuf_iterator<char>(ifs),
+                   std::istreambuf_iterator<char>()};
+  unlink(path.c_str());
+  ASSERT_GT(core.size(), sizeof(Elf64_Ehdr));
+  Elf64_Ehdr ehdr;
+  std::memcpy(&ehdr, core.data(), sizeof(ehdr));
+  ASSERT_EQ(std::memcmp(ehdr.e_ident, ELFMAG, SELFMAG), 0);
+  ASSERT_EQ(ehdr.e_type, ET_CORE);
+  std::vector<Elf64_Phdr> phdrs(ehdr.e_phnum);
+  std::memcpy(phdrs.data(), core.data() + ehdr.e_phoff,
+              phdrs.size() * sizeof(Elf64_Phdr));
+  ASSERT_EQ(phdrs[0].p_type, PT_NOTE);
+
+  // The first note is the main thread's NT_PRSTATUS
+  Elf64_Nhdr nhdr;
+  std::memcpy(&nhdr, core.data() + phdrs[0].p_offset, sizeof(nhdr));
+  ASSERT_EQ(nhdr.n_type, NT_PRSTATUS);
+  elf_prstatus status;
+  std::memcpy(&status, core.data() + phdrs[0].p_offset + sizeof(nhdr) + 8,
+              sizeof(status));
+  EXPECT_EQ(status.pr_pid, pid);
+  user_regs_struct regs;
+  std::memcpy(&regs, &status.pr_reg, sizeof(regs));
+  EXPECT_EQ(regs.rip, main);
+
+  auto find = [&](uint64_t addr) -> const char* {
+    for (const auto& phdr : phdrs) {
+      if (phdr.p_type == PT_LOAD && addr >= phdr.p_vaddr &&
+          addr < phdr.p_vaddr + phdr.p_filesz) {
+        return core.data() + phdr.p_offset + (addr - phdr.p_vaddr);
+      }
+    }
+    return nullptr;
+  };
+  // No int3 at the breakpoint, and the stack as it is
+  const auto* code = find(main);
+  ASSERT_NE(code, nullptr);
+  EXPECT_NE(static_cast<uint8_t>(*code), 0xcc);
+  const auto* stack = find(regs.rsp);
+  ASSERT_NE(stack, nullptr);
+  uint64_t word;
+  std::memcpy(&word, stack, sizeof(word));
+  EXPECT_EQ(word, MemoryOperator::ReadMemory(pid, regs.rsp));
+}
+
+}  // namespace shuidb
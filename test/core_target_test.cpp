@@ -0,0 +1,89 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "core_target.h"
+
+#include <cstring>
+
+#include "debugger.h"
+#include "gtest/gtest.h"
+#include "memory_operator.h"
+#include "symbolizer.h"
+
+namespace shuidb {
+
+TEST(CoreTargetTest, OpenTest) {
+  Debugger debugger("examples/hello_world");
+  debugger.RunProc();
+  auto pid = debugger.GetPid();
+  auto main = Symbolizer(pid).LookupAddress("main").value();
+  debugger.SetBreakPointAtAddress(main);
+  debugger.ContinueExecution();
+  auto path = "/tmp/shuidb_core_target_" + std::to_string(getpid());
+  ASSERT_EQ(debugger.GenerateCore(path), StatusType::kSuccess);
+
+  ProcessTarget process(pid);
+  auto live_regs = process.GetRegisters(pid).value();
+  // First word of every readable mapping, some only in the mapped files
+  std::vector<std::pair<std::uintptr_t, uint64_t>> words;
+  for (const auto& region : process.GetRegions()) {
+    // [vvar] and [vvar_vclock] are not dumped
+    if (region.IsReadable() && region.path.rfind("[vvar", 0) != 0 &&
+        region.path != "[vsyscall]") {
+      words.emplace_back(region.start,
+                         MemoryOperator::ReadMemory(pid, region.start));
+    }
+  }
+  words.emplace_back(live_regs.rsp,
+                     MemoryOperator::ReadMemory(pid, live_regs.rsp));
+  debugger.Quit();
+
+  auto core = CoreTarget::Open(path);
+  ASSERT_NE(core, nullptr);
+  EXPECT_EQ(core->GetPid(), pid);
+  EXPECT_EQ(core->GetThreads(), std::vector<pid_t>{pid});
+  auto regs = core->GetRegisters(pid);
+  ASSERT_TRUE(regs.has_value());
+  EXPECT_EQ(regs->rip, main);
+  EXPECT_EQ(regs->rsp, live_regs.rsp);
+  EXPECT_FALSE(core->GetRegisters(pid + 1).has_value());
+
+  for (const auto& [addr, word] : words) {
+    uint64_t value = 0;
+    ASSERT_EQ(core->ReadMemory(addr, &value, sizeof(value)), sizeof(value))
+        << std::hex << addr;
+    EXPECT_EQ(value, word) << std::hex << addr;
+  }
+  // The stack is served straight from the mapping of the core
+  auto stack = core->GetMemory(regs->rsp);
+  ASSERT_GE(stack.size(), sizeof(uint64_t));
+  uint64_t top;
+  std::memcpy(&top, stack.data(), sizeof(top));
+  EXPECT_EQ(top, words.back().second);
+  uint64_t value;
+  EXPECT_EQ(core->ReadMemory(0, &value, sizeof(value)), 0);
+
+  // Post-mortem, with no process running
+  Debugger offline("examples/hello_world");
+  ASSERT_EQ(offline.LoadCore(path), StatusType::kSuccess);
+  EXPECT_EQ(offline.GetRegisters()->at(Register::RIP), main);
+  EXPECT_EQ(offline.Backtrace(), StatusType::kSuccess);
+  EXPECT_EQ(offline.ExamineMemory("$rsp", 32), StatusType::kSuccess);
+  EXPECT_EQ(offline.ExamineMemory("main", 16), StatusType::kSuccess);
+  unlink(path.c_str());
+}
+
+}  // namespace shuidb
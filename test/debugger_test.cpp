@@ -16,10 +16,26 @@
 
 #include "debugger.h"
 
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <csignal>
+#include <fstream>
+#include <functional>
 #include <memory>
+#include <sstream>
 
+#include "branch_trace.h"
+#include "coverage.h"
+#include "deadlock_detector.h"
+#include "register_operator.h"
+#include "symbolizer.h"
+#include "target.h"
 #include "gtest/gtest.h"
+#include "thread_stopper.h"
 #include "utils/ps_utils.hpp"
+#include "utils/syscall_stats.hpp"
+#include "utils/thread_pool.hpp"
 
 namespace shuidb {
 class DebuggerTest : public ::testing::Test {
@@ -60,4 +76,375 @@ TEST_F(DebuggerTest, BreakPointTest) {
 
 TEST_F(DebuggerTest, DumpRegistersTest) { debugger_->DumpRegisters(); }
 
+TEST_F(DebuggerTest, SnapshotStacksTest) {
+  ASSERT_EQ(debugger_->Backtrace(), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->SnapshotStacks(), StatusType::kSuccess);
+  // The traced thread must still be under our control afterwards
+  ASSERT_EQ(debugger_->IsRunning(), true);
+  debugger_->ContinueExecution();
+  ASSERT_EQ(debugger_->IsRunning(), false);
+}
+
+TEST_F(DebuggerTest, DisassembleTest) {
+  ASSERT_EQ(debugger_->Disassemble("", 5), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->Disassemble("main", 5), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->Disassemble("no_such_symbol", 5),
+            StatusType::kBadInput);
+  debugger_->ContinueExecution();
+  ASSERT_EQ(debugger_->IsRunning(), false);
+}
+
+TEST_F(DebuggerTest, StepTest) {
+  auto pc = debugger_->GetRegisters()->at(Register::RIP);
+  ASSERT_EQ(debugger_->StepInstruction(), StatusType::kSuccess);
+  ASSERT_NE(debugger_->GetRegisters()->at(Register::RIP), pc);
+  ASSERT_EQ(debugger_->NextInstruction(), StatusType::kSuccess);
+
+  Symbolizer symbolizer(debugger_->GetPid());
+  auto main_addr = symbolizer.LookupAddress("main");
+  ASSERT_TRUE(main_addr.has_value());
+  debugger_->SetBreakPointAtAddress(main_addr.value());
+  debugger_->ContinueExecution();
+  ASSERT_EQ(debugger_->GetRegisters()->at(Register::RIP), main_addr.value());
+  // Steps over the int3 at main
+  ASSERT_EQ(debugger_->StepInstruction(), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->Finish(), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->IsRunning(), true);
+  debugger_->ContinueExecution();
+  ASSERT_EQ(debugger_->IsRunning(), false);
+}
+
+TEST_F(DebuggerTest, SourceStepTest) {
+  ASSERT_EQ(debugger_->Next(), StatusType::kFailed);  // no line info in ld.so
+
+  Symbolizer symbolizer(debugger_->GetPid());
+  debugger_->SetBreakPointAtAddress(symbolizer.LookupAddress("main").value());
+  debugger_->ContinueExecution();
+  for (int i = 0; i < 3; i++) {
+    ASSERT_EQ(debugger_->Next(), StatusType::kSuccess);
+    ASSERT_EQ(debugger_->IsRunning(), true);
+  }
+  ASSERT_EQ(debugger_->Step(), StatusType::kSuccess);
+  debugger_->ContinueExecution();
+  ASSERT_EQ(debugger_->IsRunning(), false);
+}
+
+TEST_F(DebuggerTest, RecordTraceTest) {
+  auto path = "/tmp/shuidb_record_" + std::to_string(getpid()) + ".trace";
+  auto start = debugger_->GetRegisters()->at(Register::RIP);
+  ASSERT_EQ(debugger_->RecordTrace(path, 1000), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->IsRunning(), true);
+
+  auto reader = TraceReader::Open(path);
+  ASSERT_NE(reader, nullptr);
+  ASSERT_EQ(reader->GetStops().size(), 1000);
+  std::vector<std::uintptr_t> path_pcs;
+  auto count = reader->Replay([&](const Instruction& insn) {
+    path_pcs.push_back(insn.address);
+    return true;
+  });
+  ASSERT_GE(count, 1000);
+  ASSERT_EQ(path_pcs.front(), start);
+  ASSERT_EQ(debugger_->DumpTrace(path, 5), StatusType::kSuccess);
+  unlink(path.c_str());
+}
+
+TEST_F(DebuggerTest, CoverageTest) {
+  auto prefix = "/tmp/shuidb_coverage_" + std::to_string(getpid());
+  ASSERT_EQ(debugger_->StartCoverage(true, {}), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->StartCoverage(true, {}), StatusType::kFailed);
+  // Single steps run into coverage sites too
+  Symbolizer symbolizer(debugger_->GetPid());
+  debugger_->SetBreakPointAtAddress(symbolizer.LookupAddress("main").value());
+  debugger_->ContinueExecution();
+  for (int i = 0; i < 20; i++) {
+    ASSERT_EQ(debugger_->StepInstruction(), StatusType::kSuccess);
+  }
+  debugger_->ContinueExecution();
+  ASSERT_EQ(debugger_->IsRunning(), false);
+  ASSERT_EQ(debugger_->ShowCoverage(), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->SaveCoverage(prefix), StatusType::kSuccess);
+
+  std::ifstream cov(prefix + ".cov", std::ios::binary);
+  CoverageHeader header;
+  ASSERT_TRUE(cov.read(reinterpret_cast<char*>(&header), sizeof(header)));
+  ASSERT_EQ(header.mode, static_cast<uint32_t>(CoverageMode::kBlocks));
+  ASSERT_GT(header.hit_count, 0);
+  ASSERT_LT(header.hit_count, header.count);
+  std::ifstream info(prefix + ".info");
+  std::stringstream lcov;
+  lcov << info.rdbuf();
+  ASSERT_NE(lcov.str().find("FNDA:1,main\n"), std::string::npos);
+  ASSERT_NE(lcov.str().find("end_of_record"), std::string::npos);
+  unlink((prefix + ".cov").c_str());
+  unlink((prefix + ".info").c_str());
+}
+
+TEST_F(DebuggerTest, DisplayTest) {
+  ASSERT_EQ(debugger_->AddDisplay("$rip"), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->AddDisplay("*$rsp+8"), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->AddDisplay("/20 $rsp"), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->AddDisplay("/0 $rsp"), StatusType::kBadInput);
+  ASSERT_EQ(debugger_->AddDisplay("*"), StatusType::kBadInput);
+  ASSERT_EQ(debugger_->AddDisplay("/8 nowhere"), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->StepInstruction(), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->RemoveDisplay(4), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->RemoveDisplay(4), StatusType::kBadInput);
+  ASSERT_EQ(debugger_->ShowDisplays(), StatusType::kSuccess);
+}
+
+TEST_F(DebuggerTest, SnapshotTest) {
+  Symbolizer symbolizer(debugger_->GetPid());
+  auto main = symbolizer.LookupAddress("main").value();
+  debugger_->SetBreakPointAtAddress(main);
+  debugger_->ContinueExecution();
+  ASSERT_EQ(debugger_->SaveSnapshot("a"), StatusType::kSuccess);
+  for (int i = 0; i < 20; i++) {
+    ASSERT_EQ(debugger_->StepInstruction(), StatusType::kSuccess);
+  }
+  auto pid = debugger_->GetPid();
+  auto pc = RegisterOperator::GetRegisterValue(pid, Register::RIP).value();
+  ASSERT_NE(pc, main);
+  ASSERT_EQ(debugger_->SaveSnapshot("b"), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->DiffSnapshots("a", "b"), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->DiffSnapshots("a", "x"), StatusType::kBadInput);
+
+  ASSERT_EQ(debugger_->RestoreSnapshot("a"), StatusType::kSuccess);
+  ASSERT_EQ(RegisterOperator::GetRegisterValue(pid, Register::RIP), main);
+
+  // Every run goes from main to where the steps ended
+  auto input = "/tmp/shuidb_fuzz_" + std::to_string(getpid());
+  std::ofstream(input) << "input";
+  debugger_->SetBreakPointAtAddress(pc);
+  ASSERT_EQ(debugger_->Fuzz("a", "$rsp-0x1000", input, 10, "$rsi"),
+            StatusType::kSuccess);
+  ASSERT_EQ(debugger_->IsRunning(), true);
+  ASSERT_EQ(RegisterOperator::GetRegisterValue(pid, Register::RIP), main);
+  ASSERT_EQ(debugger_->Fuzz("a", "$rsp", "/nonexistent", 1, ""),
+            StatusType::kBadInput);
+  unlink(input.c_str());
+}
+
+TEST_F(DebuggerTest, CheckpointTest) {
+  Symbolizer symbolizer(debugger_->GetPid());
+  auto main = symbolizer.LookupAddress("main").value();
+  debugger_->SetBreakPointAtAddress(main);
+  debugger_->ContinueExecution();
+  ASSERT_EQ(debugger_->ReverseContinue(), StatusType::kFailed);
+  ASSERT_EQ(debugger_->AddCheckpoint(), StatusType::kSuccess);
+  for (int i = 0; i < 20; i++) {
+    ASSERT_EQ(debugger_->StepInstruction(), StatusType::kSuccess);
+  }
+  auto pc = RegisterOperator::GetRegisterValue(debugger_->GetPid(),
+                                               Register::RIP)
+                .value();
+  debugger_->SetBreakPointAtAddress(pc);
+
+  // The checkpoint is unchanged by the steps, and gets the new breakpoint
+  ASSERT_EQ(debugger_->Restart(1), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->Restart(2), StatusType::kBadInput);
+  ASSERT_EQ(debugger_->ShowCheckpoints(), StatusType::kSuccess);
+  auto pid = debugger_->GetPid();
+  ASSERT_EQ(RegisterOperator::GetRegisterValue(pid, Register::RIP), main);
+  debugger_->ContinueExecution();
+  ASSERT_EQ(RegisterOperator::GetRegisterValue(pid, Register::RIP), pc);
+
+  for (int i = 0; i < 2; i++) {
+    ASSERT_EQ(debugger_->ReverseContinue(), StatusType::kSuccess);
+    ASSERT_NE(debugger_->GetPid(), pid);
+    pid = debugger_->GetPid();
+    ASSERT_EQ(RegisterOperator::GetRegisterValue(pid, Register::RIP), main);
+    debugger_->ContinueExecution();
+    ASSERT_EQ(RegisterOperator::GetRegisterValue(pid, Register::RIP), pc);
+  }
+  ASSERT_EQ(debugger_->RemoveCheckpoint(1), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->ReverseContinue(), StatusType::kFailed);
+}
+
+TEST_F(DebuggerTest, RerunTest) {
+  auto main = Symbolizer(debugger_->GetPid()).LookupAddress("main").value();
+  ASSERT_EQ(debugger_->SetBreakPoint("main"), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->SetBreakPoint("main+4"), StatusType::kSuccess);
+  ASSERT_EQ(debugger_->SetBreakPoint("+4"), StatusType::kBadInput);
+  debugger_->ContinueExecution();
+  ASSERT_EQ(debugger_->GetRegisters()->at(Register::RIP), main);
+  while (debugger_->IsRunning()) {
+    debugger_->ContinueExecution();
+  }
+
+  // Resolved again in the new process
+  debugger_->RunProc();
+  auto breakpoints = debugger_->GetBreakPoints();
+  std::sort(breakpoints.begin(), breakpoints.end());
+  ASSERT_EQ(breakpoints, (std::vector<std::intptr_t>{
+                             static_cast<std::intptr_t>(main),
+                             static_cast<std::intptr_t>(main + 4)}));
+  debugger_->ContinueExecution();
+  ASSERT_EQ(debugger_->GetRegisters()->at(Register::RIP), main);
+  ASSERT_EQ(debugger_->ShowBreakPoints(), StatusType::kSuccess);
+
+  // Set before the first run
+  Debugger debugger("examples/hello_world");
+  ASSERT_EQ(debugger.SetBreakPoint("main"), StatusType::kSuccess);
+  debugger.RunProc();
+  debugger.ContinueExecution();
+  ASSERT_EQ(debugger.GetRegisters()->at(Register::RIP), main);
+}
+
+TEST_F(DebuggerTest, CallFunctionTest) {
+  ASSERT_EQ(debugger_->SetBreakPoint("main"), StatusType::kSuccess);
+  debugger_->ContinueExecution();
+  auto before = debugger_->GetRegisters().value();
+  ASSERT_EQ(debugger_->CallFunction("getpid", {}),
+            static_cast<uint64_t>(debugger_->GetPid()));
+  ASSERT_EQ(debugger_->CallFunction("abs", {"-5"}), 5U);
+  ASSERT_FALSE(debugger_->CallFunction("nosuch", {}).has_value());
+  // The stub page is reused, nothing piles up
+  for (int i = 0; i < 100; i++) {
+    ASSERT_EQ(debugger_->CallFunction("labs", {std::to_string(-i)}),
+              static_cast<uint64_t>(i));
+  }
+  ASSERT_EQ(debugger_->GetRegisters().value(), before);
+
+  // Still runs to the end from the breakpoint
+  debugger_->ContinueExecution();
+  ASSERT_FALSE(debugger_->IsRunning());
+}
+
+TEST_F(DebuggerTest, KilledTest) {
+  // Reported with the signal, not as an exit
+  kill(debugger_->GetPid(), SIGKILL);
+  auto info = debugger_->RunUntilStop(false, 0);
+  ASSERT_TRUE(info.exit_status.has_value());
+  ASSERT_TRUE(WIFSIGNALED(info.exit_status.value()));
+  ASSERT_EQ(WTERMSIG(info.exit_status.value()), SIGKILL);
+  ASSERT_EQ(debugger_->IsRunning(), false);
+}
+
+TEST_F(DebuggerTest, SyscallStatsTest) {
+  using utils::SyscallOp;
+  auto calls = [](SyscallOp op) {
+    return utils::SyscallStats::Get().Take().ops[static_cast<int>(op)].calls;
+  };
+  auto pokes = calls(SyscallOp::kPoke);
+  auto waits = calls(SyscallOp::kWaitPid);
+  auto stops = calls(SyscallOp::kStopHandling);
+  ASSERT_EQ(debugger_->SetBreakPoint("main"), StatusType::kSuccess);
+  debugger_->ContinueExecution();
+  // The int3 goes in, the stop is waited for and handled
+  EXPECT_GT(calls(SyscallOp::kPoke), pokes);
+  EXPECT_EQ(calls(SyscallOp::kWaitPid), waits + 1);
+  EXPECT_EQ(calls(SyscallOp::kStopHandling), stops + 1);
+
+  auto snapshot = utils::SyscallStats::Get().Take();
+  const auto& wait = snapshot.ops[static_cast<int>(SyscallOp::kWaitPid)];
+  EXPECT_LE(wait.cycles, snapshot.cycles);
+  EXPECT_GT(snapshot.cycles_per_ns, 0);
+  EXPECT_EQ(debugger_->ShowStats(), StatusType::kSuccess);
+}
+
+TEST(InjectedSignalTest, DeliveredTest) {
+  // A signal queued while stopped arrives during the injected syscall, and
+  // is delivered on the next resume instead of lost
+  std::vector<std::function<void(Debugger&)>> injections{
+      [](Debugger& d) { ASSERT_EQ(d.SaveSnapshot("a"), StatusType::kSuccess); },
+      [](Debugger& d) { ASSERT_EQ(d.AddCheckpoint(), StatusType::kSuccess); },
+      [](Debugger& d) {
+        ASSERT_EQ(d.CallFunction("getpid", {}),
+                  static_cast<uint64_t>(d.GetPid()));
+      }};
+  for (const auto& inject : injections) {
+    Debugger debugger("examples/hello_world");
+    ASSERT_EQ(debugger.SetBreakPoint("main"), StatusType::kSuccess);
+    debugger.RunProc();
+    debugger.ContinueExecution();
+    kill(debugger.GetPid(), SIGUSR1);
+    inject(debugger);
+    debugger.ContinueExecution();
+    ASSERT_FALSE(debugger.IsRunning());
+    auto info = debugger.RunUntilStop(false, 0);
+    ASSERT_TRUE(WIFSIGNALED(info.exit_status.value()));
+    ASSERT_EQ(WTERMSIG(info.exit_status.value()), SIGUSR1);
+  }
+}
+
+TEST(ThreadsTest, CoverageTest) {
+  // Sites hit by the worker thread are lifted as well, instead of killing the
+  // process with a SIGTRAP
+  Debugger debugger("examples/threads");
+  debugger.RunProc();
+  ASSERT_EQ(debugger.StartCoverage(true, {}), StatusType::kSuccess);
+  auto info = debugger.RunUntilStop(false, 0);
+  ASSERT_TRUE(info.exit_status.has_value());
+  ASSERT_TRUE(WIFEXITED(info.exit_status.value()));
+  ASSERT_EQ(WEXITSTATUS(info.exit_status.value()), 0);
+
+  auto prefix = "/tmp/shuidb_threads_" + std::to_string(getpid());
+  ASSERT_EQ(debugger.SaveCoverage(prefix), StatusType::kSuccess);
+  std::ifstream lcov(prefix + ".info");
+  std::stringstream text;
+  text << lcov.rdbuf();
+  ASSERT_NE(text.str().find("FNDA:1,_Z4worki\n"), std::string::npos);
+  unlink((prefix + ".cov").c_str());
+  unlink((prefix + ".info").c_str());
+}
+
+TEST(ThreadsTest, BreakPointTest) {
+  Debugger debugger("examples/threads");
+  debugger.RunProc();
+  // By its demangled name, without the parameters
+  ASSERT_EQ(debugger.SetBreakPoint("work"), StatusType::kSuccess);
+  auto info = debugger.RunUntilStop(false, 0);
+  ASSERT_TRUE(info.breakpoint);
+  // Stopped in the worker, with the main thread stopped too
+  ASSERT_EQ(debugger.GetThreads().size(), 2);
+  Symbolizer symbolizer(debugger.GetPid());
+  user_regs_struct regs;
+  user_fpregs_struct fpregs;
+  ASSERT_TRUE(debugger.ReadRegisterSets(&regs, &fpregs));
+  ASSERT_EQ(regs.rip, symbolizer.LookupAddress("_Z4worki").value());
+  ProcessTarget target(debugger.GetPid());
+  for (auto tid : debugger.GetThreads()) {
+    ASSERT_TRUE(target.GetRegisters(tid).has_value());
+  }
+  info = debugger.RunUntilStop(false, 0);
+  ASSERT_TRUE(info.exit_status.has_value());
+  ASSERT_EQ(WEXITSTATUS(info.exit_status.value()), 0);
+}
+
+TEST(PluginTest, PendingBreakPointTest) {
+  // plugin_entry only exists once the program loaded libplugin.so
+  Debugger debugger("examples/load_plugin");
+  debugger.RunProc();
+  ASSERT_EQ(debugger.SetBreakPoint("plugin_entry"), StatusType::kSuccess);
+  auto info = debugger.RunUntilStop(false, 0);
+  ASSERT_TRUE(info.breakpoint);
+  Symbolizer symbolizer(debugger.GetPid());
+  user_regs_struct regs;
+  user_fpregs_struct fpregs;
+  ASSERT_TRUE(debugger.ReadRegisterSets(&regs, &fpregs));
+  ASSERT_EQ(regs.rip, symbolizer.LookupAddress("plugin_entry").value());
+  info = debugger.RunUntilStop(false, 0);
+  ASSERT_TRUE(info.exit_status.has_value());
+  ASSERT_EQ(WEXITSTATUS(info.exit_status.value()), 0);
+}
+
+TEST(DeadlockTest, DetectDeadlocksTest) {
+  Debugger debugger("examples/deadlock");
+  debugger.RunProc();
+  // Stops at the SIGTRAP raised once both workers are stuck
+  debugger.ContinueExecution();
+  ASSERT_EQ(debugger.IsRunning(), true);
+  ASSERT_EQ(debugger.DetectDeadlocks(), StatusType::kSuccess);
+
+  utils::ThreadPool pool;
+  // Every thread is traced, and stopped along with the main one
+  ASSERT_EQ(debugger.GetThreads().size(), 3);
+  ThreadStopper stopper(debugger.GetPid(), debugger.GetThreads());
+  auto graph =
+      DeadlockDetector::Analyze(debugger.GetPid(), stopper.GetThreads(), pool);
+  ASSERT_EQ(graph.cycles.size(), 1);
+  ASSERT_EQ(graph.cycles[0].size(), 2);
+}
+
 }  // namespace shuidb
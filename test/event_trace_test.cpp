@@ -0,0 +1,162 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "event_trace.h"
+
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "debugger.h"
+#include "gtest/gtest.h"
+
+namespace shuidb {
+
+namespace {
+
+std::string TracePath() {
+  return "/tmp/shuidb_trace_" + std::to_string(getpid());
+}
+
+EventRecord MakeRecord(uint64_t i) {
+  return {i * 1000, i % 7, 0x1000 + i % 3, 1, EventType::kBreakpoint,
+          static_cast<int32_t>(i), 0};
+}
+
+// Writes `count` records from MakeRecord, reads them back
+std::shared_ptr<EventTraceReader> WriteRecords(uint64_t count,
+                                               std::size_t max_segments) {
+  auto path = TracePath();
+  {
+    auto writer = EventTraceWriter::Create(path, max_segments);
+    EXPECT_NE(writer, nullptr);
+    for (uint64_t i = 0; i < count; i++) {
+      writer->Append(MakeRecord(i));
+    }
+    EXPECT_EQ(writer->GetCount(), count);
+  }
+  auto reader = EventTraceReader::Open(path);
+  unlink(path.c_str());
+  return reader;
+}
+
+}  // namespace
+
+TEST(EventTraceTest, RingTest) {
+  constexpr auto kRecords = EventTraceWriter::kSegmentRecords;
+  auto reader = WriteRecords(2 * kRecords + 10, 2);
+  ASSERT_NE(reader, nullptr);
+  // The oldest segment was overwritten by the third
+  const auto& records = reader->GetRecords();
+  ASSERT_EQ(records.size(), kRecords + 10);
+  for (std::size_t i = 0; i < records.size(); i++) {
+    ASSERT_EQ(records[i].value, static_cast<int32_t>(kRecords + i));
+  }
+  EXPECT_EQ(EventTraceReader::Open("/proc/self/exe"), nullptr);
+}
+
+TEST(EventTraceTest, SummaryTest) {
+  auto reader = WriteRecords(9, 0);
+  ASSERT_NE(reader, nullptr);
+  auto summary = reader->Summarize(2);
+  EXPECT_EQ(summary.records, 9);
+  EXPECT_EQ(summary.duration_ns, 8000);
+  EXPECT_EQ(summary.types[EventType::kBreakpoint], 9);
+  EXPECT_EQ(summary.hits[0x1000], 3);
+  // 1000ns apart, in [512, 1024)
+  EXPECT_EQ(summary.inter_arrival[9], 8);
+  ASSERT_EQ(summary.slowest.size(), 2);
+  EXPECT_EQ(summary.slowest[0].latency_ns, 6);
+
+  std::ostringstream oss;
+  reader->WriteChromeTrace(oss);
+  EXPECT_NE(oss.str().find("\"name\":\"breakpoint\",\"ph\":\"X\",\"pid\":1,"
+                           "\"tid\":1,\"ts\":0.999,\"dur\":0.001"),
+            std::string::npos);
+}
+
+TEST(EventTraceTest, DebuggerTest) {
+  auto path = TracePath();
+  Debugger debugger("examples/hello_world");
+  ASSERT_EQ(debugger.StartEventTrace(path, 0), StatusType::kSuccess);
+  ASSERT_EQ(debugger.SetBreakPoint("main"), StatusType::kSuccess);
+  debugger.RunProc();
+  debugger.ContinueExecution();
+  auto main = debugger.GetRegisters()->at(Register::RIP);
+  debugger.ContinueExecution();
+  ASSERT_FALSE(debugger.IsRunning());
+  ASSERT_EQ(debugger.StopEventTrace(), StatusType::kSuccess);
+
+  auto reader = EventTraceReader::Open(path);
+  unlink(path.c_str());
+  ASSERT_NE(reader, nullptr);
+  const auto& records = reader->GetRecords();
+  // Stepping off the breakpoint is a stop of its own
+  auto hit = std::find_if(records.begin(), records.end(), [&](auto& record) {
+    return record.type == EventType::kBreakpoint && record.pc == main;
+  });
+  ASSERT_NE(hit, records.end());
+  EXPECT_GE(hit->value, 0);
+  EXPECT_EQ((hit + 1)->type, EventType::kStep);
+  const auto& exit = records.back();
+  EXPECT_EQ(exit.type, EventType::kExit);
+  EXPECT_TRUE(WIFEXITED(exit.value));
+  EXPECT_GE(exit.time_ns, hit->time_ns);
+}
+
+TEST(EventTraceTest, ThreadsTest) {
+  auto path = TracePath();
+  Debugger debugger("examples/threads");
+  ASSERT_EQ(debugger.StartEventTrace(path, 0), StatusType::kSuccess);
+  debugger.RunProc();
+  auto pid = debugger.GetPid();
+  debugger.ContinueExecution();
+  ASSERT_FALSE(debugger.IsRunning());
+  ASSERT_EQ(debugger.StopEventTrace(), StatusType::kSuccess);
+
+  auto reader = EventTraceReader::Open(path);
+  unlink(path.c_str());
+  ASSERT_NE(reader, nullptr);
+  const auto& records = reader->GetRecords();
+  // Created by the main thread, gone before the process
+  auto clone = std::find_if(records.begin(), records.end(), [](auto& record) {
+    return record.type == EventType::kClone;
+  });
+  ASSERT_NE(clone, records.end());
+  EXPECT_EQ(clone->tid, pid);
+  auto worker = clone->value;
+  EXPECT_NE(worker, pid);
+  auto exit = std::find_if(clone, records.end(), [](auto& record) {
+    return record.type == EventType::kThreadExit;
+  });
+  ASSERT_NE(exit, records.end());
+  EXPECT_EQ(exit->tid, worker);
+  EXPECT_TRUE(WIFEXITED(exit->value));
+  EXPECT_EQ(records.back().type, EventType::kExit);
+
+  auto summary = reader->Summarize(0);
+  EXPECT_EQ(summary.types[EventType::kClone], 1);
+  EXPECT_EQ(summary.types[EventType::kThreadExit], 1);
+  ASSERT_EQ(summary.threads.size(), 1);
+  const auto& span = summary.threads[worker];
+  ASSERT_TRUE(span.created_ns.has_value());
+  ASSERT_TRUE(span.exited_ns.has_value());
+  EXPECT_LE(*span.created_ns, *span.exited_ns);
+  EXPECT_STREQ(GetEventTypeName(EventType::kThreadExit), "thread exit");
+}
+
+}  // namespace shuidb
@@ -0,0 +1,250 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#include "gdb_server.h"
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <elf.h>
+
+#include <cstdio>
+#include <future>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "symbolizer.h"
+#include "utils/ps_utils.hpp"
+
+namespace shuidb {
+
+namespace {
+
+std::string ToHex(uint64_t value) {
+  char hex[17];
+  std::snprintf(hex, sizeof(hex), "%016lx",
+                static_cast<unsigned long>(__builtin_bswap64(value)));
+  return hex;
+}
+
+}  // namespace
+
+// Plays the frontend over a socket pair. The debugger and its server run on
+// a thread of their own, the tracer of the process
+class GdbServerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds_), 0);
+    std::promise<pid_t> pid;
+    server_ = std::thread([this, &pid] {
+      Debugger debugger(prog_);
+      debugger.RunProc();
+      pid.set_value(debugger.GetPid());
+      GdbServer(debugger).Serve(fds_[1], fds_[1]);
+    });
+    pid_ = pid.get_future().get();
+    ASSERT_NE(pid_, 0);
+  }
+
+  void TearDown() override {
+    close(fds_[0]);
+    server_.join();
+    close(fds_[1]);
+  }
+
+  // Sends `payload` and returns the reply, acknowledging it until no-ack
+  // mode is on
+  std::string Request(const std::string& payload) {
+    uint8_t sum = 0;
+    for (char c : payload) {
+      sum += c;
+    }
+    char checksum[3];
+    std::snprintf(checksum, sizeof(checksum), "%02x", sum);
+    auto packet = "$" + payload + "#" + checksum;
+    EXPECT_EQ(write(fds_[0], packet.data(), packet.size()),
+              static_cast<ssize_t>(packet.size()));
+    std::string input;
+    char c;
+    while (read(fds_[0], &c, 1) == 1) {
+      input += c;
+      auto end = input.find('#');
+      if (end != std::string::npos && input.size() == end + 3) {
+        break;
+      }
+    }
+    if (ack_) {
+      EXPECT_EQ(input[0], '+');
+      EXPECT_EQ(write(fds_[0], "+", 1), 1);
+    }
+    auto start = input.find('$');
+    return input.substr(start + 1, input.find('#') - start - 1);
+  }
+
+  std::string prog_{"examples/hello_world"};
+  pid_t pid_;
+  int fds_[2];
+  std::thread server_;
+  bool ack_{true};
+};
+
+TEST_F(GdbServerTest, QueryTest) {
+  EXPECT_NE(Request("qSupported:swbreak+").find("qXfer:features:read+"),
+            std::string::npos);
+  EXPECT_EQ(Request("QStartNoAckMode"), "OK");
+  ack_ = false;
+  auto xml = Request("qXfer:features:read:target.xml:0,fffff");
+  EXPECT_EQ(xml.rfind("l<?xml", 0), 0);
+  EXPECT_NE(xml.find("<reg name=\"orig_rax\""), std::string::npos);
+  // Read in pieces
+  EXPECT_EQ(Request("qXfer:features:read:target.xml:0,5"), "m<?xml");
+
+  char tid[16];
+  std::snprintf(tid, sizeof(tid), "%x", pid_);
+  EXPECT_EQ(Request("?"), std::string("T05thread:") + tid + ";");
+  EXPECT_EQ(Request("qC"), std::string("QC") + tid);
+  EXPECT_NE(Request("qXfer:threads:read::0,fff").find(
+                std::string("<thread id=\"") + tid + "\""),
+            std::string::npos);
+  EXPECT_EQ(Request("vMustReplyEmpty"), "");
+}
+
+TEST_F(GdbServerTest, RegistersTest) {
+  auto rip = utils::GetAuxValue(pid_, AT_ENTRY).value();
+  auto g = Request("g");
+  // General, x87 and SSE registers, orig_rax and the segment bases
+  ASSERT_EQ(g.size(), 560U * 2);
+  EXPECT_EQ(g.substr(16 * 16, 16), ToHex(rip));
+  EXPECT_EQ(Request("p10"), ToHex(rip));
+
+  EXPECT_EQ(Request("P0=" + ToHex(0x1234)), "OK");
+  EXPECT_EQ(Request("p0"), ToHex(0x1234));
+  EXPECT_EQ(Request("g").substr(0, 16), ToHex(0x1234));
+  // Written back as read, the x87 tag word survives the round trip
+  EXPECT_EQ(Request("G" + g), "OK");
+  EXPECT_EQ(Request("g"), g);
+  EXPECT_EQ(Request("p100"), "E01");
+}
+
+TEST_F(GdbServerTest, MemoryTest) {
+  auto rsp = __builtin_bswap64(std::stoull(Request("p7"), nullptr, 16));
+  char addr[32];
+  std::snprintf(addr, sizeof(addr), "%lx", rsp - 0x1000);
+  // Escaped bytes: } # $ *
+  EXPECT_EQ(Request(std::string("X") + addr + ",5:}]}\x03}\x04}\x0aok"),
+            "E01");
+  EXPECT_EQ(Request(std::string("X") + addr + ",6:}]}\x03}\x04}\x0aok"),
+            "OK");
+  EXPECT_EQ(Request(std::string("m") + addr + ",6"), "7d23242a6f6b");
+  EXPECT_EQ(Request(std::string("M") + addr + ",2:0102"), "OK");
+  EXPECT_EQ(Request(std::string("m") + addr + ",3"), "010224");
+  // One packet for a whole page
+  EXPECT_EQ(Request(std::string("m") + addr + ",1000").size(), 0x2000U);
+  EXPECT_EQ(Request("m0,8"), "E01");
+}
+
+TEST_F(GdbServerTest, StopTest) {
+  auto main = Symbolizer(pid_).LookupAddress("main").value();
+  char addr[32];
+  std::snprintf(addr, sizeof(addr), "%lx", main);
+  auto code = Request(std::string("m") + addr + ",4");
+  EXPECT_EQ(Request(std::string("Z0,") + addr + ",1"), "OK");
+  // The int3 does not show
+  EXPECT_EQ(Request(std::string("m") + addr + ",4"), code);
+  EXPECT_NE(Request("vCont;c").find("swbreak:;"), std::string::npos);
+  EXPECT_EQ(Request("p10"), ToHex(main));
+  EXPECT_EQ(Request(std::string("z0,") + addr + ",1"), "OK");
+
+  // main starts with pushes
+  auto rsp = __builtin_bswap64(std::stoull(Request("p7"), nullptr, 16));
+  char watch[32];
+  std::snprintf(watch, sizeof(watch), "%lx", rsp - 8);
+  EXPECT_EQ(Request(std::string("Z2,") + watch + ",8"), "OK");
+  EXPECT_NE(Request("vCont;c").find(std::string("watch:") + watch + ";"),
+            std::string::npos);
+  EXPECT_EQ(Request(std::string("z2,") + watch + ",8"), "OK");
+  EXPECT_EQ(Request(std::string("Z2,") + watch + ",3"), "E01");
+
+  EXPECT_EQ(Request("vCont;s").rfind("T05", 0), 0);
+  EXPECT_EQ(Request("vCont;c"), "W00");
+}
+
+// work() runs on a worker thread
+class GdbServerThreadsTest : public GdbServerTest {
+ protected:
+  GdbServerThreadsTest() { prog_ = "examples/threads"; }
+
+  // Continues to the stop in work(), which must be on the worker
+  void ContinueToWork(const std::string& kind) {
+    auto reply = Request("vCont;c");
+    EXPECT_NE(reply.find(kind), std::string::npos) << reply;
+    auto thread = reply.find("thread:");
+    ASSERT_NE(thread, std::string::npos);
+    worker_ = std::stoi(reply.substr(thread + 7), nullptr, 16);
+    EXPECT_NE(worker_, pid_);
+  }
+
+  pid_t worker_{0};
+};
+
+TEST_F(GdbServerThreadsTest, BreakPointTest) {
+  auto work = Symbolizer(pid_).LookupAddress("work").value();
+  char addr[32];
+  std::snprintf(addr, sizeof(addr), "%lx", work);
+  EXPECT_EQ(Request(std::string("Z0,") + addr + ",1"), "OK");
+  ContinueToWork("swbreak:;");
+
+  char main[16], worker[16];
+  std::snprintf(main, sizeof(main), "%x", pid_);
+  std::snprintf(worker, sizeof(worker), "%x", worker_);
+  EXPECT_EQ(Request("qC"), std::string("QC") + worker);
+  EXPECT_NE(Request("qfThreadInfo").find(worker), std::string::npos);
+  EXPECT_EQ(Request(std::string("T") + main), "OK");
+  EXPECT_EQ(Request(std::string("T") + worker), "OK");
+  EXPECT_EQ(Request("T1"), "E01");
+  EXPECT_EQ(Request("p10"), ToHex(work));
+  // Registers follow the selected thread
+  EXPECT_EQ(Request(std::string("Hg") + main), "OK");
+  EXPECT_NE(Request("p10"), ToHex(work));
+  EXPECT_EQ(Request("qC"), std::string("QC") + main);
+  EXPECT_EQ(Request("Hg1"), "E01");
+  EXPECT_EQ(Request(std::string("Hc") + worker), "OK");
+  EXPECT_EQ(Request("p10"), ToHex(work));
+
+  EXPECT_EQ(Request(std::string("z0,") + addr + ",1"), "OK");
+  // Steps the worker off the breakpoint
+  auto reply = Request(std::string("vCont;s:") + worker + ";c");
+  EXPECT_NE(reply.find(std::string("thread:") + worker + ";"),
+            std::string::npos);
+  EXPECT_NE(Request("p10"), ToHex(work));
+  EXPECT_EQ(Request("vCont;c"), "W00");
+}
+
+TEST_F(GdbServerThreadsTest, HardwareBreakPointTest) {
+  auto work = Symbolizer(pid_).LookupAddress("work").value();
+  char addr[32];
+  std::snprintf(addr, sizeof(addr), "%lx", work);
+  // Set before the worker exists, which does not inherit it
+  EXPECT_EQ(Request(std::string("Z1,") + addr + ",1"), "OK");
+  ContinueToWork("hwbreak:;");
+  EXPECT_EQ(Request("p10"), ToHex(work));
+  EXPECT_EQ(Request(std::string("z1,") + addr + ",1"), "OK");
+  EXPECT_EQ(Request("vCont;c"), "W00");
+}
+
+}  // namespace shuidb
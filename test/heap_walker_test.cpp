@@ -0,0 +1,85 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "heap_walker.h"
+
+#include <numeric>
+
+#include "debugger.h"
+#include "gtest/gtest.h"
+#include "process_launcher.h"
+#include "thread_stopper.h"
+
+namespace shuidb {
+
+TEST(HeapWalkerTest, LargeHeapTest) {
+  // A 16 MiB block, and 100000 small chunks in each of two arenas with every
+  // third one freed
+  Debugger debugger("examples/large_heap");
+  LaunchOptions options;
+  options.args = {"16"};
+  debugger.SetLaunchOptions(options);
+  debugger.RunProc();
+  ASSERT_EQ(debugger.RunUntilStop(false, 0).signal, SIGTRAP);
+  auto pid = debugger.GetPid();
+  auto regions = utils::GetMemoryRegions(pid);
+
+  ThreadStopper stopper(pid, debugger.GetThreads());
+  auto main_arena = HeapWalker::FindMainArena(pid, regions);
+  ASSERT_TRUE(main_arena.has_value());
+  utils::ThreadPool pool(4);
+  auto report = HeapWalker::Walk(pid, regions, main_arena.value(), 5, pool);
+  ASSERT_TRUE(report.has_value());
+
+  ASSERT_EQ(report->arenas.size(), 2u);
+  EXPECT_EQ(report->arenas[0].addr, main_arena.value());
+  for (const auto& arena : report->arenas) {
+    EXPECT_FALSE(arena.corrupt);
+    EXPECT_GE(arena.heaps, 1u);
+    EXPECT_GE(arena.used_count, 66666u);
+    // Every third chunk, but for the few malloc took back since
+    EXPECT_GE(arena.free_count, 33300u);
+    EXPECT_GT(arena.top_size, 0u);
+  }
+  // The main thread still has its tcache, fastbins take what it does not
+  EXPECT_GT(report->arenas[0].tcache_count, 0u);
+  EXPECT_GT(report->arenas[0].fastbin_count, 0u);
+
+  ASSERT_EQ(report->largest.size(), 5u);
+  EXPECT_TRUE(report->largest[0].mmapped);
+  EXPECT_GE(report->largest[0].size, 16u << 20);
+  EXPECT_GE(report->mmapped_bytes, 16u << 20);
+  EXPECT_TRUE(std::is_sorted(
+      report->largest.begin(), report->largest.end(),
+      [](const auto& a, const auto& b) { return a.size > b.size; }));
+
+  // Classes add up to the arenas and mmapped chunks
+  std::size_t class_used = 0, class_free = 0;
+  for (const auto& cls : report->classes) {
+    EXPECT_LE(cls.min_size, cls.max_size);
+    class_used += cls.used_count;
+    class_free += cls.free_count;
+  }
+  std::size_t used = report->mmapped_count, free = 0;
+  for (const auto& arena : report->arenas) {
+    used += arena.used_count;
+    free += arena.free_count;
+  }
+  EXPECT_EQ(class_used, used);
+  EXPECT_EQ(class_free, free);
+}
+
+}  // namespace shuidb
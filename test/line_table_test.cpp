@@ -0,0 +1,48 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "line_table.h"
+
+#include <algorithm>
+
+#include "gtest/gtest.h"
+#include "symbolizer.h"
+
+namespace shuidb {
+
+// Built with -g, the test binary carries its own line table
+TEST(LineTableTest, SelfTest) {
+  Symbolizer symbolizer(getpid());
+  auto addr = reinterpret_cast<std::uintptr_t>(&LineTable::Parse);
+  auto sym = symbolizer.FindSymbol(addr);
+  ASSERT_TRUE(sym.has_value());
+  const auto* table = symbolizer.GetLineTable(sym->module);
+  ASSERT_NE(table, nullptr);
+  auto bias = symbolizer.GetLoadBias(sym->module).value();
+
+  const auto* row = table->FindRow(addr - bias);
+  ASSERT_NE(row, nullptr);
+  ASSERT_TRUE(table->GetFileName(row->file).ends_with("line_table.cpp"));
+  ASSERT_GT(row->line, 0);
+
+  auto starts = table->GetLineStarts(sym->address - bias,
+                                     sym->address + sym->size - bias);
+  ASSERT_GT(starts.size(), 1);
+  ASSERT_TRUE(std::is_sorted(starts.begin(), starts.end()));
+  ASSERT_EQ(table->FindRow(0), nullptr);
+}
+
+}  // namespace shuidb
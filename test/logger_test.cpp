@@ -0,0 +1,114 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "utils/logger.hpp"
+
+#include <fcntl.h>
+
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "utils/output_utils.hpp"
+
+namespace shuidb {
+
+namespace {
+
+// Runs `fn` with stderr of the logger going to a file, returns the file
+std::string CaptureStderr(const std::function<void()>& fn) {
+  auto path = "/tmp/shuidb_logger_" + std::to_string(getpid());
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  EXPECT_NE(fd, -1);
+  auto& logger = utils::Logger::Get();
+  logger.Redirect(utils::Sink::kStderr, fd);
+  fn();
+  logger.Redirect(utils::Sink::kStderr, STDERR_FILENO);
+  close(fd);
+  std::ifstream ifs(path);
+  std::string output{std::istreambuf_iterator<char>(ifs),
+                     std::istreambuf_iterator<char>()};
+  unlink(path.c_str());
+  return output;
+}
+
+}  // namespace
+
+TEST(LoggerTest, ThreadOrderTest) {
+  constexpr int kThreads = 4;
+  constexpr int kLines = 20000;
+  auto output = CaptureStderr([] {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+      threads.emplace_back([t] {
+        for (int i = 0; i < kLines; i++) {
+          PR(WARNING) << t << ' ' << i;
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  });
+  // Whole lines, in order per thread
+  std::istringstream iss(output);
+  std::vector<int> next(kThreads, 0);
+  int t;
+  int i;
+  while (iss >> t >> i) {
+    ASSERT_GE(t, 0);
+    ASSERT_LT(t, kThreads);
+    ASSERT_EQ(i, next[t]++);
+  }
+  EXPECT_EQ(next, std::vector<int>(kThreads, kLines));
+}
+
+TEST(LoggerTest, LongLineTest) {
+  std::string line(200000, 'x');
+  auto output = CaptureStderr([&] { PR(ERROR) << line; });
+  // No color codes for a file
+  EXPECT_EQ(output, line + "\n");
+}
+
+TEST(LoggerTest, LevelTest) {
+  int evaluated = 0;
+  auto output = CaptureStderr([&] {
+    PR(DEBUG) << ++evaluated;
+    PR(WARNING) << ++evaluated;
+  });
+  EXPECT_EQ(evaluated, SHUIDB_LOG_LEVEL >= 3 ? 2 : 1);
+  EXPECT_NE(output.find(std::to_string(evaluated) + "\n"), std::string::npos);
+}
+
+TEST(LoggerTest, ElseTest) {
+  bool taken = false;
+  auto output = CaptureStderr([&] {
+    // The else goes with the if written here
+    if (taken)
+      PR(ERROR) << "not printed";
+    else
+      taken = true;
+  });
+  EXPECT_TRUE(taken);
+  EXPECT_EQ(output, "");
+}
+
+}  // namespace shuidb
@@ -0,0 +1,108 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "memory_cache.h"
+
+#include "debugger.h"
+#include "gtest/gtest.h"
+#include "memory_operator.h"
+#include "register_operator.h"
+#include "symbolizer.h"
+
+namespace shuidb {
+
+TEST(MemoryCacheTest, ReadWriteTest) {
+  Debugger debugger("examples/hello_world");
+  debugger.RunProc();
+  auto pid = debugger.GetPid();
+  Symbolizer symbolizer(pid);
+  MemoryCache cache(symbolizer);
+  cache.Reset(pid);
+
+  // Text comes from the file
+  const utils::MemoryRegion* exec = nullptr;
+  for (const auto& region : symbolizer.GetRegions()) {
+    if (region.IsExecutable() && region.IsFileBacked()) {
+      exec = &region;
+      break;
+    }
+  }
+  ASSERT_NE(exec, nullptr);
+  std::vector<uint8_t> expected(exec->Size()), actual(exec->Size());
+  MemoryOperator::ReadMemory(pid, exec->start, expected.data(),
+                             expected.size());
+  ASSERT_EQ(cache.Read(exec->start, actual.data(), actual.size()),
+            actual.size());
+  ASSERT_EQ(actual, expected);
+  ASSERT_EQ(cache.GetStats().file_reads, exec->Size() / 4096);
+  ASSERT_EQ(cache.GetStats().misses, 0);
+
+  // The stack is read once per page, across a page boundary
+  auto sp = RegisterOperator::GetRegisterValue(pid, Register::RSP).value();
+  auto addr = (sp & ~4095ul) - 16;
+  std::vector<uint8_t> stack(64), again(64);
+  ASSERT_EQ(cache.Read(addr, stack.data(), stack.size()), stack.size());
+  ASSERT_EQ(cache.Read(addr, again.data(), again.size()), again.size());
+  ASSERT_EQ(stack, again);
+  ASSERT_EQ(cache.GetStats().misses, 2);
+  ASSERT_EQ(cache.GetStats().hits, 2);
+
+  // Writes go through, also to text
+  uint64_t value = 0x1122334455667788;
+  ASSERT_EQ(cache.Write(addr + 4, &value, sizeof(value)), sizeof(value));
+  ASSERT_EQ(cache.Write(exec->start, &value, sizeof(value)), sizeof(value));
+  cache.Invalidate();
+  for (auto at : {addr + 4, exec->start}) {
+    uint64_t cached = 0;
+    ASSERT_EQ(cache.Read(at, &cached, sizeof(cached)), sizeof(cached));
+    ASSERT_EQ(cached, value);
+    ASSERT_EQ(MemoryOperator::ReadMemory(pid, at), value);
+  }
+
+  ASSERT_EQ(cache.Read(0, actual.data(), 16), 0);
+}
+
+TEST(MemoryCacheTest, RelocatedDataTest) {
+  Debugger debugger("examples/hello_world");
+  debugger.RunProc();
+  auto pid = debugger.GetPid();
+  Symbolizer symbolizer(pid);
+  auto main = symbolizer.LookupAddress("main").value();
+  debugger.SetBreakPointAtAddress(main);
+  debugger.ContinueExecution();
+
+  // Relocated read-only data (RELRO) differs from the files
+  symbolizer.Load(pid);
+  MemoryCache cache(symbolizer);
+  cache.Reset(pid);
+  for (const auto& region : symbolizer.GetRegions()) {
+    if (!region.IsReadable() || region.IsWritable() ||
+        !region.IsFileBacked()) {
+      continue;
+    }
+    std::vector<uint8_t> expected(region.Size()), actual(region.Size());
+    auto n = MemoryOperator::ReadMemory(pid, region.start, expected.data(),
+                                        expected.size());
+    expected.resize(n);
+    actual.resize(cache.Read(region.start, actual.data(), n));
+    if (region.Contains(main)) {
+      expected[main - region.start] = actual[main - region.start];
+    }
+    ASSERT_EQ(actual, expected) << region.path;
+  }
+}
+
+}  // namespace shuidb
@@ -0,0 +1,90 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "memory_search.h"
+
+#include <random>
+
+#include "gtest/gtest.h"
+
+namespace shuidb {
+
+TEST(MemorySearchTest, KernelsTest) {
+  std::mt19937 rng(7);
+  // Few distinct bytes, plenty of partial matches
+  std::vector<uint8_t> data(100003);
+  for (auto& byte : data) {
+    byte = rng() % 4;
+  }
+  for (std::size_t len : {1, 2, 3, 7, 16, 33}) {
+    std::vector<uint8_t> pattern(data.begin() + 5000,
+                                 data.begin() + 5000 + len);
+    std::vector<std::size_t> expected;
+    for (std::size_t i = 0; i + len <= data.size(); i++) {
+      if (std::equal(pattern.begin(), pattern.end(), data.begin() + i)) {
+        expected.push_back(i);
+      }
+    }
+    for (auto kernel : {SearchKernel::kScalar, SearchKernel::kSse2,
+                        MemorySearch::GetBestKernel()}) {
+      std::vector<std::size_t> matches;
+      ASSERT_EQ(MemorySearch::FindPattern(data, pattern, matches, SIZE_MAX,
+                                          kernel),
+                expected.size());
+      ASSERT_EQ(matches, expected);
+      // Capped, still counted
+      matches.clear();
+      ASSERT_EQ(MemorySearch::FindPattern(data, pattern, matches, 2, kernel),
+                expected.size());
+      ASSERT_EQ(matches.size(), std::min<std::size_t>(2, expected.size()));
+    }
+  }
+}
+
+TEST(MemorySearchTest, ParsePatternTest) {
+  using Bytes = std::vector<uint8_t>;
+  ASSERT_EQ(MemorySearch::ParsePattern('b', "de ad BE ef"),
+            (Bytes{0xde, 0xad, 0xbe, 0xef}));
+  ASSERT_EQ(MemorySearch::ParsePattern('b', "0x0102"), (Bytes{1, 2}));
+  ASSERT_EQ(MemorySearch::ParsePattern('w', "0x0102"),
+            (Bytes{2, 1, 0, 0, 0, 0, 0, 0}));
+  ASSERT_EQ(MemorySearch::ParsePattern('s', "hi"), (Bytes{'h', 'i'}));
+  ASSERT_FALSE(MemorySearch::ParsePattern('b', "abc").has_value());
+  ASSERT_FALSE(MemorySearch::ParsePattern('w', "12z").has_value());
+  ASSERT_FALSE(MemorySearch::ParsePattern('s', "").has_value());
+}
+
+TEST(MemorySearchTest, SearchTest) {
+  // A pattern spanning a chunk boundary of a heap buffer, searched for in
+  // our own address space
+  std::vector<uint8_t> buffer(3 * MemorySearch::kChunkSize);
+  std::string secret = "shuidb-memory-search-secret";
+  auto at = buffer.data() + MemorySearch::kChunkSize * 2 - 5;
+  std::copy(secret.begin(), secret.end(), at);
+  auto begin = reinterpret_cast<std::uintptr_t>(buffer.data());
+  auto end = begin + buffer.size();
+
+  utils::ThreadPool pool(4);
+  std::vector<uint8_t> pattern(secret.begin(), secret.end());
+  auto regions = utils::GetMemoryRegions(getpid());
+  auto result =
+      MemorySearch::Search(getpid(), regions, begin, end, pattern, 10, pool);
+  ASSERT_EQ(result.count, 1);
+  ASSERT_EQ(result.matches[0], reinterpret_cast<std::uintptr_t>(at));
+  ASSERT_EQ(result.bytes_scanned, buffer.size());
+}
+
+}  // namespace shuidb
@@ -0,0 +1,101 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "memory_snapshot.h"
+
+#include <sys/mman.h>
+
+#include <cstring>
+
+#include "gtest/gtest.h"
+
+namespace shuidb {
+
+TEST(MemorySnapshotTest, Crc32cTest) {
+  const char* text = "123456789";
+  EXPECT_EQ(MemorySnapshot::Crc32c(reinterpret_cast<const uint8_t*>(text), 9),
+            0xe3069283);
+}
+
+TEST(MemorySnapshotTest, TakeDiffTest) {
+  constexpr auto kPageSize = MemorySnapshot::kPageSize;
+  auto* buffer = static_cast<uint8_t*>(
+      mmap(nullptr, 4 * kPageSize, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  ASSERT_NE(buffer, MAP_FAILED);
+  auto start = reinterpret_cast<std::uintptr_t>(buffer);
+  std::vector<utils::MemoryRegion> regions{
+      {start, start + 4 * kPageSize, "rw-p", 0, ""}};
+  // The last page is never touched
+  std::memset(buffer, 1, 3 * kPageSize);
+
+  auto a = MemorySnapshot::Take(getpid(), regions, nullptr);
+  ASSERT_NE(a, nullptr);
+  ASSERT_EQ(a->GetPages().size(), 3);
+  EXPECT_EQ(a->GetStoredPages(), 3);
+
+  std::memset(buffer + kPageSize + 10, 2, 3);
+  auto b = MemorySnapshot::Take(getpid(), regions, a.get());
+  ASSERT_NE(b, nullptr);
+  ASSERT_EQ(b->GetPages().size(), 3);
+  EXPECT_EQ(b->GetStoredPages(), 1);
+  EXPECT_EQ(b->GetPages()[0].data, a->GetPages()[0].data);
+  EXPECT_NE(b->GetPages()[1].data, a->GetPages()[1].data);
+  EXPECT_EQ(b->GetPages()[1].data[10], 2);
+
+  auto ranges = MemorySnapshot::Diff(*a, *b);
+  ASSERT_EQ(ranges.size(), 1);
+  EXPECT_EQ(ranges[0].begin, start + kPageSize + 10);
+  EXPECT_EQ(ranges[0].end, start + kPageSize + 13);
+  EXPECT_TRUE(MemorySnapshot::Diff(*b, *b).empty());
+
+  // A page appearing later compares against zeros
+  buffer[3 * kPageSize + 5] = 7;
+  auto c = MemorySnapshot::Take(getpid(), regions, b.get());
+  ASSERT_NE(c, nullptr);
+  ranges = MemorySnapshot::Diff(*b, *c);
+  ASSERT_EQ(ranges.size(), 1);
+  EXPECT_EQ(ranges[0].begin, start + 3 * kPageSize + 5);
+  munmap(buffer, 4 * kPageSize);
+}
+
+TEST(MemorySnapshotTest, RestoreTest) {
+  constexpr auto kPageSize = MemorySnapshot::kPageSize;
+  auto* buffer = static_cast<uint8_t*>(
+      mmap(nullptr, 3 * kPageSize, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+  ASSERT_NE(buffer, MAP_FAILED);
+  auto start = reinterpret_cast<std::uintptr_t>(buffer);
+  std::vector<utils::MemoryRegion> regions{
+      {start, start + 3 * kPageSize, "rw-p", 0, ""}};
+  std::memset(buffer, 1, 2 * kPageSize);
+  auto a = MemorySnapshot::Take(getpid(), regions, nullptr);
+  ASSERT_NE(a, nullptr);
+  MemorySnapshot::ClearSoftDirty(getpid());
+
+  // One page changed, one dropped and one which was not there
+  buffer[5] = 2;
+  madvise(buffer + kPageSize, kPageSize, MADV_DONTNEED);
+  buffer[2 * kPageSize] = 3;
+  auto written = MemorySnapshot::Restore(getpid(), regions, *a, a.get());
+  ASSERT_EQ(written, 3);
+  EXPECT_EQ(buffer[5], 1);
+  EXPECT_EQ(buffer[kPageSize], 1);
+  EXPECT_EQ(buffer[2 * kPageSize], 0);
+  munmap(buffer, 3 * kPageSize);
+}
+
+}  // namespace shuidb
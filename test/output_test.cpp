@@ -0,0 +1,104 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "utils/output_utils.hpp"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "utils/fs_utils.hpp"
+#include "utils/string_utils.hpp"
+
+namespace shuidb {
+
+TEST(OutputTest, JsonQuoteTest) {
+  EXPECT_EQ(utils::json_quote(""), "\"\"");
+  EXPECT_EQ(utils::json_quote("plain text"), "\"plain text\"");
+  EXPECT_EQ(utils::json_quote("say \"hi\""), "\"say \\\"hi\\\"\"");
+  EXPECT_EQ(utils::json_quote("C:\\dir\\"), "\"C:\\\\dir\\\\\"");
+  EXPECT_EQ(utils::json_quote("a\nb\tc"), "\"a\\nb\\tc\"");
+  // Other control characters as \u00XX, DEL and UTF-8 as they are
+  EXPECT_EQ(utils::json_quote(std::string("\x01\x1b[31m\r\0", 8)),
+            "\"\\u0001\\u001b[31m\\u000d\\u0000\"");
+  EXPECT_EQ(utils::json_quote("\x7f\xc3\xa9"), "\"\x7f\xc3\xa9\"");
+}
+
+TEST(OutputTest, JsonRecordTest) {
+  using utils::Color;
+  auto record = utils::json_record(
+      "p \"x\"",
+      {{Color::CYAN, "info"},
+       {Color::RESET, "raw"},
+       {Color::YELLOW, "careful"},
+       {Color::BRIGHT_BLACK, "debug"}},
+      std::chrono::microseconds(42));
+  EXPECT_EQ(record,
+            "{\"command\":\"p \\\"x\\\"\",\"ok\":true,\"elapsed_us\":42,"
+            "\"output\":[\"info\",\"raw\",\"debug\"],"
+            "\"warnings\":[\"careful\"],\"errors\":[]}\n");
+
+  // Not ok once an error is printed
+  record = utils::json_record("b", {{Color::RED, "No symbol"}},
+                              std::chrono::microseconds(0));
+  EXPECT_EQ(record,
+            "{\"command\":\"b\",\"ok\":false,\"elapsed_us\":0,"
+            "\"output\":[],\"warnings\":[],\"errors\":[\"No symbol\"]}\n");
+}
+
+TEST(OutputTest, JsonModeTest) {
+  auto& output = utils::Output::Get();
+  output.SetMode(utils::OutputMode::kJson);
+  PR(INFO) << "value " << 0x10;
+  PR(WARNING) << "odd";
+  PR(ERROR) << "bad\n";
+  output.SetMode(utils::OutputMode::kText);
+  // Kept plain, without color codes or newlines of their own
+  auto lines = output.Take();
+  ASSERT_EQ(lines.size(), 3);
+  EXPECT_EQ(lines[0].text, "value 16");
+  EXPECT_EQ(lines[2].text, "bad\n");
+  EXPECT_TRUE(output.Take().empty());
+  EXPECT_EQ(utils::json_record("x", lines, {}),
+            "{\"command\":\"x\",\"ok\":false,\"elapsed_us\":0,"
+            "\"output\":[\"value 16\"],\"warnings\":[\"odd\"],"
+            "\"errors\":[\"bad\\n\"]}\n");
+}
+
+TEST(OutputTest, ReadScriptTest) {
+  auto path = "/tmp/shuidb_script_" + std::to_string(getpid());
+  std::ofstream(path) << "# setup\n"
+                         "b main\n"
+                         "\n"
+                         "   \t\n"
+                         "  r  \n"
+                         "  # indented comment\n"
+                         "p $rip # not a comment\n"
+                         "c";
+  auto commands = utils::read_script(path);
+  unlink(path.c_str());
+  ASSERT_TRUE(commands.has_value());
+  EXPECT_EQ(commands.value(), (std::vector<std::string>{
+                                  "b main", "r", "p $rip # not a comment",
+                                  "c"}));
+  EXPECT_FALSE(utils::read_script("/nonexistent").has_value());
+}
+
+}  // namespace shuidb
@@ -0,0 +1,100 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "process_launcher.h"
+
+#include <elf.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+#include <fstream>
+#include <iterator>
+
+#include "debugger.h"
+#include "gtest/gtest.h"
+#include "utils/ps_utils.hpp"
+
+namespace shuidb {
+
+TEST(ProcessLauncherTest, LaunchTest) {
+  auto out = "/tmp/shuidb_launch_" + std::to_string(getpid());
+  LaunchOptions options;
+  options.args = {"-c", "echo $0 $FOO; pwd", "first"};
+  options.env = {"FOO=bar"};
+  options.cwd = "/";
+  options.stdout_path = out;
+  auto pid = ProcessLauncher::Launch("/bin/sh", options);
+  ASSERT_TRUE(pid.has_value());
+  // Stopped after the exec
+  EXPECT_NE(utils::GetProcessExe(pid.value()), utils::GetProcessExe(getpid()));
+  ASSERT_EQ(ptrace(PTRACE_DETACH, pid.value(), nullptr, nullptr), 0);
+  int wait_status;
+  ASSERT_EQ(waitpid(pid.value(), &wait_status, 0), pid.value());
+  EXPECT_TRUE(WIFEXITED(wait_status));
+
+  std::ifstream ifs(out);
+  std::string output{std::istreambuf_iterator<char>(ifs),
+                     std::istreambuf_iterator<char>()};
+  unlink(out.c_str());
+  EXPECT_EQ(output, "first bar\n/\n");
+
+  options = {};
+  options.cwd = "/nonexistent";
+  EXPECT_FALSE(ProcessLauncher::Launch("/bin/sh", options).has_value());
+  EXPECT_EQ(errno, ENOENT);
+  EXPECT_FALSE(ProcessLauncher::Launch("/nonexistent", {}).has_value());
+  EXPECT_EQ(errno, ENOENT);
+}
+
+TEST(ProcessLauncherTest, SignalMaskTest) {
+  // Every signal is blocked around the launch, the program gets our mask
+  sigset_t usr2, mask;
+  sigemptyset(&usr2);
+  sigaddset(&usr2, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &usr2, &mask);
+  auto pid = ProcessLauncher::Launch("/bin/true", {});
+  ASSERT_TRUE(pid.has_value());
+  sigset_t after;
+  pthread_sigmask(SIG_SETMASK, &mask, &after);
+  EXPECT_TRUE(sigismember(&after, SIGUSR2));
+  EXPECT_FALSE(sigismember(&after, SIGUSR1));
+
+  std::ifstream ifs("/proc/" + std::to_string(pid.value()) + "/status");
+  std::string line;
+  while (std::getline(ifs, line) && line.rfind("SigBlk:", 0) != 0) {
+  }
+  EXPECT_EQ(std::stoull(line.substr(7), nullptr, 16),
+            1ULL << (SIGUSR2 - 1));
+  kill(pid.value(), SIGKILL);
+  waitpid(pid.value(), nullptr, 0);
+}
+
+TEST(ProcessLauncherTest, RunToEntryTest) {
+  Debugger debugger("examples/hello_world");
+  debugger.RunProc();
+  ASSERT_TRUE(debugger.IsRunning());
+  auto entry = utils::GetAuxValue(debugger.GetPid(), AT_ENTRY);
+  ASSERT_TRUE(entry.has_value());
+  EXPECT_EQ(debugger.GetRegisters()->at(Register::RIP), entry.value());
+  // Nothing is left behind at the entry point
+  EXPECT_TRUE(debugger.GetBreakPoints().empty());
+  debugger.ContinueExecution();
+  EXPECT_FALSE(debugger.IsRunning());
+}
+
+}  // namespace shuidb
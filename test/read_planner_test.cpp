@@ -0,0 +1,70 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "read_planner.h"
+
+#include <sys/mman.h>
+
+#include <numeric>
+
+#include "gtest/gtest.h"
+
+namespace shuidb {
+
+TEST(ReadPlannerTest, MergeTest) {
+  std::vector<uint8_t> data(256);
+  std::iota(data.begin(), data.end(), 0);
+  auto base = reinterpret_cast<std::uintptr_t>(data.data());
+  auto* guard = mmap(nullptr, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+  ASSERT_NE(guard, MAP_FAILED);
+
+  ReadPlanner planner;
+  // Overlapping, adjacent and separate ranges, and an unreadable one
+  auto a = planner.Request(base + 10, 20);
+  auto b = planner.Request(base + 20, 20);
+  auto c = planner.Request(base + 40, 8);
+  auto d = planner.Request(base + 100, 4);
+  auto e = planner.Request(reinterpret_cast<std::uintptr_t>(guard), 8);
+  auto f = planner.Request(base, 0);
+  ASSERT_EQ(planner.Execute(getpid()), 42);
+  ASSERT_EQ(planner.GetRangeCount(), 3);
+
+  auto expect = [&](ReadPlanner::Handle handle, std::size_t offset,
+                    std::size_t len) {
+    auto bytes = planner.Get(handle);
+    ASSERT_EQ(bytes.size(), len);
+    for (std::size_t i = 0; i < len; i++) {
+      ASSERT_EQ(bytes[i], data[offset + i]);
+    }
+  };
+  expect(a, 10, 20);
+  expect(b, 20, 20);
+  expect(c, 40, 8);
+  expect(d, 100, 4);
+  ASSERT_TRUE(planner.Get(e).empty());
+  ASSERT_TRUE(planner.Get(f).empty());
+
+  // The arena is reused for the next stop
+  planner.Clear();
+  data[5] = 0xff;
+  auto g = planner.Request(base + 5, 1);
+  ASSERT_EQ(planner.Execute(getpid()), 1);
+  ASSERT_EQ(planner.Get(g)[0], 0xff);
+  munmap(guard, 4096);
+}
+
+}  // namespace shuidb
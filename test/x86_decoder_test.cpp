@@ -0,0 +1,127 @@
+/*
+ Copyright 2023 Jason Shui
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+      https://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include "x86_decoder.h"
+
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace shuidb {
+
+namespace {
+
+Instruction DecodeBytes(const std::vector<uint8_t>& bytes,
+                        std::uintptr_t address = 0x1000) {
+  Instruction insn;
+  EXPECT_TRUE(X86Decoder::Decode(bytes.data(), bytes.size(), address, insn));
+  return insn;
+}
+
+}  // namespace
+
+TEST(X86DecoderTest, FormatTest) {
+  struct Case {
+    std::vector<uint8_t> bytes;
+    const char* text;
+  };
+  std::vector<Case> cases = {
+      {{0x55}, "push rbp"},
+      {{0x48, 0x89, 0xe5}, "mov rbp, rsp"},
+      {{0x48, 0x83, 0xec, 0x10}, "sub rsp, 0x10"},
+      {{0x48, 0x83, 0xe4, 0xf0}, "and rsp, 0xfffffffffffffff0"},
+      {{0x89, 0x7d, 0xfc}, "mov dword ptr [rbp-0x4], edi"},
+      {{0x48, 0x8b, 0x04, 0xc8}, "mov rax, qword ptr [rax+rcx*8]"},
+      {{0x64, 0x48, 0x8b, 0x04, 0x25, 0x28, 0x00, 0x00, 0x00},
+       "mov rax, qword ptr fs:[0x28]"},
+      {{0x40, 0x88, 0xc6}, "mov sil, al"},
+      {{0x88, 0xe0}, "mov al, ah"},
+      {{0x66, 0x41, 0xc7, 0x00, 0x34, 0x12}, "mov word ptr [r8], 0x1234"},
+      {{0x48, 0xb8, 0x88, 0x77, 0x66, 0x55, 0x44, 0x33, 0x22, 0x11},
+       "mov rax, 0x1122334455667788"},
+      {{0xf3, 0x48, 0xab}, "rep stosq"},
+      {{0xf3, 0x0f, 0x1e, 0xfa}, "endbr64"},
+      {{0x0f, 0x1f, 0x44, 0x00, 0x00}, "nop dword ptr [rax+rax]"},
+      {{0xf3, 0x0f, 0x10, 0x45, 0xf8}, "movss xmm0, dword ptr [rbp-0x8]"},
+      {{0x66, 0x0f, 0xef, 0xc0}, "pxor xmm0, xmm0"},
+      {{0x0f, 0xef, 0xc0}, "pxor mm0, mm0"},
+      {{0x66, 0x0f, 0x73, 0xdb, 0x01}, "psrldq xmm3, 0x1"},
+      {{0xc5, 0xfd, 0x74, 0x0f}, "vpcmpeqb ymm1, ymm0, ymmword ptr [rdi]"},
+      {{0xc5, 0xf8, 0x77}, "vzeroupper"},
+      {{0xdd, 0x45, 0xf0}, "fld qword ptr [rbp-0x10]"},
+      {{0xde, 0xc1}, "faddp st(1), st"},
+      {{0x0f, 0xc7, 0x64, 0x24, 0x40}, "xsavec [rsp+0x40]"},
+      {{0x0f, 0x05}, "syscall"},
+      {{0xc3}, "ret"},
+  };
+  for (const auto& c : cases) {
+    auto insn = DecodeBytes(c.bytes);
+    EXPECT_EQ(insn.length, c.bytes.size()) << c.text;
+    EXPECT_EQ(X86Decoder::Format(insn), c.text);
+  }
+}
+
+TEST(X86DecoderTest, FlowTest) {
+  // call rel32
+  auto call = DecodeBytes({0xe8, 0x10, 0x00, 0x00, 0x00});
+  EXPECT_EQ(call.flow, FlowType::kCall);
+  EXPECT_EQ(call.target, 0x1015);
+
+  // jne rel8, backwards
+  auto jne = DecodeBytes({0x75, 0xfe});
+  EXPECT_EQ(jne.flow, FlowType::kConditionalJump);
+  EXPECT_EQ(jne.target, 0x1000);
+
+  // jmp qword ptr [rax*8+0x2000]
+  auto jmp = DecodeBytes({0xff, 0x24, 0xc5, 0x00, 0x20, 0x00, 0x00});
+  EXPECT_EQ(jmp.flow, FlowType::kIndirectJump);
+  EXPECT_FALSE(jmp.HasDirectTarget());
+
+  EXPECT_EQ(DecodeBytes({0xff, 0xd0}).flow, FlowType::kIndirectCall);
+  EXPECT_EQ(DecodeBytes({0xc3}).flow, FlowType::kReturn);
+  EXPECT_EQ(DecodeBytes({0xcc}).flow, FlowType::kInterrupt);
+  EXPECT_EQ(DecodeBytes({0x90}).flow, FlowType::kSequential);
+}
+
+TEST(X86DecoderTest, RipRelativeTest) {
+  // lea rdi, [rip+0xe9c]
+  auto lea = DecodeBytes({0x48, 0x8d, 0x3d, 0x9c, 0x0e, 0x00, 0x00}, 0x1164);
+  EXPECT_TRUE(lea.rip_relative);
+  EXPECT_EQ(lea.disp_offset, 3);
+  EXPECT_EQ(lea.disp_size, 4);
+  EXPECT_EQ(lea.target, 0x1164 + 7 + 0xe9c);
+
+  // cmp byte ptr [rip+0x10], 0x0: the displacement is relative to the end of
+  // the immediate
+  auto cmp = DecodeBytes({0x80, 0x3d, 0x10, 0x00, 0x00, 0x00, 0x00});
+  EXPECT_EQ(cmp.length, 7);
+  EXPECT_EQ(cmp.target, 0x1000 + 7 + 0x10);
+}
+
+TEST(X86DecoderTest, InvalidTest) {
+  Instruction insn;
+  // Truncated
+  std::vector<uint8_t> truncated = {0x48, 0x8b};
+  EXPECT_FALSE(X86Decoder::Decode(truncated.data(), truncated.size(), 0, insn));
+  // Prefixes only, and longer than 15 bytes
+  std::vector<uint8_t> prefixes(16, 0x66);
+  EXPECT_FALSE(X86Decoder::Decode(prefixes.data(), prefixes.size(), 0, insn));
+  // pop with reg != 0
+  std::vector<uint8_t> bad_group = {0x8f, 0xc8};
+  EXPECT_FALSE(X86Decoder::Decode(bad_group.data(), bad_group.size(), 0, insn));
+}
+
+}  // namespace shuidb